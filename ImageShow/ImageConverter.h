@@ -1,6 +1,7 @@
 #pragma once 
 
 #include <Image.h>
+#include <PixelConverter.h>
 
 #define CALL_MEMBER_FN(object,ptrToMember)  ((object).*(ptrToMember))
 
@@ -11,6 +12,16 @@ namespace ImgOps
 	public:
 		System::Drawing::Bitmap^ ConvertImage(Image* image)
 		{
+			if(image->IsFloatingPoint())
+			{
+				// Quantize to 8bit first
+				Image* converted = PixelConverter::ConvertFromFloat(image, 
+					image->PixFormat() == PixelFormats::GrayFloat32 ? PixelFormats::Gray8 : PixelFormats::Rgba32);
+				System::Drawing::Bitmap^ convertedImage = ConvertImage(converted);
+				delete converted;
+				return convertedImage;
+			}
+
 			int width = image->Width();
 			int height = image->Height();
 			System::Drawing::Bitmap^ frameworkImage = gcnew System::Drawing::Bitmap(
@@ -16,8 +16,8 @@ namespace ImgOps
 		_phaseImage = 0;
 		_fourier = 0;
 
-		_publicKey = new RSA::RSAKey();
-		_privateKey = new RSA::RSAKey();
+		_publicKey = new RSA::SizedKey();
+		_privateKey = new RSA::SizedKey();
 
 		_tabPhase->Enabled = false;
 	}
@@ -171,52 +171,27 @@ namespace ImgOps
 
 	System::Void MainWindow::_butKeyGen_Click(System::Object^  sender, System::EventArgs^  e) 
 	{
-		RSA::GenerateRSAKeys(_publicKey, _privateKey);
+		RSA::GenerateRSAKeys(RSA::DefaultKeyBits, _publicKey, _privateKey);
 	}
 
-	bool MainWindow::ReadKeyFromFile(const char* filePath, RSA::RSAKey* key)
+	bool MainWindow::ReadKeyFromFile(const char* filePath, RSA::SizedKey* key)
 	{
-		// File should consist of 2 times WordByteCount bytes
-		// First is key->n, second is key->e
+		// Versioned key file (see RSA::WriteKey), older 1024-bit files (also with only n and e) are read too
 		FileStream fileStream(filePath, OpenModes::Read);
 		if(fileStream.IsOpen() == false)
 			return false;
 
-		byte buf[RSA::WordByteCount * 2];
-
-		int64 read = fileStream.ReadSome(RSA::WordByteCount, buf);
-		if(read != RSA::WordByteCount)
-			return false;
-		RSA::ByteArrayToWord(buf, read, &key->n);
-
-		read = fileStream.ReadSome(RSA::WordByteCount, buf);
-		if(read != RSA::WordByteCount)
-			return false;
-		RSA::ByteArrayToWord(buf, read, &key->e);
-
-		return true;
+		return RSA::ReadKey(&fileStream, key);
 	}
 
-	bool MainWindow::WriteKeyToFile(const char* filePath, RSA::RSAKey* key)
+	bool MainWindow::WriteKeyToFile(const char* filePath, RSA::SizedKey* key)
 	{
-		// File should consist of 2 times WordByteCount bytes
-		// First is key->n, second is key->e
+		// Private key is stored with CRT parameters if it have them
 		FileStream fileStream(filePath, OpenModes::WriteTrunc);
 		if(fileStream.IsOpen() == false)
 			return false;
 
-		byte buf[RSA::WordByteCount];
-		RSA::WordToByteArray_FullWord(buf, &key->n);
-		int64 writen = fileStream.WriteSome(RSA::WordByteCount, buf);
-		if(writen != RSA::WordByteCount)
-			return false;
-
-		RSA::WordToByteArray_FullWord(buf, &key->e);
-		writen = fileStream.WriteSome(RSA::WordByteCount, buf);
-		if(writen != RSA::WordByteCount)
-			return false;
-
-		return true;
+		return RSA::WriteKey(&fileStream, key);
 	}
 
 	System::Void MainWindow::_butKeyLoad_Click(System::Object^  sender, System::EventArgs^  e) 
@@ -309,33 +284,27 @@ namespace ImgOps
 	{
 		if(_image != 0)
 		{
-			// Encrypted image : encrypt whole image pixel data in chunks
-			// Knowing that WordByteCount is multiple of 8, let chunkSize be
-			// if pixSize == 1 then chunkSize = WordByteCount / 2,
-			// if pixSize == 2 then chunkSize = WordByteCount / 2,
-			// if pixSize == 3 then chunkSize = WordByteCount * 3 / 4,
-			// if pixSize == 4 then chunkSize = WordByteCount / 2
-			uint32 chunkSize = RSA::WordByteCount / 2;
-			if( _image->PixelSize() == 3 || _image->PixelSize() == 6 )
-				chunkSize = RSA::WordByteCount * 3 / 4;
-
+			// Hybrid encryption : pixel data is encrypted with ChaCha20 in place of copy,
+			// so encrypted image have the same size and format, only its key is encrypted with RSA
+			// (it's stored with image in deCf chunk)
+			Image* encryptedImage = new Image(_image->Width(), _image->Height(), _image->PixFormat(), _image->GetPalettesCount());
 			uint64 imgSize  = _image->PixelSize() * _image->Width() * _image->Height();
+			memcpy(encryptedImage->Data(), _image->Data(), imgSize);
+			if(_image->GetPalettesCount() > 0)
+				memcpy(encryptedImage->Palette(0), _image->Palette(0), _image->GetPalettesCount() * 3);
 
-			uint32 lastChunkSize;
-			uint64 encryptedLength;
-			byte* encryptedData;
-			RSA::EncryptMessage_FixedChunks(_image->Data(), imgSize, 
-				chunkSize, &lastChunkSize, &encryptedData, &encryptedLength, _publicKey);
-
-			// As encrypted length is larger than base data length, we need to enlarge image
-			// to show / encode it. Stored format is Rgba32,
-			// For pixSize != 3 for each base pixel we have 2 pixels in encoded image
-			// For pixSize for each pixel we have one pixel, but with different format
-			uint32 encWidth = (_image->PixelSize() == 3 || _image->PixelSize() == 6) ? _image->Width() : _image->Width() * 2;
-			uint32 encHeight = _image->Height();
-			Image* encryptedImage = new Image(encWidth, encHeight, PixelFormats::Rgba32, encryptedData);
+			// Wrapped key have length of n, so it's size depends on key size
+			byte wrappedKey[RSA::Rsa4096::KeyBytes];
+			if(RSA::EncryptHybrid(encryptedImage->Data(), imgSize, wrappedKey, _publicKey) == false)
+			{
+				delete encryptedImage;
+				System::Windows::Forms::MessageBox::Show("Brak klucza publicznego");
+				return;
+			}
 			encryptedImage->SetDecryptedFormat(_image->PixFormat());
-			encryptedImage->SetDecryptedLastChunkSize(lastChunkSize);
+			encryptedImage->SetDecryptedLastChunkSize(0);
+			encryptedImage->SetEncryptionMode(RSA::EncryptionMode::Hybrid);
+			encryptedImage->SetWrappedKey(wrappedKey, _publicKey->ByteCount());
 
 			SetNewImage(encryptedImage);
 		}
@@ -347,6 +316,34 @@ namespace ImgOps
 		{
 			// Encrypted image is in format Rgba32, but decrypted format may differ
 			// According to decrypted format, set chunk size / pixel format / img width etc
+			if(_image->IsDecrypted() && _image->GetEncryptionMode() == RSA::EncryptionMode::Hybrid)
+			{
+				// Data have the same size and format as decrypted one, so only symmetric key is decrypted with RSA
+				Image* decryptedImage = new Image(_image->Width(), _image->Height(), _image->PixFormat(), _image->GetPalettesCount());
+				uint64 imgSize  = _image->PixelSize() * _image->Width() * _image->Height();
+				memcpy(decryptedImage->Data(), _image->Data(), imgSize);
+				if(_image->GetPalettesCount() > 0)
+					memcpy(decryptedImage->Palette(0), _image->Palette(0), _image->GetPalettesCount() * 3);
+
+				if(_image->GetWrappedKeyLength() != (uint32)_privateKey->ByteCount() ||
+					RSA::DecryptHybrid(decryptedImage->Data(), imgSize, _image->GetWrappedKey(), _privateKey) == false)
+				{
+					delete decryptedImage;
+					System::Windows::Forms::MessageBox::Show("Klucz prywatny nie pasuje do obrazu");
+					return;
+				}
+				SetNewImage(decryptedImage);
+				return;
+			}
+
+			// Data encrypted in chunks with RSA works only with keys of Word size
+			RSA::RSAKey chunksKey;
+			if(RSA::ToRSAKey(*_privateKey, &chunksKey) == false)
+			{
+				System::Windows::Forms::MessageBox::Show("Obraz zaszyfrowany kawalkami wymaga klucza 1024-bitowego");
+				return;
+			}
+
 			if(_image->IsDecrypted() == false)
 			{
 				// Image was not encrypted (at least not here)
@@ -370,8 +367,8 @@ namespace ImgOps
 
 			uint64 decryptedLength;
 			byte* decryptedData;
-			RSA::DecryptMessage_FixedChunks(_image->Data(), imgSize, 
-				chunkSize, _image->GetDecryptedLastChunkSize(), &decryptedData, &decryptedLength, _privateKey);
+			RSA::DecryptMessage_FixedChunksParallel(_image->Data(), imgSize, 
+				chunkSize, _image->GetDecryptedLastChunkSize(), &decryptedData, &decryptedLength, &chunksKey);
 
 			Image* decryptedImage = new Image(decWidth, decHeight, PixelFormats::Rgba32, decryptedData);
 			decryptedImage->SetDecryptedFormat(PixelFormats::Unknown);
@@ -3,6 +3,7 @@
 #include <Image.h>
 #include <Fourier.h>
 #include <RSA.h>
+#include <RsaEngine.h>
 
 namespace ImgOps 
 {
@@ -14,8 +15,8 @@ namespace ImgOps
 		Image* _phaseImage;
 		FourierData* _fourier;
 
-		RSA::RSAKey* _publicKey;
-		RSA::RSAKey* _privateKey;
+		RSA::SizedKey* _publicKey;
+		RSA::SizedKey* _privateKey;
 
 		// Buttons panel:
 		System::Windows::Forms::Panel^  _butsPanels;
@@ -65,8 +66,8 @@ namespace ImgOps
 		void SetNewImage(Image* image);
 		void FourierTransform(bool scaleLog);
 		void ResetFourier();
-		bool ReadKeyFromFile(const char* filePath, RSA::RSAKey* key);
-		bool WriteKeyToFile(const char* filePath, RSA::RSAKey* key);
+		bool ReadKeyFromFile(const char* filePath, RSA::SizedKey* key);
+		bool WriteKeyToFile(const char* filePath, RSA::SizedKey* key);
 
 #pragma region Windows Form Designer generated code
 		/// <summary>
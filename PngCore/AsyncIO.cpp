@@ -0,0 +1,484 @@
+#include "AsyncIO.h"
+#include "ThreadPool.h"
+#include "FileStream.h"
+
+#ifdef IMGOPS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace ImgOps
+{
+	struct AsyncFileQueue::Request
+	{
+		string Path;
+		byte* Data;
+		uint64 Size;
+		uint64 Done; // Bytes already transfered
+		bool Finished;
+		bool Success;
+#ifdef IMGOPS_IO_URING
+		int Fd;
+		struct iovec Vec;
+#endif
+	};
+
+#ifdef IMGOPS_IO_URING
+	// Minimal io_uring wrapper : single submitter / consumer, one sqe per request
+	class IoUring
+	{
+	protected:
+		int _fd;
+		unsigned _entries;
+		unsigned _toSubmit;
+
+		void* _sqRing;
+		size_t _sqRingSize;
+		unsigned* _sqHead;
+		unsigned* _sqTail;
+		unsigned* _sqMask;
+		unsigned* _sqArray;
+		io_uring_sqe* _sqes;
+		size_t _sqesSize;
+
+		void* _cqRing;
+		size_t _cqRingSize;
+		unsigned* _cqHead;
+		unsigned* _cqTail;
+		unsigned* _cqMask;
+		io_uring_cqe* _cqes;
+
+	public:
+		IoUring()
+		{
+			_fd = -1;
+			_toSubmit = 0;
+			_sqRing = MAP_FAILED;
+			_cqRing = MAP_FAILED;
+			_sqes = (io_uring_sqe*)MAP_FAILED;
+		}
+
+		~IoUring()
+		{
+			if(_sqes != MAP_FAILED)
+				munmap(_sqes, _sqesSize);
+			if(_cqRing != MAP_FAILED && _cqRing != _sqRing)
+				munmap(_cqRing, _cqRingSize);
+			if(_sqRing != MAP_FAILED)
+				munmap(_sqRing, _sqRingSize);
+			if(_fd >= 0)
+				close(_fd);
+		}
+
+		bool Init(unsigned entries)
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if(_fd < 0)
+				return false;
+			_entries = params.sq_entries;
+
+			_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if(singleMap)
+			{
+				if(_cqRingSize > _sqRingSize)
+					_sqRingSize = _cqRingSize;
+				_cqRingSize = _sqRingSize;
+			}
+
+			_sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+			if(_sqRing == MAP_FAILED)
+				return false;
+
+			_cqRing = singleMap ? _sqRing : mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if(_cqRing == MAP_FAILED)
+				return false;
+
+			_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			_sqes = (io_uring_sqe*)mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+			if(_sqes == MAP_FAILED)
+				return false;
+
+			byte* sq = (byte*)_sqRing;
+			_sqHead = (unsigned*)(sq + params.sq_off.head);
+			_sqTail = (unsigned*)(sq + params.sq_off.tail);
+			_sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+			_sqArray = (unsigned*)(sq + params.sq_off.array);
+
+			byte* cq = (byte*)_cqRing;
+			_cqHead = (unsigned*)(cq + params.cq_off.head);
+			_cqTail = (unsigned*)(cq + params.cq_off.tail);
+			_cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+			_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+			return true;
+		}
+
+		// Queues readv / writev of single buffer, returns false if submission queue is full
+		bool QueueTransfer(int opcode, int fd, struct iovec* vec, uint64 offset, uint64 userData)
+		{
+			unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+			unsigned tail = *_sqTail;
+			if(tail - head >= _entries)
+				return false;
+
+			unsigned index = tail & *_sqMask;
+			io_uring_sqe* sqe = &_sqes[index];
+			memset(sqe, 0, sizeof(io_uring_sqe));
+			sqe->opcode = (byte)opcode;
+			sqe->fd = fd;
+			sqe->addr = (uint64)(size_t)vec;
+			sqe->len = 1;
+			sqe->off = offset;
+			sqe->user_data = userData;
+			_sqArray[index] = index;
+
+			__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+			++_toSubmit;
+			return true;
+		}
+
+		// Submits queued entries and optionally waits for 'waitCount' completions
+		bool Submit(unsigned waitCount)
+		{
+			if(_toSubmit == 0 && waitCount == 0)
+				return true;
+
+			int res;
+			do
+			{
+				res = (int)syscall(__NR_io_uring_enter, _fd, _toSubmit, waitCount,
+					waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			}
+			while(res < 0 && errno == EINTR);
+			if(res < 0)
+				return false;
+			_toSubmit -= (unsigned)res;
+			return true;
+		}
+
+		// Takes next completion, returns false if completion queue is empty
+		bool PopCompletion(uint64* userData, int* result)
+		{
+			unsigned head = *_cqHead;
+			unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+			if(head == tail)
+				return false;
+
+			io_uring_cqe* cqe = &_cqes[head & *_cqMask];
+			*userData = cqe->user_data;
+			*result = cqe->res;
+			__atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+	};
+#else
+	class IoUring { };
+#endif
+
+	AsyncFileQueue::AsyncFileQueue(int queueDepth, ThreadPool* pool, bool writing)
+	{
+		_queueDepth = queueDepth > 0 ? queueDepth : 1;
+		_writing = writing;
+		_pool = NULL;
+		_ownsPool = false;
+		_ring = NULL;
+
+#ifdef IMGOPS_IO_URING
+		IoUring* ring = new IoUring();
+		if(ring->Init((unsigned)_queueDepth))
+		{
+			_ring = ring;
+			return;
+		}
+		delete ring;
+#endif
+		_pool = pool;
+		if(_pool == NULL)
+		{
+			_pool = new ThreadPool(_queueDepth < MaxIoThreads ? _queueDepth : MaxIoThreads);
+			_ownsPool = true;
+		}
+	}
+
+	AsyncFileQueue::~AsyncFileQueue()
+	{
+		// Buffers can't be released while kernel / pool still uses them
+		while(_started.empty() == false)
+		{
+			WaitFor(_started.front());
+			FreeRequest(_started.front());
+			_started.pop_front();
+		}
+		while(_pending.empty() == false)
+		{
+			FreeRequest(_pending.front());
+			_pending.pop_front();
+		}
+		delete _ring;
+		if(_ownsPool)
+			delete _pool;
+	}
+
+	void AsyncFileQueue::FreeRequest(Request* request)
+	{
+		if(request->Data != NULL)
+			free(request->Data);
+		delete request;
+	}
+
+	void AsyncFileQueue::StartPending()
+	{
+		while(_pending.empty() == false && (int)_started.size() < _queueDepth)
+		{
+			Request* request = _pending.front();
+			_pending.pop_front();
+			_started.push_back(request);
+			Start(request);
+		}
+#ifdef IMGOPS_IO_URING
+		if(_ring != NULL)
+			_ring->Submit(0);
+#endif
+	}
+
+	void AsyncFileQueue::Finish(Request* request, bool success)
+	{
+#ifdef IMGOPS_IO_URING
+		if(_ring != NULL && request->Fd >= 0)
+		{
+			close(request->Fd);
+			request->Fd = -1;
+		}
+#endif
+		request->Success = success;
+		if(!success && !_writing && request->Data != NULL)
+		{
+			free(request->Data);
+			request->Data = NULL;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		request->Finished = true;
+		_requestFinished.notify_all();
+	}
+
+	void AsyncFileQueue::Start(Request* request)
+	{
+#ifdef IMGOPS_IO_URING
+		if(_ring != NULL)
+		{
+			if(_writing)
+			{
+				request->Fd = open(request->Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			}
+			else
+			{
+				request->Fd = open(request->Path.c_str(), O_RDONLY | O_CLOEXEC);
+				struct stat st;
+				if(request->Fd >= 0 && fstat(request->Fd, &st) == 0)
+				{
+					request->Size = st.st_size;
+					request->Data = (byte*)malloc(request->Size > 0 ? request->Size : 1);
+				}
+			}
+
+			if(request->Fd < 0 || request->Data == NULL)
+				Finish(request, false);
+			else if(request->Size == 0)
+				Finish(request, true);
+			else
+				QueueTransfer(request);
+			return;
+		}
+#endif
+		bool writing = _writing;
+		_pool->Submit([this, request, writing]()
+		{
+			Finish(request, TransferFile(request, writing));
+		});
+	}
+
+	bool AsyncFileQueue::TransferFile(Request* request, bool writing)
+	{
+		FileStream file(request->Path.c_str(), writing ? OpenModes::WriteTrunc : OpenModes::Read);
+		if(file.IsOpen() == false)
+			return false;
+
+		if(writing)
+		{
+			return file.WriteSome(request->Size, request->Data) == (int64)request->Size && file.Flush();
+		}
+
+		int64 length = file.Length();
+		if(length < 0)
+			return false;
+		request->Size = length;
+		request->Data = (byte*)malloc(length > 0 ? length : 1);
+		if(request->Data == NULL)
+			return false;
+		return file.ReadSome(length, request->Data) == length;
+	}
+
+#ifdef IMGOPS_IO_URING
+	void AsyncFileQueue::QueueTransfer(Request* request)
+	{
+		// Kernel transfers at most ~2GB per call, so large files are done in parts
+		const uint64 maxTransfer = 1u << 30;
+		uint64 left = request->Size - request->Done;
+		request->Vec.iov_base = request->Data + request->Done;
+		request->Vec.iov_len = (size_t)(left < maxTransfer ? left : maxTransfer);
+
+		int opcode = _writing ? IORING_OP_WRITEV : IORING_OP_READV;
+		while(_ring->QueueTransfer(opcode, request->Fd, &request->Vec,
+			request->Done, (uint64)(size_t)request) == false)
+		{
+			// Queue is full (only if completions are not reaped yet) : make some space
+			ProcessCompletions(true);
+		}
+	}
+
+	void AsyncFileQueue::ProcessCompletions(bool wait)
+	{
+		if(_ring->Submit(wait ? 1 : 0) == false)
+		{
+			// Ring broke down : fail everything in flight
+			for(size_t i = 0; i < _started.size(); ++i)
+			{
+				if(_started[i]->Finished == false)
+					Finish(_started[i], false);
+			}
+			return;
+		}
+
+		uint64 userData;
+		int result;
+		while(_ring->PopCompletion(&userData, &result))
+		{
+			Request* request = (Request*)(size_t)userData;
+			if(result == -EINTR || result == -EAGAIN)
+			{
+				QueueTransfer(request);
+			}
+			else if(result <= 0)
+			{
+				// Error or unexpected EOF (file was truncated)
+				Finish(request, false);
+			}
+			else
+			{
+				request->Done += result;
+				if(request->Done < request->Size)
+					QueueTransfer(request);
+				else
+					Finish(request, true);
+			}
+		}
+	}
+#endif
+
+	void AsyncFileQueue::WaitFor(Request* request)
+	{
+#ifdef IMGOPS_IO_URING
+		if(_ring != NULL)
+		{
+			while(request->Finished == false)
+				ProcessCompletions(true);
+			return;
+		}
+#endif
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(request->Finished == false)
+			_requestFinished.wait(lock);
+	}
+
+	void AsyncFileReader::Submit(const char* path)
+	{
+		Request* request = new Request();
+		request->Path = path;
+		request->Data = NULL;
+		request->Size = 0;
+		request->Done = 0;
+		request->Finished = false;
+		request->Success = false;
+#ifdef IMGOPS_IO_URING
+		request->Fd = -1;
+#endif
+		_pending.push_back(request);
+		StartPending();
+	}
+
+	bool AsyncFileReader::Next(Result* result)
+	{
+		StartPending();
+		if(_started.empty())
+			return false;
+
+		Request* request = _started.front();
+		WaitFor(request);
+		_started.pop_front();
+
+		result->Path = request->Path;
+		result->Data = request->Data;
+		result->Size = request->Size;
+		result->Success = request->Success;
+		request->Data = NULL; // Now owned by caller
+		FreeRequest(request);
+
+		// Slot is free : start next read before caller starts decoding
+		StartPending();
+		return true;
+	}
+
+	void AsyncFileWriter::Submit(const char* path, byte* data, uint64 size)
+	{
+		Request* request = new Request();
+		request->Path = path;
+		request->Data = data;
+		request->Size = size;
+		request->Done = 0;
+		request->Finished = false;
+		request->Success = false;
+#ifdef IMGOPS_IO_URING
+		request->Fd = -1;
+#endif
+		while((int)_started.size() >= _queueDepth)
+			RetireOldest();
+
+		_pending.push_back(request);
+		StartPending();
+	}
+
+	void AsyncFileWriter::RetireOldest()
+	{
+		Request* request = _started.front();
+		WaitFor(request);
+		_started.pop_front();
+		if(request->Success == false)
+			++_failedCount;
+		FreeRequest(request);
+	}
+
+	int AsyncFileWriter::WaitAll()
+	{
+		while(_started.empty() == false || _pending.empty() == false)
+		{
+			StartPending();
+			RetireOldest();
+		}
+		int failed = _failedCount;
+		_failedCount = 0;
+		return failed;
+	}
+}
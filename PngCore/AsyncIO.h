@@ -0,0 +1,117 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// io_uring is used on Linux unless disabled with IMGOPS_NO_IO_URING
+// (it is driven with raw syscalls, so liburing is not needed)
+#if defined(__linux__) && !defined(IMGOPS_NO_IO_URING)
+#define IMGOPS_IO_URING
+#endif
+
+namespace ImgOps
+{
+	class ThreadPool;
+	class IoUring;
+
+	// Base for asynchronous whole-file transfers
+	// Requests are started in submission order, at most 'queueDepth' at once
+	// If io_uring is not available (or kernel refuses to create it) blocking
+	// FileStream transfers are run on thread pool instead (never on shared ThreadPool::Default(),
+	// as its ParallelFor() waiters would be stalled by file io)
+	class AsyncFileQueue
+	{
+	protected:
+		struct Request;
+
+		int _queueDepth;
+		bool _writing;
+		ThreadPool* _pool; // NULL if io_uring is used
+		bool _ownsPool;
+		IoUring* _ring; // NULL if thread pool is used
+		std::deque<Request*> _pending; // Not started yet
+		std::deque<Request*> _started; // In submission order, may be finished already
+		std::mutex _mutex;
+		std::condition_variable _requestFinished;
+
+	public:
+		static const int MaxIoThreads = 4;
+
+		// If 'pool' is NULL and fallback transfers are needed, queue creates its own pool
+		// of at most MaxIoThreads threads ('pool' should be reserved for io too)
+		AsyncFileQueue(int queueDepth, ThreadPool* pool, bool writing);
+		// Waits for started transfers and releases all buffers
+		virtual ~AsyncFileQueue();
+
+		bool UsesIoUring() const { return _ring != NULL; }
+		int QueueDepth() const { return _queueDepth; }
+
+	protected:
+		// Starts pending requests untill '_queueDepth' requests are started
+		void StartPending();
+		void Start(Request* request);
+		// Blocks untill 'request' is finished
+		void WaitFor(Request* request);
+		void Finish(Request* request, bool success);
+		void FreeRequest(Request* request);
+
+#ifdef IMGOPS_IO_URING
+		void QueueTransfer(Request* request);
+		// Submits queued transfers and processes completions, waits for at least one if 'wait' is set
+		void ProcessCompletions(bool wait);
+#endif
+		// Blocking transfer used with thread pool
+		static bool TransferFile(Request* request, bool writing);
+
+	private:
+		AsyncFileQueue(const AsyncFileQueue&);
+		AsyncFileQueue& operator=(const AsyncFileQueue&);
+	};
+
+	// Reads whole files in background, results are returned in submission order
+	class AsyncFileReader : public AsyncFileQueue
+	{
+	public:
+		struct Result
+		{
+			string Path;
+			byte* Data; // Allocated with malloc, caller must free() it (NULL on failure)
+			uint64 Size;
+			bool Success;
+		};
+
+		AsyncFileReader(int queueDepth = 8, ThreadPool* pool = NULL) :
+			AsyncFileQueue(queueDepth, pool, false)
+		{ }
+
+		// Queues file to be read, reading starts immediately if less than QueueDepth() files are in progress
+		void Submit(const char* path);
+		// Waits for oldest submitted file, returns false if no files are left
+		bool Next(Result* result);
+	};
+
+	// Writes whole buffers to files in background
+	class AsyncFileWriter : public AsyncFileQueue
+	{
+	protected:
+		int _failedCount;
+
+	public:
+		AsyncFileWriter(int queueDepth = 8, ThreadPool* pool = NULL) :
+			AsyncFileQueue(queueDepth, pool, true),
+			_failedCount(0)
+		{ }
+
+		// Queues 'size' bytes to be written to file (which is created / truncated)
+		// Writer takes ownership of 'data' (must be allocated with malloc)
+		// If QueueDepth() writes are in progress waits for oldest one to finish
+		void Submit(const char* path, byte* data, uint64 size);
+		// Waits for all queued writes, returns number of files that failed since last call
+		int WaitAll();
+
+	protected:
+		void RetireOldest();
+	};
+}
@@ -0,0 +1,99 @@
+#include "ChaCha20.h"
+#include "ThreadPool.h"
+
+namespace ImgOps
+{
+	static inline uint32 LoadLE32(const byte* bytes)
+	{
+		return (uint32)bytes[0] | ((uint32)bytes[1] << 8) | ((uint32)bytes[2] << 16) | ((uint32)bytes[3] << 24);
+	}
+
+	static inline uint32 RotateLeft(uint32 x, int bits)
+	{
+		return (x << bits) | (x >> (32 - bits));
+	}
+
+	#define CHACHA_QUARTER_ROUND(a, b, c, d) \
+		a += b; d ^= a; d = RotateLeft(d, 16); \
+		c += d; b ^= c; b = RotateLeft(b, 12); \
+		a += b; d ^= a; d = RotateLeft(d, 8); \
+		c += d; b ^= c; b = RotateLeft(b, 7);
+
+	ChaCha20::ChaCha20(const byte* key, const byte* nonce)
+	{
+		// "expand 32-byte k"
+		_state[0] = 0x61707865;
+		_state[1] = 0x3320646e;
+		_state[2] = 0x79622d32;
+		_state[3] = 0x6b206574;
+		for(int i = 0; i < 8; ++i)
+			_state[4 + i] = LoadLE32(key + 4 * i);
+		_state[12] = 0;
+		for(int i = 0; i < 3; ++i)
+			_state[13 + i] = LoadLE32(nonce + 4 * i);
+	}
+
+	void ChaCha20::Block(uint32 counter, byte* out) const
+	{
+		uint32 x[16];
+		for(int i = 0; i < 16; ++i)
+			x[i] = _state[i];
+		x[12] = counter;
+
+		// 10 double rounds : columns then diagonals
+		for(int i = 0; i < 10; ++i)
+		{
+			CHACHA_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+			CHACHA_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+			CHACHA_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+			CHACHA_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+			CHACHA_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+			CHACHA_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+			CHACHA_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+			CHACHA_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+		}
+
+		for(int i = 0; i < 16; ++i)
+		{
+			uint32 v = x[i] + (i == 12 ? counter : _state[i]);
+			out[4 * i] = (byte)v;
+			out[4 * i + 1] = (byte)(v >> 8);
+			out[4 * i + 2] = (byte)(v >> 16);
+			out[4 * i + 3] = (byte)(v >> 24);
+		}
+	}
+
+	void ChaCha20::Process(byte* data, uint64 length, uint64 offset) const
+	{
+		byte keystream[BlockSize];
+		uint32 counter = (uint32)(offset / BlockSize);
+		uint32 skip = (uint32)(offset % BlockSize);
+		while(length > 0)
+		{
+			Block(counter++, keystream);
+			uint32 count = BlockSize - skip;
+			count = length < count ? (uint32)length : count;
+			for(uint32 i = 0; i < count; ++i)
+				data[i] ^= keystream[skip + i];
+			data += count;
+			length -= count;
+			skip = 0;
+		}
+	}
+
+	void ChaCha20::ProcessParallel(byte* data, uint64 length, ThreadPool* pool) const
+	{
+		// Ranges of whole blocks, large enough to hide cost of task
+		static const uint64 BytesPerTask = 64 * 1024;
+		if(pool == NULL)
+			pool = ThreadPool::Default();
+
+		int taskCount = (int)((length + BytesPerTask - 1) / BytesPerTask);
+		pool->ParallelFor(taskCount, [&](int begin, int end)
+		{
+			uint64 offset = begin * BytesPerTask;
+			uint64 rangeEnd = end * BytesPerTask < length ? end * BytesPerTask : length;
+			Process(data + offset, rangeEnd - offset, offset);
+		});
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "TypeDefs.h"
+
+namespace ImgOps
+{
+	class ThreadPool;
+
+	// ChaCha20 stream cipher (RFC 8439) : 256-bit key, 96-bit nonce and 32-bit block counter
+	// Keystream block may be computed for any counter, so any byte range of data may be
+	// processed independently (i.e. by many threads) and encryption is the same as decryption
+	class ChaCha20
+	{
+	public:
+		static const int KeySize = 32;
+		static const int NonceSize = 12;
+		static const int BlockSize = 64;
+
+	protected:
+		uint32 _state[16]; // Constants, key, block counter (0 here) and nonce
+
+	public:
+		ChaCha20(const byte* key, const byte* nonce);
+
+		// Stores keystream block number 'counter' in 'out' (BlockSize bytes)
+		void Block(uint32 counter, byte* out) const;
+
+		// XORs 'length' bytes of data with keystream starting at byte 'offset' of stream
+		// (stream holds at most 2^32 blocks, so offset + length must not exceed 256GB)
+		void Process(byte* data, uint64 length, uint64 offset = 0) const;
+
+		// Same as Process(data, length, 0), but ranges of 'data' are processed in parallel on 'pool'
+		// (NULL - ThreadPool::Default())
+		void ProcessParallel(byte* data, uint64 length, ThreadPool* pool = NULL) const;
+	};
+}
@@ -0,0 +1,509 @@
+#include "Convolution.h"
+#include "Fourier.h"
+#include "Image.h"
+#include "PixelConverter.h"
+#include <cmath>
+
+namespace ImgOps
+{
+	namespace Convolution
+	{
+		Kernel::Kernel(int width, int height, const float* values)
+		{
+			_width = width;
+			_height = height;
+			_anchorX = width / 2;
+			_anchorY = height / 2;
+			_values = (float*)malloc(width * height * sizeof(float));
+			if(values != NULL)
+				memcpy(_values, values, width * height * sizeof(float));
+			else
+				memset(_values, 0, width * height * sizeof(float));
+			_flipped = NULL;
+		}
+
+		Kernel::~Kernel()
+		{
+			ClearSpectra();
+			free(_values);
+		}
+
+		void Kernel::ClearSpectra()
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			for(auto it = _spectra.begin(); it != _spectra.end(); ++it)
+				free(it->second);
+			_spectra.clear();
+			delete _flipped;
+			_flipped = NULL;
+		}
+
+		void Kernel::SetValue(int x, int y, float value)
+		{
+			ClearSpectra();
+			_values[y * _width + x] = value;
+		}
+
+		void Kernel::SetAnchor(int x, int y)
+		{
+			ClearSpectra();
+			_anchorX = x;
+			_anchorY = y;
+		}
+
+		void Kernel::Normalize()
+		{
+			double sum = 0.0;
+			for(int i = 0; i < _width * _height; ++i)
+				sum += _values[i];
+			if(sum == 0.0)
+				return;
+
+			ClearSpectra();
+			float scale = (float)(1.0 / sum);
+			for(int i = 0; i < _width * _height; ++i)
+				_values[i] *= scale;
+		}
+
+		const ComplexF* Kernel::Spectrum(int fftWidth, int fftHeight)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			std::pair<int, int> key(fftWidth, fftHeight);
+			auto it = _spectra.find(key);
+			if(it != _spectra.end())
+				return it->second;
+
+			int columns = fftWidth / 2 + 1;
+			int size = columns * fftHeight;
+			ComplexF* spectrum = (ComplexF*)malloc(size * sizeof(ComplexF));
+			if(spectrum == NULL)
+				return NULL;
+			memset(spectrum, 0, size * sizeof(ComplexF));
+			for(int y = 0; y < _height; ++y)
+			{
+				float* row = (float*)(spectrum + y * columns);
+				memcpy(row, _values + y * _width, _width * sizeof(float));
+			}
+			Fourier::RealFFT2D(spectrum, fftWidth, fftHeight);
+
+			// Forward transforms are scaled by 1/n and inverse is not, so kernel spectrum is scaled back by n
+			float scale = (float)fftWidth * (float)fftHeight;
+			for(int i = 0; i < size; ++i)
+			{
+				spectrum[i].Real *= scale;
+				spectrum[i].Imag *= scale;
+			}
+
+			_spectra[key] = spectrum;
+			return spectrum;
+		}
+
+		Kernel* Kernel::Flipped()
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			if(_flipped == NULL)
+			{
+				_flipped = new Kernel(_width, _height);
+				for(int y = 0; y < _height; ++y)
+				{
+					for(int x = 0; x < _width; ++x)
+						_flipped->_values[(_height - 1 - y) * _width + (_width - 1 - x)] = _values[y * _width + x];
+				}
+				_flipped->_anchorX = _width - 1 - _anchorX;
+				_flipped->_anchorY = _height - 1 - _anchorY;
+			}
+			return _flipped;
+		}
+
+		Kernel* Kernel::Gaussian(double sigma)
+		{
+			int radius = sigma > 0.0 ? (int)ceil(3.0 * sigma) : 0;
+			int size = 2 * radius + 1;
+			Kernel* kernel = new Kernel(size, size);
+			if(radius == 0)
+			{
+				kernel->_values[0] = 1.0f;
+				return kernel;
+			}
+
+			double denom = 1.0 / (2.0 * sigma * sigma);
+			for(int y = 0; y < size; ++y)
+			{
+				for(int x = 0; x < size; ++x)
+				{
+					double dx = x - radius, dy = y - radius;
+					kernel->_values[y * size + x] = (float)exp(-(dx * dx + dy * dy) * denom);
+				}
+			}
+			kernel->Normalize();
+			return kernel;
+		}
+
+		Kernel* Kernel::FromImage(Image* image, int channel)
+		{
+			if(image->PixFormat() == PixelFormats::Indexed)
+				return NULL;
+
+			Kernel* kernel = new Kernel(image->Width(), image->Height());
+			const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+			float* rowBuffer = (float*)malloc(image->Width() * PixelFormats::GetChannels(image->PixFormat()) * sizeof(float));
+			for(int row = 0; row < image->Height(); ++row)
+			{
+				PixelConverter::ExtractIntensityRow(image, row, channel, table, rowBuffer,
+					kernel->_values + row * image->Width());
+			}
+			free(rowBuffer);
+			return kernel;
+		}
+
+		// Plane extended by border, so output (x,y) = sum{i,j}(k(i,j) * ext(y + kh-1-i, x + kw-1-j))
+		// (input is placed at (kw-1-anchorX, kh-1-anchorY) of extended plane)
+		struct ExtendedPlane
+		{
+			float* Data;
+			int Width;
+			int Height;
+
+			ExtendedPlane(const float* src, int width, int height, int srcStride, Kernel* kernel, BorderMode border)
+			{
+				int left = kernel->Width() - 1 - kernel->AnchorX();
+				int top = kernel->Height() - 1 - kernel->AnchorY();
+				Width = width + kernel->Width() - 1;
+				Height = height + kernel->Height() - 1;
+				Data = (float*)malloc((size_t)Width * Height * sizeof(float));
+
+				for(int y = 0; y < Height; ++y)
+				{
+					float* dst = Data + (size_t)y * Width;
+					int srcY = y - top;
+					if(border == BorderMode::Zero && (srcY < 0 || srcY >= height))
+					{
+						memset(dst, 0, Width * sizeof(float));
+						continue;
+					}
+					srcY = srcY < 0 ? 0 : (srcY >= height ? height - 1 : srcY);
+					const float* srcRow = src + (size_t)srcY * srcStride;
+
+					float leftValue = border == BorderMode::Zero ? 0.0f : srcRow[0];
+					float rightValue = border == BorderMode::Zero ? 0.0f : srcRow[width - 1];
+					for(int x = 0; x < left; ++x)
+						dst[x] = leftValue;
+					memcpy(dst + left, srcRow, width * sizeof(float));
+					for(int x = left + width; x < Width; ++x)
+						dst[x] = rightValue;
+				}
+			}
+
+			~ExtendedPlane()
+			{
+				free(Data);
+			}
+		};
+
+		static void ConvolveDirect(const ExtendedPlane& ext, int width, int height, Kernel* kernel, float* dst, int dstStride)
+		{
+			int kw = kernel->Width();
+			int kh = kernel->Height();
+			Fourier::ParallelFor(height, [&](int begin, int end)
+			{
+				for(int y = begin; y < end; ++y)
+				{
+					float* out = dst + (size_t)y * dstStride;
+					memset(out, 0, width * sizeof(float));
+					// Each tap adds shifted row, so inner loop is contiguous and vectorized
+					for(int i = 0; i < kh; ++i)
+					{
+						const float* extRow = ext.Data + (size_t)(y + kh - 1 - i) * ext.Width + kw - 1;
+						for(int j = 0; j < kw; ++j)
+						{
+							float k = kernel->Value(j, i);
+							if(k == 0.0f)
+								continue;
+							const float* in = extRow - j;
+							for(int x = 0; x < width; ++x)
+								out[x] += k * in[x];
+						}
+					}
+				}
+			}, 1 + 4096 / (width * kw * kh + 1));
+		}
+
+		// Chooses FFT tile size for one dimension : minimizes cost of transforms per output value
+		// (tile of size n gives n - kernel + 1 valid outputs)
+		static int ChooseTileSize(int length, int kernel)
+		{
+			int needed = Fourier::NextMixedRadixSize(length + kernel - 1); // Whole line in one tile
+			int maxSize = 1024 > 4 * kernel ? 1024 : Fourier::NextMixedRadixSize(4 * kernel);
+			int best = needed;
+			double bestCost = needed * log2((double)needed);
+			for(int n = Fourier::NextMixedRadixSize(kernel + kernel / 2 + 8); n < needed && n <= maxSize;
+				n = Fourier::NextMixedRadixSize(n + 1))
+			{
+				int tiles = (length + n - kernel) / (n - kernel + 1);
+				double cost = tiles * n * log2((double)n);
+				if(cost < bestCost)
+				{
+					best = n;
+					bestCost = cost;
+				}
+			}
+			return best;
+		}
+
+		// Approximate cost of FFT convolution relative to one multiply-add of direct convolution
+		static const double FftCostFactor = 4.0;
+
+		Method ChooseMethod(int width, int height, int kernelWidth, int kernelHeight)
+		{
+			int tileWidth = ChooseTileSize(width, kernelWidth);
+			int tileHeight = ChooseTileSize(height, kernelHeight);
+			double tiles = (double)((width + tileWidth - kernelWidth) / (tileWidth - kernelWidth + 1)) *
+				(double)((height + tileHeight - kernelHeight) / (tileHeight - kernelHeight + 1));
+			double tileValues = (double)tileWidth * tileHeight;
+			double fftCost = FftCostFactor * tiles * tileValues * log2(tileValues);
+			double directCost = (double)width * height * kernelWidth * kernelHeight;
+			return fftCost < directCost ? Method::Fft : Method::Direct;
+		}
+
+		// Overlap-save : each tile of extended plane is transformed, multiplied by kernel spectrum and transformed back,
+		// values not affected by circular wrap (last tile - kernel + 1 rows / columns) are outputs of tile
+		static void ConvolveFft(const ExtendedPlane& ext, int width, int height, Kernel* kernel, float* dst, int dstStride)
+		{
+			int kw = kernel->Width();
+			int kh = kernel->Height();
+			int fftWidth = ChooseTileSize(width, kw);
+			int fftHeight = ChooseTileSize(height, kh);
+			int columns = fftWidth / 2 + 1;
+			int outWidth = fftWidth - kw + 1;
+			int outHeight = fftHeight - kh + 1;
+			int tilesX = (width + outWidth - 1) / outWidth;
+			int tilesY = (height + outHeight - 1) / outHeight;
+			const ComplexF* spectrum = kernel->Spectrum(fftWidth, fftHeight);
+
+			Fourier::ParallelFor(tilesX * tilesY, [&](int begin, int end)
+			{
+				ComplexF* tile = (ComplexF*)malloc((size_t)columns * fftHeight * sizeof(ComplexF));
+				for(int t = begin; t < end; ++t)
+				{
+					int x0 = (t % tilesX) * outWidth;
+					int y0 = (t / tilesX) * outHeight;
+
+					// Tile covers extended plane from (x0,y0), parts outside are zero
+					int copyWidth = ext.Width - x0 < fftWidth ? ext.Width - x0 : fftWidth;
+					for(int y = 0; y < fftHeight; ++y)
+					{
+						float* row = (float*)(tile + y * columns);
+						if(y0 + y >= ext.Height)
+						{
+							memset(row, 0, fftWidth * sizeof(float));
+							continue;
+						}
+						memcpy(row, ext.Data + (size_t)(y0 + y) * ext.Width + x0, copyWidth * sizeof(float));
+						memset(row + copyWidth, 0, (fftWidth - copyWidth) * sizeof(float));
+					}
+
+					Fourier::RealFFT2D(tile, fftWidth, fftHeight);
+					for(int i = 0; i < columns * fftHeight; ++i)
+					{
+						float re = tile[i].Real * spectrum[i].Real - tile[i].Imag * spectrum[i].Imag;
+						float im = tile[i].Real * spectrum[i].Imag + tile[i].Imag * spectrum[i].Real;
+						tile[i].Real = re;
+						tile[i].Imag = im;
+					}
+					Fourier::RealInverseFFT2D(tile, fftWidth, fftHeight);
+
+					int copyX = width - x0 < outWidth ? width - x0 : outWidth;
+					int copyY = height - y0 < outHeight ? height - y0 : outHeight;
+					for(int y = 0; y < copyY; ++y)
+					{
+						const float* row = (const float*)(tile + (y + kh - 1) * columns) + kw - 1;
+						memcpy(dst + (size_t)(y0 + y) * dstStride + x0, row, copyX * sizeof(float));
+					}
+				}
+				free(tile);
+			}, 1);
+		}
+
+		void ConvolvePlane(const float* src, int width, int height, int srcStride, Kernel* kernel,
+			float* dst, int dstStride, BorderMode border, Method method)
+		{
+			if(method == Method::Auto)
+				method = ChooseMethod(width, height, kernel->Width(), kernel->Height());
+
+			ExtendedPlane ext(src, width, height, srcStride, kernel, border);
+			if(method == Method::Fft)
+				ConvolveFft(ext, width, height, kernel, dst, dstStride);
+			else
+				ConvolveDirect(ext, width, height, kernel, dst, dstStride);
+		}
+
+		Image* Convolve(Image* image, Kernel* kernel, BorderMode border, Method method)
+		{
+			PixelFormat format = image->PixFormat();
+			Image* floats = image->IsFloatingPoint() ? image : PixelConverter::ConvertToFloat(image);
+			if(floats == NULL)
+				return NULL;
+
+			int width = image->Width();
+			int height = image->Height();
+			int channels = PixelFormats::GetChannels(floats->PixFormat());
+			// Alpha added by conversion to float is constant, so it is only copied
+			int convolved = channels == 1 ? 1 : ((format & PixelFormats::HaveAlphaChannel) != 0 ? 4 : 3);
+			if(method == Method::Auto)
+				method = ChooseMethod(width, height, kernel->Width(), kernel->Height());
+
+			Image* result = new Image(width, height, floats->PixFormat());
+			float* srcPlane = (float*)malloc((size_t)width * height * sizeof(float));
+			float* dstPlane = (float*)malloc((size_t)width * height * sizeof(float));
+			for(int c = 0; c < channels; ++c)
+			{
+				float* plane = srcPlane;
+				if(channels == 1)
+				{
+					for(int y = 0; y < height; ++y)
+						memcpy(srcPlane + (size_t)y * width, floats->FloatRow(y), width * sizeof(float));
+				}
+				else
+				{
+					for(int y = 0; y < height; ++y)
+					{
+						const float* row = floats->FloatRow(y);
+						for(int x = 0; x < width; ++x)
+							srcPlane[(size_t)y * width + x] = row[x * channels + c];
+					}
+				}
+
+				if(c < convolved)
+				{
+					ConvolvePlane(srcPlane, width, height, width, kernel, dstPlane, width, border, method);
+					plane = dstPlane;
+				}
+
+				for(int y = 0; y < height; ++y)
+				{
+					float* row = result->FloatRow(y);
+					for(int x = 0; x < width; ++x)
+						row[x * channels + c] = plane[(size_t)y * width + x];
+				}
+			}
+			free(srcPlane);
+			free(dstPlane);
+			if(floats != image)
+				delete floats;
+
+			if(image->IsFloatingPoint() || format == PixelFormats::Indexed)
+				return result;
+
+			Image* converted = PixelConverter::ConvertFromFloat(result, format);
+			delete result;
+			return converted;
+		}
+
+		Image* CrossCorrelate(Image* image, Kernel* pattern, bool normalized, int channel)
+		{
+			if(image->PixFormat() == PixelFormats::Indexed)
+				return NULL;
+
+			int width = image->Width();
+			int height = image->Height();
+			Image* result = new Image(width, height, PixelFormats::GrayFloat32);
+
+			// Intensity plane is stored in result, then replaced by correlation
+			float* plane = (float*)malloc((size_t)width * height * sizeof(float));
+			const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+			float* rowBuffer = (float*)malloc(width * PixelFormats::GetChannels(image->PixFormat()) * sizeof(float));
+			for(int row = 0; row < height; ++row)
+				PixelConverter::ExtractIntensityRow(image, row, channel, table, rowBuffer, plane + (size_t)row * width);
+			free(rowBuffer);
+
+			// Correlation with pattern is convolution with pattern rotated by 180 degrees
+			float* corr = result->FloatRow(0);
+			int stride = result->Stride() / sizeof(float);
+			ConvolvePlane(plane, width, height, width, pattern->Flipped(), corr, stride, BorderMode::Zero);
+
+			if(normalized)
+			{
+				// NCC = (sum(t*a) - mean(t)*sum(a)) / sqrt(var(a window) * var(t)), window sums from integral images
+				int pw = pattern->Width();
+				int ph = pattern->Height();
+				int n = pw * ph;
+				double sumT = 0.0, sumT2 = 0.0;
+				for(int i = 0; i < n; ++i)
+				{
+					sumT += pattern->Values()[i];
+					sumT2 += (double)pattern->Values()[i] * pattern->Values()[i];
+				}
+				double meanT = sumT / n;
+				double varT = sumT2 - sumT * meanT;
+
+				int iw = width + 1;
+				double* sum1 = (double*)malloc((size_t)iw * (height + 1) * sizeof(double));
+				double* sum2 = (double*)malloc((size_t)iw * (height + 1) * sizeof(double));
+				for(int x = 0; x < iw; ++x)
+					sum1[x] = sum2[x] = 0.0;
+				for(int y = 0; y < height; ++y)
+				{
+					double row1 = 0.0, row2 = 0.0;
+					double* s1 = sum1 + (size_t)(y + 1) * iw;
+					double* s2 = sum2 + (size_t)(y + 1) * iw;
+					s1[0] = s2[0] = 0.0;
+					for(int x = 0; x < width; ++x)
+					{
+						double a = plane[(size_t)y * width + x];
+						row1 += a;
+						row2 += a * a;
+						s1[x + 1] = s1[x + 1 - iw] + row1;
+						s2[x + 1] = s2[x + 1 - iw] + row2;
+					}
+				}
+
+				// Window variance below ~1 gray level is treated as flat
+				const double minVariance = 1e-5 * n;
+				Fourier::ParallelFor(height, [&](int begin, int end)
+				{
+					for(int y = begin; y < end; ++y)
+					{
+						int top = y - pattern->AnchorY();
+						int bottom = top + ph;
+						top = top < 0 ? 0 : top;
+						bottom = bottom > height ? height : bottom;
+						float* out = corr + (size_t)y * stride;
+						for(int x = 0; x < width; ++x)
+						{
+							int left = x - pattern->AnchorX();
+							int right = left + pw;
+							left = left < 0 ? 0 : left;
+							right = right > width ? width : right;
+							size_t tl = (size_t)top * iw + left, tr = (size_t)top * iw + right;
+							size_t bl = (size_t)bottom * iw + left, br = (size_t)bottom * iw + right;
+							double s1 = sum1[br] - sum1[bl] - sum1[tr] + sum1[tl];
+							double s2 = sum2[br] - sum2[bl] - sum2[tr] + sum2[tl];
+							double varA = s2 - s1 * s1 / n;
+							if(varA < minVariance || varT <= 0.0)
+							{
+								out[x] = 0.0f;
+								continue;
+							}
+							double ncc = (out[x] - meanT * s1) / sqrt(varA * varT);
+							out[x] = (float)(ncc < -1.0 ? -1.0 : (ncc > 1.0 ? 1.0 : ncc));
+						}
+					}
+				}, 16);
+				free(sum1);
+				free(sum2);
+			}
+			free(plane);
+			return result;
+		}
+
+		Image* CrossCorrelate(Image* image, Image* pattern, bool normalized, int channel)
+		{
+			Kernel* kernel = Kernel::FromImage(pattern, channel);
+			if(kernel == NULL)
+				return NULL;
+			Image* result = CrossCorrelate(image, kernel, normalized, channel);
+			delete kernel;
+			return result;
+		}
+	}
+}
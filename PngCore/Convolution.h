@@ -0,0 +1,102 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include <map>
+#include <mutex>
+
+namespace ImgOps
+{
+	class Image;
+	struct ComplexF;
+
+	namespace Convolution
+	{
+		// Values outside of image used by convolution
+		enum BorderMode : int
+		{
+			Zero = 0, // Image is surrounded by zeros
+			Clamp = 1 // Nearest edge pixel is used
+		};
+
+		// Way convolution is computed
+		enum Method : int
+		{
+			Auto = 0, // Cheaper of Direct / Fft, based on kernel size
+			Direct = 1,
+			Fft = 2 // Overlap-save tiles transformed with single precision real FFT
+		};
+
+		// 2D convolution kernel of floats, anchor (kernel value applied to pixel itself) is (Width/2, Height/2) by default
+		// Spectra of kernel padded to FFT tile sizes are cached, so same kernel may be applied
+		// to many images without transforming it again (cache is thread-safe)
+		class Kernel
+		{
+		protected:
+			int _width;
+			int _height;
+			int _anchorX;
+			int _anchorY;
+			float* _values; // Row-major
+			std::mutex _cacheMutex;
+			std::map<std::pair<int, int>, ComplexF*> _spectra; // By FFT size, pre-scaled for inverse transform
+			Kernel* _flipped; // Kernel rotated by 180 degrees used for correlation, created on first use
+
+		public:
+			// If 'values' is NULL kernel is zeroed
+			Kernel(int width, int height, const float* values = NULL);
+			~Kernel();
+
+			int Width() const { return _width; }
+			int Height() const { return _height; }
+			int AnchorX() const { return _anchorX; }
+			int AnchorY() const { return _anchorY; }
+			const float* Values() const { return _values; }
+			float Value(int x, int y) const { return _values[y * _width + x]; }
+
+			// Changes value and drops cached spectra
+			void SetValue(int x, int y, float value);
+			void SetAnchor(int x, int y);
+			// Scales values so they sum to 1 (if sum is not 0)
+			void Normalize();
+
+			// Returns spectrum (half spectrum of fftHeight x (fftWidth/2+1) values) of kernel placed in top-left
+			// corner of zero fftWidth x fftHeight array, scaled so that inverse of product with forward transform
+			// of data gives circular convolution, spectrum is owned by kernel
+			const ComplexF* Spectrum(int fftWidth, int fftHeight);
+			// Returns kernel rotated by 180 degrees, with anchor on the same value (owned by this kernel)
+			Kernel* Flipped();
+
+			// Normalized gaussian kernel of size 2*ceil(3*sigma)+1
+			static Kernel* Gaussian(double sigma);
+			// Kernel with intensities (or values of 'channel' if >= 0) of image pixels, Indexed images are not supported
+			static Kernel* FromImage(Image* image, int channel = -1);
+
+		protected:
+			void ClearSpectra();
+
+		private:
+			Kernel(const Kernel&);
+			Kernel& operator=(const Kernel&);
+		};
+
+		// Convolves plane of 'width' x 'height' floats (rows every 'srcStride' floats) with kernel
+		// and stores result of the same size in 'dst' (rows every 'dstStride' floats)
+		void ConvolvePlane(const float* src, int width, int height, int srcStride, Kernel* kernel,
+			float* dst, int dstStride, BorderMode border = BorderMode::Clamp, Method method = Method::Auto);
+
+		// Returns method chosen by Auto for given image and kernel size
+		Method ChooseMethod(int width, int height, int kernelWidth, int kernelHeight);
+
+		// Convolves each channel of image with kernel, returns image of the same format
+		// (Indexed images are converted to RgbaFloat32 first and returned in this format)
+		Image* Convolve(Image* image, Kernel* kernel, BorderMode border = BorderMode::Clamp, Method method = Method::Auto);
+
+		// Returns GrayFloat32 map of cross-correlation of image intensities (or 'channel') with pattern :
+		// value at (x,y) is computed for pattern anchor placed on (x,y), pixels outside of image are zero
+		// If 'normalized' is set, zero-mean normalized cross-correlation in range [-1,1] is returned
+		// (0 where image window or pattern is flat), otherwise raw sums are returned
+		Image* CrossCorrelate(Image* image, Kernel* pattern, bool normalized = true, int channel = -1);
+		// Same as above for pattern given as image (for repeated matching create Kernel once)
+		Image* CrossCorrelate(Image* image, Image* pattern, bool normalized = true, int channel = -1);
+	}
+}
@@ -1,15 +1,23 @@
 #pragma once
 
+#include "TypeDefs.h"
+
 namespace ImgOps
 {
-	class FileStream;
+	__interface IDataStream;
 	class Image;
+	__interface ImageRowSink;
 
 	__interface ImageDecoder
 	{
 	public:
 		virtual Image* ReadImageFromFile(const char* filePath) = 0;
-		virtual Image* ReadImageFromFile(FileStream* file) = 0;
+		virtual Image* ReadImageFromFile(IDataStream* file) = 0;
+		// Decoded rows are passed to 'rowSink' (i.e. TiledImage) instead of being stored in image
+		// Returned image contains only image info (size, format, palettes), its Data() is NULL
+		virtual Image* ReadImageFromFile(IDataStream* file, ImageRowSink* rowSink) = 0;
+		// Decodes image stored in memory (data is read in place, without copying to temporary stream)
+		virtual Image* DecodeFromMemory(const byte* data, uint64 size) = 0;
 	};
 
 	ImageDecoder* CreatePNGDecoder();
@@ -0,0 +1,233 @@
+#include "Drbg.h"
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#elif defined(__linux__)
+#include <errno.h>
+#include <sys/random.h>
+#endif
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+namespace ImgOps
+{
+	// Fixed-seed mode state : generation changes on every switch, thread generators compare it on each use
+	static std::mutex _seedMutex;
+	static std::atomic<uint32> _currentGeneration(0);
+	static bool _deterministicMode = false;
+	static uint64 _deterministicSeed = 0;
+	static uint64 _nextStream = 0;
+
+	// Incremented in child process after each fork(), generators compare it on each use
+	static std::atomic<uint32> _forkCount(0);
+
+#if !defined(_WIN32)
+	static void OnForkChild()
+	{
+		_forkCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static int _forkHandlerRegistered = pthread_atfork(NULL, NULL, OnForkChild);
+#endif
+
+	static void SeedKey(uint64 seed, byte* key)
+	{
+		memset(key, 0, Drbg::KeySize);
+		for(int i = 0; i < 8; ++i)
+			key[i] = (byte)(seed >> (8 * i));
+	}
+
+	bool Drbg::SystemEntropy(byte* out, size_t length)
+	{
+#if defined(_WIN32)
+		return BCryptGenRandom(NULL, out, (ULONG)length, BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#elif defined(__linux__)
+		while(length > 0)
+		{
+			ssize_t count = getrandom(out, length, 0);
+			if(count < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return false;
+			}
+			out += count;
+			length -= (size_t)count;
+		}
+		return true;
+#else
+		std::random_device device;
+		for(size_t i = 0; i < length; i += 4)
+		{
+			uint32 value = device();
+			for(size_t j = 0; j < 4 && i + j < length; ++j)
+				out[i + j] = (byte)(value >> (8 * j));
+		}
+		return true;
+#endif
+	}
+
+	Drbg::Drbg()
+	{
+		_seedGeneration = 0;
+		SeedFromSystem();
+	}
+
+	Drbg::~Drbg()
+	{
+		memset(_key, 0, sizeof(_key));
+		memset(_buffer, 0, sizeof(_buffer));
+	}
+
+	void Drbg::Seed(const byte* key, uint64 stream)
+	{
+		memcpy(_key, key, KeySize);
+		_stream = stream;
+		_forkGeneration = _forkCount.load(std::memory_order_relaxed);
+		_position = BufferSize;
+		_generated = 0;
+		_deterministic = true;
+	}
+
+	void Drbg::SeedFromSystem()
+	{
+		if(SystemEntropy(_key, KeySize) == false)
+		{
+			// Should not happen, but generator must not be left with predictable state
+			std::random_device device;
+			for(int i = 0; i < KeySize; i += 4)
+			{
+				uint32 value = device();
+				memcpy(_key + i, &value, 4);
+			}
+		}
+		_stream = 0;
+		_forkGeneration = _forkCount.load(std::memory_order_relaxed);
+		_position = BufferSize;
+		_generated = 0;
+		_deterministic = false;
+	}
+
+	void Drbg::Refill()
+	{
+		if(_deterministic == false && _generated >= ReseedInterval)
+		{
+			byte entropy[KeySize];
+			if(SystemEntropy(entropy, KeySize))
+			{
+				for(int i = 0; i < KeySize; ++i)
+					_key[i] ^= entropy[i];
+			}
+			memset(entropy, 0, sizeof(entropy));
+			_generated = 0;
+		}
+
+		byte nonce[ChaCha20::NonceSize] = { 0 };
+		for(int i = 0; i < 8; ++i)
+			nonce[i] = (byte)(_stream >> (8 * i));
+		ChaCha20 cipher(_key, nonce);
+		for(int block = 0; block < BufferSize / ChaCha20::BlockSize; ++block)
+			cipher.Block((uint32)block, _buffer + block * ChaCha20::BlockSize);
+
+		// Fast key erasure : key for next buffer is taken from this one and never returned
+		memcpy(_key, _buffer, KeySize);
+		memset(_buffer, 0, KeySize);
+		_position = KeySize;
+	}
+
+	void Drbg::Generate(byte* out, size_t length)
+	{
+		// Child process must not continue parent's key and buffered bytes
+		if(_deterministic == false && _forkGeneration != _forkCount.load(std::memory_order_relaxed))
+			SeedFromSystem();
+		while(length > 0)
+		{
+			if(_position == BufferSize)
+				Refill();
+			size_t count = BufferSize - _position;
+			count = length < count ? length : count;
+			memcpy(out, _buffer + _position, count);
+			// Returned bytes are not kept in state
+			memset(_buffer + _position, 0, count);
+			_position += (uint32)count;
+			_generated += count;
+			out += count;
+			length -= count;
+		}
+	}
+
+	uint32 Drbg::Next32()
+	{
+		byte bytes[4];
+		Generate(bytes, 4);
+		return (uint32)bytes[0] | ((uint32)bytes[1] << 8) | ((uint32)bytes[2] << 16) | ((uint32)bytes[3] << 24);
+	}
+
+	uint64 Drbg::Next64()
+	{
+		uint64 low = Next32();
+		return ((uint64)Next32() << 32) | low;
+	}
+
+	uint64 Drbg::Uniform(uint64 bound)
+	{
+		// Rejects values from incomplete last range of 2^64 (so result is not biased)
+		uint64 limit = (uint64)0 - ((uint64)0 - bound) % bound;
+		while(true)
+		{
+			uint64 value = Next64();
+			if(limit == 0 || value < limit)
+				return value % bound;
+		}
+	}
+
+	Drbg& Drbg::ThreadLocal()
+	{
+		thread_local Drbg generator;
+		uint32 generation = _currentGeneration.load(std::memory_order_acquire);
+		if(generator._seedGeneration != generation)
+		{
+			std::lock_guard<std::mutex> lock(_seedMutex);
+			generator._seedGeneration = _currentGeneration;
+			if(_deterministicMode)
+			{
+				byte key[KeySize];
+				SeedKey(_deterministicSeed, key);
+				generator.Seed(key, _nextStream++);
+			}
+			else
+			{
+				generator.SeedFromSystem();
+			}
+		}
+		return generator;
+	}
+
+	void Drbg::SetDeterministicSeed(uint64 seed)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_seedMutex);
+			_deterministicMode = true;
+			_deterministicSeed = seed;
+			_nextStream = 0;
+			++_currentGeneration;
+		}
+		// Calling thread takes stream 0
+		ThreadLocal();
+	}
+
+	void Drbg::ClearDeterministicSeed()
+	{
+		std::lock_guard<std::mutex> lock(_seedMutex);
+		_deterministicMode = false;
+		++_currentGeneration;
+	}
+}
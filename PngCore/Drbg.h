@@ -0,0 +1,69 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include "ChaCha20.h"
+
+namespace ImgOps
+{
+	// Random generator for key material : ChaCha20 keystream with key from system entropy
+	// (getrandom on Linux, BCryptGenRandom on Windows, std::random_device elsewhere)
+	// Keystream is generated in buffers of BufferSize bytes, first KeySize bytes of each buffer become
+	// the next key (so state does not reveal earlier output) and key is mixed with fresh entropy every
+	// ReseedInterval bytes. One generator is not thread-safe : use ThreadLocal(), which gives
+	// each thread its own independently seeded generator (no locks on the hot path)
+	// After fork() generators seeded from system entropy are reseeded in child on next use, so parent
+	// and child never return the same bytes (generators in fixed-seed mode are left as they are)
+	class Drbg
+	{
+	public:
+		static const int KeySize = ChaCha20::KeySize;
+		static const int BufferSize = 16 * ChaCha20::BlockSize;
+		static const uint64 ReseedInterval = 16 * 1024 * 1024;
+
+	protected:
+		byte _key[KeySize];
+		uint64 _stream; // Used as nonce, so generators with the same seed and different streams are independent
+		byte _buffer[BufferSize];
+		uint32 _position; // First unused byte of buffer
+		uint64 _generated; // Bytes generated since last reseed
+		bool _deterministic; // Seeded by Seed(), never mixed with system entropy
+		uint32 _seedGeneration; // See SetDeterministicSeed()
+		uint32 _forkGeneration; // Number of forks seen when generator was seeded
+
+	public:
+		// Seeds generator from system entropy
+		Drbg();
+		~Drbg();
+
+		// Deterministic seeding (i.e. for tests and benchmarks) : the same key and stream give the same output
+		void Seed(const byte* key, uint64 stream);
+		// Seeds generator from system entropy
+		void SeedFromSystem();
+
+		void Generate(byte* out, size_t length);
+		uint32 Next32();
+		uint64 Next64();
+		// Uniform value in range [0, bound) (bound > 0)
+		uint64 Uniform(uint64 bound);
+
+		// Generator of calling thread, seeded on first use
+		static Drbg& ThreadLocal();
+
+		// Fixed-seed mode : all thread generators are reseeded (on their next use) with 'seed', each
+		// with other stream. Calling thread gets stream 0, so values drawn on it are reproducible
+		// (values drawn on workers depend on order in which threads first use their generators)
+		static void SetDeterministicSeed(uint64 seed);
+		// Back to system entropy (on next use of each thread generator)
+		static void ClearDeterministicSeed();
+
+		// Fills 'out' with bytes from system entropy source, returns false if it failed
+		static bool SystemEntropy(byte* out, size_t length);
+
+	protected:
+		void Refill();
+
+	private:
+		Drbg(const Drbg&);
+		Drbg& operator=(const Drbg&);
+	};
+}
@@ -1,15 +1,23 @@
 #pragma once
 
+#include "TypeDefs.h"
+
 namespace ImgOps
 {
-	class FileStream;
+	__interface IDataStream;
+	class MemoryStream;
 	class Image;
+	class TiledImage;
 
 	__interface ImageEncoder
 	{
 	public:
 		virtual bool SaveImageToFile(const char* filePath, Image* image) = 0;
-		virtual bool SaveImageToFile(FileStream* file, Image* image) = 0;
+		virtual bool SaveImageToFile(IDataStream* file, Image* image) = 0;
+		// Tiled image is encoded row by row, so it is never fully loaded into memory
+		virtual bool SaveImageToFile(IDataStream* file, TiledImage* image) = 0;
+		// Appends encoded image to 'stream' (its buffer is grown once using size estimate)
+		virtual bool EncodeToMemory(Image* image, MemoryStream* stream) = 0;
 	};
 
 	ImageEncoder* CreatePNGEncoder();
@@ -4,14 +4,21 @@
 
 namespace ImgOps
 {
+	// Message is stored here, as std::exception(const char*) is available only in MSVC
+	// (all messages are string literals, so pointer is enough)
 	class Exception : public std::exception
 	{
+	protected:
+		const char* _message;
+
 	public:
-		Exception() : exception()
+		Exception() : exception(), _message("")
 		{ }
 		
-		Exception(const char* txt) : exception(txt)
+		Exception(const char* txt) : exception(), _message(txt)
 		{ }
+
+		const char* what() const throw() { return _message; }
 	};
 
 	class DecoderException : public Exception
@@ -0,0 +1,375 @@
+#pragma once
+
+// Internal header : Stockham pass kernels of FftPlanT, written once for generic vector type
+// Included by FourierFFT.cpp (scalar and SSE2 kernels) and FourierFFTAvx2.cpp (compiled for AVX2),
+// so kernels have internal linkage and each file keeps its own instantiations
+
+#include "TypeDefs.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMGOPS_FFT_X86
+#include <immintrin.h>
+#endif
+
+namespace ImgOps
+{
+	namespace Fourier
+	{
+		// Arguments of single Stockham pass with radix 'Radix' : 'Stride' is product of radices of previous passes
+		// Reads x[j + r*n/p], multiplies by twiddles, does size-p DFT and writes to y[expand(j) + r*stride]
+		// Each element is a vector of 'Lanes' values (independent transforms stored side by side)
+		// Twiddles exp(-dir*2Pi*i*b*r/(stride*p)) are stored at tw[(r-1) * stride + b] (contiguous in b),
+		// 'Roots' are p-th roots of unity (used by generic radix-7 pass), 'DirSign' is 1 for forward transform
+		template<typename T>
+		struct StockhamPassData
+		{
+			int N;
+			int Radix;
+			int Stride;
+			int Lanes;
+			const T* XRe;
+			const T* XIm;
+			T* YRe;
+			T* YIm;
+			const T* TwRe;
+			const T* TwIm;
+			const T* RootsRe;
+			const T* RootsIm;
+			T DirSign;
+		};
+
+#ifdef IMGOPS_FFT_X86
+		// Defined in FourierFFTAvx2.cpp, may be called only if cpu supports AVX2 and FMA
+		void StockhamPassAvx2(const StockhamPassData<double>& pass);
+		void StockhamPassAvx2(const StockhamPassData<float>& pass);
+#endif
+
+		namespace
+		{
+			static const int KernelMaxRadix = 7;
+
+			// Vector types used by kernels : Type holds 'Width' values of T
+			// MulAdd = a*b+c, MulSub = a*b-c, NegMulAdd = c-a*b (fused in AVX2 kernels)
+			template<typename T>
+			struct ScalarVec
+			{
+				typedef T Type;
+				static const int Width = 1;
+				static Type Load(const T* p) { return *p; }
+				static void Store(T* p, Type v) { *p = v; }
+				static Type Set(T v) { return v; }
+				static Type Add(Type a, Type b) { return a + b; }
+				static Type Sub(Type a, Type b) { return a - b; }
+				static Type Mul(Type a, Type b) { return a * b; }
+				static Type MulAdd(Type a, Type b, Type c) { return a * b + c; }
+				static Type MulSub(Type a, Type b, Type c) { return a * b - c; }
+				static Type NegMulAdd(Type a, Type b, Type c) { return c - a * b; }
+			};
+
+#ifdef IMGOPS_FFT_X86
+			template<typename T>
+			struct Sse2Vec;
+
+			template<>
+			struct Sse2Vec<double>
+			{
+				typedef __m128d Type;
+				static const int Width = 2;
+				static Type Load(const double* p) { return _mm_loadu_pd(p); }
+				static void Store(double* p, Type v) { _mm_storeu_pd(p, v); }
+				static Type Set(double v) { return _mm_set1_pd(v); }
+				static Type Add(Type a, Type b) { return _mm_add_pd(a, b); }
+				static Type Sub(Type a, Type b) { return _mm_sub_pd(a, b); }
+				static Type Mul(Type a, Type b) { return _mm_mul_pd(a, b); }
+				static Type MulAdd(Type a, Type b, Type c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+				static Type MulSub(Type a, Type b, Type c) { return _mm_sub_pd(_mm_mul_pd(a, b), c); }
+				static Type NegMulAdd(Type a, Type b, Type c) { return _mm_sub_pd(c, _mm_mul_pd(a, b)); }
+			};
+
+			template<>
+			struct Sse2Vec<float>
+			{
+				typedef __m128 Type;
+				static const int Width = 4;
+				static Type Load(const float* p) { return _mm_loadu_ps(p); }
+				static void Store(float* p, Type v) { _mm_storeu_ps(p, v); }
+				static Type Set(float v) { return _mm_set1_ps(v); }
+				static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+				static Type Sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+				static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+				static Type MulAdd(Type a, Type b, Type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+				static Type MulSub(Type a, Type b, Type c) { return _mm_sub_ps(_mm_mul_ps(a, b), c); }
+				static Type NegMulAdd(Type a, Type b, Type c) { return _mm_sub_ps(c, _mm_mul_ps(a, b)); }
+			};
+#endif
+
+#ifdef IMGOPS_FFT_AVX2
+			template<typename T>
+			struct Avx2Vec;
+
+			template<>
+			struct Avx2Vec<double>
+			{
+				typedef __m256d Type;
+				static const int Width = 4;
+				static Type Load(const double* p) { return _mm256_loadu_pd(p); }
+				static void Store(double* p, Type v) { _mm256_storeu_pd(p, v); }
+				static Type Set(double v) { return _mm256_set1_pd(v); }
+				static Type Add(Type a, Type b) { return _mm256_add_pd(a, b); }
+				static Type Sub(Type a, Type b) { return _mm256_sub_pd(a, b); }
+				static Type Mul(Type a, Type b) { return _mm256_mul_pd(a, b); }
+				static Type MulAdd(Type a, Type b, Type c) { return _mm256_fmadd_pd(a, b, c); }
+				static Type MulSub(Type a, Type b, Type c) { return _mm256_fmsub_pd(a, b, c); }
+				static Type NegMulAdd(Type a, Type b, Type c) { return _mm256_fnmadd_pd(a, b, c); }
+			};
+
+			template<>
+			struct Avx2Vec<float>
+			{
+				typedef __m256 Type;
+				static const int Width = 8;
+				static Type Load(const float* p) { return _mm256_loadu_ps(p); }
+				static void Store(float* p, Type v) { _mm256_storeu_ps(p, v); }
+				static Type Set(float v) { return _mm256_set1_ps(v); }
+				static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+				static Type Sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+				static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+				static Type MulAdd(Type a, Type b, Type c) { return _mm256_fmadd_ps(a, b, c); }
+				static Type MulSub(Type a, Type b, Type c) { return _mm256_fmsub_ps(a, b, c); }
+				static Type NegMulAdd(Type a, Type b, Type c) { return _mm256_fnmadd_ps(a, b, c); }
+			};
+#endif
+
+			// Twiddles of consecutive butterflies (single transform, vector over 'b')
+			template<typename T, typename V>
+			struct TwiddleArray
+			{
+				const T* Re;
+				const T* Im;
+				int Stride;
+
+				TwiddleArray(const StockhamPassData<T>& pass) : Re(pass.TwRe), Im(pass.TwIm), Stride(pass.Stride) { }
+
+				void Get(int r, int i, typename V::Type& wRe, typename V::Type& wIm) const
+				{
+					wRe = V::Load(Re + (r - 1) * Stride + i);
+					wIm = V::Load(Im + (r - 1) * Stride + i);
+				}
+			};
+
+			// Twiddles of one butterfly broadcasted to all lanes (batch of transforms, vector over lanes)
+			template<typename T, typename V>
+			struct TwiddleBroadcast
+			{
+				typename V::Type Re[KernelMaxRadix];
+				typename V::Type Im[KernelMaxRadix];
+
+				TwiddleBroadcast(const StockhamPassData<T>& pass, int b)
+				{
+					for(int r = 1; r < pass.Radix; ++r)
+					{
+						Re[r] = V::Set(pass.TwRe[(r - 1) * pass.Stride + b]);
+						Im[r] = V::Set(pass.TwIm[(r - 1) * pass.Stride + b]);
+					}
+				}
+
+				void Get(int r, int, typename V::Type& wRe, typename V::Type& wIm) const
+				{
+					wRe = Re[r];
+					wIm = Im[r];
+				}
+			};
+
+			// Loads input 'r' at 'i' multiplied by its twiddle
+			template<typename T, typename V, typename W>
+			static inline void LoadTwiddled(const T* const* inRe, const T* const* inIm, const W& tw, int r, int i,
+				typename V::Type& re, typename V::Type& im)
+			{
+				typedef typename V::Type Vt;
+				Vt xRe = V::Load(inRe[r] + i), xIm = V::Load(inIm[r] + i);
+				Vt wRe, wIm;
+				tw.Get(r, i, wRe, wIm);
+				re = V::MulSub(xRe, wRe, V::Mul(xIm, wIm));
+				im = V::MulAdd(xRe, wIm, V::Mul(xIm, wRe));
+			}
+
+			// Computes butterfly of radix 'P' for values at 'i' of all inputs
+			template<typename T, typename V, int P, typename W>
+			static inline void Butterfly(const StockhamPassData<T>& pass, const T* const* inRe, const T* const* inIm,
+				T* const* outRe, T* const* outIm, const W& tw, int i)
+			{
+				typedef typename V::Type Vt;
+				Vt aRe[P], aIm[P];
+				aRe[0] = V::Load(inRe[0] + i);
+				aIm[0] = V::Load(inIm[0] + i);
+				for(int r = 1; r < P; ++r)
+					LoadTwiddled<T, V>(inRe, inIm, tw, r, i, aRe[r], aIm[r]);
+
+				Vt dirSign = V::Set(pass.DirSign);
+				if(P == 2)
+				{
+					V::Store(outRe[0] + i, V::Add(aRe[0], aRe[1]));
+					V::Store(outIm[0] + i, V::Add(aIm[0], aIm[1]));
+					V::Store(outRe[1] + i, V::Sub(aRe[0], aRe[1]));
+					V::Store(outIm[1] + i, V::Sub(aIm[0], aIm[1]));
+				}
+				else if(P == 4)
+				{
+					// -i * dirSign rotation for forward transform
+					Vt t0Re = V::Add(aRe[0], aRe[2]), t0Im = V::Add(aIm[0], aIm[2]);
+					Vt t1Re = V::Sub(aRe[0], aRe[2]), t1Im = V::Sub(aIm[0], aIm[2]);
+					Vt t2Re = V::Add(aRe[1], aRe[3]), t2Im = V::Add(aIm[1], aIm[3]);
+					Vt t3Re = V::Mul(V::Sub(aIm[1], aIm[3]), dirSign);
+					Vt t3Im = V::Mul(V::Sub(aRe[3], aRe[1]), dirSign);
+					V::Store(outRe[0] + i, V::Add(t0Re, t2Re));
+					V::Store(outIm[0] + i, V::Add(t0Im, t2Im));
+					V::Store(outRe[1] + i, V::Add(t1Re, t3Re));
+					V::Store(outIm[1] + i, V::Add(t1Im, t3Im));
+					V::Store(outRe[2] + i, V::Sub(t0Re, t2Re));
+					V::Store(outIm[2] + i, V::Sub(t0Im, t2Im));
+					V::Store(outRe[3] + i, V::Sub(t1Re, t3Re));
+					V::Store(outIm[3] + i, V::Sub(t1Im, t3Im));
+				}
+				else if(P == 3)
+				{
+					Vt c = V::Set((T)-0.5);
+					Vt s = V::Mul(V::Set((T)-0.86602540378443864676), dirSign); // sin(-2Pi/3)
+					Vt sRe = V::Add(aRe[1], aRe[2]), sIm = V::Add(aIm[1], aIm[2]);
+					Vt dRe = V::Sub(aRe[1], aRe[2]), dIm = V::Sub(aIm[1], aIm[2]);
+					Vt mRe = V::MulAdd(c, sRe, aRe[0]), mIm = V::MulAdd(c, sIm, aIm[0]);
+					V::Store(outRe[0] + i, V::Add(aRe[0], sRe));
+					V::Store(outIm[0] + i, V::Add(aIm[0], sIm));
+					V::Store(outRe[1] + i, V::NegMulAdd(s, dIm, mRe));
+					V::Store(outIm[1] + i, V::MulAdd(s, dRe, mIm));
+					V::Store(outRe[2] + i, V::MulAdd(s, dIm, mRe));
+					V::Store(outIm[2] + i, V::NegMulAdd(s, dRe, mIm));
+				}
+				else if(P == 5)
+				{
+					Vt c1 = V::Set((T)0.30901699437494742410); // cos(2Pi/5)
+					Vt c2 = V::Set((T)-0.80901699437494742410); // cos(4Pi/5)
+					Vt s1 = V::Mul(V::Set((T)-0.95105651629515357212), dirSign); // sin(-2Pi/5)
+					Vt s2 = V::Mul(V::Set((T)-0.58778525229247312917), dirSign); // sin(-4Pi/5)
+					Vt s14Re = V::Add(aRe[1], aRe[4]), s14Im = V::Add(aIm[1], aIm[4]);
+					Vt d14Re = V::Sub(aRe[1], aRe[4]), d14Im = V::Sub(aIm[1], aIm[4]);
+					Vt s23Re = V::Add(aRe[2], aRe[3]), s23Im = V::Add(aIm[2], aIm[3]);
+					Vt d23Re = V::Sub(aRe[2], aRe[3]), d23Im = V::Sub(aIm[2], aIm[3]);
+					Vt m1Re = V::MulAdd(c1, s14Re, V::MulAdd(c2, s23Re, aRe[0]));
+					Vt m1Im = V::MulAdd(c1, s14Im, V::MulAdd(c2, s23Im, aIm[0]));
+					Vt m2Re = V::MulAdd(c2, s14Re, V::MulAdd(c1, s23Re, aRe[0]));
+					Vt m2Im = V::MulAdd(c2, s14Im, V::MulAdd(c1, s23Im, aIm[0]));
+					Vt n1Re = V::NegMulAdd(s1, d14Im, V::NegMulAdd(s2, d23Im, V::Set((T)0)));
+					Vt n1Im = V::MulAdd(s1, d14Re, V::Mul(s2, d23Re));
+					Vt n2Re = V::MulSub(s1, d23Im, V::Mul(s2, d14Im));
+					Vt n2Im = V::MulSub(s2, d14Re, V::Mul(s1, d23Re));
+					V::Store(outRe[0] + i, V::Add(aRe[0], V::Add(s14Re, s23Re)));
+					V::Store(outIm[0] + i, V::Add(aIm[0], V::Add(s14Im, s23Im)));
+					V::Store(outRe[1] + i, V::Add(m1Re, n1Re));
+					V::Store(outIm[1] + i, V::Add(m1Im, n1Im));
+					V::Store(outRe[2] + i, V::Add(m2Re, n2Re));
+					V::Store(outIm[2] + i, V::Add(m2Im, n2Im));
+					V::Store(outRe[3] + i, V::Sub(m2Re, n2Re));
+					V::Store(outIm[3] + i, V::Sub(m2Im, n2Im));
+					V::Store(outRe[4] + i, V::Sub(m1Re, n1Re));
+					V::Store(outIm[4] + i, V::Sub(m1Im, n1Im));
+				}
+				else
+				{
+					// Generic small DFT (radix 7)
+					for(int q = 0; q < P; ++q)
+					{
+						Vt sumRe = aRe[0], sumIm = aIm[0];
+						for(int r = 1; r < P; ++r)
+						{
+							int t = (r * q) % P;
+							Vt rootRe = V::Set(pass.RootsRe[t]), rootIm = V::Set(pass.RootsIm[t]);
+							sumRe = V::MulAdd(aRe[r], rootRe, V::NegMulAdd(aIm[r], rootIm, sumRe));
+							sumIm = V::MulAdd(aRe[r], rootIm, V::MulAdd(aIm[r], rootRe, sumIm));
+						}
+						V::Store(outRe[q] + i, sumRe);
+						V::Store(outIm[q] + i, sumIm);
+					}
+				}
+			}
+
+			// Runs butterflies for 'count' consecutive values : full vectors first, then narrower 'VTail' vectors
+			// (so short runs of early passes are still vectorized), then scalar tail
+			template<typename T, typename V, typename VTail, int P, typename W, typename WTail, typename W1>
+			static inline void ButterflyRun(const StockhamPassData<T>& pass, const T* const* inRe, const T* const* inIm,
+				T* const* outRe, T* const* outIm, const W& tw, const WTail& twTail, const W1& tw1, int count)
+			{
+				int i = 0;
+				for(; i + V::Width <= count; i += V::Width)
+					Butterfly<T, V, P>(pass, inRe, inIm, outRe, outIm, tw, i);
+				if(VTail::Width < V::Width)
+				{
+					for(; i + VTail::Width <= count; i += VTail::Width)
+						Butterfly<T, VTail, P>(pass, inRe, inIm, outRe, outIm, twTail, i);
+				}
+				for(; i < count; ++i)
+					Butterfly<T, ScalarVec<T>, P>(pass, inRe, inIm, outRe, outIm, tw1, i);
+			}
+
+			// Single transform is vectorized over butterflies of a group (consecutive 'b' have consecutive
+			// inputs, outputs and twiddles), batch of transforms is vectorized over lanes
+			template<typename T, typename V, typename VTail, int P>
+			static void StockhamRadixPass(const StockhamPassData<T>& pass)
+			{
+				int quarter = pass.N / P; // Distance between inputs of one butterfly
+				int stride = pass.Stride;
+				int lanes = pass.Lanes;
+				int groups = quarter / stride;
+
+				const T* inRe[P];
+				const T* inIm[P];
+				T* outRe[P];
+				T* outIm[P];
+				for(int a = 0; a < groups; ++a)
+				{
+					int j = a * stride;
+					int dst = a * stride * P;
+					if(lanes == 1)
+					{
+						for(int r = 0; r < P; ++r)
+						{
+							inRe[r] = pass.XRe + j + r * quarter;
+							inIm[r] = pass.XIm + j + r * quarter;
+							outRe[r] = pass.YRe + dst + r * stride;
+							outIm[r] = pass.YIm + dst + r * stride;
+						}
+						ButterflyRun<T, V, VTail, P>(pass, inRe, inIm, outRe, outIm, TwiddleArray<T, V>(pass),
+							TwiddleArray<T, VTail>(pass), TwiddleArray<T, ScalarVec<T> >(pass), stride);
+					}
+					else
+					{
+						for(int b = 0; b < stride; ++b)
+						{
+							for(int r = 0; r < P; ++r)
+							{
+								inRe[r] = pass.XRe + (j + b + r * quarter) * lanes;
+								inIm[r] = pass.XIm + (j + b + r * quarter) * lanes;
+								outRe[r] = pass.YRe + (dst + b + r * stride) * lanes;
+								outIm[r] = pass.YIm + (dst + b + r * stride) * lanes;
+							}
+							ButterflyRun<T, V, VTail, P>(pass, inRe, inIm, outRe, outIm, TwiddleBroadcast<T, V>(pass, b),
+								TwiddleBroadcast<T, VTail>(pass, b), TwiddleBroadcast<T, ScalarVec<T> >(pass, b), lanes);
+						}
+					}
+				}
+			}
+
+			template<typename T, typename V, typename VTail>
+			static void StockhamPassKernel(const StockhamPassData<T>& pass)
+			{
+				switch(pass.Radix)
+				{
+				case 2: StockhamRadixPass<T, V, VTail, 2>(pass); break;
+				case 3: StockhamRadixPass<T, V, VTail, 3>(pass); break;
+				case 4: StockhamRadixPass<T, V, VTail, 4>(pass); break;
+				case 5: StockhamRadixPass<T, V, VTail, 5>(pass); break;
+				default: StockhamRadixPass<T, V, VTail, 7>(pass); break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "TypeDefs.h"
+
+namespace ImgOps
+{
+	namespace Fourier
+	{
+		// Precomputed data of complex FFT of given size and direction :
+		// - radices of Stockham passes with twiddles of each pass (Stockham output is already in natural order,
+		//   so there is no bit-reversal permutation)
+		// - for sizes with prime factors other than 2,3,5,7 : Bluestein chirp and spectrum of convolution kernel
+		// Plans are cached by size and direction and never change after creation, so they may be shared by threads
+		// Scratch memory is thread-local and aligned, so transforms do not allocate after first use
+		// 'T' is sample type : double (FftPlan) or float (FftPlanF), plans of both types are cached separately
+		template<typename T>
+		class FftPlanT
+		{
+		public:
+			static const int MaxRadix = 7;
+			static const int MaxStages = 32;
+
+			// Independent thread-local scratch buffers (shared by plans of both types)
+			enum ScratchSlot : int
+			{
+				ExecuteScratch = 0, // Used by Execute()
+				BluesteinScratch = 1, // Used by Execute() of Bluestein plans
+				CallerScratch = 2, // Free to use by code calling Execute() (i.e. for gathering columns)
+				ScratchSlots = 3
+			};
+
+		protected:
+			int _size;
+			int _dir;
+			int _stages; // -1 for Bluestein plans
+			int _radices[MaxStages];
+			T* _twiddlesRe; // For each pass : stride * (radix - 1) twiddles
+			T* _twiddlesIm;
+			int _twiddleOffsets[MaxStages];
+			T _rootsRe[MaxRadix]; // exp(-dir*2Pi*i*k/7) for generic radix-7 pass
+			T _rootsIm[MaxRadix];
+
+			// Bluestein : convolution with chirp done with forward plan of '_convSize' (power of 2)
+			int _convSize;
+			FftPlanT* _convPlan;
+			T* _chirpRe;
+			T* _chirpIm;
+			T* _kernelRe; // Spectrum of conj(chirp), pre-scaled by 1/_convSize
+			T* _kernelIm;
+
+		public:
+			// Returns cached plan for given size (>= 1) and direction (TransfromDirection)
+			static FftPlanT* Get(int size, int dir);
+			// Releases all cached plans of this type, no plan may be in use
+			static void ClearCache();
+
+			int Size() const { return _size; }
+			int Direction() const { return _dir; }
+			bool UsesBluestein() const { return _stages < 0; }
+
+			// Transforms in place 'lanes' interleaved sequences (element k of lane l is at [k * lanes + l])
+			// Forward transform is scaled by 1/Size() (same as Fourier::FFT)
+			void Execute(T* real, T* imag, int lanes = 1) const;
+			// Same as above, but without scaling
+			void ExecuteUnscaled(T* real, T* imag, int lanes = 1) const;
+
+			// Returns thread-local 64-byte aligned buffer of at least 'count' values
+			// Buffer is kept for next calls, so it's content is valid untill next call with the same slot
+			static T* ThreadScratch(ScratchSlot slot, size_t count);
+
+		protected:
+			FftPlanT(int size, int dir);
+			~FftPlanT();
+
+			void ExecuteStockham(T* real, T* imag, int lanes) const;
+			void ExecuteBluestein(T* real, T* imag, int step) const;
+
+		private:
+			FftPlanT(const FftPlanT&);
+			FftPlanT& operator=(const FftPlanT&);
+		};
+
+		typedef FftPlanT<double> FftPlan;
+		typedef FftPlanT<float> FftPlanF;
+	}
+}
@@ -1,4 +1,7 @@
 #include "FileStream.h"
+
+#ifdef _WIN32
+
 #include <stdio.h>
 //#include <io.h>
 
@@ -8,6 +11,7 @@ namespace ImgOps
 
 	FileStream::FileStream(const char* filePath, OpenMode openMode, uint32 buffSize)
 	{
+		_file = NULL;
 		_filePath = filePath;
 
 		string stdOpenMode = "";
@@ -31,12 +35,6 @@ namespace ImgOps
 			return;
 
 		setvbuf(File, NULL, _IOFBF, buffSize);
-
-		//int res = _fseeki64((FILE*)_file, 0, SEEK_END);
-		//if(res == -1)
-		//	Close();
-
-		//_length = _ftelli64(File);
 		rewind(File);
 		_openMode = openMode;
 	}
@@ -55,6 +53,21 @@ namespace ImgOps
 		}
 	}
 
+	int64 FileStream::Length()
+	{
+		int64 pos = _ftelli64(File);
+		if(_fseeki64(File, 0, SEEK_END) == -1)
+			return -1;
+		int64 length = _ftelli64(File);
+		_fseeki64(File, pos, SEEK_SET);
+		return length;
+	}
+
+	bool FileStream::Flush()
+	{
+		return fflush(File) == 0;
+	}
+
 	bool FileStream::NextByte()
 	{
 		return _fseeki64(File, 1, SEEK_CUR) != -1;
@@ -118,4 +131,6 @@ namespace ImgOps
 	{
 		return fwrite(buffer, 1, bytesToWrite, File);
 	}
-}
\ No newline at end of file
+}
+
+#endif
@@ -1,7 +1,6 @@
 #pragma once
 
-#include "TypeDefs.h"
-//#include "PngDataStream.h"
+#include "DataStream.h"
 
 namespace ImgOps
 {
@@ -23,21 +22,46 @@ namespace ImgOps
 	}
 	typedef OpenModes::OpenModeType OpenMode;
 	
-	class FileStream // : IDataStream
+	// File stream with buffered io :
+	// - on Windows it wraps stdio (FileStream.cpp)
+	// - elsewhere it uses posix pread / pwrite with own buffer (FileStreamPosix.cpp),
+	//   so position changes are free and large reads / writes bypass the buffer
+	class FileStream : public IDataStream
 	{
+	public:
+#ifdef _WIN32
+		static const uint32 DefaultBufferSize = 512u;
+#else
+		static const uint32 DefaultBufferSize = 1u << 20;
+#endif
+
 	protected:
+#ifdef _WIN32
 		void* _file;
+#else
+		int _fd;
+		byte* _buffer;
+		uint32 _bufferSize;
+		int64 _bufferStart; // File position of first byte in buffer
+		uint32 _bufferLength; // Number of valid bytes in buffer
+		bool _bufferDirty; // Buffer contains written bytes not yet stored in file
+		int64 _position;
+		int64 _length;
+#endif
 		string _filePath;
-		//int64 _length;
 		OpenMode _openMode;
 
 	public:
-		FileStream(const char* filePath, OpenMode openMode, uint32 bufferSize = 512u);
+		FileStream(const char* filePath, OpenMode openMode, uint32 bufferSize = DefaultBufferSize);
 		~FileStream();
 
 		string FilePath() { return _filePath; }
-		//int64 Length() { return _length; }
+		int64 Length();
+#ifdef _WIN32
 		bool IsOpen() { return _file != NULL; }
+#else
+		bool IsOpen() { return _fd >= 0; }
+#endif
 
 		bool NextByte();
 		int64 Position();
@@ -54,8 +78,15 @@ namespace ImgOps
 		int64 ReadLine(int64 bytesToRead, byte* buffer);
 		int64 WriteSome(int64 bytesToWrite, byte* buffer);
 
+		// Stores buffered data in file
+		bool Flush();
+
 	protected:
 		void Close();
+#ifndef _WIN32
+		// Fills buffer with data starting at current position, returns false on EOF / error
+		bool FillBuffer();
+#endif
 		
 	private:
 		FileStream(const FileStream&);
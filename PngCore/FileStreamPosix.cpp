@@ -0,0 +1,302 @@
+#include "FileStream.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+namespace ImgOps
+{
+	// Buffer holds either clean data read from file (read window) or
+	// data written at [_bufferStart, _bufferStart + _bufferLength) not yet stored (write window, _bufferDirty)
+
+	FileStream::FileStream(const char* filePath, OpenMode openMode, uint32 buffSize)
+	{
+		_fd = -1;
+		_buffer = NULL;
+		_bufferSize = buffSize > 0 ? buffSize : DefaultBufferSize;
+		_bufferStart = 0;
+		_bufferLength = 0;
+		_bufferDirty = false;
+		_position = 0;
+		_length = 0;
+		_filePath = filePath;
+		_openMode = OpenModes::Unknown;
+
+		int flags = 0;
+		switch (openMode)
+		{
+		case OpenModes::Read: flags = O_RDONLY; break;
+		case OpenModes::ReadWrite: flags = O_RDWR; break;
+		case OpenModes::ReadWriteAppend: flags = O_RDWR | O_CREAT; break;
+		case OpenModes::ReadWriteTrunc: flags = O_RDWR | O_CREAT | O_TRUNC; break;
+		case OpenModes::Append:
+		case OpenModes::WriteAppend: flags = O_WRONLY | O_CREAT; break;
+		case OpenModes::Write:
+		case OpenModes::Trunc:
+		case OpenModes::WriteTrunc: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+		default:
+			return;
+		}
+
+		do
+		{
+			_fd = open(filePath, flags | O_CLOEXEC, 0644);
+		}
+		while(_fd < 0 && errno == EINTR);
+		if(_fd < 0)
+			return;
+
+		struct stat st;
+		if(fstat(_fd, &st) != 0)
+		{
+			Close();
+			return;
+		}
+		_length = st.st_size;
+
+		_buffer = (byte*)malloc(_bufferSize);
+		if(_buffer == NULL)
+		{
+			Close();
+			return;
+		}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+		// O_APPEND is not used as it would ignore pwrite() offsets, so appending
+		// just starts at the end (stdio "a" mode also allows reading whole file)
+		if((openMode & OpenModes::Append) != 0)
+			_position = _length;
+		_openMode = openMode;
+	}
+
+	FileStream::~FileStream()
+	{
+		Close();
+	}
+
+	void FileStream::Close()
+	{
+		if(_fd >= 0)
+		{
+			Flush();
+			close(_fd);
+			_fd = -1;
+		}
+		if(_buffer != NULL)
+		{
+			free(_buffer);
+			_buffer = NULL;
+		}
+	}
+
+	// Reads / writes whole 'count' bytes (retrying partial transfers), returns number of bytes transferred
+	static int64 PRead(int fd, byte* data, int64 count, int64 offset)
+	{
+		int64 done = 0;
+		while(done < count)
+		{
+			ssize_t res = pread(fd, data + done, (size_t)(count - done), (off_t)(offset + done));
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				break;
+			done += res;
+		}
+		return done;
+	}
+
+	static int64 PWrite(int fd, const byte* data, int64 count, int64 offset)
+	{
+		int64 done = 0;
+		while(done < count)
+		{
+			ssize_t res = pwrite(fd, data + done, (size_t)(count - done), (off_t)(offset + done));
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				break;
+			done += res;
+		}
+		return done;
+	}
+
+	bool FileStream::Flush()
+	{
+		if(_bufferDirty == false)
+			return true;
+
+		int64 written = PWrite(_fd, _buffer, _bufferLength, _bufferStart);
+		bool ok = written == _bufferLength;
+		_bufferDirty = false;
+		_bufferLength = 0;
+		return ok;
+	}
+
+	bool FileStream::FillBuffer()
+	{
+		if(Flush() == false)
+			return false;
+
+		_bufferStart = _position;
+		_bufferLength = 0;
+		int64 bytesRead = PRead(_fd, _buffer, _bufferSize, _position);
+		_bufferLength = (uint32)bytesRead;
+		return bytesRead > 0;
+	}
+
+	int64 FileStream::Length()
+	{
+		return _length;
+	}
+
+	bool FileStream::NextByte()
+	{
+		return MovePosition(1);
+	}
+
+	int64 FileStream::Position()
+	{
+		return _position;
+	}
+
+	bool FileStream::SetPosition(int64 pos)
+	{
+		if(pos < 0)
+			return false;
+		_position = pos;
+		return true;
+	}
+
+	bool FileStream::MovePosition(int64 pos)
+	{
+		return SetPosition(_position + pos);
+	}
+
+	bool FileStream::ReadByte(byte* data)
+	{
+		// Fast path : byte is in read window
+		uint64 offset = (uint64)(_position - _bufferStart);
+		if(!_bufferDirty && offset < _bufferLength)
+		{
+			*data = _buffer[offset];
+			++_position;
+			return true;
+		}
+		return ReadSome(1, data) == 1;
+	}
+
+	bool FileStream::WriteByte(byte data)
+	{
+		return WriteSome(1, &data) == 1;
+	}
+
+	int64 FileStream::ReadSome(int64 bytesToRead, byte* buffer)
+	{
+		if(_fd < 0 || bytesToRead <= 0)
+			return 0;
+		if(_bufferDirty && Flush() == false)
+			return 0;
+
+		int64 totalRead = 0;
+		while(bytesToRead > 0)
+		{
+			uint64 offset = (uint64)(_position - _bufferStart);
+			if(offset < _bufferLength)
+			{
+				int64 count = _bufferLength - (int64)offset;
+				if(count > bytesToRead)
+					count = bytesToRead;
+				memcpy(buffer, _buffer + offset, (size_t)count);
+				buffer += count;
+				bytesToRead -= count;
+				totalRead += count;
+				_position += count;
+			}
+			else if(bytesToRead >= _bufferSize)
+			{
+				// Large read : skip buffer
+				int64 count = PRead(_fd, buffer, bytesToRead, _position);
+				totalRead += count;
+				_position += count;
+				break;
+			}
+			else if(FillBuffer() == false)
+			{
+				break;
+			}
+		}
+		return totalRead;
+	}
+
+	int64 FileStream::ReadLine(int64 bytesToRead, byte* buffer)
+	{
+		if(bytesToRead <= 0)
+			return -1;
+
+		int64 p = 0;
+		byte c;
+		bool anyRead = false;
+		while(p < bytesToRead - 1 && ReadByte(&c))
+		{
+			anyRead = true;
+			if(c == '\n')
+				break;
+			if(c == '\r')
+			{
+				// Consume '\n' of "\r\n"
+				byte next;
+				if(ReadByte(&next) && next != '\n')
+					MovePosition(-1);
+				break;
+			}
+			buffer[p++] = c;
+		}
+		buffer[p] = '\0';
+		return anyRead ? p : -1;
+	}
+
+	int64 FileStream::WriteSome(int64 bytesToWrite, byte* buffer)
+	{
+		if(_fd < 0 || bytesToWrite <= 0)
+			return 0;
+
+		// Written data may only be appended contiguously to dirty buffer
+		bool canAppend = _bufferDirty &&
+			_position == _bufferStart + _bufferLength &&
+			_bufferLength + bytesToWrite <= _bufferSize;
+		if(!canAppend)
+		{
+			if(Flush() == false)
+				return 0;
+			// Clean read window may be overwritten, so drop it
+			_bufferLength = 0;
+
+			if(bytesToWrite >= _bufferSize)
+			{
+				// Large write : skip buffer
+				int64 written = PWrite(_fd, buffer, bytesToWrite, _position);
+				_position += written;
+				if(_position > _length)
+					_length = _position;
+				return written;
+			}
+			_bufferStart = _position;
+			_bufferDirty = true;
+		}
+
+		memcpy(_buffer + _bufferLength, buffer, (size_t)bytesToWrite);
+		_bufferLength += (uint32)bytesToWrite;
+		_position += bytesToWrite;
+		if(_position > _length)
+			_length = _position;
+		return bytesToWrite;
+	}
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include "FixedUIntKernels.h"
+#include <atomic>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define IMGOPS_FIXEDUINT_ADX
+#endif
+
+namespace ImgOps
+{
+	struct PortableLimbOps
+	{
+		static inline void MultiplyAdd(const uint64* x, uint64 y, uint64* t, int limbs)
+		{
+			uint64 carry = 0;
+			for(int j = 0; j < limbs; ++j)
+			{
+				uint64 high;
+				uint64 low = MultiplyWide(x[j], y, &high);
+				low += carry;
+				high += low < carry ? 1 : 0;
+				t[j] += low;
+				high += t[j] < low ? 1 : 0;
+				carry = high;
+			}
+			uint64 c = 0;
+			t[limbs] = AddWithCarry(t[limbs], carry, &c);
+			t[limbs + 1] += c;
+		}
+	};
+
+	void MontgomeryMultiplyPortable(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result)
+	{
+		MontgomeryMultiplyKernel<PortableLimbOps>(a, b, n, n0Inv, limbs, result);
+	}
+
+#ifdef IMGOPS_FIXEDUINT_ADX
+	// FixedUIntAdx.cpp
+	void MontgomeryMultiplyAdx(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result);
+
+	static bool CpuSupportsMulxAdx()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if(info[0] < 7)
+			return false;
+		__cpuidex(info, 7, 0);
+		// BMI2 (mulx) - bit 8, ADX (adcx, adox) - bit 19
+		return (info[1] & (1 << 8)) != 0 && (info[1] & (1 << 19)) != 0;
+#elif defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx");
+#else
+		return false;
+#endif
+	}
+#endif
+
+	bool HasMulxAdx()
+	{
+#ifdef IMGOPS_FIXEDUINT_ADX
+		static const bool supported = CpuSupportsMulxAdx();
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	static std::atomic<bool> _mulxAdxEnabled(true);
+
+	void SetMulxAdxEnabled(bool enabled)
+	{
+		_mulxAdxEnabled = enabled;
+	}
+
+	void MontgomeryMultiply(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result)
+	{
+#ifdef IMGOPS_FIXEDUINT_ADX
+		if(HasMulxAdx() && _mulxAdxEnabled.load(std::memory_order_relaxed))
+		{
+			MontgomeryMultiplyAdx(a, b, n, n0Inv, limbs, result);
+			return;
+		}
+#endif
+		MontgomeryMultiplyPortable(a, b, n, n0Inv, limbs, result);
+	}
+}
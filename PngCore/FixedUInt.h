@@ -0,0 +1,407 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace ImgOps
+{
+	// Low 64 bits of a*b, high ones are stored in 'high'
+	inline uint64 MultiplyWide(uint64 a, uint64 b, uint64* high)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return _umul128(a, b, high);
+#elif defined(__SIZEOF_INT128__)
+		unsigned __int128 product = (unsigned __int128)a * b;
+		*high = (uint64)(product >> 64);
+		return (uint64)product;
+#else
+		uint64 aLow = (uint32)a, aHigh = a >> 32;
+		uint64 bLow = (uint32)b, bHigh = b >> 32;
+		uint64 p0 = aLow * bLow, p1 = aLow * bHigh, p2 = aHigh * bLow, p3 = aHigh * bHigh;
+		uint64 middle = (p0 >> 32) + (uint32)p1 + (uint32)p2;
+		*high = p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32);
+		return (middle << 32) | (uint32)p0;
+#endif
+	}
+
+	// a + b + carry, carry (0 or 1) is replaced with carry out
+	inline uint64 AddWithCarry(uint64 a, uint64 b, uint64* carry)
+	{
+		uint64 sum = a + b;
+		uint64 result = sum + *carry;
+		*carry = (uint64)(sum < a) | (uint64)(result < sum);
+		return result;
+	}
+
+	// a - b - borrow, borrow (0 or 1) is replaced with borrow out
+	inline uint64 SubWithBorrow(uint64 a, uint64 b, uint64* borrow)
+	{
+		uint64 diff = a - b;
+		uint64 result = diff - *borrow;
+		*borrow = (uint64)(a < b) | (uint64)(diff < *borrow);
+		return result;
+	}
+
+	// Unsigned integer of Limbs * 64 bits kept on stack (no allocations, no sign)
+	// Limbs are little-endian : Limb[0] holds lowest 64 bits
+	// Operations are modulo 2^BitCount, ones that may overflow return carry / borrow
+	template<int Limbs>
+	struct FixedUInt
+	{
+		static const int LimbCount = Limbs;
+		static const int BitCount = Limbs * 64;
+		static const int ByteCount = Limbs * 8;
+
+		uint64 Limb[Limbs];
+
+		FixedUInt() { SetZero(); }
+		explicit FixedUInt(uint64 value) { SetZero(); Limb[0] = value; }
+
+		void SetZero()
+		{
+			for(int i = 0; i < Limbs; ++i)
+				Limb[i] = 0;
+		}
+
+		bool IsZero() const
+		{
+			uint64 bits = 0;
+			for(int i = 0; i < Limbs; ++i)
+				bits |= Limb[i];
+			return bits == 0;
+		}
+
+		bool IsOdd() const { return (Limb[0] & 1) != 0; }
+
+		bool Bit(int index) const { return ((Limb[index >> 6] >> (index & 63)) & 1) != 0; }
+
+		void SetBit(int index) { Limb[index >> 6] |= (uint64)1 << (index & 63); }
+
+		// Number of significant bits (0 for zero)
+		int BitLength() const
+		{
+			for(int i = Limbs - 1; i >= 0; --i)
+			{
+				if(Limb[i] != 0)
+				{
+					int bits = 64;
+					while(((Limb[i] >> (bits - 1)) & 1) == 0)
+						--bits;
+					return i * 64 + bits;
+				}
+			}
+			return 0;
+		}
+
+		// -1, 0 or 1
+		static int Compare(const FixedUInt& a, const FixedUInt& b)
+		{
+			for(int i = Limbs - 1; i >= 0; --i)
+			{
+				if(a.Limb[i] != b.Limb[i])
+					return a.Limb[i] < b.Limb[i] ? -1 : 1;
+			}
+			return 0;
+		}
+
+		bool operator==(const FixedUInt& b) const { return Compare(*this, b) == 0; }
+		bool operator!=(const FixedUInt& b) const { return Compare(*this, b) != 0; }
+		bool operator<(const FixedUInt& b) const { return Compare(*this, b) < 0; }
+		bool operator>=(const FixedUInt& b) const { return Compare(*this, b) >= 0; }
+
+		// this += b, returns carry
+		uint64 Add(const FixedUInt& b)
+		{
+			uint64 carry = 0;
+			for(int i = 0; i < Limbs; ++i)
+				Limb[i] = AddWithCarry(Limb[i], b.Limb[i], &carry);
+			return carry;
+		}
+
+		// this -= b, returns borrow
+		uint64 Sub(const FixedUInt& b)
+		{
+			uint64 borrow = 0;
+			for(int i = 0; i < Limbs; ++i)
+				Limb[i] = SubWithBorrow(Limb[i], b.Limb[i], &borrow);
+			return borrow;
+		}
+
+		// this += value, returns carry
+		uint64 AddSmall(uint64 value)
+		{
+			uint64 carry = value;
+			for(int i = 0; i < Limbs && carry != 0; ++i)
+			{
+				Limb[i] += carry;
+				carry = Limb[i] < carry ? 1 : 0;
+			}
+			return carry;
+		}
+
+		// this -= value, returns borrow
+		uint64 SubSmall(uint64 value)
+		{
+			uint64 borrow = value;
+			for(int i = 0; i < Limbs && borrow != 0; ++i)
+			{
+				uint64 old = Limb[i];
+				Limb[i] -= borrow;
+				borrow = old < borrow ? 1 : 0;
+			}
+			return borrow;
+		}
+
+		// Shifts left by one bit, returns shifted out bit
+		uint64 ShiftLeft1()
+		{
+			uint64 carry = 0;
+			for(int i = 0; i < Limbs; ++i)
+			{
+				uint64 next = Limb[i] >> 63;
+				Limb[i] = (Limb[i] << 1) | carry;
+				carry = next;
+			}
+			return carry;
+		}
+
+		void ShiftRight(int bits)
+		{
+			int limbShift = bits >> 6;
+			int bitShift = bits & 63;
+			for(int i = 0; i < Limbs; ++i)
+			{
+				int src = i + limbShift;
+				uint64 low = src < Limbs ? Limb[src] : 0;
+				uint64 high = src + 1 < Limbs ? Limb[src + 1] : 0;
+				Limb[i] = bitShift == 0 ? low : (low >> bitShift) | (high << (64 - bitShift));
+			}
+		}
+
+		// this mod divisor (divisor < 2^32)
+		uint32 ModSmall(uint32 divisor) const
+		{
+			uint64 rem = 0;
+			for(int i = Limbs - 1; i >= 0; --i)
+			{
+				rem = ((rem << 32) | (Limb[i] >> 32)) % divisor;
+				rem = ((rem << 32) | (Limb[i] & 0xFFFFFFFF)) % divisor;
+			}
+			return (uint32)rem;
+		}
+
+		// Reads 'length' little-endian bytes (missing bytes are zero, ones over ByteCount are ignored)
+		void FromBytes(const byte* bytes, uint32 length)
+		{
+			SetZero();
+			uint32 count = length < (uint32)ByteCount ? length : (uint32)ByteCount;
+			for(uint32 i = 0; i < count; ++i)
+				Limb[i >> 3] |= (uint64)bytes[i] << (8 * (i & 7));
+		}
+
+		// Writes 'length' little-endian bytes (zeros over ByteCount)
+		void ToBytes(byte* bytes, uint32 length) const
+		{
+			for(uint32 i = 0; i < length; ++i)
+				bytes[i] = i < (uint32)ByteCount ? (byte)(Limb[i >> 3] >> (8 * (i & 7))) : 0;
+		}
+
+		// 'a' where mask has all bits set, 'b' where it is zero (without branches)
+		static FixedUInt Select(uint64 mask, const FixedUInt& a, const FixedUInt& b)
+		{
+			FixedUInt result;
+			for(int i = 0; i < Limbs; ++i)
+				result.Limb[i] = (a.Limb[i] & mask) | (b.Limb[i] & ~mask);
+			return result;
+		}
+
+		// Copy of lower or zero-extended limbs of number of other size
+		template<int OtherLimbs>
+		static FixedUInt Resize(const FixedUInt<OtherLimbs>& other)
+		{
+			FixedUInt result;
+			for(int i = 0; i < Limbs && i < OtherLimbs; ++i)
+				result.Limb[i] = other.Limb[i];
+			return result;
+		}
+	};
+
+	// Full product a * b (schoolbook)
+	template<int Limbs>
+	FixedUInt<2 * Limbs> MultiplyFull(const FixedUInt<Limbs>& a, const FixedUInt<Limbs>& b)
+	{
+		FixedUInt<2 * Limbs> result;
+		for(int i = 0; i < Limbs; ++i)
+		{
+			uint64 carry = 0;
+			for(int j = 0; j < Limbs; ++j)
+			{
+				uint64 high;
+				uint64 low = MultiplyWide(a.Limb[j], b.Limb[i], &high);
+				low += carry;
+				high += low < carry ? 1 : 0;
+				uint64 cell = result.Limb[i + j] + low;
+				high += cell < low ? 1 : 0;
+				result.Limb[i + j] = cell;
+				carry = high;
+			}
+			result.Limb[i + Limbs] = carry;
+		}
+		return result;
+	}
+
+	// Montgomery multiplication kernels (CIOS) on raw limbs : result = a*b*2^(-64*limbs) mod n
+	// Inputs must be < n, 'n0Inv' = -n^-1 mod 2^64, limbs <= MaxMontgomeryLimbs
+	// Run time does not depend on values (final subtraction is masked), so it is safe for secret data
+	// Uses mulx / adcx / adox version if cpu supports BMI2 and ADX (see HasMulxAdx())
+	static const int MaxMontgomeryLimbs = 64;
+	void MontgomeryMultiply(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result);
+	void MontgomeryMultiplyPortable(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result);
+	bool HasMulxAdx();
+	// Disables mulx / adx kernel (i.e. for comparisons), it is used only if supported anyway
+	void SetMulxAdxEnabled(bool enabled);
+
+	// Montgomery arithmetic for odd modulus n with R = 2^BitCount
+	// Object does not change after construction, so it may be shared by threads
+	template<int Limbs>
+	class FixedMontgomery
+	{
+	public:
+		typedef FixedUInt<Limbs> UInt;
+
+	protected:
+		UInt _n;
+		uint64 _n0Inv; // -n^-1 mod 2^64
+		UInt _one; // R mod n
+		UInt _r2; // R^2 mod n
+
+	public:
+		// 'modulus' must be odd
+		FixedMontgomery(const UInt& modulus)
+		{
+			static_assert(Limbs <= MaxMontgomeryLimbs, "FixedMontgomery : too many limbs");
+			_n = modulus;
+
+			// n^-1 mod 2^64 with Newton's method, each step doubles number of correct bits (n is its own inverse on 3 bits)
+			uint64 inv = modulus.Limb[0];
+			for(int i = 0; i < 5; ++i)
+				inv *= 2 - modulus.Limb[0] * inv;
+			_n0Inv = (uint64)0 - inv;
+
+			// R mod n and R^2 mod n by doubling 1 (no division needed)
+			UInt x(1);
+			for(int i = 0; i < 2 * UInt::BitCount; ++i)
+			{
+				uint64 carry = x.ShiftLeft1();
+				if(carry != 0 || x >= _n)
+					x.Sub(_n);
+				if(i == UInt::BitCount - 1)
+					_one = x;
+			}
+			_r2 = x;
+		}
+
+		const UInt& Modulus() const { return _n; }
+		// 1 in Montgomery form
+		const UInt& One() const { return _one; }
+
+		// aR, bR -> abR mod n
+		void Multiply(const UInt& a, const UInt& b, UInt* result) const
+		{
+			MontgomeryMultiply(a.Limb, b.Limb, _n.Limb, _n0Inv, Limbs, result->Limb);
+		}
+
+		UInt Multiply(const UInt& a, const UInt& b) const
+		{
+			UInt result;
+			Multiply(a, b, &result);
+			return result;
+		}
+
+		// a -> aR mod n (a < n, or a < R if only used as multiplier by R^2)
+		UInt ToMontgomery(const UInt& a) const { return Multiply(a, _r2); }
+		// aR -> a mod n
+		UInt FromMontgomery(const UInt& a) const { return Multiply(a, UInt(1)); }
+
+		// a mod n for any a < R, assuming n >= R/2 (top bit set), so one subtraction is enough
+		UInt Reduce(const UInt& a) const
+		{
+			UInt diff = a;
+			uint64 mask = diff.Sub(_n) - 1; // All ones if a >= n
+			return UInt::Select(mask, diff, a);
+		}
+
+		// a + b mod n (a, b < n)
+		UInt Add(const UInt& a, const UInt& b) const
+		{
+			UInt sum = a;
+			uint64 carry = sum.Add(b);
+			UInt diff = sum;
+			uint64 borrow = diff.Sub(_n);
+			return UInt::Select((uint64)0 - ((carry | (borrow ^ 1)) & 1), diff, sum);
+		}
+
+		// a - b mod n (a, b < n)
+		UInt Sub(const UInt& a, const UInt& b) const
+		{
+			UInt diff = a;
+			uint64 borrow = diff.Sub(b);
+			UInt wrapped = diff;
+			wrapped.Add(_n);
+			return UInt::Select((uint64)0 - borrow, wrapped, diff);
+		}
+
+		// base^e mod n (normal numbers, base < n)
+		// Constant time for secret exponents : fixed 5-bit windows over all bits of modulus (or 'e' if it is longer),
+		// multiplication in each window and table entries selected by masks (all entries are read)
+		UInt Power(const UInt& base, const UInt& e) const
+		{
+			static const int Window = 5;
+			int bits = _n.BitLength();
+			int eBits = e.BitLength();
+			bits = eBits > bits ? eBits : bits;
+
+			UInt table[1 << Window];
+			table[0] = _one;
+			table[1] = ToMontgomery(base);
+			for(int i = 2; i < (1 << Window); ++i)
+				Multiply(table[i - 1], table[1], &table[i]);
+
+			UInt res = _one;
+			UInt entry;
+			for(int bit = ((bits + Window - 1) / Window - 1) * Window; bit >= 0; bit -= Window)
+			{
+				for(int i = 0; i < Window; ++i)
+					Multiply(res, res, &res);
+
+				uint32 value = 0;
+				for(int i = Window - 1; i >= 0; --i)
+					value = (value << 1) | (bit + i < UInt::BitCount && e.Bit(bit + i) ? 1 : 0);
+
+				entry.SetZero();
+				for(uint32 t = 0; t < (1u << Window); ++t)
+					entry = UInt::Select((uint64)0 - (uint64)(t == value), table[t], entry);
+				Multiply(res, entry, &res);
+			}
+			return FromMontgomery(res);
+		}
+
+		// base^e mod n for public exponents ('left-to-right binary method' up to highest bit of 'e')
+		UInt PowerPublic(const UInt& base, const UInt& e) const
+		{
+			UInt b = ToMontgomery(base);
+			UInt res = _one;
+			for(int i = e.BitLength() - 1; i >= 0; --i)
+			{
+				Multiply(res, res, &res);
+				if(e.Bit(i))
+					Multiply(res, b, &res);
+			}
+			return FromMontgomery(res);
+		}
+	};
+}
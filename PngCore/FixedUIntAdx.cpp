@@ -0,0 +1,74 @@
+// mulx / adcx / adox Montgomery kernel, used only after runtime check of cpu (see FixedUInt.cpp)
+// Whole file is compiled for BMI2 + ADX (MSVC accepts these intrinsics without options)
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+#if defined(__GNUC__) && !(defined(__BMI2__) && defined(__ADX__))
+#pragma GCC target("bmi2,adx")
+#endif
+
+#include "FixedUIntKernels.h"
+#include <immintrin.h>
+
+namespace ImgOps
+{
+	struct AdxLimbOps
+	{
+		// Two independent carry chains : low halves of products go to t[j] (adcx - CF),
+		// high halves to t[j+1] (adox - OF), so additions of both halves do not wait for each other
+		static inline void MultiplyAdd(const uint64* x, uint64 y, uint64* t, int limbs)
+		{
+#if defined(__GNUC__)
+			// Compilers do not keep two flag chains for intrinsics, so loop is written in assembly
+			// (only lea and jrcxz are used between additions, they do not change flags)
+			uint64 count = (uint64)limbs;
+			uint64 low, high, zero;
+			__asm__ volatile(
+				"xorl %k[zero], %k[zero]\n\t" // Clears CF and OF
+				"1:\n\t"
+				"mulxq (%[x]), %[low], %[high]\n\t"
+				"adcxq (%[t]), %[low]\n\t"
+				"movq %[low], (%[t])\n\t"
+				"adoxq 8(%[t]), %[high]\n\t"
+				"movq %[high], 8(%[t])\n\t"
+				"leaq 8(%[x]), %[x]\n\t"
+				"leaq 8(%[t]), %[t]\n\t"
+				"leaq -1(%[count]), %[count]\n\t"
+				"jrcxz 2f\n\t"
+				"jmp 1b\n\t"
+				"2:\n\t"
+				// CF goes to t[limbs], then OF and new CF to t[limbs+1]
+				"movq (%[t]), %[low]\n\t"
+				"adcxq %[zero], %[low]\n\t"
+				"movq %[low], (%[t])\n\t"
+				"movq 8(%[t]), %[high]\n\t"
+				"adoxq %[zero], %[high]\n\t"
+				"adcxq %[zero], %[high]\n\t"
+				"movq %[high], 8(%[t])\n\t"
+				: [x] "+r" (x), [t] "+r" (t), [count] "+c" (count), [low] "=&r" (low), [high] "=&r" (high), [zero] "=&r" (zero)
+				: "d" (y)
+				: "cc", "memory");
+#else
+			unsigned char carryLow = 0;
+			unsigned char carryHigh = 0;
+			unsigned long long* tt = (unsigned long long*)t;
+			for(int j = 0; j < limbs; ++j)
+			{
+				unsigned long long high;
+				unsigned long long low = _mulx_u64(x[j], y, &high);
+				carryLow = _addcarryx_u64(carryLow, tt[j], low, &tt[j]);
+				carryHigh = _addcarryx_u64(carryHigh, tt[j + 1], high, &tt[j + 1]);
+			}
+			carryLow = _addcarryx_u64(carryLow, tt[limbs], 0, &tt[limbs]);
+			t[limbs + 1] += (uint64)carryLow + carryHigh;
+#endif
+		}
+	};
+
+	void MontgomeryMultiplyAdx(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result)
+	{
+		MontgomeryMultiplyKernel<AdxLimbOps>(a, b, n, n0Inv, limbs, result);
+	}
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+// Internal header : Montgomery multiplication kernel written once for generic limb operations
+// Included by FixedUInt.cpp (portable operations) and FixedUIntAdx.cpp (compiled for BMI2 + ADX),
+// so kernel has internal linkage and each file keeps its own instantiation
+
+#include "FixedUInt.h"
+
+namespace ImgOps
+{
+	// CIOS (Coarsely Integrated Operand Scanning) : for each limb of b t = (t + a*b[i] + m*n) / 2^64,
+	// where m = t[0] * n0Inv makes lowest limb zero. For a, b < n result is < 2n, so it ends with
+	// one masked subtraction. 'Ops::MultiplyAdd(x, y, t, limbs)' adds x * y to t[0..limbs+1]
+	template<class Ops>
+	static inline void MontgomeryMultiplyKernel(const uint64* a, const uint64* b, const uint64* n, uint64 n0Inv, int limbs, uint64* result)
+	{
+		uint64 t[MaxMontgomeryLimbs + 2];
+		for(int i = 0; i < limbs + 2; ++i)
+			t[i] = 0;
+
+		for(int i = 0; i < limbs; ++i)
+		{
+			Ops::MultiplyAdd(a, b[i], t, limbs);
+			uint64 m = t[0] * n0Inv;
+			Ops::MultiplyAdd(n, m, t, limbs);
+			for(int j = 0; j <= limbs; ++j)
+				t[j] = t[j + 1];
+			t[limbs + 1] = 0;
+		}
+
+		// t >= n if highest limb is set or subtraction does not borrow
+		uint64 diff[MaxMontgomeryLimbs];
+		uint64 borrow = 0;
+		for(int j = 0; j < limbs; ++j)
+			diff[j] = SubWithBorrow(t[j], n[j], &borrow);
+		uint64 mask = (uint64)0 - ((t[limbs] | (borrow ^ 1)) & 1);
+		for(int j = 0; j < limbs; ++j)
+			result[j] = (t[j] & ~mask) | (diff[j] & mask);
+	}
+}
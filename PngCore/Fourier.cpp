@@ -1,103 +1,197 @@
 #include "Fourier.h"
 #include "Image.h"
+#include "PixelConverter.h"
+#include "TiledImage.h"
+#include "FftPlan.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMGOPS_FOURIER_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace ImgOps
 {
 	namespace Fourier
 	{
-		double PixelValue_Gray(Image* image, int row, int col)
+		// Thread count set by SetThreadCount() : 0 - shared default pool, 1 - no threading, other - own pool
+		static int _threadCount = 0;
+		static ThreadPool* _ownPool = NULL;
+
+		void SetThreadCount(int threads)
 		{
-			return ((double)*image->Pixel(row, col)) / 255.0;
+			if(threads < 0)
+				threads = 0;
+			if(threads == _threadCount)
+				return;
+
+			delete _ownPool;
+			_ownPool = threads > 1 ? new ThreadPool(threads) : NULL;
+			_threadCount = threads;
 		}
 
-		double PixelValue_Color(Image* image, int row, int col)
+		int GetThreadCount()
 		{
-			byte* pixel = image->Pixel(row, col);
-			return ((double)((int)pixel[0] + (int)pixel[1] + (int)pixel[2])) / 765.0;
+			if(_threadCount == 0)
+				return ThreadPool::Default()->ThreadCount();
+			return _threadCount;
 		}
 
-		int _channel;
-		double PixelValue_Channel(Image* image, int row, int col)
+		void ParallelFor(int count, const ThreadPool::RangeTask& task, int minRange)
 		{
-			return ((double)*image->Pixel(row, col, _channel)) / 2555.0;
+			ThreadPool* pool = _threadCount == 0 ? ThreadPool::Default() : _ownPool;
+			if(pool == NULL)
+				task(0, count);
+			else
+				pool->ParallelFor(count, task, minRange);
 		}
 
-		FourierData* FourierTransform(Image* image, int channel)
+		// Rows / columns per task so each task handles at least 32k values
+		static int MinLinesPerTask(int lineLength)
 		{
-			// 1) Create fourier array : dimensions of image must be powers of 2, so if they are not, we have somes options:
-			// a) down-scale image to nearest power of 2
-			// b) up-scale image to nearest power of 2
-			// c) crop image preserving center
-			// d) place image on center of bigger black image
-			// For now lets do option d)
+			int lines = 32768 / (lineLength > 0 ? lineLength : 1);
+			return lines > 1 ? lines : 1;
+		}
 
-			// 1.1) Check if height is power of 2
+		// Returns smallest power of 2 not less than 'size'
+		uint32 NextPowerOf2(uint32 size)
+		{
 			// Starting from MSB save first set bit (high_bit) and check if there is more than one
 			// If there is more, its not power of 2
 			// Next bigger pow2 is number with bit (high_bit+1) set
-			uint32 height = image->Height();
 			int highBit = -1;
 			int bitsSet = 0;
 			for(int bit = 0; bit < 32; ++bit)
 			{
-				if( ((height >> bit) & 1) == 1 )
+				if( ((size >> bit) & 1) == 1 )
 				{
-					// Height have 'bit' bit set and it higher than previous highest
+					// Size have 'bit' bit set and it higher than previous highest
 					highBit = bit;
 					++bitsSet;
 				}
 			}
+			return bitsSet > 1 ? 1 << (highBit + 1) : size;
+		}
+
+		static void GetPaddedSize(uint32 width, uint32 height, bool padToPowerOf2,
+			uint32* newWidth, uint32* newHeight, uint32* left, uint32* top)
+		{
+			// FFT2D handles any size, but power of 2 may still be requested :
+			// then image is placed on center of bigger black image
+			*newHeight = padToPowerOf2 ? NextPowerOf2(height) : height;
+			*newWidth = padToPowerOf2 ? NextPowerOf2(width) : width;
 
-			uint32 newHeight = height;
-			if(bitsSet > 1)
+			// Compute top-left of original image
+			*left = (*newWidth - width) / 2;
+			*top = (*newHeight - height) / 2;
+		}
+
+		FourierData* CreatePaddedFourierData(uint32 width, uint32 height, bool padToPowerOf2, uint32* left, uint32* top)
+		{
+			uint32 newWidth, newHeight;
+			GetPaddedSize(width, height, padToPowerOf2, &newWidth, &newHeight, left, top);
+			FourierData* fourier = new FourierData(newWidth, newHeight, true);
+			fourier->ImageLeft = *left;
+			fourier->ImageTop = *top;
+			fourier->ImageWidth = width;
+			fourier->ImageHeight = height;
+			return fourier;
+		}
+
+		// Transforms real rows of 'count' spectra of the same size in place in one batch
+		// Single precision transform also runs in place : ComplexF row 'r' takes first half of bytes of Complex row 'r',
+		// so real rows are narrowed from first row and results are widened from last one (rows are moved through
+		// caller scratch, so nothing is overwritten before it is read)
+		static bool TransformRealData(FourierData* const* spectra, int count, TransformPrecision precision)
+		{
+			uint32 width = spectra[0]->Width;
+			uint32 height = spectra[0]->Height;
+			uint32 columns = spectra[0]->Columns;
+			if(precision == TransformPrecision::Double)
 			{
-				// Height is not power of 2
-				newHeight = 1 << (highBit + 1);
+				Complex** arrays = (Complex**)malloc(count * sizeof(Complex*));
+				for(int i = 0; i < count; ++i)
+					arrays[i] = spectra[i]->Data;
+				bool ok = RealFFT2DBatch(arrays, count, width, height);
+				free(arrays);
+				return ok;
 			}
 
-			// 1.2) Same with width
-			uint32 width = image->Width();
-			highBit = -1;
-			bitsSet = 0;
-			for(int bit = 0; bit < 32; ++bit)
+			float* rowBuffer = FftPlanF::ThreadScratch(FftPlanF::CallerScratch, 2 * columns);
+			if(rowBuffer == NULL)
+				return false;
+
+			ComplexF** data = (ComplexF**)malloc(count * sizeof(ComplexF*));
+			for(int i = 0; i < count; ++i)
 			{
-				if( ((width >> bit) & 1) == 1 )
+				data[i] = (ComplexF*)spectra[i]->Data;
+				for(uint32 row = 0; row < height; ++row)
 				{
-					// Height have 'bit' bit set and it higher than previous highest
-					highBit = bit;
-					++bitsSet;
+					const double* src = spectra[i]->RealRow(row);
+					for(uint32 col = 0; col < width; ++col)
+						rowBuffer[col] = (float)src[col];
+					memcpy(data[i] + row * columns, rowBuffer, width * sizeof(float));
 				}
 			}
 
-			uint32 newWidth = width;
-			if(bitsSet > 1)
-				newWidth = 1 << (highBit + 1);
-
-			// Compute top-left of original image
-			uint32 left = (newWidth - width) / 2;
-			uint32 top = (newHeight - height) / 2;
-
-			uint32 imgSize = newHeight * newWidth;
-			FourierData* fourier = new FourierData(newWidth, newHeight);
+			bool ok = RealFFT2DBatch(data, count, width, height);
+			for(int i = 0; ok && i < count; ++i)
+			{
+				for(uint32 row = height; row > 0; --row)
+				{
+					memcpy(rowBuffer, data[i] + (row - 1) * columns, columns * sizeof(ComplexF));
+					Complex* dst = spectra[i]->Data + (row - 1) * columns;
+					for(uint32 col = 0; col < columns; ++col)
+					{
+						dst[col].Real = rowBuffer[2 * col];
+						dst[col].Imag = rowBuffer[2 * col + 1];
+					}
+				}
+			}
+			free(data);
+			return ok;
+		}
 
-			// Set correct pixel-value getter based on pixformat and desired channel
-			_channel = channel;
-			auto pixelValue = channel < 0 ? 
-				((image->PixFormat() & PixelFormats::TrueColor) != 0 ? PixelValue_Color : PixelValue_Gray)
-				: PixelValue_Channel;
+		// Fills real rows of 'fourier' with image intensities placed at (left, top), rest is zeroed
+		static void FillRealRows(Image* image, FourierData* fourier, uint32 left, uint32 top, int channel)
+		{
+			// Convert whole rows to intensities at once (floating point images are read directly)
+			// Scratch of transforms is free untill transform starts and table is shared, so nothing is allocated
+			const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+			int channels = PixelFormats::GetChannels(image->PixFormat());
+			float* rowBuffer = FftPlanF::ThreadScratch(FftPlanF::CallerScratch, image->Width() * (channels + 1));
+			float* intensity = rowBuffer + image->Width() * channels;
 
 			// Fill array with image info
-			for(int row = 0; row < image->Height(); ++row)
+			for(uint32 row = 0; row < fourier->Height; ++row)
 			{
-				int frow = row + top;
+				double* frow = fourier->RealRow(row);
+				if(row < top || row >= top + image->Height())
+				{
+					memset(frow, 0, fourier->Width * sizeof(double));
+					continue;
+				}
+
+				PixelConverter::ExtractIntensityRow(image, row - top, channel, table, rowBuffer, intensity);
+				memset(frow, 0, left * sizeof(double));
 				for(int col = 0; col < image->Width(); ++col)
 				{
-					int fcol = col + left;
-					fourier->GetCell(frow, fcol)->Real = pixelValue(image, row, col);
+					frow[left + col] = intensity[col];
 				}
+				memset(frow + left + image->Width(), 0, (fourier->Width - left - image->Width()) * sizeof(double));
 			}
+		}
+
+		FourierData* FourierTransform(Image* image, int channel, bool padToPowerOf2, TransformPrecision precision)
+		{
+			uint32 left, top;
+			FourierData* fourier = CreatePaddedFourierData(image->Width(), image->Height(), padToPowerOf2, &left, &top);
+			FillRealRows(image, fourier, left, top, channel);
 
-			if( FFT2D(fourier->Data, newWidth, newHeight, TransfromDirection::Forward) == false )
+			if( TransformRealData(&fourier, 1, precision) == false )
 			{
 				delete fourier;
 				return NULL;
@@ -106,99 +200,509 @@ namespace ImgOps
 			return fourier;
 		}
 
-		inline byte GetMagnitudeByte(FourierData* fourier, 
-			int row, int col, double magScale, double logScale, bool scaleLog)
+		bool FourierTransform(Image* image, FourierData* fourier, int channel)
+		{
+			if(fourier->HalfSpectrum == false || image->PixFormat() == PixelFormats::Indexed ||
+				fourier->Width < (uint32)image->Width() || fourier->Height < (uint32)image->Height())
+				return false;
+
+			fourier->ImageLeft = (fourier->Width - image->Width()) / 2;
+			fourier->ImageTop = (fourier->Height - image->Height()) / 2;
+			fourier->ImageWidth = image->Width();
+			fourier->ImageHeight = image->Height();
+			FillRealRows(image, fourier, fourier->ImageLeft, fourier->ImageTop, channel);
+			return RealFFT2D(fourier->Data, fourier->Width, fourier->Height);
+		}
+
+		bool InverseTransform(FourierData* fourier)
 		{
-			Complex* f = fourier->GetCell(row, col);
-			double mag = sqrt(f->Real * f->Real + f->Imag * f->Imag) * magScale;
-			mag = scaleLog ? (log(mag + 1.0)) * logScale : mag;
-			return (byte)((int)(mag * 255.0));
+			if(fourier->HalfSpectrum)
+				return RealInverseFFT2D(fourier->Data, fourier->Width, fourier->Height);
+			return FFT2D(fourier->Data, fourier->Width, fourier->Height, TransfromDirection::Inverse);
 		}
 
-		Image* GetMagnitudeImage(FourierData* fourier, bool scaleLog)
+		bool InverseTransform(FourierData* fourier, Image* result)
 		{
-			// Magintude : M(y,x) = sqrt(F(y,x).R^2 + F(y,x).I^2)
-			Image* image = new Image(fourier->Width, fourier->Height, PixelFormats::Gray8);
+			PixelFormat format = result->PixFormat();
+			if((format != PixelFormats::Gray8 && format != PixelFormats::GrayFloat32) ||
+				(uint32)result->Width() != fourier->ImageWidth || (uint32)result->Height() != fourier->ImageHeight)
+				return false;
+			if(InverseTransform(fourier) == false)
+				return false;
 
-			int fsize = fourier->Height * fourier->Width;
-			Complex* f;
-			double maxMag = 0.0;
-			double mag;
-			for(int i = 0; i < fsize; ++i)
+			// Real values are either packed rows (half spectrum) or real parts of cells
+			int step = fourier->HalfSpectrum ? 1 : 2;
+			ParallelFor(result->Height(), [&](int begin, int end)
 			{
-				f = &fourier->Data[i];
-				mag = f->Real * f->Real + f->Imag * f->Imag;
-				maxMag = maxMag < mag ? mag : maxMag;
-			}
+				for(int row = begin; row < end; ++row)
+				{
+					const double* src = fourier->RealRow(row + fourier->ImageTop) + fourier->ImageLeft * step;
+					if(format == PixelFormats::GrayFloat32)
+					{
+						float* dst = result->FloatRow(row);
+						for(int col = 0; col < result->Width(); ++col)
+							dst[col] = (float)src[col * step];
+					}
+					else
+					{
+						byte* dst = result->Row(row);
+						for(int col = 0; col < result->Width(); ++col)
+						{
+							double v = src[col * step];
+							v = v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+							dst[col] = (byte)(v * 255.0 + 0.5);
+						}
+					}
+				}
+			}, MinLinesPerTask(result->Width()));
+			return true;
+		}
 
-			double scale = 1.0 / sqrt(maxMag);
-			double logScale = 1.0 / log(2.0);
-			// We need to translate fourier image so that bias (fourier(0,0)) is on image center
-			// So lets divide image to four parts :
-			// TopLeft will be shifted by (+width/2, +height/2)
-			// TopRight will be shifted by (-width/2, +height/2)
-			// BotLeft will be shifted by (+width/2, -height/2)
-			// BotRight will be shifted by (-width/2, -height/2)
-			int h2 = image->Height() / 2;
-			int w2 = image->Width() / 2;
-
-			// TOP LEFT
-			for(int row = 0; row < h2; ++row)
-				for(int col = 0; col < w2; ++col)
-					image->Pixel(row + h2, col + w2)[0] = 
-					GetMagnitudeByte(fourier, row, col, scale, logScale, scaleLog);
-			// Top Right
-			for(int row = 0; row < h2; ++row)
-				for(int col = w2; col < image->Width(); ++col)
-					image->Pixel(row + h2, col - w2)[0] = 
-					GetMagnitudeByte(fourier, row, col, scale, logScale, scaleLog);
-			// Bot Left
-			for(int row = h2; row < image->Height(); ++row)
-				for(int col = 0; col < w2; ++col)
-					image->Pixel(row - h2, col + w2)[0] = 
-					GetMagnitudeByte(fourier, row, col, scale, logScale, scaleLog);
-			// Bot Right
-			for(int row = h2; row < image->Height(); ++row)
-				for(int col = w2; col < image->Width(); ++col)
-					image->Pixel(row - h2, col - w2)[0] = 
-					GetMagnitudeByte(fourier, row, col, scale, logScale, scaleLog);
+		Image* RetrieveImage(FourierData* fourier)
+		{
+			FourierData copy(fourier->Width, fourier->Height, fourier->HalfSpectrum);
+			memcpy(copy.Data, fourier->Data, fourier->Columns * fourier->Height * sizeof(Complex));
+			copy.ImageLeft = fourier->ImageLeft;
+			copy.ImageTop = fourier->ImageTop;
+			copy.ImageWidth = fourier->ImageWidth;
+			copy.ImageHeight = fourier->ImageHeight;
 
+			Image* image = new Image(fourier->ImageWidth, fourier->ImageHeight, PixelFormats::Gray8);
+			if(InverseTransform(&copy, image) == false)
+			{
+				delete image;
+				return NULL;
+			}
 			return image;
 		}
 
+		FourierData* FourierTransform(TiledImage* image, int channel, bool padToPowerOf2, TransformPrecision precision)
+		{
+			uint32 left, top;
+			FourierData* fourier = CreatePaddedFourierData(image->Width(), image->Height(), padToPowerOf2, &left, &top);
+
+			const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+			float* rowBuffer = (float*)malloc(TiledImage::TileSize * PixelFormats::GetChannels(image->PixFormat()) * sizeof(float));
+			float* intensity = (float*)malloc(TiledImage::TileSize * sizeof(float));
 
-		inline byte GetPhaseByte(FourierData* fourier, int row, int col)
+			// Fill array tile by tile, so each tile is loaded only once
+			for(int tileY = 0; tileY < image->TilesY(); ++tileY)
+			{
+				for(int tileX = 0; tileX < image->TilesX(); ++tileX)
+				{
+					const byte* tile = image->TileForRead(tileX, tileY);
+					if(tile == NULL) // Never written tile is black
+						continue;
+
+					int tileWidth = image->TileWidth(tileX);
+					for(int row = 0; row < image->TileHeight(tileY); ++row)
+					{
+						PixelConverter::ExtractIntensity(image->PixFormat(), tile + row * image->TileStride(),
+							tileWidth, channel, table, rowBuffer, intensity);
+						double* frow = fourier->RealRow(tileY * TiledImage::TileSize + row + top) +
+							tileX * TiledImage::TileSize + left;
+						for(int col = 0; col < tileWidth; ++col)
+						{
+							frow[col] = intensity[col];
+						}
+					}
+				}
+			}
+			free(rowBuffer);
+			free(intensity);
+
+			if( TransformRealData(&fourier, 1, precision) == false )
+			{
+				delete fourier;
+				return NULL;
+			}
+
+			return fourier;
+		}
+
+		FourierBatch* FourierTransformChannels(Image* image, bool withAlpha, bool padToPowerOf2, TransformPrecision precision)
+		{
+			PixelFormat format = image->PixFormat();
+			if(format == PixelFormats::Indexed)
+				return NULL;
+
+			// Alpha is always last channel, so first 'count' channels are transformed
+			int count = (format & PixelFormats::TrueColor) != 0 ? 3 : 1;
+			if(withAlpha && (format & PixelFormats::HaveAlphaChannel) != 0)
+				++count;
+
+			uint32 newWidth, newHeight, left, top;
+			GetPaddedSize(image->Width(), image->Height(), padToPowerOf2, &newWidth, &newHeight, &left, &top);
+			FourierBatch* batch = new FourierBatch(count, newWidth, newHeight);
+
+			const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+			float* rowBuffer = (float*)malloc(image->Width() * PixelFormats::GetChannels(format) * sizeof(float));
+			float* samples = (float*)malloc(count * image->Width() * sizeof(float));
+			float* channels[4];
+			for(int c = 0; c < count; ++c)
+				channels[c] = samples + c * image->Width();
+
+			// Each row is converted once for all channels
+			for(int row = 0; row < image->Height(); ++row)
+			{
+				PixelConverter::ExtractChannels(format, image->Row(row), image->Width(), count, table, rowBuffer, channels);
+				for(int c = 0; c < count; ++c)
+				{
+					double* frow = batch->Spectra[c]->RealRow(row + top) + left;
+					for(int col = 0; col < image->Width(); ++col)
+						frow[col] = channels[c][col];
+				}
+			}
+			free(rowBuffer);
+			free(samples);
+
+			if( TransformRealData(batch->Spectra, count, precision) == false )
+			{
+				delete batch;
+				return NULL;
+			}
+			return batch;
+		}
+
+		FourierBatch* FourierTransformStack(Image** images, int count, int channel, bool padToPowerOf2, TransformPrecision precision)
+		{
+			if(count < 1)
+				return NULL;
+			int width = images[0]->Width();
+			int height = images[0]->Height();
+			int maxChannels = 0;
+			for(int i = 0; i < count; ++i)
+			{
+				if(images[i]->Width() != width || images[i]->Height() != height || images[i]->PixFormat() == PixelFormats::Indexed)
+					return NULL;
+				int channels = PixelFormats::GetChannels(images[i]->PixFormat());
+				maxChannels = channels > maxChannels ? channels : maxChannels;
+			}
+
+			uint32 newWidth, newHeight, left, top;
+			GetPaddedSize(width, height, padToPowerOf2, &newWidth, &newHeight, &left, &top);
+			FourierBatch* batch = new FourierBatch(count, newWidth, newHeight);
+
+			float* rowBuffer = (float*)malloc(width * maxChannels * sizeof(float));
+			float* intensity = (float*)malloc(width * sizeof(float));
+			for(int i = 0; i < count; ++i)
+			{
+				Image* image = images[i];
+				const PixelConverter::SampleToFloatTable& table = PixelConverter::LinearSampleTable(image->IsFloatingPoint() ? 8 : image->ChannelSize() * 8);
+				for(int row = 0; row < height; ++row)
+				{
+					PixelConverter::ExtractIntensityRow(image, row, channel, table, rowBuffer, intensity);
+					double* frow = batch->Spectra[i]->RealRow(row + top) + left;
+					for(int col = 0; col < width; ++col)
+						frow[col] = intensity[col];
+				}
+			}
+			free(rowBuffer);
+			free(intensity);
+
+			if( TransformRealData(batch->Spectra, count, precision) == false )
+			{
+				delete batch;
+				return NULL;
+			}
+			return batch;
+		}
+
+		// Conversion of spectrum cells into bytes of magnitude / phase images
+		// Exact versions match std::sqrt / log / atan2, fast ones use polynomial approximations
+		// (errors are below 1e-4, far below quantization step) and process 4 cells at once with SSE2
+		namespace
 		{
-			Complex* f = fourier->GetCell(row, col);
-			double arg = atan2(f->Imag, f->Real); // Arg is  in range [-pi,pi]
-			return (byte)((uint32)(((arg + Pi) / TwoPi ) * 255.0));
+			struct SpectrumByteParams
+			{
+				double MagScale; // 1 / max magnitude
+				bool ScaleLog;
+				bool FastMath;
+			};
+
+			// log2(1 + t) for t in [0,1] is t * (c1 + c2 t + ... + c5 t^4)
+			const float Log2C1 = 1.4418255f;
+			const float Log2C2 = -0.7086789f;
+			const float Log2C3 = 0.4154112f;
+			const float Log2C4 = -0.1944083f;
+			const float Log2C5 = 0.0458790f;
+
+			// atan(z) for z in [0,1] is z * (a0 + a1 z^2 + ... + a5 z^10)
+			const float AtanA0 = 0.99997726f;
+			const float AtanA1 = -0.33262347f;
+			const float AtanA2 = 0.19354346f;
+			const float AtanA3 = -0.11643287f;
+			const float AtanA4 = 0.05265332f;
+			const float AtanA5 = -0.01172120f;
+
+			inline float FastLog2(float x)
+			{
+				// x = 2^e * (1 + t)
+				int bits;
+				memcpy(&bits, &x, sizeof(float));
+				int e = ((bits >> 23) & 255) - 127;
+				bits = (bits & 0x7FFFFF) | 0x3F800000;
+				float t;
+				memcpy(&t, &bits, sizeof(float));
+				t -= 1.0f;
+				return (float)e + t * (Log2C1 + t * (Log2C2 + t * (Log2C3 + t * (Log2C4 + t * Log2C5))));
+			}
+
+			inline float FastAtan2(float y, float x)
+			{
+				float ax = std::fabs(x);
+				float ay = std::fabs(y);
+				float mx = ax > ay ? ax : ay;
+				float z = mx > 0.0f ? (ax < ay ? ax : ay) / mx : 0.0f;
+				float z2 = z * z;
+				float a = z * (AtanA0 + z2 * (AtanA1 + z2 * (AtanA2 + z2 * (AtanA3 + z2 * (AtanA4 + z2 * AtanA5)))));
+				a = ay > ax ? (float)(Pi / 2) - a : a;
+				a = std::signbit(x) ? (float)Pi - a : a;
+				return std::signbit(y) ? -a : a;
+			}
+
+			inline byte MagnitudeByte(double re, double im, const SpectrumByteParams& params)
+			{
+				if(params.FastMath)
+				{
+					float mag = (float)(std::sqrt(re * re + im * im) * params.MagScale);
+					mag = params.ScaleLog ? FastLog2(mag + 1.0f) : mag;
+					return (byte)(int)(mag * 255.0f);
+				}
+				// log(mag + 1) / log(2) maps [0,1] onto [0,1]
+				double mag = std::sqrt(re * re + im * im) * params.MagScale;
+				mag = params.ScaleLog ? std::log(mag + 1.0) * (1.0 / std::log(2.0)) : mag;
+				return (byte)((int)(mag * 255.0));
+			}
+
+			inline byte PhaseByte(double re, double im, const SpectrumByteParams& params)
+			{
+				// Arg is in range [-pi,pi]
+				if(params.FastMath)
+					return (byte)(uint32)((FastAtan2((float)im, (float)re) + (float)Pi) * (float)(255.0 / TwoPi));
+				return (byte)((uint32)(((std::atan2(im, re) + Pi) / TwoPi) * 255.0));
+			}
+
+#ifdef IMGOPS_FOURIER_SSE2
+			// Loads 4 cells as {re0,re1,re2,re3} and {im0,im1,im2,im3}
+			inline void LoadCells(const Complex* cells, __m128& re, __m128& im)
+			{
+				const double* d = (const double*)cells;
+				__m128 c01 = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(d)), _mm_cvtpd_ps(_mm_loadu_pd(d + 2)));
+				__m128 c23 = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(d + 4)), _mm_cvtpd_ps(_mm_loadu_pd(d + 6)));
+				re = _mm_shuffle_ps(c01, c23, _MM_SHUFFLE(2, 0, 2, 0));
+				im = _mm_shuffle_ps(c01, c23, _MM_SHUFFLE(3, 1, 3, 1));
+			}
+
+			inline __m128 FastLog2(__m128 x)
+			{
+				__m128i bits = _mm_castps_si128(x);
+				__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+				__m128 t = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x7FFFFF)), _mm_set1_epi32(0x3F800000)));
+				t = _mm_sub_ps(t, _mm_set1_ps(1.0f));
+				__m128 p = _mm_add_ps(_mm_set1_ps(Log2C4), _mm_mul_ps(t, _mm_set1_ps(Log2C5)));
+				p = _mm_add_ps(_mm_set1_ps(Log2C3), _mm_mul_ps(t, p));
+				p = _mm_add_ps(_mm_set1_ps(Log2C2), _mm_mul_ps(t, p));
+				p = _mm_add_ps(_mm_set1_ps(Log2C1), _mm_mul_ps(t, p));
+				return _mm_add_ps(e, _mm_mul_ps(t, p));
+			}
+
+			inline __m128 FastAtan2(__m128 y, __m128 x)
+			{
+				__m128 signMask = _mm_set1_ps(-0.0f);
+				__m128 ax = _mm_andnot_ps(signMask, x);
+				__m128 ay = _mm_andnot_ps(signMask, y);
+				__m128 mx = _mm_max_ps(ax, ay);
+				__m128 z = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(mx, _mm_set1_ps(1e-37f)));
+				__m128 z2 = _mm_mul_ps(z, z);
+				__m128 p = _mm_add_ps(_mm_set1_ps(AtanA4), _mm_mul_ps(z2, _mm_set1_ps(AtanA5)));
+				p = _mm_add_ps(_mm_set1_ps(AtanA3), _mm_mul_ps(z2, p));
+				p = _mm_add_ps(_mm_set1_ps(AtanA2), _mm_mul_ps(z2, p));
+				p = _mm_add_ps(_mm_set1_ps(AtanA1), _mm_mul_ps(z2, p));
+				p = _mm_add_ps(_mm_set1_ps(AtanA0), _mm_mul_ps(z2, p));
+				__m128 a = _mm_mul_ps(z, p);
+				// Octant / quadrant fix-ups, selected with masks
+				__m128 steep = _mm_cmpgt_ps(ay, ax);
+				a = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps((float)(Pi / 2)), a)), _mm_andnot_ps(steep, a));
+				__m128 negX = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x), 31));
+				a = _mm_or_ps(_mm_and_ps(negX, _mm_sub_ps(_mm_set1_ps((float)Pi), a)), _mm_andnot_ps(negX, a));
+				return _mm_or_ps(a, _mm_and_ps(signMask, y));
+			}
+
+			// Stores 4 values in [0,255] as bytes (truncated)
+			inline void StoreBytes(__m128 v, byte* out)
+			{
+				__m128i i32 = _mm_cvttps_epi32(v);
+				__m128i i16 = _mm_packs_epi32(i32, i32);
+				int packed = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+				memcpy(out, &packed, 4);
+			}
+#endif
+
+			// Converts 'count' consecutive cells to magnitude and/or phase bytes (NULL outputs are skipped)
+			// If 'conjugate' is set conjugates of cells are converted
+			void CellsToBytes(const Complex* cells, int count, bool conjugate,
+				const SpectrumByteParams& params, byte* magnitude, byte* phase)
+			{
+				int i = 0;
+#ifdef IMGOPS_FOURIER_SSE2
+				if(params.FastMath)
+				{
+					__m128 magScale = _mm_set1_ps((float)params.MagScale);
+					__m128 one = _mm_set1_ps(1.0f);
+					__m128 byteScale = _mm_set1_ps(255.0f);
+					__m128 phaseScale = _mm_set1_ps((float)(255.0 / TwoPi));
+					__m128 pi = _mm_set1_ps((float)Pi);
+					for(; i + 4 <= count; i += 4)
+					{
+						__m128 re, im;
+						LoadCells(cells + i, re, im);
+						if(magnitude != NULL)
+						{
+							__m128 mag = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im))), magScale);
+							mag = params.ScaleLog ? FastLog2(_mm_add_ps(mag, one)) : mag;
+							StoreBytes(_mm_mul_ps(mag, byteScale), magnitude + i);
+						}
+						if(phase != NULL)
+						{
+							im = conjugate ? _mm_xor_ps(im, _mm_set1_ps(-0.0f)) : im;
+							StoreBytes(_mm_mul_ps(_mm_add_ps(FastAtan2(im, re), pi), phaseScale), phase + i);
+						}
+					}
+				}
+#endif
+				for(; i < count; ++i)
+				{
+					double im = conjugate ? -cells[i].Imag : cells[i].Imag;
+					if(magnitude != NULL)
+						magnitude[i] = MagnitudeByte(cells[i].Real, im, params);
+					if(phase != NULL)
+						phase[i] = PhaseByte(cells[i].Real, im, params);
+				}
+			}
+
+			// Returns square of maximal magnitude of 'count' cells
+			double MaxSquaredMagnitude(const Complex* cells, int count)
+			{
+				int i = 0;
+				double result = 0.0;
+#ifdef IMGOPS_FOURIER_SSE2
+				const double* d = (const double*)cells;
+				__m128d max = _mm_setzero_pd();
+				for(; i + 2 <= count; i += 2)
+				{
+					__m128d c0 = _mm_loadu_pd(d + 2 * i);
+					__m128d c1 = _mm_loadu_pd(d + 2 * i + 2);
+					__m128d re = _mm_unpacklo_pd(c0, c1);
+					__m128d im = _mm_unpackhi_pd(c0, c1);
+					max = _mm_max_pd(max, _mm_add_pd(_mm_mul_pd(re, re), _mm_mul_pd(im, im)));
+				}
+				double lanes[2];
+				_mm_storeu_pd(lanes, max);
+				result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+#endif
+				for(; i < count; ++i)
+				{
+					double mag = cells[i].Real * cells[i].Real + cells[i].Imag * cells[i].Imag;
+					result = result < mag ? mag : result;
+				}
+				return result;
+			}
 		}
 
-		Image* GetPhaseImage(FourierData* fourier)
+		bool GetSpectrumImages(FourierData* fourier, Image** magnitude, Image** phase, bool scaleLog, bool fastMath)
 		{
+			// Magintude : M(y,x) = sqrt(F(y,x).R^2 + F(y,x).I^2)
 			// Phase : A(y,x) = atan2(F(y,x).I, F(y,x).R)
-			Image* image = new Image(fourier->Width, fourier->Height, PixelFormats::Gray8);
-
-			int h2 = image->Height() / 2;
-			int w2 = image->Width() / 2;
-			
-			// TOP LEFT
-			for(int row = 0; row < h2; ++row)
-				for(int col = 0; col < w2; ++col)
-					image->Pixel(row + h2, col + w2)[0] = GetPhaseByte(fourier, row, col);
-			// Top Right
-			for(int row = 0; row < h2; ++row)
-				for(int col = w2; col < image->Width(); ++col)
-					image->Pixel(row + h2, col - w2)[0] = GetPhaseByte(fourier, row, col);
-			// Bot Left
-			for(int row = h2; row < image->Height(); ++row)
-				for(int col = 0; col < w2; ++col)
-					image->Pixel(row - h2, col + w2)[0] = GetPhaseByte(fourier, row, col);
-			// Bot Right
-			for(int row = h2; row < image->Height(); ++row)
-				for(int col = w2; col < image->Width(); ++col)
-					image->Pixel(row - h2, col - w2)[0] = GetPhaseByte(fourier, row, col);
+			if(magnitude == NULL && phase == NULL)
+				return false;
+
+			int width = fourier->Width;
+			int height = fourier->Height;
+			int columns = fourier->Columns;
+			Image* magImage = magnitude != NULL ? new Image(width, height, PixelFormats::Gray8) : NULL;
+			Image* phaseImage = phase != NULL ? new Image(width, height, PixelFormats::Gray8) : NULL;
 
+			SpectrumByteParams params;
+			params.ScaleLog = scaleLog;
+			params.FastMath = fastMath;
+			params.MagScale = 1.0;
+			if(magImage != NULL)
+			{
+				// Maximum is found per range of rows, then ranges are merged
+				double maxMag = 0.0;
+				std::mutex maxMutex;
+				ParallelFor(height, [&](int begin, int end)
+				{
+					double rangeMax = MaxSquaredMagnitude(fourier->Data + begin * columns, (end - begin) * columns);
+					std::lock_guard<std::mutex> lock(maxMutex);
+					maxMag = maxMag < rangeMax ? rangeMax : maxMag;
+				}, MinLinesPerTask(columns));
+				params.MagScale = 1.0 / sqrt(maxMag);
+			}
+
+			// We need to translate fourier image so that bias (fourier(0,0)) is on image center :
+			// cell (row,col) goes to ((row + h/2) mod h, (col + w/2) mod w) (works for odd sizes too)
+			// Each spectrum row is converted in natural order into thread-local buffer, then it's two halves
+			// are copied to output row swapped
+			int h2 = height / 2;
+			int w2 = width / 2;
+			ParallelFor(height, [&](int begin, int end)
+			{
+				byte* buffer = (byte*)FftPlan::ThreadScratch(FftPlan::CallerScratch, width / 4 + 1);
+				byte* magRow = magImage != NULL ? buffer : NULL;
+				byte* phaseRow = phaseImage != NULL ? buffer + width : NULL;
+				for(int row = begin; row < end; ++row)
+				{
+					CellsToBytes(fourier->Data + row * columns, columns, false, params, magRow, phaseRow);
+					if(columns < width)
+					{
+						// Missing half of real data spectrum : F(y,x) = conj(F(h-y,w-x)), converted to
+						// free part of buffer and reversed
+						int mirrored = width - columns;
+						const Complex* mirror = fourier->Data + ((height - row) % height) * columns + 1;
+						CellsToBytes(mirror, mirrored, true, params,
+							magRow != NULL ? magRow + columns : NULL, phaseRow != NULL ? phaseRow + columns : NULL);
+						if(magRow != NULL)
+							std::reverse(magRow + columns, magRow + width);
+						if(phaseRow != NULL)
+							std::reverse(phaseRow + columns, phaseRow + width);
+					}
+
+					int dstRow = (row + h2) % height;
+					if(magImage != NULL)
+					{
+						byte* dst = magImage->Row(dstRow);
+						memcpy(dst + w2, magRow, width - w2);
+						memcpy(dst, magRow + width - w2, w2);
+					}
+					if(phaseImage != NULL)
+					{
+						byte* dst = phaseImage->Row(dstRow);
+						memcpy(dst + w2, phaseRow, width - w2);
+						memcpy(dst, phaseRow + width - w2, w2);
+					}
+				}
+			}, MinLinesPerTask(width));
+
+			if(magnitude != NULL)
+				*magnitude = magImage;
+			if(phase != NULL)
+				*phase = phaseImage;
+			return true;
+		}
+
+		Image* GetMagnitudeImage(FourierData* fourier, bool scaleLog, bool fastMath)
+		{
+			Image* image = NULL;
+			GetSpectrumImages(fourier, &image, NULL, scaleLog, fastMath);
+			return image;
+		}
+
+		Image* GetPhaseImage(FourierData* fourier, bool fastMath)
+		{
+			Image* image = NULL;
+			GetSpectrumImages(fourier, NULL, &image, false, fastMath);
 			return image;
 		}
 
@@ -324,73 +828,254 @@ namespace ImgOps
 			return true;
 		}
 
+		// Transforms 'nx' columns of 'count' arrays with rows of 'nx' values
+		// Columns are processed in blocks of ColumnBatch (for double, twice more for float, so block row is
+		// one cache line) : each row of block is one contiguous read / write
+		// and block is transformed at once by batched kernel (lanes are vectorized)
+		// Blocks of all arrays are scheduled together, so small arrays still use all threads
+		template<typename T, typename C>
+		static bool TransformColumns(C* const* arrays, int count, int nx, int ny, int dir)
+		{
+			const FftPlanT<T>* plan = FftPlanT<T>::Get(ny, dir);
+			std::atomic<bool> ok(true);
+			const int batch = ColumnBatch * (int)(sizeof(double) / sizeof(T));
+			int blocks = (nx + batch - 1) / batch;
+			ParallelFor(count * blocks, [&](int begin, int end)
+			{
+				// Each thread has own scratch
+				T* real = FftPlanT<T>::ThreadScratch(FftPlanT<T>::CallerScratch, 2 * ny * batch);
+				if (real == NULL)
+				{
+					ok = false;
+					return;
+				}
+				T* imag = real + ny * batch;
+
+				for (int block = begin; block < end; ++block)
+				{
+					C* c = arrays[block / blocks];
+					int x0 = (block % blocks) * batch;
+					int lanes = nx - x0 < batch ? nx - x0 : batch;
+					for (int y = 0; y < ny; ++y) 
+					{
+						C* src = c + y * nx + x0;
+						for (int l = 0; l < lanes; ++l)
+						{
+							real[y * lanes + l] = src[l].Real;
+							imag[y * lanes + l] = src[l].Imag;
+						}
+					}
+					plan->Execute(real, imag, lanes);
+					for (int y = 0; y < ny; ++y) 
+					{
+						C* dst = c + y * nx + x0;
+						for (int l = 0; l < lanes; ++l)
+						{
+							dst[l].Real = real[y * lanes + l];
+							dst[l].Imag = imag[y * lanes + l];
+						}
+					}
+				}
+			}, MinLinesPerTask(ny * batch));
+			return ok.load();
+		}
+
 		/*-------------------------------------------------------------------------
 		Perform a 2D FFT inplace given a complex 2D array
 		The direction dir, 1 for forward, -1 for reverse
 		The size of the array (nx,ny)
-		Return false if there are memory problems or
-		the dimensions are not powers of 2
+		Return false if there are memory problems
+		Plans of both sizes are taken from cache and scratch is thread-local, so nothing is allocated per call
 		*/
-
-		bool FFT2D(Complex* c, int nx, int ny, int dir)
+		template<typename T, typename C>
+		static bool FFT2DImpl(C* c, int nx, int ny, int dir)
 		{
-			int x, y;
-			int m,twopm;
-			double *real,*imag;
+			const FftPlanT<T>* plan = FftPlanT<T>::Get(nx, dir);
+			std::atomic<bool> ok(true);
 
 			/* Transform the rows */
-			real = (double *)malloc(nx * sizeof(double));
-			imag = (double *)malloc(nx * sizeof(double));
+			ParallelFor(ny, [&](int begin, int end)
+			{
+				T* real = FftPlanT<T>::ThreadScratch(FftPlanT<T>::CallerScratch, 2 * nx);
+				if (real == NULL)
+				{
+					ok = false;
+					return;
+				}
+				T* imag = real + nx;
 
-			if (real == NULL || imag == NULL)
-				return false;
-			if (!Powerof2(nx, &m, &twopm) || twopm != nx)
-				return false;
+				for (int y = begin; y < end; ++y) 
+				{
+					C* row = c + y * nx;
+					for (int x = 0; x < nx; ++x) 
+					{
+						real[x] = row[x].Real;
+						imag[x] = row[x].Imag;
+					}
+					plan->Execute(real, imag);
+					for (int x = 0; x < nx; ++x) 
+					{
+						row[x].Real = real[x];
+						row[x].Imag = imag[x];
+					}
+				}
+			}, MinLinesPerTask(nx));
+
+			/* Transform the columns */
+			return ok && TransformColumns<T>(&c, 1, nx, ny, dir);
+		}
+
+		// Real rows are transformed in pairs as one complex row z = a + ib :
+		// A(k) = (Z(k) + conj(Z(n-k))) / 2, B(k) = (Z(k) - conj(Z(n-k))) / 2i
+		// Row pairs of all 'count' arrays are scheduled together
+		template<typename T, typename C>
+		static bool RealFFT2DImpl(C* const* arrays, int count, int nx, int ny)
+		{
+			int cols = nx / 2 + 1;
+			int pairs = (ny + 1) / 2;
+			const FftPlanT<T>* plan = FftPlanT<T>::Get(nx, TransfromDirection::Forward);
+			std::atomic<bool> ok(true);
 
-			for (y = 0; y < ny; ++y) 
+			/* Transform pairs of rows */
+			ParallelFor(count * pairs, [&](int begin, int end)
 			{
-				for (x = 0; x < nx; ++x) 
+				T* real = FftPlanT<T>::ThreadScratch(FftPlanT<T>::CallerScratch, 2 * nx);
+				if (real == NULL)
 				{
-					real[x] = c[y * nx + x].Real;
-					imag[x] = c[y * nx + x].Imag;
+					ok = false;
+					return;
 				}
-				FFT(dir, m, real, imag);
-				for (x = 0; x < nx; ++x) 
+				T* imag = real + nx;
+
+				for (int pair = begin; pair < end; ++pair)
 				{
-					c[y * nx + x].Real = real[x];
-					c[y * nx + x].Imag = imag[x];
+					C* c = arrays[pair / pairs];
+					int y = 2 * (pair % pairs);
+					T* a = (T*)(c + y * cols);
+					T* b = y + 1 < ny ? (T*)(c + (y + 1) * cols) : NULL;
+					for (int x = 0; x < nx; ++x)
+					{
+						real[x] = a[x];
+						imag[x] = b != NULL ? b[x] : 0.0;
+					}
+					plan->Execute(real, imag);
+
+					C* fa = c + y * cols;
+					C* fb = c + (y + 1) * cols;
+					for (int k = 0; k < cols; ++k)
+					{
+						int nk = k == 0 ? 0 : nx - k;
+						T zRe = real[k], zIm = imag[k];
+						T zcRe = real[nk], zcIm = -imag[nk]; // conj(Z(n-k))
+						fa[k].Real = (T)0.5 * (zRe + zcRe);
+						fa[k].Imag = (T)0.5 * (zIm + zcIm);
+						if (b != NULL)
+						{
+							fb[k].Real = (T)0.5 * (zIm - zcIm);
+							fb[k].Imag = (T)-0.5 * (zRe - zcRe);
+						}
+					}
 				}
-			}
-			free(real);
-			free(imag);
+			}, MinLinesPerTask(2 * nx));
 
-			/* Transform the columns */
-			real = (double *)malloc(ny * sizeof(double));
-			imag = (double *)malloc(ny * sizeof(double));
+			/* Transform the columns of half spectrum */
+			return ok && TransformColumns<T>(arrays, count, cols, ny, TransfromDirection::Forward);
+		}
 
-			if (real == NULL || imag == NULL)
-				return false;
-			if (!Powerof2(ny, &m, &twopm) || twopm != ny)
+		template<typename T, typename C>
+		static bool RealInverseFFT2DImpl(C* c, int nx, int ny)
+		{
+			int cols = nx / 2 + 1;
+			if (TransformColumns<T>(&c, 1, cols, ny, TransfromDirection::Inverse) == false)
 				return false;
 
-			for (x = 0; x < nx; ++x) 
+			const FftPlanT<T>* plan = FftPlanT<T>::Get(nx, TransfromDirection::Inverse);
+			std::atomic<bool> ok(true);
+
+			/* Rebuild full spectra of pair of rows as Z = A + iB and get both real rows at once */
+			ParallelFor((ny + 1) / 2, [&](int beginPair, int endPair)
 			{
-				for (y = 0; y < ny; ++y) 
+				T* real = FftPlanT<T>::ThreadScratch(FftPlanT<T>::CallerScratch, 2 * nx);
+				if (real == NULL)
 				{
-					real[y] = c[y * nx + x].Real;
-					imag[y] = c[y * nx + x].Imag;
+					ok = false;
+					return;
 				}
-				FFT(dir, m, real, imag);
-				for (y = 0; y < ny; ++y) 
+				T* imag = real + nx;
+
+				for (int y = 2 * beginPair; y < 2 * endPair && y < ny; y += 2)
 				{
-					c[y * nx + x].Real = real[y];
-					c[y * nx + x].Imag = imag[y];
+					C* fa = c + y * cols;
+					C* fb = y + 1 < ny ? c + (y + 1) * cols : NULL;
+					for (int k = 0; k < nx; ++k)
+					{
+						// Cells above nx/2 are conjugates of mirrored ones
+						bool mirrored = k >= cols;
+						int kk = mirrored ? nx - k : k;
+						T aRe = fa[kk].Real, aIm = mirrored ? -fa[kk].Imag : fa[kk].Imag;
+						T bRe = 0.0, bIm = 0.0;
+						if (fb != NULL)
+						{
+							bRe = fb[kk].Real;
+							bIm = mirrored ? -fb[kk].Imag : fb[kk].Imag;
+						}
+						real[k] = aRe - bIm;
+						imag[k] = aIm + bRe;
+					}
+					plan->Execute(real, imag);
+
+					T* a = (T*)fa;
+					for (int x = 0; x < nx; ++x)
+						a[x] = real[x];
+					if (fb != NULL)
+					{
+						T* b = (T*)fb;
+						for (int x = 0; x < nx; ++x)
+							b[x] = imag[x];
+					}
 				}
-			}
-			free(real);
-			free(imag);
+			}, MinLinesPerTask(2 * nx));
+			return ok.load();
+		}
 
-			return true;
+		bool FFT2D(Complex* c, int nx, int ny, int dir)
+		{
+			return FFT2DImpl<double>(c, nx, ny, dir);
+		}
+
+		bool FFT2D(ComplexF* c, int nx, int ny, int dir)
+		{
+			return FFT2DImpl<float>(c, nx, ny, dir);
+		}
+
+		bool RealFFT2D(Complex* c, int nx, int ny)
+		{
+			return RealFFT2DImpl<double>(&c, 1, nx, ny);
+		}
+
+		bool RealFFT2D(ComplexF* c, int nx, int ny)
+		{
+			return RealFFT2DImpl<float>(&c, 1, nx, ny);
+		}
+
+		bool RealFFT2DBatch(Complex* const* arrays, int count, int nx, int ny)
+		{
+			return RealFFT2DImpl<double>(arrays, count, nx, ny);
+		}
+
+		bool RealFFT2DBatch(ComplexF* const* arrays, int count, int nx, int ny)
+		{
+			return RealFFT2DImpl<float>(arrays, count, nx, ny);
+		}
+
+		bool RealInverseFFT2D(Complex* c, int nx, int ny)
+		{
+			return RealInverseFFT2DImpl<double>(c, nx, ny);
+		}
+
+		bool RealInverseFFT2D(ComplexF* c, int nx, int ny)
+		{
+			return RealInverseFFT2DImpl<float>(c, nx, ny);
 		}
 
 		/*-------------------------------------------------------------------------
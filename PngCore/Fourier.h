@@ -1,10 +1,12 @@
 #pragma once
 
 #include "TypeDefs.h"
+#include <functional>
 
 namespace ImgOps
 {
 	class Image;
+	class TiledImage;
 	struct Complex
 	{
 	public:
@@ -12,22 +14,45 @@ namespace ImgOps
 		double Imag;
 	};
 
+	// Single precision complex value (for transforms where float is enough, i.e. visualization)
+	struct ComplexF
+	{
+	public:
+		float Real;
+		float Imag;
+	};
+
 	struct FourierData
 	{
 	public:
-		uint32 Width;
+		uint32 Width; // Size of transformed data
 		uint32 Height;
+		// Number of stored columns : Width or Width/2+1 for half spectrum of real data
+		// (other columns are redundant as F(y,x) = conj(F(-y,-x)))
+		uint32 Columns;
+		bool HalfSpectrum;
 		Complex* Data;
+		// Area of transformed image (rest of data is padding), used when image is retrieved
+		uint32 ImageLeft;
+		uint32 ImageTop;
+		uint32 ImageWidth;
+		uint32 ImageHeight;
 
-		FourierData(uint32 width, uint32 height)
+		FourierData(uint32 width, uint32 height, bool halfSpectrum = false)
 		{
 			Width = width;
 			Height = height;
-			uint32 size = width * height;
+			ImageLeft = 0;
+			ImageTop = 0;
+			ImageWidth = width;
+			ImageHeight = height;
+			HalfSpectrum = halfSpectrum;
+			Columns = halfSpectrum ? width / 2 + 1 : width;
+			uint32 size = Columns * height;
 			Data = (Complex*)malloc(size * sizeof(Complex));
 
 			// Zero memory:
-			for(int i = 0; i < size; ++i)
+			for(uint32 i = 0; i < size; ++i)
 			{
 				Data[i].Imag = 0.0;
 				Data[i].Real = 0.0;
@@ -41,24 +66,133 @@ namespace ImgOps
 
 		Complex* GetCell(uint32 row, uint32 col)
 		{
-			return &Data[row * Width + col];
+			return &Data[row * Columns + col];
+		}
+
+		// Returns value of any cell (for half spectrum missing cells are reconstructed)
+		Complex GetValue(uint32 row, uint32 col)
+		{
+			if(col < Columns)
+				return Data[row * Columns + col];
+
+			Complex c = Data[((Height - row) % Height) * Columns + (Width - col)];
+			c.Imag = -c.Imag;
+			return c;
+		}
+
+		// Returns row of real values for half spectrum data before forward / after inverse transform
+		// (rows are stored with stride of 2 * Columns doubles, so transform is done in place)
+		double* RealRow(uint32 row)
+		{
+			return (double*)(Data + row * Columns);
+		}
+	};
+
+	// Spectra of several real inputs of the same size (channels of one image or stack of images),
+	// transformed together : row and column passes of all spectra share plans and are scheduled at once
+	struct FourierBatch
+	{
+	public:
+		int Count;
+		FourierData** Spectra; // 'Count' half spectra, owned by batch
+
+		FourierBatch(int count, uint32 width, uint32 height)
+		{
+			Count = count;
+			Spectra = (FourierData**)malloc(count * sizeof(FourierData*));
+			for(int i = 0; i < count; ++i)
+				Spectra[i] = new FourierData(width, height, true);
+		}
+
+		~FourierBatch()
+		{
+			for(int i = 0; i < Count; ++i)
+				delete Spectra[i];
+			free(Spectra);
 		}
+
+		FourierData* Get(int index)
+		{
+			return Spectra[index];
+		}
+
+		// Passes ownership of spectrum to caller (batch keeps NULL)
+		FourierData* Detach(int index)
+		{
+			FourierData* spectrum = Spectra[index];
+			Spectra[index] = NULL;
+			return spectrum;
+		}
+
+	private:
+		FourierBatch(const FourierBatch&);
+		FourierBatch& operator=(const FourierBatch&);
 	};
 
 	namespace Fourier // (DFT/FFT based on Paul Bourke implementation) 
 	{
+		// Precision of computations of FourierTransform()
+		// Single precision transform is about twice faster (twice more values per SIMD instruction, half of memory traffic),
+		// with relative error about 1e-6 (enough for magnitude / phase images and correlations)
+		enum TransformPrecision : int
+		{
+			Double = 0,
+			Single = 1
+		};
+
 		// Returns array with 2d-fourier transform of given image (based on pixel intensity (channels average) or given channel if set >= 0 )
-		// Array is row-major matrix of complex values of size image.width * image.height
-		// Indexed images are not supported
-		FourierData* FourierTransform(Image* image, int channel = -1);
+		// Array is row-major matrix of complex values of size image.width * image.height, but as input is real
+		// only half spectrum is stored (see FourierData::HalfSpectrum)
+		// If 'padToPowerOf2' is set image is placed on center of black image with power of 2 dimensions
+		// Indexed images are not supported, floating point images (GrayFloat32 / RgbaFloat32) are read directly
+		// With Single 'precision' transform is computed on floats and converted to FourierData at the end
+		FourierData* FourierTransform(Image* image, int channel = -1, bool padToPowerOf2 = false,
+			TransformPrecision precision = TransformPrecision::Double);
+
+		// Same as above for tiled image, image is read tile by tile (never written tiles are skipped)
+		FourierData* FourierTransform(TiledImage* image, int channel = -1, bool padToPowerOf2 = false,
+			TransformPrecision precision = TransformPrecision::Double);
+
+		// Transforms each color channel of image in one batch : spectrum 'i' is channel 'i' (Red, Green, Blue or Gray)
+		// Alpha is transformed as last channel if 'withAlpha' is set and image have one
+		// Returns NULL for Indexed images
+		FourierBatch* FourierTransformChannels(Image* image, bool withAlpha = false, bool padToPowerOf2 = false,
+			TransformPrecision precision = TransformPrecision::Double);
+
+		// Transforms 'count' images of the same size in one batch (same as FourierTransform() for each image)
+		// Returns NULL if sizes differ or any image is Indexed
+		FourierBatch* FourierTransformStack(Image** images, int count, int channel = -1, bool padToPowerOf2 = false,
+			TransformPrecision precision = TransformPrecision::Double);
 
 		// Returns image with magnitude of fourier transfrom, in format Gray8
-		Image* GetMagnitudeImage(FourierData* fourier, bool scaleLog = false);
+		// 'fastMath' uses approximations of log and atan2 (error is below 1e-4, so few pixels may differ by 1)
+		Image* GetMagnitudeImage(FourierData* fourier, bool scaleLog = false, bool fastMath = false);
 
 		// Returns image with phase of fourier transfrom, in format Gray8
-		Image* GetPhaseImage(FourierData* fourier);
+		Image* GetPhaseImage(FourierData* fourier, bool fastMath = false);
+
+		// Creates magnitude and phase images (same as above) in one pass over spectrum
+		// Pass NULL as 'magnitude' or 'phase' if image is not needed
+		bool GetSpectrumImages(FourierData* fourier, Image** magnitude, Image** phase,
+			bool scaleLog = false, bool fastMath = false);
+
+		// Same as FourierTransform(image, channel) but result is stored in existing half spectrum 'fourier'
+		// (i.e. reused for many images of the same size), image is placed on center of data
+		// Returns false if data is smaller than image, is not half spectrum or image is Indexed
+		bool FourierTransform(Image* image, FourierData* fourier, int channel = -1);
+
+		// Performs inverse fourier transform in place : afterwards rows of half spectrum hold real values
+		// (see FourierData::RealRow()), for full spectrum real parts of cells are values
+		bool InverseTransform(FourierData* fourier);
+
+		// Performs inverse fourier transform in place and stores values of FourierData image area in 'result'
+		// 'result' must have size of the area and format Gray8 (values are clamped to [0,1]) or GrayFloat32
+		// Forward transform, filtering and this call reuse the same buffers, plans and conversion tables, so no
+		// per-image memory is allocated (with SetThreadCount(1) nothing is allocated, pool threads get small task records)
+		bool InverseTransform(FourierData* fourier, Image* result);
 
 		// Performs inverse fourier transform and stores results in Image in format Gray8
+		// 'fourier' is not changed (transform is done on copy)
 		Image* RetrieveImage(FourierData* fourier);
 
 		enum TransfromDirection : int
@@ -78,14 +212,86 @@ namespace ImgOps
 		*/
 		bool FFT(short int dir, long N, double* real, double* imag);
 
+		/*
+		Computes an in-place complex-to-complex FFT of any size N
+		Sizes with prime factors 2,3,5,7 use mixed-radix Stockham FFT, others use Bluestein's algorithm
+		Forward transform is scaled by 1/N (same as FFT / DFT)
+		*/
+		bool MixedRadixFFT(int dir, int N, double* real, double* imag);
+		bool MixedRadixFFT(int dir, int N, float* real, float* imag);
+
+		/*
+		Computes 'lanes' complex FFTs of size N at once, element k of transform l is stored at [k * lanes + l]
+		Used for columns of 2D transforms (block of neighbouring columns is one batch)
+		*/
+		bool MixedRadixFFTBatch(int dir, int N, int lanes, double* real, double* imag);
+		bool MixedRadixFFTBatch(int dir, int N, int lanes, float* real, float* imag);
+
+		// Instruction sets used by FFT passes
+		enum SimdLevel : int
+		{
+			Scalar = 0,
+			Sse2 = 1,
+			Avx2 = 2 // With FMA
+		};
+
+		// Returns best level supported by cpu (and build : SSE2 / AVX2 are x86 only)
+		SimdLevel GetSupportedSimdLevel();
+		// Limits instruction set used by transforms (i.e. to compare results), level above supported is lowered
+		// By default best supported level is used
+		void SetSimdLevel(SimdLevel level);
+		SimdLevel GetSimdLevel();
+
+		// Number of columns transformed at once by FFT2D / RealFFT2D (twice more for single precision)
+		static const int ColumnBatch = 8;
+
+		// Sets number of threads used by 2D transforms and magnitude / phase images
+		// 0 - shared ThreadPool::Default() (default), 1 - transforms run on calling thread
+		// Must not be called while any transform is running
+		void SetThreadCount(int threads);
+		// Returns number of threads used by 2D transforms
+		int GetThreadCount();
+
+		// Runs 'task' on ranges of [0, count) on transform threads (used by modules built on transforms)
+		// 'minRange' should be big enough to make task worth scheduling
+		void ParallelFor(int count, const std::function<void(int begin, int end)>& task, int minRange);
+		// Same for lambdas : std::function only refers to 'task', so lambdas capturing many variables are not copied to heap
+		template<typename Task>
+		void ParallelFor(int count, const Task& task, int minRange)
+		{
+			ParallelFor(count, std::function<void(int begin, int end)>(std::cref(task)), minRange);
+		}
+
+		// Returns true if 'n' has only 2,3,5,7 prime factors (so is transformed without Bluestein's algorithm)
+		bool IsMixedRadixSize(int n);
+		// Returns smallest size >= 'n' with only 2,3,5,7 prime factors
+		int NextMixedRadixSize(int n);
+
 		/*-------------------------------------------------------------------------
 		Perform a 2D FFT inplace given a complex 2D array
 		The direction dir, 1 for forward, -1 for reverse
-		The size of the array (nx,ny)
-		Return false if there are memory problems or
-		the dimensions are not powers of 2
+		The size of the array (nx,ny), any sizes are accepted
+		Return false if there are memory problems
 		*/
 		bool FFT2D(Complex* c, int nx, int ny, int dir);
+		bool FFT2D(ComplexF* c, int nx, int ny, int dir);
+
+		/*
+		Perform a 2D real-to-complex FFT inplace
+		On input each of 'ny' rows contains 'nx' real values, rows are stored every (nx/2+1) complex values
+		(FourierData::RealRow() layout), on output array holds half spectrum : ny x (nx/2+1) complex values
+		Return false if there are memory problems
+		*/
+		bool RealFFT2D(Complex* c, int nx, int ny);
+		bool RealFFT2D(ComplexF* c, int nx, int ny);
+
+		// Performs RealFFT2D on 'count' arrays of the same size at once
+		bool RealFFT2DBatch(Complex* const* arrays, int count, int nx, int ny);
+		bool RealFFT2DBatch(ComplexF* const* arrays, int count, int nx, int ny);
+
+		// Inverse of RealFFT2D : half spectrum is transformed in place to real values
+		bool RealInverseFFT2D(Complex* c, int nx, int ny);
+		bool RealInverseFFT2D(ComplexF* c, int nx, int ny);
 
 		/*-------------------------------------------------------------------------
 		Calculate the closest but lower power of two of a number
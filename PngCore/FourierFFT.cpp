@@ -0,0 +1,469 @@
+#include "Fourier.h"
+#include "FftPlan.h"
+#include "FftKernels.h"
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <atomic>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#if defined(IMGOPS_FFT_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ImgOps
+{
+	namespace Fourier
+	{
+		// Pi with full double precision (twiddles for big sizes need it)
+		static const double FftPi = 3.14159265358979323846;
+
+		// Splits 'n' into radices 4, 2, 3, 5, 7 (4 first as radix-4 pass is cheapest per element)
+		// Returns number of stages or -1 if 'n' has other prime factors
+		static int FactorizeSize(int n, int* radices)
+		{
+			int stages = 0;
+			while(n % 4 == 0) { radices[stages++] = 4; n /= 4; }
+			while(n % 2 == 0) { radices[stages++] = 2; n /= 2; }
+			while(n % 3 == 0) { radices[stages++] = 3; n /= 3; }
+			while(n % 5 == 0) { radices[stages++] = 5; n /= 5; }
+			while(n % 7 == 0) { radices[stages++] = 7; n /= 7; }
+			return n == 1 ? stages : -1;
+		}
+
+		bool IsMixedRadixSize(int n)
+		{
+			int radices[FftPlan::MaxStages];
+			return n >= 1 && FactorizeSize(n, radices) >= 0;
+		}
+
+		int NextMixedRadixSize(int n)
+		{
+			while(IsMixedRadixSize(n) == false)
+				++n;
+			return n;
+		}
+
+		static void* AlignedAlloc(size_t bytes)
+		{
+#ifdef _WIN32
+			return _aligned_malloc(bytes, 64);
+#else
+			void* ptr = NULL;
+			return posix_memalign(&ptr, 64, bytes) == 0 ? ptr : NULL;
+#endif
+		}
+
+		static void AlignedFree(void* ptr)
+		{
+#ifdef _WIN32
+			_aligned_free(ptr);
+#else
+			free(ptr);
+#endif
+		}
+
+		// Detects AVX2 + FMA support of cpu and os (AVX registers must be saved by os)
+		static bool CpuSupportsAvx2()
+		{
+#if defined(IMGOPS_FFT_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if(info[0] < 7)
+				return false;
+			__cpuid(info, 1);
+			bool fma = (info[2] & (1 << 12)) != 0;
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			if(!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#elif defined(IMGOPS_FFT_X86) && defined(__GNUC__)
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+			return false;
+#endif
+		}
+
+		SimdLevel GetSupportedSimdLevel()
+		{
+#ifdef IMGOPS_FFT_X86
+			static const bool avx2 = CpuSupportsAvx2();
+			return avx2 ? SimdLevel::Avx2 : SimdLevel::Sse2;
+#else
+			return SimdLevel::Scalar;
+#endif
+		}
+
+		// Level used by passes, -1 untill first use (then best supported)
+		static std::atomic<int> _simdLevel(-1);
+
+		void SetSimdLevel(SimdLevel level)
+		{
+			SimdLevel supported = GetSupportedSimdLevel();
+			_simdLevel = level < supported ? level : supported;
+		}
+
+		SimdLevel GetSimdLevel()
+		{
+			int level = _simdLevel;
+			if(level < 0)
+			{
+				level = GetSupportedSimdLevel();
+				_simdLevel = level;
+			}
+			return (SimdLevel)level;
+		}
+
+		template<typename T>
+		static void RunStockhamPass(const StockhamPassData<T>& pass, SimdLevel level)
+		{
+#ifdef IMGOPS_FFT_X86
+			if(level == SimdLevel::Avx2)
+				StockhamPassAvx2(pass);
+			else if(level == SimdLevel::Sse2)
+				StockhamPassKernel<T, Sse2Vec<T>, ScalarVec<T> >(pass);
+			else
+#endif
+				StockhamPassKernel<T, ScalarVec<T>, ScalarVec<T> >(pass);
+		}
+
+		// Scratch is shared by plans of both types, so it is kept as raw memory
+		struct ThreadScratchBuffers
+		{
+			void* Data[FftPlan::ScratchSlots];
+			size_t Size[FftPlan::ScratchSlots];
+
+			ThreadScratchBuffers()
+			{
+				for(int i = 0; i < FftPlan::ScratchSlots; ++i)
+				{
+					Data[i] = NULL;
+					Size[i] = 0;
+				}
+			}
+
+			~ThreadScratchBuffers()
+			{
+				for(int i = 0; i < FftPlan::ScratchSlots; ++i)
+					AlignedFree(Data[i]);
+			}
+		};
+
+		static void* ThreadScratchBytes(int slot, size_t bytes)
+		{
+			static thread_local ThreadScratchBuffers buffers;
+			if(buffers.Size[slot] < bytes)
+			{
+				AlignedFree(buffers.Data[slot]);
+				buffers.Data[slot] = AlignedAlloc(bytes);
+				buffers.Size[slot] = buffers.Data[slot] != NULL ? bytes : 0;
+			}
+			return buffers.Data[slot];
+		}
+
+		template<typename T>
+		T* FftPlanT<T>::ThreadScratch(ScratchSlot slot, size_t count)
+		{
+			return (T*)ThreadScratchBytes(slot, count * sizeof(T));
+		}
+
+		// Plans live untill ClearCache(), creation of Bluestein plan recursively gets its convolution plan
+		// Mutex is common, as float and double plans may be created at once
+		static std::recursive_mutex PlanCacheMutex;
+
+		template<typename T>
+		static std::map<std::pair<int, int>, FftPlanT<T>*>& PlanCache()
+		{
+			static std::map<std::pair<int, int>, FftPlanT<T>*> cache;
+			return cache;
+		}
+
+		template<typename T>
+		FftPlanT<T>* FftPlanT<T>::Get(int size, int dir)
+		{
+			std::lock_guard<std::recursive_mutex> lock(PlanCacheMutex);
+			std::map<std::pair<int, int>, FftPlanT*>& cache = PlanCache<T>();
+			std::pair<int, int> key(size, dir);
+			auto it = cache.find(key);
+			if(it != cache.end())
+				return it->second;
+
+			FftPlanT* plan = new FftPlanT(size, dir);
+			cache[key] = plan;
+			return plan;
+		}
+
+		template<typename T>
+		void FftPlanT<T>::ClearCache()
+		{
+			std::lock_guard<std::recursive_mutex> lock(PlanCacheMutex);
+			std::map<std::pair<int, int>, FftPlanT*>& cache = PlanCache<T>();
+			for(auto it = cache.begin(); it != cache.end(); ++it)
+				delete it->second;
+			cache.clear();
+		}
+
+		// Plan data is computed in double precision and then rounded to T
+		template<typename T>
+		FftPlanT<T>::FftPlanT(int size, int dir)
+		{
+			_size = size;
+			_dir = dir;
+			_twiddlesRe = NULL;
+			_twiddlesIm = NULL;
+			_convSize = 0;
+			_convPlan = NULL;
+			_chirpRe = NULL;
+			_chirpIm = NULL;
+			_kernelRe = NULL;
+			_kernelIm = NULL;
+
+			for(int k = 0; k < MaxRadix; ++k)
+			{
+				double arg = -dir * 2.0 * FftPi * (double)k / (double)MaxRadix;
+				_rootsRe[k] = (T)cos(arg);
+				_rootsIm[k] = (T)sin(arg);
+			}
+
+			_stages = FactorizeSize(size, _radices);
+			if(_stages >= 0)
+			{
+				// Twiddles of each pass : exp(-dir*2Pi*i*b*r/(stride*p)) for b < stride, 0 < r < p
+				int total = 0;
+				int stride = 1;
+				for(int s = 0; s < _stages; ++s)
+				{
+					_twiddleOffsets[s] = total;
+					total += stride * (_radices[s] - 1);
+					stride *= _radices[s];
+				}
+				_twiddlesRe = (T*)AlignedAlloc((total + 1) * sizeof(T));
+				_twiddlesIm = (T*)AlignedAlloc((total + 1) * sizeof(T));
+
+				stride = 1;
+				for(int s = 0; s < _stages; ++s)
+				{
+					int p = _radices[s];
+					T* twRe = _twiddlesRe + _twiddleOffsets[s];
+					T* twIm = _twiddlesIm + _twiddleOffsets[s];
+					for(int b = 0; b < stride; ++b)
+					{
+						for(int r = 1; r < p; ++r)
+						{
+							double arg = -dir * 2.0 * FftPi * (double)(b * r) / (double)(stride * p);
+							twRe[(r - 1) * stride + b] = (T)cos(arg);
+							twIm[(r - 1) * stride + b] = (T)sin(arg);
+						}
+					}
+					stride *= p;
+				}
+			}
+			else
+			{
+				// Bluestein (chirp-z) : X(k) = w(k) * sum{j}(x(j) * w(j) * conj(w(k-j))), where w(k) = exp(-dir*Pi*i*k^2/n)
+				// Convolution is done with power of 2 FFT of size >= 2n-1
+				int m = 1;
+				while(m < 2 * size - 1)
+					m *= 2;
+				_convSize = m;
+				_convPlan = Get(m, TransfromDirection::Forward);
+
+				_chirpRe = (T*)AlignedAlloc(size * sizeof(T));
+				_chirpIm = (T*)AlignedAlloc(size * sizeof(T));
+				_kernelRe = (T*)AlignedAlloc(m * sizeof(T));
+				_kernelIm = (T*)AlignedAlloc(m * sizeof(T));
+
+				// k^2 mod 2n keeps argument small, so chirp stays accurate for big n
+				for(int k = 0; k < size; ++k)
+				{
+					int64 k2 = ((int64)k * k) % (2 * (int64)size);
+					double arg = -dir * FftPi * (double)k2 / (double)size;
+					_chirpRe[k] = (T)cos(arg);
+					_chirpIm[k] = (T)sin(arg);
+				}
+
+				memset(_kernelRe, 0, m * sizeof(T));
+				memset(_kernelIm, 0, m * sizeof(T));
+				_kernelRe[0] = _chirpRe[0];
+				_kernelIm[0] = -_chirpIm[0];
+				for(int k = 1; k < size; ++k)
+				{
+					_kernelRe[k] = _kernelRe[m - k] = _chirpRe[k];
+					_kernelIm[k] = _kernelIm[m - k] = -_chirpIm[k];
+				}
+				_convPlan->ExecuteUnscaled(_kernelRe, _kernelIm);
+
+				// Scaling of inverse convolution transform is moved here
+				T mInv = (T)(1.0 / (double)m);
+				for(int k = 0; k < m; ++k)
+				{
+					_kernelRe[k] *= mInv;
+					_kernelIm[k] *= mInv;
+				}
+			}
+		}
+
+		template<typename T>
+		FftPlanT<T>::~FftPlanT()
+		{
+			AlignedFree(_twiddlesRe);
+			AlignedFree(_twiddlesIm);
+			AlignedFree(_chirpRe);
+			AlignedFree(_chirpIm);
+			AlignedFree(_kernelRe);
+			AlignedFree(_kernelIm);
+		}
+
+		template<typename T>
+		void FftPlanT<T>::Execute(T* real, T* imag, int lanes) const
+		{
+			ExecuteUnscaled(real, imag, lanes);
+
+			if(_dir == TransfromDirection::Forward)
+			{
+				T nInv = (T)(1.0 / (double)_size);
+				int count = _size * lanes;
+				for(int i = 0; i < count; ++i)
+				{
+					real[i] *= nInv;
+					imag[i] *= nInv;
+				}
+			}
+		}
+
+		template<typename T>
+		void FftPlanT<T>::ExecuteUnscaled(T* real, T* imag, int lanes) const
+		{
+			if(_stages > 0)
+			{
+				ExecuteStockham(real, imag, lanes);
+			}
+			else if(_stages < 0)
+			{
+				// Bluestein lanes are done one by one
+				for(int l = 0; l < lanes; ++l)
+					ExecuteBluestein(real + l, imag + l, lanes);
+			}
+		}
+
+		template<typename T>
+		void FftPlanT<T>::ExecuteStockham(T* real, T* imag, int lanes) const
+		{
+			int count = _size * lanes;
+			T* work = ThreadScratch(ExecuteScratch, 2 * count);
+			SimdLevel level = GetSimdLevel();
+
+			StockhamPassData<T> pass;
+			pass.N = _size;
+			pass.Lanes = lanes;
+			pass.XRe = real;
+			pass.XIm = imag;
+			pass.YRe = work;
+			pass.YIm = work + count;
+			pass.RootsRe = _rootsRe;
+			pass.RootsIm = _rootsIm;
+			pass.DirSign = _dir == TransfromDirection::Forward ? (T)1 : (T)-1;
+
+			int stride = 1;
+			for(int s = 0; s < _stages; ++s)
+			{
+				pass.Radix = _radices[s];
+				pass.Stride = stride;
+				pass.TwRe = _twiddlesRe + _twiddleOffsets[s];
+				pass.TwIm = _twiddlesIm + _twiddleOffsets[s];
+				RunStockhamPass(pass, level);
+				stride *= _radices[s];
+
+				// Output of this pass is input of next one
+				T* srcRe = pass.YRe;
+				T* srcIm = pass.YIm;
+				pass.YRe = (T*)pass.XRe;
+				pass.YIm = (T*)pass.XIm;
+				pass.XRe = srcRe;
+				pass.XIm = srcIm;
+			}
+			if(pass.XRe != real)
+			{
+				memcpy(real, pass.XRe, count * sizeof(T));
+				memcpy(imag, pass.XIm, count * sizeof(T));
+			}
+		}
+
+		template<typename T>
+		void FftPlanT<T>::ExecuteBluestein(T* real, T* imag, int step) const
+		{
+			int m = _convSize;
+			T* aRe = ThreadScratch(BluesteinScratch, 2 * m);
+			T* aIm = aRe + m;
+
+			for(int k = 0; k < _size; ++k)
+			{
+				T re = real[k * step];
+				T im = imag[k * step];
+				aRe[k] = re * _chirpRe[k] - im * _chirpIm[k];
+				aIm[k] = re * _chirpIm[k] + im * _chirpRe[k];
+			}
+			memset(aRe + _size, 0, (m - _size) * sizeof(T));
+			memset(aIm + _size, 0, (m - _size) * sizeof(T));
+
+			_convPlan->ExecuteUnscaled(aRe, aIm);
+
+			// Inverse transform of product through conjugation : ifft(x) = conj(fft(conj(x)))
+			for(int k = 0; k < m; ++k)
+			{
+				T pRe = aRe[k] * _kernelRe[k] - aIm[k] * _kernelIm[k];
+				T pIm = aRe[k] * _kernelIm[k] + aIm[k] * _kernelRe[k];
+				aRe[k] = pRe;
+				aIm[k] = -pIm;
+			}
+			_convPlan->ExecuteUnscaled(aRe, aIm);
+
+			for(int k = 0; k < _size; ++k)
+			{
+				T cRe = aRe[k];
+				T cIm = -aIm[k];
+				real[k * step] = cRe * _chirpRe[k] - cIm * _chirpIm[k];
+				imag[k * step] = cRe * _chirpIm[k] + cIm * _chirpRe[k];
+			}
+		}
+
+		template class FftPlanT<double>;
+		template class FftPlanT<float>;
+
+		bool MixedRadixFFT(int dir, int n, double* real, double* imag)
+		{
+			if(n < 1)
+				return false;
+			FftPlan::Get(n, dir)->Execute(real, imag);
+			return true;
+		}
+
+		bool MixedRadixFFT(int dir, int n, float* real, float* imag)
+		{
+			if(n < 1)
+				return false;
+			FftPlanF::Get(n, dir)->Execute(real, imag);
+			return true;
+		}
+
+		bool MixedRadixFFTBatch(int dir, int N, int lanes, double* real, double* imag)
+		{
+			if(N < 1 || lanes < 1)
+				return false;
+			FftPlan::Get(N, dir)->Execute(real, imag, lanes);
+			return true;
+		}
+
+		bool MixedRadixFFTBatch(int dir, int N, int lanes, float* real, float* imag)
+		{
+			if(N < 1 || lanes < 1)
+				return false;
+			FftPlanF::Get(N, dir)->Execute(real, imag, lanes);
+			return true;
+		}
+	}
+}
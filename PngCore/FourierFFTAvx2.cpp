@@ -0,0 +1,29 @@
+// AVX2 kernels of FFT passes, used only after runtime check of cpu (see FourierFFT.cpp)
+// Whole file is compiled for AVX2 (MSVC accepts AVX intrinsics without /arch option)
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2,fma")
+#endif
+
+#define IMGOPS_FFT_AVX2
+#include "FftKernels.h"
+
+namespace ImgOps
+{
+	namespace Fourier
+	{
+		void StockhamPassAvx2(const StockhamPassData<double>& pass)
+		{
+			StockhamPassKernel<double, Avx2Vec<double>, Sse2Vec<double> >(pass);
+		}
+
+		void StockhamPassAvx2(const StockhamPassData<float>& pass)
+		{
+			StockhamPassKernel<float, Avx2Vec<float>, Sse2Vec<float> >(pass);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include "FrequencyFilter.h"
+#include "Fourier.h"
+#include "Image.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMGOPS_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace ImgOps
+{
+	namespace Fourier
+	{
+		FrequencyFilter::FrequencyFilter(Type type, Shape shape, double cutoff, double bandWidth, int order)
+		{
+			_type = type;
+			_shape = shape;
+			_cutoff = cutoff;
+			_bandWidth = bandWidth;
+			_order = order;
+		}
+
+		FrequencyFilter::~FrequencyFilter()
+		{
+		}
+
+		void FrequencyFilter::SetCutoff(double cutoff)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			_masks.clear();
+			_cutoff = cutoff;
+		}
+
+		void FrequencyFilter::SetBandWidth(double bandWidth)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			_masks.clear();
+			_bandWidth = bandWidth;
+		}
+
+		void FrequencyFilter::SetOrder(int order)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			_masks.clear();
+			_order = order;
+		}
+
+		void FrequencyFilter::AddNotch(double fx, double fy)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			_masks.clear();
+			_notches.push_back(std::make_pair(fx, fy));
+		}
+
+		void FrequencyFilter::ClearNotches()
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			_masks.clear();
+			_notches.clear();
+		}
+
+		double FrequencyFilter::Response(double fx, double fy) const
+		{
+			double d2 = fx * fx + fy * fy;
+			double c2 = _cutoff > 1e-12 ? _cutoff * _cutoff : 1e-24;
+
+			switch(_type)
+			{
+			case LowPass:
+				if(_shape == Gaussian)
+					return std::exp(-d2 / (2.0 * c2));
+				return 1.0 / (1.0 + std::pow(d2 / c2, _order));
+
+			case HighPass:
+				if(_shape == Gaussian)
+					return 1.0 - std::exp(-d2 / (2.0 * c2));
+				return d2 == 0.0 ? 0.0 : 1.0 / (1.0 + std::pow(c2 / d2, _order));
+
+			case BandPass:
+			case BandStop:
+			{
+				// Band-stop response, band-pass is it's complement
+				double stop;
+				double dw = std::sqrt(d2) * _bandWidth;
+				double diff = d2 - _cutoff * _cutoff;
+				if(d2 == 0.0)
+					stop = 1.0;
+				else if(_shape == Gaussian)
+					stop = dw == 0.0 ? 1.0 : 1.0 - std::exp(-(diff * diff) / (dw * dw));
+				else
+					stop = diff == 0.0 ? 0.0 : 1.0 / (1.0 + std::pow(dw / diff, 2 * _order));
+				return _type == BandStop ? stop : 1.0 - stop;
+			}
+
+			case Notch:
+			{
+				double response = 1.0;
+				for(size_t i = 0; i < _notches.size(); ++i)
+				{
+					for(int sign = -1; sign <= 1; sign += 2)
+					{
+						double dx = fx - sign * _notches[i].first;
+						double dy = fy - sign * _notches[i].second;
+						double dk2 = dx * dx + dy * dy;
+						if(_shape == Gaussian)
+							response *= 1.0 - std::exp(-dk2 / (2.0 * c2));
+						else
+							response *= dk2 == 0.0 ? 0.0 : 1.0 / (1.0 + std::pow(c2 / dk2, _order));
+					}
+				}
+				return response;
+			}
+			}
+			return 1.0;
+		}
+
+		std::shared_ptr<const float> FrequencyFilter::Mask(uint32 width, uint32 height, uint32 columns)
+		{
+			std::lock_guard<std::mutex> lock(_cacheMutex);
+			std::tuple<uint32, uint32, uint32> key(width, height, columns);
+			auto it = _masks.find(key);
+			if(it != _masks.end())
+				return it->second;
+
+			float* mask = (float*)malloc(columns * height * sizeof(float));
+			if(mask == NULL)
+				return std::shared_ptr<const float>();
+
+			// Cell (row, col) holds frequency (col, row) for indices up to half of size and negative ones above
+			for(uint32 row = 0; row < height; ++row)
+			{
+				double fy = (row <= height / 2 ? (double)row : (double)row - height) / height;
+				float* mrow = mask + row * columns;
+				for(uint32 col = 0; col < columns; ++col)
+				{
+					double fx = (col <= width / 2 ? (double)col : (double)col - width) / width;
+					mrow[col] = (float)Response(fx, fy);
+				}
+			}
+
+			std::shared_ptr<const float> shared(mask, free);
+			_masks[key] = shared;
+			return shared;
+		}
+
+		bool ApplyFilter(FourierData* fourier, FrequencyFilter* filter)
+		{
+			// Reference keeps mask alive if filter parameters are changed meanwhile
+			std::shared_ptr<const float> maskRef = filter->Mask(fourier->Width, fourier->Height, fourier->Columns);
+			if(maskRef == NULL)
+				return false;
+			const float* mask = maskRef.get();
+
+			uint32 columns = fourier->Columns;
+			ParallelFor(fourier->Height, [&](int begin, int end)
+			{
+				for(int row = begin; row < end; ++row)
+				{
+					Complex* cells = fourier->Data + row * columns;
+					const float* mrow = mask + row * columns;
+					uint32 col = 0;
+#ifdef IMGOPS_FILTER_SSE2
+					// Four cells per step : four mask values are converted to doubles at once
+					// and expanded to (m, m) pairs matching (Real, Imag) of each cell
+					double* values = (double*)cells;
+					for(; col + 4 <= columns; col += 4)
+					{
+						__m128 m = _mm_loadu_ps(mrow + col);
+						__m128d m01 = _mm_cvtps_pd(m);
+						__m128d m23 = _mm_cvtps_pd(_mm_movehl_ps(m, m));
+						double* v = values + 2 * col;
+						_mm_storeu_pd(v, _mm_mul_pd(_mm_loadu_pd(v), _mm_unpacklo_pd(m01, m01)));
+						_mm_storeu_pd(v + 2, _mm_mul_pd(_mm_loadu_pd(v + 2), _mm_unpackhi_pd(m01, m01)));
+						_mm_storeu_pd(v + 4, _mm_mul_pd(_mm_loadu_pd(v + 4), _mm_unpacklo_pd(m23, m23)));
+						_mm_storeu_pd(v + 6, _mm_mul_pd(_mm_loadu_pd(v + 6), _mm_unpackhi_pd(m23, m23)));
+					}
+#endif
+					for(; col < columns; ++col)
+					{
+						cells[col].Real *= mrow[col];
+						cells[col].Imag *= mrow[col];
+					}
+				}
+			}, 1 + 32768 / columns);
+			return true;
+		}
+
+		bool FilterImage(Image* image, FourierData* buffer, FrequencyFilter* filter, Image* result, int channel)
+		{
+			if(FourierTransform(image, buffer, channel) == false)
+				return false;
+			if(ApplyFilter(buffer, filter) == false)
+				return false;
+			return InverseTransform(buffer, result);
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace ImgOps
+{
+	class Image;
+	struct FourierData;
+
+	namespace Fourier
+	{
+		// Radial mask applied to spectrum (FourierData, not shifted : DC is in cell (0,0))
+		// Frequencies are given in cycles per pixel (0 - DC, 0.5 - Nyquist), so the same filter
+		// may be used for spectra of any size. Masks are cached by spectrum size (cache is thread-safe),
+		// so filtering many images of the same size is a single multiplication pass
+		// Setters may be called while other threads run ApplyFilter() : filters already running keep
+		// the mask they started with, next ones use new parameters
+		class FrequencyFilter
+		{
+		public:
+			enum Type : int
+			{
+				LowPass = 0,
+				HighPass = 1,
+				BandPass = 2, // Passes ring of radius Cutoff and width BandWidth
+				BandStop = 3,
+				Notch = 4 // Rejects discs of radius Cutoff around each notch (and its symmetric frequency)
+			};
+
+			enum Shape : int
+			{
+				Gaussian = 0,
+				Butterworth = 1
+			};
+
+		protected:
+			Type _type;
+			Shape _shape;
+			double _cutoff;
+			double _bandWidth;
+			int _order;
+			std::vector<std::pair<double, double> > _notches;
+			std::mutex _cacheMutex; // Guards masks and parameters
+			std::map<std::tuple<uint32, uint32, uint32>, std::shared_ptr<const float> > _masks; // By width, height and columns
+
+		public:
+			// 'order' is used only by Butterworth filters
+			FrequencyFilter(Type type, Shape shape, double cutoff, double bandWidth = 0.0, int order = 2);
+			~FrequencyFilter();
+
+			Type FilterType() const { return _type; }
+			Shape FilterShape() const { return _shape; }
+			double Cutoff() const { return _cutoff; }
+			double BandWidth() const { return _bandWidth; }
+			int Order() const { return _order; }
+
+			// Setters drop cached masks
+			void SetCutoff(double cutoff);
+			void SetBandWidth(double bandWidth);
+			void SetOrder(int order);
+			// Adds notch on frequency (fx, fy) in cycles per pixel, (-fx, -fy) is rejected as well
+			void AddNotch(double fx, double fy);
+			void ClearNotches();
+
+			// Returns response of filter (in range [0,1]) for given frequency
+			// (not synchronized with setters)
+			double Response(double fx, double fy) const;
+
+			// Returns mask of 'height' rows of 'columns' values for spectrum of size 'width' x 'height'
+			// ('columns' is width/2+1 for half spectrum), mask is shared with filter cache and stays
+			// valid after setters drop it from cache
+			std::shared_ptr<const float> Mask(uint32 width, uint32 height, uint32 columns);
+
+		private:
+			FrequencyFilter(const FrequencyFilter&);
+			FrequencyFilter& operator=(const FrequencyFilter&);
+		};
+
+		// Multiplies spectrum by filter mask in place
+		bool ApplyFilter(FourierData* fourier, FrequencyFilter* filter);
+
+		// Whole round trip : transforms image (intensities or 'channel') into 'buffer' (half spectrum
+		// at least of image size, see FourierTransform(Image*, FourierData*, int)), applies filter
+		// and stores inverse transform in 'result' (Gray8 or GrayFloat32 of image size)
+		// No per-image memory is allocated (see InverseTransform(FourierData*, Image*)), so the same buffer
+		// may be used for many images
+		bool FilterImage(Image* image, FourierData* buffer, FrequencyFilter* filter, Image* result, int channel = -1);
+	}
+}
@@ -4,6 +4,17 @@
 
 namespace ImgOps
 {
+	// Receives image rows as they are produced (i.e. by decoder) so image
+	// may be stored in other form than Image (like TiledImage)
+	__interface ImageRowSink
+	{
+	public:
+		// Called once image size is known, before any row is stored
+		virtual void BeginImage(int width, int height, PixelFormat format) = 0;
+		// Stores one full row of pixels (width * pixel size bytes)
+		virtual void StoreRow(int row, const byte* data) = 0;
+	};
+
 	class Image
 	{
 	protected:
@@ -21,6 +32,9 @@ namespace ImgOps
 
 		PixelFormat _decryptedFormat; // If != 0 then image is encrypted. Format of decrypted image was one stored here
 		uint32 _decryptedLastChunkSize;
+		uint32 _encryptionMode; // RSA::EncryptionMode used for encrypted image
+		byte* _wrappedKey; // RSA encrypted key of symmetric cipher for hybrid encryption, NULL otherwise
+		uint32 _wrappedKeyLength;
 
 	public:
 		Image(int width, int height, PixelFormat format)
@@ -36,6 +50,10 @@ namespace ImgOps
 			_palettes = NULL;
 			_palettesCount = 0;
 			_decryptedFormat = PixelFormats::Unknown;
+			_decryptedLastChunkSize = 0;
+			_encryptionMode = 0;
+			_wrappedKey = NULL;
+			_wrappedKeyLength = 0;
 		}
 		
 		Image(int width, int height, PixelFormat format, int palettes)
@@ -52,6 +70,10 @@ namespace ImgOps
 			_palettesCount = palettes;
 			_palettes = (byte*)malloc(palettes * 3);
 			_decryptedFormat = PixelFormats::Unknown;
+			_decryptedLastChunkSize = 0;
+			_encryptionMode = 0;
+			_wrappedKey = NULL;
+			_wrappedKeyLength = 0;
 		}
 
 		Image(int width, int height, PixelFormat format, byte* data)
@@ -67,12 +89,17 @@ namespace ImgOps
 			_palettes = NULL;
 			_palettesCount = 0;
 			_decryptedFormat = PixelFormats::Unknown;
+			_decryptedLastChunkSize = 0;
+			_encryptionMode = 0;
+			_wrappedKey = NULL;
+			_wrappedKeyLength = 0;
 		}
 
 		~Image()
 		{
 			free(_dataPtr);
 			if(_palettes != NULL) free(_palettes);
+			if(_wrappedKey != NULL) free(_wrappedKey);
 		}
 
 		int Width() const { return _width; }
@@ -84,7 +111,16 @@ namespace ImgOps
 
 		byte* Data() { return _dataPtr; }
 
+		// Returns pointer to first pixel in given row
+		byte* Row(int row) { return _dataPtr + row * _stride; }
+		const byte* Row(int row) const { return _dataPtr + row * _stride; }
+
+		// Returns row of image with floating point format (GrayFloat32 / RgbaFloat32)
+		float* FloatRow(int row) { return reinterpret_cast<float*>(Row(row)); }
+		const float* FloatRow(int row) const { return reinterpret_cast<const float*>(Row(row)); }
+
 		PixelFormat PixFormat() const { return _format; }
+		bool IsFloatingPoint() const { return PixelFormats::IsFloatingPoint(_format); }
 
 		PixelFormat GetDecryptedFormat() const { return _decryptedFormat; }
 		void SetDecryptedFormat(PixelFormat format) { _decryptedFormat = format; }
@@ -93,6 +129,26 @@ namespace ImgOps
 		uint32 GetDecryptedLastChunkSize() const { return _decryptedLastChunkSize; }
 		void SetDecryptedLastChunkSize(uint32 size) { _decryptedLastChunkSize = size; }
 
+		uint32 GetEncryptionMode() const { return _encryptionMode; }
+		void SetEncryptionMode(uint32 mode) { _encryptionMode = mode; }
+
+		const byte* GetWrappedKey() const { return _wrappedKey; }
+		uint32 GetWrappedKeyLength() const { return _wrappedKeyLength; }
+		// Copies 'length' bytes of key (NULL / 0 removes key)
+		void SetWrappedKey(const byte* key, uint32 length)
+		{
+			if(_wrappedKey != NULL)
+				free(_wrappedKey);
+			_wrappedKey = NULL;
+			_wrappedKeyLength = 0;
+			if(key != NULL && length > 0)
+			{
+				_wrappedKey = (byte*)malloc(length);
+				memcpy(_wrappedKey, key, length);
+				_wrappedKeyLength = length;
+			}
+		}
+
 		void SetPalettesCount(int count)
 		{
 			if(_palettes != NULL) 
@@ -146,6 +202,9 @@ namespace ImgOps
 			byte* pix = Pixel(index);
 			switch (_pixelSize)
 			{
+			case 16:
+				memcpy(pix, value, 16);
+				break;
 			case 8:
 				pix[7] = value[7];
 				pix[6] = value[6];
@@ -0,0 +1,130 @@
+#include "MemoryStream.h"
+
+namespace ImgOps
+{
+	MemoryStream::MemoryStream(uint64 initialCapacity)
+	{
+		_data = NULL;
+		_capacity = 0;
+		_length = 0;
+		_position = 0;
+		if(initialCapacity > 0)
+			Reserve(initialCapacity);
+	}
+
+	MemoryStream::~MemoryStream()
+	{
+		if(_data != NULL)
+			free(_data);
+	}
+
+	void MemoryStream::Reserve(uint64 capacity)
+	{
+		if(capacity <= _capacity)
+			return;
+
+		byte* data = (byte*)realloc(_data, (size_t)capacity);
+		if(data == NULL)
+			return;
+		_data = data;
+		_capacity = capacity;
+	}
+
+	byte* MemoryStream::Detach()
+	{
+		byte* data = _data;
+		_data = NULL;
+		_capacity = 0;
+		_length = 0;
+		_position = 0;
+		return data;
+	}
+
+	bool MemoryStream::SetPosition(int64 pos)
+	{
+		if(pos < 0)
+			return false;
+		_position = pos;
+		return true;
+	}
+
+	bool MemoryStream::ReadByte(byte* data)
+	{
+		if(_position >= _length)
+			return false;
+		*data = _data[_position++];
+		return true;
+	}
+
+	bool MemoryStream::WriteByte(byte data)
+	{
+		return WriteSome(1, &data) == 1;
+	}
+
+	int64 MemoryStream::ReadSome(int64 bytesToRead, byte* buffer)
+	{
+		int64 count = _length - _position;
+		if(count > bytesToRead)
+			count = bytesToRead;
+		if(count <= 0)
+			return 0;
+
+		memcpy(buffer, _data + _position, (size_t)count);
+		_position += count;
+		return count;
+	}
+
+	int64 MemoryStream::WriteSome(int64 bytesToWrite, byte* buffer)
+	{
+		if(bytesToWrite <= 0)
+			return 0;
+
+		uint64 end = (uint64)(_position + bytesToWrite);
+		if(end > _capacity)
+		{
+			uint64 capacity = _capacity < 256 ? 256 : _capacity;
+			while(capacity < end)
+				capacity *= 2;
+			Reserve(capacity);
+			if(end > _capacity)
+				return 0;
+		}
+
+		if(_position > _length)
+			memset(_data + _length, 0, (size_t)(_position - _length));
+		memcpy(_data + _position, buffer, (size_t)bytesToWrite);
+		_position += bytesToWrite;
+		if(_position > _length)
+			_length = _position;
+		return bytesToWrite;
+	}
+
+	bool ConstMemoryStream::SetPosition(int64 pos)
+	{
+		if(pos < 0 || pos > _length)
+			return false;
+		_position = pos;
+		return true;
+	}
+
+	bool ConstMemoryStream::ReadByte(byte* data)
+	{
+		if(_position >= _length)
+			return false;
+		*data = _data[_position++];
+		return true;
+	}
+
+	int64 ConstMemoryStream::ReadSome(int64 bytesToRead, byte* buffer)
+	{
+		int64 count = _length - _position;
+		if(count > bytesToRead)
+			count = bytesToRead;
+		if(count <= 0)
+			return 0;
+
+		memcpy(buffer, _data + _position, (size_t)count);
+		_position += count;
+		return count;
+	}
+}
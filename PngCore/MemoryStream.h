@@ -0,0 +1,84 @@
+#pragma once
+
+#include "DataStream.h"
+
+namespace ImgOps
+{
+	// Stream writing to / reading from growable memory buffer
+	// Buffer grows geometrically, final size may be hinted with Reserve() to avoid reallocations
+	// Setting position past the end and writing fills the gap with zeros
+	class MemoryStream : public IDataStream
+	{
+	protected:
+		byte* _data;
+		uint64 _capacity;
+		int64 _length;
+		int64 _position;
+
+	public:
+		MemoryStream(uint64 initialCapacity = 0);
+		~MemoryStream();
+
+		// Makes sure buffer can hold at least 'capacity' bytes
+		void Reserve(uint64 capacity);
+		uint64 Capacity() const { return _capacity; }
+
+		byte* Data() { return _data; }
+		const byte* Data() const { return _data; }
+
+		// Returns buffer (allocated with malloc, so must be released with free()) and empties the stream
+		byte* Detach();
+		// Sets length and position to zero, keeps allocated buffer
+		void Clear() { _length = 0; _position = 0; }
+
+		int64 Length() { return _length; }
+		bool IsOpen() { return true; }
+
+		bool NextByte() { return MovePosition(1); }
+		int64 Position() { return _position; }
+		bool SetPosition(int64 pos);
+		bool MovePosition(int64 posChange) { return SetPosition(_position + posChange); }
+
+		bool ReadByte(byte* data);
+		bool WriteByte(byte data);
+
+		int64 ReadSome(int64 bytesToRead, byte* buffer);
+		int64 WriteSome(int64 bytesToWrite, byte* buffer);
+
+	private:
+		MemoryStream(const MemoryStream&);
+		MemoryStream& operator=(const MemoryStream&);
+	};
+
+	// Read-only stream over existing memory (data is not copied and must outlive the stream)
+	class ConstMemoryStream : public IDataStream
+	{
+	protected:
+		const byte* _data;
+		int64 _length;
+		int64 _position;
+
+	public:
+		ConstMemoryStream(const byte* data, uint64 length) :
+			_data(data),
+			_length((int64)length),
+			_position(0)
+		{ }
+
+		const byte* Data() const { return _data; }
+
+		int64 Length() { return _length; }
+		bool IsOpen() { return _data != NULL; }
+
+		bool NextByte() { return MovePosition(1); }
+		int64 Position() { return _position; }
+		bool SetPosition(int64 pos);
+		bool MovePosition(int64 posChange) { return SetPosition(_position + posChange); }
+
+		bool ReadByte(byte* data);
+		bool WriteByte(byte) { return false; }
+
+		int64 ReadSome(int64 bytesToRead, byte* buffer);
+		int64 WriteSome(int64, byte*) { return 0; }
+	};
+}
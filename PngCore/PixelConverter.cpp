@@ -0,0 +1,496 @@
+#include "PixelConverter.h"
+#include "Image.h"
+#include "TiledImage.h"
+#include <cmath>
+
+namespace ImgOps
+{
+	namespace PixelConverter
+	{
+		SampleToFloatTable::SampleToFloatTable(int bitDepth, float gamma)
+		{
+			BitDepth = bitDepth;
+			Gamma = gamma;
+			Values = NULL;
+
+			// 16bit linear conversion is just a scale, so table is not needed
+			if(bitDepth == 16 && gamma == 1.0f)
+				return;
+
+			int count = 1 << bitDepth;
+			float maxInv = 1.0f / (float)(count - 1);
+			Values = (float*)malloc(count * sizeof(float));
+			for(int i = 0; i < count; ++i)
+			{
+				float v = (float)i * maxInv;
+				Values[i] = gamma == 1.0f ? v : powf(v, gamma);
+			}
+		}
+
+		SampleToFloatTable::~SampleToFloatTable()
+		{
+			if(Values != NULL)
+				free(Values);
+		}
+
+		const SampleToFloatTable& LinearSampleTable(int bitDepth)
+		{
+			static const SampleToFloatTable table8(8);
+			static const SampleToFloatTable table16(16);
+			return bitDepth == 16 ? table16 : table8;
+		}
+
+		FloatToSampleTable::FloatToSampleTable(int bitDepth, float gamma)
+		{
+			BitDepth = bitDepth;
+			Gamma = gamma;
+			GammaInv = 1.0f / gamma;
+			Thresholds = NULL;
+
+			if(gamma == 1.0f || bitDepth != 8)
+				return;
+
+			// Midpoints between levels in encoded domain, decoded : level k is chosen for v in [Thresholds[k-1], Thresholds[k])
+			Thresholds = (float*)malloc(255 * sizeof(float));
+			for(int k = 0; k < 255; ++k)
+				Thresholds[k] = (float)pow((k + 0.5) / 255.0, (double)gamma);
+		}
+
+		FloatToSampleTable::~FloatToSampleTable()
+		{
+			if(Thresholds != NULL)
+				free(Thresholds);
+		}
+
+		inline float ClampUnit(float v)
+		{
+			return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+		}
+
+		void SamplesToFloat(const byte* src, float* dst, int count, const SampleToFloatTable& table)
+		{
+			if(table.BitDepth == 8)
+			{
+				const float* values = table.Values;
+				for(int i = 0; i < count; ++i)
+					dst[i] = values[src[i]];
+			}
+			else if(table.Values != NULL)
+			{
+				const float* values = table.Values;
+				for(int i = 0; i < count; ++i)
+					dst[i] = values[((uint32)src[2*i] << 8) | src[2*i + 1]];
+			}
+			else
+			{
+				const float scale = 1.0f / 65535.0f;
+				for(int i = 0; i < count; ++i)
+					dst[i] = (float)(((uint32)src[2*i] << 8) | src[2*i + 1]) * scale;
+			}
+		}
+
+		void FloatToSamples(const float* src, byte* dst, int count, const FloatToSampleTable& table)
+		{
+			if(table.Thresholds != NULL)
+			{
+				// Number of thresholds not greater than value (NaN gives 0)
+				const float* thresholds = table.Thresholds;
+				for(int i = 0; i < count; ++i)
+				{
+					float v = src[i];
+					int k = 0;
+					for(int step = 128; step > 0; step >>= 1)
+						k += v >= thresholds[k + step - 1] ? step : 0;
+					dst[i] = (byte)k;
+				}
+			}
+			else if(table.Gamma != 1.0f && table.BitDepth == 16)
+			{
+				const float gammaInv = table.GammaInv;
+				for(int i = 0; i < count; ++i)
+				{
+					uint32 v = (uint32)(powf(ClampUnit(src[i]), gammaInv) * 65535.0f + 0.5f);
+					dst[2*i] = (byte)(v >> 8);
+					dst[2*i + 1] = (byte)v;
+				}
+			}
+			else if(table.BitDepth == 8)
+			{
+				for(int i = 0; i < count; ++i)
+					dst[i] = (byte)(ClampUnit(src[i]) * 255.0f + 0.5f);
+			}
+			else
+			{
+				for(int i = 0; i < count; ++i)
+				{
+					uint32 v = (uint32)(ClampUnit(src[i]) * 65535.0f + 0.5f);
+					dst[2*i] = (byte)(v >> 8);
+					dst[2*i + 1] = (byte)v;
+				}
+			}
+		}
+
+		Image* ConvertIndexedToFloat(Image* image, float gamma)
+		{
+			Image* result = new Image(image->Width(), image->Height(), PixelFormats::RgbaFloat32);
+
+			// Convert palettes once, then just copy colors for each pixel
+			SampleToFloatTable table(8, gamma);
+			float palettes[256 * 4];
+			for(int p = 0; p < image->GetPalettesCount() && p < 256; ++p)
+			{
+				SamplesToFloat(image->Palette(p), palettes + 4 * p, 3, table);
+				palettes[4 * p + 3] = 1.0f;
+			}
+
+			for(int row = 0; row < image->Height(); ++row)
+			{
+				const byte* src = image->Row(row);
+				float* dst = result->FloatRow(row);
+				for(int col = 0; col < image->Width(); ++col)
+				{
+					const float* color = palettes + 4 * src[col];
+					dst[4 * col] = color[0];
+					dst[4 * col + 1] = color[1];
+					dst[4 * col + 2] = color[2];
+					dst[4 * col + 3] = color[3];
+				}
+			}
+			return result;
+		}
+
+		bool IsSupportedIntegerFormat(PixelFormat format)
+		{
+			switch (format)
+			{
+			case PixelFormats::Gray8:
+			case PixelFormats::Gray16:
+			case PixelFormats::GrayAlpha16:
+			case PixelFormats::GrayAlpha32:
+			case PixelFormats::Rgb24:
+			case PixelFormats::Rgb48:
+			case PixelFormats::Rgba32:
+			case PixelFormats::Rgba64:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		PixelFormat GetFloatFormat(PixelFormat format)
+		{
+			return format == PixelFormats::Gray8 || format == PixelFormats::Gray16 ? 
+				PixelFormats::GrayFloat32 : PixelFormats::RgbaFloat32;
+		}
+
+		void PixelsToFloat(PixelFormat format, const byte* src, float* dst, int count,
+			const SampleToFloatTable& colorTable, const SampleToFloatTable& alphaTable, float* rowBuffer)
+		{
+			int channels = PixelFormats::GetChannels(format);
+			if(GetFloatFormat(format) == PixelFormats::GrayFloat32)
+			{
+				SamplesToFloat(src, dst, count, colorTable);
+				return;
+			}
+
+			SamplesToFloat(src, rowBuffer, count * channels, colorTable);
+			if((format & PixelFormats::HaveAlphaChannel) != 0 && colorTable.Gamma != 1.0f)
+			{
+				// Alpha was converted with gamma, so convert it once more linearly
+				int channelSize = colorTable.BitDepth / 8;
+				int pixelSize = channels * channelSize;
+				int alphaOffset = (channels - 1) * channelSize;
+				for(int col = 0; col < count; ++col)
+				{
+					SamplesToFloat(src + col * pixelSize + alphaOffset,
+						rowBuffer + col * channels + channels - 1, 1, alphaTable);
+				}
+			}
+
+			// Expand samples to rgba
+			switch (channels)
+			{
+			case 2: // Gray + alpha
+				for(int col = 0; col < count; ++col)
+				{
+					dst[4 * col] = dst[4 * col + 1] = dst[4 * col + 2] = rowBuffer[2 * col];
+					dst[4 * col + 3] = rowBuffer[2 * col + 1];
+				}
+				break;
+			case 3:
+				for(int col = 0; col < count; ++col)
+				{
+					dst[4 * col] = rowBuffer[3 * col];
+					dst[4 * col + 1] = rowBuffer[3 * col + 1];
+					dst[4 * col + 2] = rowBuffer[3 * col + 2];
+					dst[4 * col + 3] = 1.0f;
+				}
+				break;
+			case 4:
+				memcpy(dst, rowBuffer, count * 4 * sizeof(float));
+				break;
+			}
+		}
+
+		void FloatToPixels(int srcChannels, const float* src, PixelFormat format, byte* dst, int count,
+			const FloatToSampleTable& colorTable, const FloatToSampleTable& alphaTable, float* rowBuffer)
+		{
+			int dstChannels = PixelFormats::GetChannels(format);
+			bool dstAlpha = (format & PixelFormats::HaveAlphaChannel) != 0;
+			int channelSize = colorTable.BitDepth / 8;
+			const float third = 1.0f / 3.0f;
+
+			// Rearrange floats to destination channel layout
+			if(srcChannels == dstChannels)
+			{
+				memcpy(rowBuffer, src, count * dstChannels * sizeof(float));
+			}
+			else if(srcChannels == 1)
+			{
+				for(int col = 0; col < count; ++col)
+				{
+					float* pix = rowBuffer + col * dstChannels;
+					for(int c = 0; c < dstChannels; ++c)
+						pix[c] = src[col];
+					if(dstAlpha)
+						pix[dstChannels - 1] = 1.0f;
+				}
+			}
+			else // Rgba to Gray / GrayAlpha / Rgb
+			{
+				for(int col = 0; col < count; ++col)
+				{
+					const float* srcPix = src + 4 * col;
+					float* pix = rowBuffer + col * dstChannels;
+					if(dstChannels == 3)
+					{
+						pix[0] = srcPix[0];
+						pix[1] = srcPix[1];
+						pix[2] = srcPix[2];
+					}
+					else
+					{
+						pix[0] = (srcPix[0] + srcPix[1] + srcPix[2]) * third;
+						if(dstAlpha)
+							pix[1] = srcPix[3];
+					}
+				}
+			}
+
+			FloatToSamples(rowBuffer, dst, count * dstChannels, colorTable);
+			if(dstAlpha && colorTable.Gamma != 1.0f)
+			{
+				// Alpha is always stored linearly
+				for(int col = 0; col < count; ++col)
+				{
+					int sample = col * dstChannels + dstChannels - 1;
+					FloatToSamples(rowBuffer + sample, dst + sample * channelSize, 1, alphaTable);
+				}
+			}
+		}
+
+		Image* ConvertToFloat(Image* image, float gamma)
+		{
+			PixelFormat format = image->PixFormat();
+			int width = image->Width();
+			int height = image->Height();
+
+			if(image->IsFloatingPoint())
+			{
+				Image* copy = new Image(width, height, format);
+				memcpy(copy->Data(), image->Data(), (size_t)image->Stride() * height);
+				return copy;
+			}
+
+			if(format == PixelFormats::Indexed)
+				return ConvertIndexedToFloat(image, gamma);
+
+			if(IsSupportedIntegerFormat(format) == false)
+				return NULL;
+
+			Image* result = new Image(width, height, GetFloatFormat(format));
+			SampleToFloatTable colorTable(image->ChannelSize() * 8, gamma);
+			SampleToFloatTable alphaTable(image->ChannelSize() * 8, 1.0f);
+			float* rowBuf = (float*)malloc(width * 4 * sizeof(float));
+
+			for(int row = 0; row < height; ++row)
+			{
+				PixelsToFloat(format, image->Row(row), result->FloatRow(row), width,
+					colorTable, alphaTable, rowBuf);
+			}
+
+			free(rowBuf);
+			return result;
+		}
+
+		bool ConvertToFloat(TiledImage* image, TiledImage* result, float gamma)
+		{
+			PixelFormat format = image->PixFormat();
+			if(IsSupportedIntegerFormat(format) == false)
+				return false;
+
+			result->Create(image->Width(), image->Height(), GetFloatFormat(format));
+			SampleToFloatTable colorTable(image->ChannelSize() * 8, gamma);
+			SampleToFloatTable alphaTable(image->ChannelSize() * 8, 1.0f);
+			float* rowBuf = (float*)malloc(TiledImage::TileSize * 4 * sizeof(float));
+			byte* srcCopy = (byte*)malloc(image->TileStride() * TiledImage::TileSize);
+
+			for(int tileY = 0; tileY < image->TilesY(); ++tileY)
+			{
+				for(int tileX = 0; tileX < image->TilesX(); ++tileX)
+				{
+					// Never written tiles are all zeros, which converts to zeros as well
+					const byte* src = image->TileForRead(tileX, tileY);
+					if(src == NULL)
+						continue;
+
+					// Tiles of both images has same positions, but source one may be paged out
+					// when result tile is loaded, so convert through copy of source tile
+					memcpy(srcCopy, src, image->TileStride() * TiledImage::TileSize);
+					byte* dst = result->Tile(tileX, tileY);
+					for(int row = 0; row < image->TileHeight(tileY); ++row)
+					{
+						PixelsToFloat(format, srcCopy + row * image->TileStride(),
+							(float*)(dst + row * result->TileStride()), image->TileWidth(tileX),
+							colorTable, alphaTable, rowBuf);
+					}
+				}
+			}
+
+			free(srcCopy);
+			free(rowBuf);
+			return true;
+		}
+
+		Image* ConvertFromFloat(Image* image, PixelFormat format, float gamma)
+		{
+			if(image->IsFloatingPoint() == false || IsSupportedIntegerFormat(format) == false)
+				return NULL;
+
+			int width = image->Width();
+			int height = image->Height();
+			int srcChannels = PixelFormats::GetChannels(image->PixFormat());
+			int channelSize = PixelFormats::GetPixelSize(format) / PixelFormats::GetChannels(format);
+
+			Image* result = new Image(width, height, format);
+			FloatToSampleTable colorTable(channelSize * 8, gamma);
+			FloatToSampleTable alphaTable(channelSize * 8, 1.0f);
+			float* rowBuf = (float*)malloc(width * 4 * sizeof(float));
+
+			for(int row = 0; row < height; ++row)
+			{
+				FloatToPixels(srcChannels, image->FloatRow(row), format, result->Row(row), width,
+					colorTable, alphaTable, rowBuf);
+			}
+
+			free(rowBuf);
+			return result;
+		}
+
+		bool ConvertFromFloat(TiledImage* image, TiledImage* result, PixelFormat format, float gamma)
+		{
+			if(image->IsFloatingPoint() == false || IsSupportedIntegerFormat(format) == false)
+				return false;
+
+			int srcChannels = PixelFormats::GetChannels(image->PixFormat());
+			int channelSize = PixelFormats::GetPixelSize(format) / PixelFormats::GetChannels(format);
+
+			result->Create(image->Width(), image->Height(), format);
+			FloatToSampleTable colorTable(channelSize * 8, gamma);
+			FloatToSampleTable alphaTable(channelSize * 8, 1.0f);
+			float* rowBuf = (float*)malloc(TiledImage::TileSize * 4 * sizeof(float));
+			byte* srcCopy = (byte*)malloc(image->TileStride() * TiledImage::TileSize);
+
+			for(int tileY = 0; tileY < image->TilesY(); ++tileY)
+			{
+				for(int tileX = 0; tileX < image->TilesX(); ++tileX)
+				{
+					const byte* src = image->TileForRead(tileX, tileY);
+					if(src == NULL)
+						continue;
+
+					memcpy(srcCopy, src, image->TileStride() * TiledImage::TileSize);
+					byte* dst = result->Tile(tileX, tileY);
+					for(int row = 0; row < image->TileHeight(tileY); ++row)
+					{
+						FloatToPixels(srcChannels, (const float*)(srcCopy + row * image->TileStride()),
+							format, dst + row * result->TileStride(), image->TileWidth(tileX),
+							colorTable, alphaTable, rowBuf);
+					}
+				}
+			}
+
+			free(srcCopy);
+			free(rowBuf);
+			return true;
+		}
+
+		void ExtractIntensity(PixelFormat format, const byte* pixels, int count, int channel,
+			const SampleToFloatTable& table, float* rowBuffer, float* intensity)
+		{
+			int channels = PixelFormats::GetChannels(format);
+
+			const float* samples;
+			if(PixelFormats::IsFloatingPoint(format))
+			{
+				samples = reinterpret_cast<const float*>(pixels);
+			}
+			else
+			{
+				SamplesToFloat(pixels, rowBuffer, count * channels, table);
+				samples = rowBuffer;
+			}
+
+			if(channel >= 0)
+			{
+				for(int col = 0; col < count; ++col)
+					intensity[col] = samples[col * channels + channel];
+			}
+			else if((format & PixelFormats::TrueColor) != 0)
+			{
+				const float third = 1.0f / 3.0f;
+				for(int col = 0; col < count; ++col)
+				{
+					const float* pix = samples + col * channels;
+					intensity[col] = (pix[0] + pix[1] + pix[2]) * third;
+				}
+			}
+			else
+			{
+				for(int col = 0; col < count; ++col)
+					intensity[col] = samples[col * channels];
+			}
+		}
+
+		void ExtractChannels(PixelFormat format, const byte* pixels, int count, int channelCount,
+			const SampleToFloatTable& table, float* rowBuffer, float* const* channels)
+		{
+			int channelsInFormat = PixelFormats::GetChannels(format);
+
+			const float* samples;
+			if(PixelFormats::IsFloatingPoint(format))
+			{
+				samples = reinterpret_cast<const float*>(pixels);
+			}
+			else
+			{
+				SamplesToFloat(pixels, rowBuffer, count * channelsInFormat, table);
+				samples = rowBuffer;
+			}
+
+			for(int c = 0; c < channelCount; ++c)
+			{
+				float* dst = channels[c];
+				for(int col = 0; col < count; ++col)
+					dst[col] = samples[col * channelsInFormat + c];
+			}
+		}
+
+		void ExtractIntensityRow(Image* image, int row, int channel,
+			const SampleToFloatTable& table, float* rowBuffer, float* intensity)
+		{
+			ExtractIntensity(image->PixFormat(), image->Row(row), image->Width(), channel,
+				table, rowBuffer, intensity);
+		}
+	}
+}
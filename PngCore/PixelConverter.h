@@ -0,0 +1,108 @@
+#pragma once
+
+#include "TypeDefs.h"
+
+namespace ImgOps
+{
+	class Image;
+	class TiledImage;
+
+	namespace PixelConverter
+	{
+		// Look-up table converting integer samples (8/16 bit) to floats in range [0,1]
+		// If 'gamma' != 1 each value v is stored as v^gamma (so gamma-encoded samples are linearized)
+		// For 16bit samples without gamma table is not created and samples are scaled directly
+		struct SampleToFloatTable
+		{
+		public:
+			int BitDepth;
+			float Gamma;
+			float* Values; // 2^BitDepth entries or NULL
+
+			SampleToFloatTable(int bitDepth, float gamma = 1.0f);
+			~SampleToFloatTable();
+
+		private:
+			SampleToFloatTable(const SampleToFloatTable&);
+			SampleToFloatTable& operator=(const SampleToFloatTable&);
+		};
+
+		// Shared linear table (gamma 1) for 8 or 16 bit samples, created once and never changed
+		// (so conversions done for every image don't build tables)
+		const SampleToFloatTable& LinearSampleTable(int bitDepth);
+
+		// Converter of floats in range [0,1] to integer samples (8/16 bit)
+		// If 'gamma' != 1 each value v is encoded as v^(1/gamma) : 8bit samples are found by binary search
+		// of thresholds between decoded levels (so round trip with SampleToFloatTable of the same gamma is exact),
+		// 16bit ones are computed directly (table over linear values is too coarse near black)
+		// Without gamma floats are scaled and rounded directly
+		struct FloatToSampleTable
+		{
+		public:
+			int BitDepth;
+			float Gamma;
+			float GammaInv;
+			float* Thresholds; // For 8bit with gamma : 255 entries, v >= Thresholds[k] gives sample > k, otherwise NULL
+
+			FloatToSampleTable(int bitDepth, float gamma = 1.0f);
+			~FloatToSampleTable();
+
+		private:
+			FloatToSampleTable(const FloatToSampleTable&);
+			FloatToSampleTable& operator=(const FloatToSampleTable&);
+		};
+
+		// Converts 'count' samples from 'src' to floats using given table
+		// 16bit samples are stored big-endian (same as in png / Image)
+		void SamplesToFloat(const byte* src, float* dst, int count, const SampleToFloatTable& table);
+
+		// Converts 'count' floats to samples (clamped to [0,1] first) using given table
+		void FloatToSamples(const float* src, byte* dst, int count, const FloatToSampleTable& table);
+
+		// Returns GrayFloat32 for gray formats without alpha and RgbaFloat32 for any other
+		// Indexed images are converted using their palettes, missing alpha is set to 1
+		// 'gamma' is applied to color channels only (alpha is always linear)
+		Image* ConvertToFloat(Image* image, float gamma = 1.0f);
+
+		// Same as above for tiled image, tiles are converted one by one (Indexed is not supported)
+		// 'result' is recreated with same size and float format, returns false if format is not supported
+		bool ConvertToFloat(TiledImage* image, TiledImage* result, float gamma = 1.0f);
+
+		// Converts GrayFloat32 / RgbaFloat32 image to one of integer formats:
+		// Gray8, Gray16, GrayAlpha16, GrayAlpha32, Rgb24, Rgb48, Rgba32, Rgba64
+		// Color to gray conversion uses channels average
+		// Returns NULL if formats are not supported
+		Image* ConvertFromFloat(Image* image, PixelFormat format, float gamma = 1.0f);
+
+		// Same as above for tiled image, tiles are converted one by one
+		bool ConvertFromFloat(TiledImage* image, TiledImage* result, PixelFormat format, float gamma = 1.0f);
+
+		// Converts row of 'count' pixels of integer format to GrayFloat32 (for Gray8 / Gray16) or RgbaFloat32
+		// 'rowBuffer' must hold 4 * count floats, 'colorTable' / 'alphaTable' must match format channel size
+		void PixelsToFloat(PixelFormat format, const byte* src, float* dst, int count,
+			const SampleToFloatTable& colorTable, const SampleToFloatTable& alphaTable, float* rowBuffer);
+
+		// Converts row of 'count' pixels with 'srcChannels' floats (1 or 4) to integer format
+		// 'rowBuffer' must hold 4 * count floats
+		void FloatToPixels(int srcChannels, const float* src, PixelFormat format, byte* dst, int count,
+			const FloatToSampleTable& colorTable, const FloatToSampleTable& alphaTable, float* rowBuffer);
+
+		// Stores intensities of 'count' pixels of given format as floats in range [0,1]
+		// (see ExtractIntensityRow())
+		void ExtractIntensity(PixelFormat format, const byte* pixels, int count, int channel,
+			const SampleToFloatTable& table, float* rowBuffer, float* intensity);
+
+		// Stores first 'channelCount' channels of 'count' pixels in separate arrays 'channels[c]' as floats
+		// (rowBuffer / table same as for ExtractIntensity())
+		void ExtractChannels(PixelFormat format, const byte* pixels, int count, int channelCount,
+			const SampleToFloatTable& table, float* rowBuffer, float* const* channels);
+
+		// Stores pixel intensities of given row as floats in range [0,1]
+		// Intensity is channels average (without alpha) if 'channel' < 0 or value of given channel otherwise
+		// 'rowBuffer' must be able to hold one row of samples as floats (width * channels),
+		// 'table' must match image channel size (not used for floating point images)
+		// Indexed images are not supported
+		void ExtractIntensityRow(Image* image, int row, int channel,
+			const SampleToFloatTable& table, float* rowBuffer, float* intensity);
+	}
+}
@@ -0,0 +1,38 @@
+#include "PngBatch.h"
+#include "PngImage.h"
+#include "MemoryStream.h"
+
+namespace ImgOps
+{
+	bool PngBatchDecoder::DecodeNext(Image** image, string* path)
+	{
+		AsyncFileReader::Result file;
+		if(_reader.Next(&file) == false)
+			return false;
+
+		if(path != NULL)
+			*path = file.Path;
+
+		*image = NULL;
+		if(file.Success)
+		{
+			PNGImageDecoder decoder;
+			*image = decoder.DecodeFromMemory(file.Data, file.Size);
+		}
+		if(file.Data != NULL)
+			free(file.Data);
+		return true;
+	}
+
+	bool PngBatchEncoder::Encode(Image* image, const char* path)
+	{
+		MemoryStream stream;
+		PNGImageEncoder encoder;
+		if(encoder.EncodeToMemory(image, &stream) == false)
+			return false;
+
+		uint64 size = stream.Length();
+		_writer.Submit(path, stream.Detach(), size);
+		return true;
+	}
+}
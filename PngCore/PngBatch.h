@@ -0,0 +1,45 @@
+#pragma once
+
+#include "AsyncIO.h"
+
+namespace ImgOps
+{
+	class Image;
+
+	// Decodes list of png files in order, next 'lookahead' files are read in background
+	// while current one is inflated and unfiltered
+	// 'pool' is used only for blocking reads when io_uring is not available (see AsyncFileQueue)
+	class PngBatchDecoder
+	{
+	protected:
+		AsyncFileReader _reader;
+
+	public:
+		PngBatchDecoder(int lookahead = 4, ThreadPool* pool = NULL) :
+			_reader(lookahead, pool)
+		{ }
+
+		void AddFile(const char* path) { _reader.Submit(path); }
+
+		// Decodes next file, returns false if there are no more files
+		// 'image' is set to NULL if file could not be read or decoded, otherwise caller owns it
+		bool DecodeNext(Image** image, string* path = NULL);
+	};
+
+	// Encodes images to memory and writes them to files in background
+	class PngBatchEncoder
+	{
+	protected:
+		AsyncFileWriter _writer;
+
+	public:
+		PngBatchEncoder(int queueDepth = 4, ThreadPool* pool = NULL) :
+			_writer(queueDepth, pool)
+		{ }
+
+		// Returns false if image could not be encoded, write errors are reported by Finish()
+		bool Encode(Image* image, const char* path);
+		// Waits for all queued writes, returns number of files that failed to be written
+		int Finish() { return _writer.WaitAll(); }
+	};
+}
@@ -1,7 +1,8 @@
 
 #include "PngImage.h"
 #include "FileStream.h"
-#include "zlib\zlib.h"
+#include "MemoryStream.h"
+#include "zlib/zlib.h"
 #include "Exceptions.h"
 #include "PngFilter.h"
 
@@ -18,7 +19,24 @@ namespace ImgOps
 
 	void PNGImageDecoder::SetImageInfo(int width, int height, PixelFormat pixFormat)
 	{
-		_image = new Image(width, height, pixFormat);
+		if(_rowSink != NULL)
+		{
+			// Pixels are stored in sink, so image only holds info
+			_image = new Image(width, height, pixFormat, (byte*)NULL);
+			_rowSink->BeginImage(width, height, pixFormat);
+		}
+		else
+		{
+			_image = new Image(width, height, pixFormat);
+		}
+	}
+
+	void PNGImageDecoder::StoreRow(uint32 row, const byte* data)
+	{
+		if(_rowSink != NULL)
+			_rowSink->StoreRow(row, data);
+		else
+			memcpy(_image->Row(row), data, _image->Stride());
 	}
 
 	// TODO: store current chunk in class and free it here
@@ -50,7 +68,21 @@ namespace ImgOps
 		}
 	}
 
-	Image* PNGImageDecoder::ReadImageFromFile(FileStream* file)
+	Image* PNGImageDecoder::ReadImageFromFile(IDataStream* file, ImageRowSink* rowSink)
+	{
+		_rowSink = rowSink;
+		Image* image = ReadImageFromFile(file);
+		_rowSink = NULL;
+		return image;
+	}
+
+	Image* PNGImageDecoder::DecodeFromMemory(const byte* data, uint64 size)
+	{
+		ConstMemoryStream stream(data, size);
+		return ReadImageFromFile(&stream);
+	}
+
+	Image* PNGImageDecoder::ReadImageFromFile(IDataStream* file)
 	{
 		try
 		{
@@ -64,7 +96,7 @@ namespace ImgOps
 		return _image;
 	}
 
-	void PNGImageDecoder::ReadImageFromFile_Internal(FileStream* file)
+	void PNGImageDecoder::ReadImageFromFile_Internal(IDataStream* file)
 	{
 		// Read png header : 8 bytes
 		int headerSize = 8;
@@ -93,7 +125,7 @@ namespace ImgOps
 		}
 	}
 
-	void PNGImageDecoder::ReadNextChunk(FileStream* file)
+	void PNGImageDecoder::ReadNextChunk(IDataStream* file)
 	{
 		ChunkInfo* info = new ChunkInfo();
 		info->Type = None;
@@ -285,19 +317,37 @@ namespace ImgOps
 	{
 		static const int ChunkBufferSize = 65536u;
 		uint32 CurrentRow;
-		uint32 CurrentColumn;
+		uint32 RowOffset; // Number of bytes of current row already read
+		uint32 RowBytes;
 		bool IsInterlaced;
 		z_stream Zlib;
 		byte OutBuf[ChunkBufferSize];
 		byte CurrentRowFilter;
-		byte RemBytesInPixel;
+		byte* CurrentRowData; // Filtered row, unfiltered in place when completed
+		byte* PrevRowData; // Previous unfiltered row (zeros before first row)
 
 		ChunkReader_IDAT(PNGImageDecoder* decoder) : ChunkReader(decoder)
 		{
 			CurrentRow = 0;
-			CurrentColumn = 0;
+			RowOffset = 0;
+			RowBytes = 0;
 			IsInterlaced = decoder->IsImageInterlaced();
 			CurrentRowFilter = 255;
+			CurrentRowData = NULL;
+			PrevRowData = NULL;
+		}
+
+		~ChunkReader_IDAT()
+		{
+			FreeRows();
+		}
+
+		void FreeRows()
+		{
+			if(CurrentRowData != NULL) free(CurrentRowData);
+			if(PrevRowData != NULL) free(PrevRowData);
+			CurrentRowData = NULL;
+			PrevRowData = NULL;
 		}
 
 		void operator()(ChunkInfo* info, byte* data)
@@ -387,9 +437,15 @@ namespace ImgOps
 		void InitIDATRead()
 		{
 			Zlib = z_stream();
-			CurrentColumn = 0;
 			CurrentRow = 0;
-			RemBytesInPixel = _decoder->GetImage()->PixelSize();
+			RowOffset = 0;
+			CurrentRowFilter = 255;
+			RowBytes = _decoder->GetImage()->Stride();
+
+			FreeRows();
+			CurrentRowData = (byte*)malloc(RowBytes);
+			PrevRowData = (byte*)malloc(RowBytes);
+			memset(PrevRowData, 0, RowBytes);
 
 			Zlib.zalloc = Z_NULL;
 			Zlib.zfree = Z_NULL;
@@ -404,15 +460,17 @@ namespace ImgOps
 		void SaveImageData(ChunkInfo* cinfo, byte* imgData, uint32 dataLength)
 		{
 			// We have uncompressed data here
-			int dataRemaining = (int)dataLength;
+			uint32 dataRemaining = dataLength;
 			byte* currentDataPtr = imgData;
+			uint32 height = _decoder->GetImage()->Height();
+			uint32 pixelSize = _decoder->GetImage()->PixelSize();
 
-			while(CurrentRow < _decoder->GetImage()->Height())
+			while(CurrentRow < height)
 			{
 				if(dataRemaining == 0) // Chunk ended before CurrentRow
 					return;
 
-				if(CurrentColumn == 0 && CurrentRowFilter == 255)
+				if(CurrentRowFilter == 255)
 				{
 					// Read filter type (1st byte for each row)
 					// If CurrentRowFilter wasn't -1 then this row is continued from previous chunk
@@ -421,37 +479,32 @@ namespace ImgOps
 					dataRemaining -= 1;
 				}
 
-				while(CurrentColumn < _decoder->GetImage()->Width())
-				{
-					if(dataRemaining == 0) // Chunk ended before CurrentColumn
-						return;
-
-					while(RemBytesInPixel > 0)
-					{
-						if(dataRemaining == 0) // Chunk ended between pixel samples -> continue on next chunk
-							return;
-
-						// For each byte in pixel unfilter it and store unfiltered
-						// TODO: add 1/2/4 bit depth unfilter support
-						int currByte = _decoder->GetImage()->PixelSize() - RemBytesInPixel;
-						byte filtered = PngFilter::UnfilterByte(CurrentRowFilter, *currentDataPtr,
-							_decoder->GetImage(), CurrentRow, CurrentColumn, currByte);
-						*(_decoder->GetImage()->Pixel(CurrentRow, CurrentColumn) + currByte) = filtered;
-
-						--RemBytesInPixel;
-						--dataRemaining;
-						++currentDataPtr;
-					}
-					// Set next pixel to be read
-					RemBytesInPixel = _decoder->GetImage()->PixelSize(); 
-					++CurrentColumn;
-				}
-				CurrentColumn = 0;
+				// Copy as much of filtered row as available, row may be continued in next chunk
+				uint32 bytes = RowBytes - RowOffset;
+				bytes = bytes < dataRemaining ? bytes : dataRemaining;
+				memcpy(CurrentRowData + RowOffset, currentDataPtr, bytes);
+				RowOffset += bytes;
+				currentDataPtr += bytes;
+				dataRemaining -= bytes;
+
+				if(RowOffset < RowBytes) // Chunk ended in middle of row
+					return;
+
+				// Whole row is read, so unfilter and store it
+				// TODO: add 1/2/4 bit depth unfilter support
+				PngFilter::UnfilterRow(CurrentRowFilter, CurrentRowData, PrevRowData, RowBytes, pixelSize);
+				_decoder->StoreRow(CurrentRow, CurrentRowData);
+
+				byte* prev = PrevRowData;
+				PrevRowData = CurrentRowData;
+				CurrentRowData = prev;
+
+				RowOffset = 0;
 				CurrentRowFilter = 255;
 				++CurrentRow;
 			}
 
-			if(dataRemaining != 0 || CurrentRow != _decoder->GetImage()->Height())
+			if(dataRemaining != 0 || CurrentRow != height)
 			{
 				_decoder->ReportError("Incorrect amount of image data");
 			}
@@ -501,10 +554,27 @@ namespace ImgOps
 			// Contents:
 			// 4bytes[0] : decrypted image pixel format
 			// 4bytes[4] : decrypted image last chunk size
+			// Version 2 (see PNGImageEncoder::StoreChunk_deCf) :
+			// 4bytes[8] : version, 4bytes[12] : encryption mode, 4bytes[16] : wrapped key length, [20] : wrapped key
+			if(info->Lenght < 8)
+				_decoder->ReportError("deCf chunk too short");
+
 			uint32 pixFormatBytes =  Byte4ToUint32(data);
 			uint32 lastChunkSize = Byte4ToUint32(data+4);
 			PixelFormat pixFormat = (PixelFormat)pixFormatBytes;
-			_decoder->GetImage()->SetDecryptedFormat(pixFormat);
+			Image* image = _decoder->GetImage();
+			image->SetDecryptedFormat(pixFormat);
+			image->SetDecryptedLastChunkSize(lastChunkSize);
+
+			if(info->Lenght >= 20)
+			{
+				uint32 mode = Byte4ToUint32(data + 12);
+				uint32 keyLength = Byte4ToUint32(data + 16);
+				if(keyLength > info->Lenght - 20)
+					_decoder->ReportError("deCf wrapped key length exceeds chunk");
+				image->SetEncryptionMode(mode);
+				image->SetWrappedKey(data + 20, keyLength);
+			}
 		}
 	};
 
@@ -513,6 +583,7 @@ namespace ImgOps
 	PNGImageDecoder::PNGImageDecoder()
 	{
 		_image = NULL;
+		_rowSink = NULL;
 		_chunkReaders[IHDR_Bytes] = new ChunkReader_IHDR(this);
 		_chunkReaders[IEND_Bytes] = new ChunkReader_IEND(this);
 		_chunkReaders[IDAT_Bytes] = new ChunkReader_IDAT(this);
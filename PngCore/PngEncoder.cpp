@@ -1,7 +1,8 @@
 
 #include "PngImage.h"
 #include "FileStream.h"
-#include "zlib\zlib.h"
+#include "MemoryStream.h"
+#include "zlib/zlib.h"
 #include "Exceptions.h"
 #include "PngFilter.h"
 
@@ -19,6 +20,12 @@ namespace ImgOps
 	PNGImageEncoder::PNGImageEncoder()
 	{
 		_image = NULL;
+		_tiledImage = NULL;
+		_filteredImageBuf = NULL;
+		_filteredImageBufSize = 0;
+		_zeroRow = NULL;
+		_rowBuf[0] = NULL;
+		_rowBuf[1] = NULL;
 		_saveInterlaced = false;
 	}
 
@@ -34,7 +41,52 @@ namespace ImgOps
 
 	void PNGImageEncoder::FreeMemory()
 	{
+		if(_filteredImageBuf != NULL) free(_filteredImageBuf);
+		if(_zeroRow != NULL) free(_zeroRow);
+		if(_rowBuf[0] != NULL) free(_rowBuf[0]);
+		if(_rowBuf[1] != NULL) free(_rowBuf[1]);
+		_filteredImageBuf = NULL;
+		_filteredImageBufSize = 0;
+		_zeroRow = NULL;
+		_rowBuf[0] = NULL;
+		_rowBuf[1] = NULL;
+	}
+
+	void PNGImageEncoder::AllocateRowBuffers()
+	{
+		FreeMemory();
 
+		// Filtered buffer must fit at least one row with filter byte
+		uint32 stride = _image->Stride();
+		_filteredImageBufSize = stride + 1 > ImageBufferSize ? stride + 1 : ImageBufferSize;
+		_filteredImageBuf = (byte*)malloc(_filteredImageBufSize);
+		_zeroRow = (byte*)malloc(stride);
+		memset(_zeroRow, 0, stride);
+
+		if(_tiledImage != NULL)
+		{
+			_rowBuf[0] = (byte*)malloc(stride);
+			_rowBuf[1] = (byte*)malloc(stride);
+			_rowBufIndex[0] = -1;
+			_rowBufIndex[1] = -1;
+		}
+	}
+
+	const byte* PNGImageEncoder::GetRow(uint32 row)
+	{
+		if(_tiledImage == NULL)
+			return _image->Row(row);
+
+		// Filters need current and previous row, so keep two last rows
+		if(_rowBufIndex[0] == row)
+			return _rowBuf[0];
+		if(_rowBufIndex[1] == row)
+			return _rowBuf[1];
+
+		int slot = _rowBufIndex[0] < _rowBufIndex[1] ? 0 : 1;
+		_tiledImage->ReadRow(row, _rowBuf[slot]);
+		_rowBufIndex[slot] = row;
+		return _rowBuf[slot];
 	}
 
 	bool PNGImageEncoder::SaveImageToFile(const char* filePath, Image* image)
@@ -50,7 +102,7 @@ namespace ImgOps
 		}
 	}
 
-	bool PNGImageEncoder::SaveImageToFile(FileStream* file, Image* image)
+	bool PNGImageEncoder::SaveImageToFile(IDataStream* file, Image* image)
 	{
 		try
 		{
@@ -62,11 +114,51 @@ namespace ImgOps
 			FreeMemory();
 			return false;
 		}
+		FreeMemory();
 		return true;
 	}
 
-	void PNGImageEncoder::SaveImageToFile_Internal(FileStream* file)
+	bool PNGImageEncoder::EncodeToMemory(Image* image, MemoryStream* stream)
+	{
+		// Guess : half of raw image size + header chunks and palettes,
+		// if it's too small stream will grow anyway
+		uint64 estimate = (uint64)image->Stride() * image->Height() / 2 + 1024;
+		stream->Reserve(stream->Position() + estimate);
+		return SaveImageToFile(stream, image);
+	}
+
+	bool PNGImageEncoder::SaveImageToFile(const char* filePath, TiledImage* image)
+	{
+		FileStream file(filePath, OpenModes::WriteTrunc);
+		if(file.IsOpen())
+		{
+			return SaveImageToFile(&file, image);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	bool PNGImageEncoder::SaveImageToFile(IDataStream* file, TiledImage* image)
+	{
+		// Image without data holds only info used to store header chunks
+		Image header(image->Width(), image->Height(), image->PixFormat(), (byte*)NULL);
+		_tiledImage = image;
+		bool result = SaveImageToFile(file, &header);
+		_tiledImage = NULL;
+		_image = NULL;
+		return result;
+	}
+
+	void PNGImageEncoder::SaveImageToFile_Internal(IDataStream* file)
 	{
+		if(_image->IsFloatingPoint())
+		{
+			ReportError("Floating point images must be converted to integer format before saving");
+		}
+		AllocateRowBuffers();
+
 		// First store png header
 		int headerSize = 8;
 		memcpy(_chunkBuf, PNGHeaderBytes, headerSize);
@@ -93,7 +185,7 @@ namespace ImgOps
 
 #pragma region STORE_CHUNK
 
-	void PNGImageEncoder::StoreChunk_IHDR(FileStream* file)
+	void PNGImageEncoder::StoreChunk_IHDR(IDataStream* file)
 	{
 		// 1) Store chunk length and type in buffer
 		uint32 length = 13;
@@ -165,7 +257,7 @@ namespace ImgOps
 		}
 	}
 
-	void PNGImageEncoder::StoreChunk_IEND(FileStream* file)
+	void PNGImageEncoder::StoreChunk_IEND(IDataStream* file)
 	{
 		// 1) Store chunk length and type in buffer
 		uint32 length = 0;
@@ -187,7 +279,7 @@ namespace ImgOps
 		}
 	}
 
-	void PNGImageEncoder::StoreChunk_IDAT(FileStream* file)
+	void PNGImageEncoder::StoreChunk_IDAT(IDataStream* file)
 	{
 		// Init zlib
 		z_stream zlib = z_stream();
@@ -203,7 +295,7 @@ namespace ImgOps
 		}
 
 		// Check how much rows will fit to image buffer (+ one byte each row for filter type)
-		uint32 rowsInChunk = ImageBufferSize / (1 + _image->Stride());
+		uint32 rowsInChunk = _filteredImageBufSize / (1 + _image->Stride());
 		uint32 totalRows = 0; // Count of processed rows
 		uint32 imageBufSize;  // Current amount of available image data
 		while(retVal != Z_STREAM_END) // Process all image data
@@ -293,8 +385,8 @@ namespace ImgOps
 		// that produces the smallest sum of absolute values per row.
 
 		uint32 currentRow = startRow;
-		uint32 currentColumn = 0;	
-		int currentByte;
+		uint32 rowBytes = _image->Stride();
+		uint32 pixelSize = _image->PixelSize();
 		int bufOffset = 0;
 
 		if(filter == -1 && _image->PixFormat() == PixelFormats::Indexed)
@@ -302,98 +394,47 @@ namespace ImgOps
 			filter = 0;
 		}
 		byte filterMethod = (byte)filter;
-		byte curVal[8], leftVal[8], topVal[8], topLeftVal[8];
-		memset(curVal, 0, 8);
-		memset(topVal, 0, 8);
 
 		while(currentRow < _image->Height() && currentRow < startRow + rowsCount)
 		{
+			const byte* prevRow = currentRow > 0 ? GetRow(currentRow - 1) : _zeroRow;
+			const byte* row = GetRow(currentRow);
+			byte* filteredRow = _filteredImageBuf + bufOffset + 1;
+
 			if(filter == -1)
 			{
 				// Choose best filter for current row: 
 				// apply all five filters and select the filter 
 				// that produces the smallest sum of absolute values per row
-
-				int64 filterSums[5]; // Sum of values for each filter
-				memset(filterSums, 0, 5 * 8);
-				currentColumn = 0;
-
-				memset(leftVal, 0, _image->PixelSize()); // Zero left/top-left for each row -> it will be column -1
-				memset(topLeftVal, 0, _image->PixelSize());
-
-				while (currentColumn < _image->Width())
-				{
-					if(currentRow > 0)
-						memcpy(topVal, _image->Pixel(currentRow - 1, currentColumn), _image->PixelSize());
-					memcpy(curVal, _image->Pixel(currentRow, currentColumn), _image->PixelSize());
-
-					currentByte = 0;
-					while(currentByte < _image->PixelSize())
-					{
-						// For each channel check value with each filter
-						for(int fm = 0; fm < 5; ++fm)
-						{
-							filterSums[fm] += PngFilter::FilterByte(fm, 
-								curVal[currentByte], leftVal[currentByte], 
-								topVal[currentByte], topLeftVal[currentByte]);
-						}
-						++currentByte;
-					}
-
-					// We will move right in next iteration, so left/topLeft values will be same as current/top values
-					memcpy(leftVal, curVal, _image->PixelSize());
-					memcpy(topLeftVal, topVal, _image->PixelSize());
-					++currentColumn;
-				}
-
-				// We have sums, so choose filter with smallest one
+				// Each filter is applied to whole row in place of output row, best one is filtered again at the end
 				filterMethod = 0;
-				int64 bestSum = filterSums[0];
-				for(int i = 1; i < 5; ++i)
+				int64 bestSum = -1;
+				for(int fm = 0; fm < 5; ++fm)
 				{
-					if(bestSum > filterSums[i])
+					PngFilter::FilterRow(fm, row, prevRow, filteredRow, rowBytes, pixelSize);
+					int64 sum = 0;
+					for(uint32 i = 0; i < rowBytes; ++i)
+						sum += filteredRow[i];
+
+					if(bestSum < 0 || bestSum > sum)
 					{
-						filterMethod = i;
-						bestSum = filterSums[i];
+						filterMethod = fm;
+						bestSum = sum;
 					}
 				}
 			}
 
 			// We are sure we have proper 'filterMethod' set, so just filter and store image row
 			_filteredImageBuf[bufOffset] = filterMethod;
-			++bufOffset;
-			currentColumn = 0;
-
-			memset(leftVal, 0, _image->PixelSize()); // Zero left/top-left for each row -> it will be column -1
-			memset(topLeftVal, 0, _image->PixelSize());
-
-			while (currentColumn < _image->Width())
-			{
-				if(currentRow > 0)
-					memcpy(topVal, _image->Pixel(currentRow - 1, currentColumn), _image->PixelSize());
-				memcpy(curVal, _image->Pixel(currentRow, currentColumn), _image->PixelSize());
-
-				currentByte = 0;
-				while(currentByte < _image->PixelSize())
-				{
-					_filteredImageBuf[bufOffset] = PngFilter::FilterByte(filterMethod, 
-						curVal[currentByte], leftVal[currentByte], 
-						topVal[currentByte], topLeftVal[currentByte]);
-					++bufOffset;
-					++currentByte;
-				}
-
-				// We will move right in next iteration, so left/topLeft values will be same as current/top values
-				memcpy(leftVal, curVal, _image->PixelSize());
-				memcpy(topLeftVal, topVal, _image->PixelSize());
-				++currentColumn;
-			}
+			if(filter != -1 || filterMethod != 4)
+				PngFilter::FilterRow(filterMethod, row, prevRow, filteredRow, rowBytes, pixelSize);
+			bufOffset += 1 + rowBytes;
 			++currentRow;
 		}
 		return currentRow - startRow;
 	}
 
-	void PNGImageEncoder::StoreChunk_PLTE(FileStream* file)
+	void PNGImageEncoder::StoreChunk_PLTE(IDataStream* file)
 	{
 		// 1) Store chunk length and type in buffer
 		uint32 length = _image->GetPalettesCount() * 3;
@@ -427,10 +468,10 @@ namespace ImgOps
 		}
 	}
 
-	void PNGImageEncoder::StoreChunk_deCf(FileStream* file)
+	void PNGImageEncoder::StoreChunk_deCf(IDataStream* file)
 	{
 		// 1) Store chunk length and type in buffer
-		uint32 length = 8;
+		uint32 length = 20 + _image->GetWrappedKeyLength();
 		uint32 ihdrBytes = deCf_Bytes;
 		Uint32ToByte4(length, _chunkBuf);
 		Uint32ToByte4(ihdrBytes, _chunkBuf + 4);
@@ -440,11 +481,27 @@ namespace ImgOps
 		// Contents:
 		// 4bytes[0] : pix format
 		// 4bytes[4] : decrypted image last chunk size
+		// Since version 2 (older chunks have only 8 bytes) :
+		// 4bytes[8] : version
+		// 4bytes[12] : encryption mode (RSA::EncryptionMode)
+		// 4bytes[16] : length of wrapped key
+		// [20] : RSA encrypted key of symmetric cipher (hybrid mode)
 		
 		Uint32ToByte4(_image->GetDecryptedFormat(), _chunkBuf + bufOffset);
 		bufOffset += 4;
 		Uint32ToByte4(_image->GetDecryptedLastChunkSize(), _chunkBuf + bufOffset);
 		bufOffset += 4;
+		Uint32ToByte4(deCf_Version, _chunkBuf + bufOffset);
+		bufOffset += 4;
+		Uint32ToByte4(_image->GetEncryptionMode(), _chunkBuf + bufOffset);
+		bufOffset += 4;
+		Uint32ToByte4(_image->GetWrappedKeyLength(), _chunkBuf + bufOffset);
+		bufOffset += 4;
+		if(_image->GetWrappedKeyLength() > 0)
+		{
+			memcpy(_chunkBuf + bufOffset, _image->GetWrappedKey(), _image->GetWrappedKeyLength());
+			bufOffset += _image->GetWrappedKeyLength();
+		}
 
 		// Compute CRC from buffer
 		CRC_Init();
@@ -111,6 +111,78 @@ namespace ImgOps
 			};
 		}
 
+		// Unfilters whole row in place
+		// 'prevRow' is previous unfiltered row (all zeros for first row)
+		// 'pixelSize' is distance in bytes to corresponding byte of left pixel
+		static void UnfilterRow(byte method, byte* row, const byte* prevRow, uint32 rowBytes, uint32 pixelSize)
+		{
+			uint32 i;
+			switch (method)
+			{
+			case None:
+				return;
+			case Sub:
+				for(i = pixelSize; i < rowBytes; ++i)
+					row[i] = UnfilterByte_Sub(row[i], row[i - pixelSize]);
+				return;
+			case Up:
+				for(i = 0; i < rowBytes; ++i)
+					row[i] = UnfilterByte_Up(row[i], prevRow[i]);
+				return;
+			case Average:
+				for(i = 0; i < pixelSize && i < rowBytes; ++i)
+					row[i] = UnfilterByte_Average(row[i], 0, prevRow[i]);
+				for(; i < rowBytes; ++i)
+					row[i] = UnfilterByte_Average(row[i], row[i - pixelSize], prevRow[i]);
+				return;
+			case Paeth:
+				for(i = 0; i < pixelSize && i < rowBytes; ++i)
+					row[i] = UnfilterByte_Paeth(row[i], 0, prevRow[i], 0);
+				for(; i < rowBytes; ++i)
+					row[i] = UnfilterByte_Paeth(row[i], row[i - pixelSize], prevRow[i], prevRow[i - pixelSize]);
+				return;
+			default:
+				throw Exception("Unsupported filter type");
+			};
+		}
+
+		// Filters whole row and stores result in 'filtered'
+		// 'prevRow' is previous row (all zeros for first row)
+		static void FilterRow(byte method, const byte* row, const byte* prevRow, byte* filtered, uint32 rowBytes, uint32 pixelSize)
+		{
+			uint32 i;
+			switch (method)
+			{
+			case None:
+				memcpy(filtered, row, rowBytes);
+				return;
+			case Sub:
+				for(i = 0; i < pixelSize && i < rowBytes; ++i)
+					filtered[i] = row[i];
+				for(; i < rowBytes; ++i)
+					filtered[i] = FilterByte_Sub(row[i], row[i - pixelSize]);
+				return;
+			case Up:
+				for(i = 0; i < rowBytes; ++i)
+					filtered[i] = FilterByte_Up(row[i], prevRow[i]);
+				return;
+			case Average:
+				for(i = 0; i < pixelSize && i < rowBytes; ++i)
+					filtered[i] = FilterByte_Average(row[i], 0, prevRow[i]);
+				for(; i < rowBytes; ++i)
+					filtered[i] = FilterByte_Average(row[i], row[i - pixelSize], prevRow[i]);
+				return;
+			case Paeth:
+				for(i = 0; i < pixelSize && i < rowBytes; ++i)
+					filtered[i] = FilterByte_Paeth(row[i], 0, prevRow[i], 0);
+				for(; i < rowBytes; ++i)
+					filtered[i] = FilterByte_Paeth(row[i], row[i - pixelSize], prevRow[i], prevRow[i - pixelSize]);
+				return;
+			default:
+				throw Exception("Unsupported filter type");
+			};
+		}
+
 		static byte FilterByte_None(byte actualValue)
 		{
 			return actualValue;
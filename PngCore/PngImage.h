@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Image.h"
+#include "TiledImage.h"
 #include "Decoder.h"
 #include "Encoder.h"
 #include <map>
@@ -121,6 +122,9 @@ namespace ImgOps
 		((uint32)'e' << 16) | ((uint32)'d' << 24),
 	};
 
+	// Version of deCf chunk written by encoder (1 - only format and last chunk size, 2 - with encryption mode and key)
+	static const uint32 deCf_Version = 2;
+
 	namespace ColorModes
 	{
 		enum ColorModeType : byte
@@ -164,6 +168,8 @@ namespace ImgOps
 			_decoder = decoder;
 		}
 
+		virtual ~ChunkReader() { }
+
 		virtual void operator()(ChunkInfo* cinfo, byte* chunkData) = 0;
 	};
 
@@ -194,6 +200,7 @@ namespace ImgOps
 		std::map<uint32, ChunkReader*> _chunkReaders; // Contains all available chunk readers with chunk type byte-code as keys
 
 		Image* _image; // Decoded image
+		ImageRowSink* _rowSink; // If set, decoded rows are stored in it instead of '_image'
 		byte _chunkInfoBuf[16]; // For storing info abount chunk (max 8 bytes)
 
 		bool _imageInterlaced;
@@ -214,15 +221,20 @@ namespace ImgOps
 		void SetImageInterlaced(bool val) { _imageInterlaced = val; }
 		bool IsImageInterlaced() const { return _imageInterlaced; }
 
+		// Stores unfiltered row in image or in row sink
+		void StoreRow(uint32 row, const byte* data);
+
 		void FreeMemory(bool removeImage);
 		void ReportError(const char* error);
 
 		Image* ReadImageFromFile(const char* filePath);
-		Image* ReadImageFromFile(FileStream* file);
+		Image* ReadImageFromFile(IDataStream* file);
+		Image* ReadImageFromFile(IDataStream* file, ImageRowSink* rowSink);
+		Image* DecodeFromMemory(const byte* data, uint64 size);
 
 	private:
-		void ReadNextChunk(FileStream* file);
-		void ReadImageFromFile_Internal(FileStream* file);
+		void ReadNextChunk(IDataStream* file);
+		void ReadImageFromFile_Internal(IDataStream* file);
 	};
 
 	class PNGImageEncoder : public ImageEncoder
@@ -233,8 +245,13 @@ namespace ImgOps
 
 	private:
 		Image* _image;
+		TiledImage* _tiledImage; // If set, rows are read from it and '_image' only holds image info
 		byte _chunkBuf[ChunkBufferSize];
-		byte _filteredImageBuf[ImageBufferSize];
+		byte* _filteredImageBuf; // At least ImageBufferSize, but always holds one filtered row
+		uint32 _filteredImageBufSize;
+		byte* _zeroRow; // Previous row for first one
+		byte* _rowBuf[2]; // Last rows read from tiled image
+		int64 _rowBufIndex[2];
 		bool _saveInterlaced;
 
 	public:
@@ -251,16 +268,23 @@ namespace ImgOps
 		void ReportError(const char* error);
 
 		bool SaveImageToFile(const char* filePath, Image* image);
-		bool SaveImageToFile(FileStream* file, Image* image);
+		bool SaveImageToFile(IDataStream* file, Image* image);
+		bool SaveImageToFile(const char* filePath, TiledImage* image);
+		bool SaveImageToFile(IDataStream* file, TiledImage* image);
+		bool EncodeToMemory(Image* image, MemoryStream* stream);
 
 	private:
-		void SaveImageToFile_Internal(FileStream* file);
+		void SaveImageToFile_Internal(IDataStream* file);
+		void AllocateRowBuffers();
+
+		// Returns row of image (from tiled image it is read into row buffer)
+		const byte* GetRow(uint32 row);
 
-		void StoreChunk_IHDR(FileStream* file);
-		void StoreChunk_PLTE(FileStream* file);
-		void StoreChunk_IDAT(FileStream* file);
-		void StoreChunk_IEND(FileStream* file);
-		void StoreChunk_deCf(FileStream* file);
+		void StoreChunk_IHDR(IDataStream* file);
+		void StoreChunk_PLTE(IDataStream* file);
+		void StoreChunk_IDAT(IDataStream* file);
+		void StoreChunk_IEND(IDataStream* file);
+		void StoreChunk_deCf(IDataStream* file);
 
 		// Stores filtered rows in '_filteredImageBuf', uses fixed 'filter' method or adaptative if 'filter' = -1
 		uint32 FilterRows(uint32 startRow, uint32 rowsCount, int filter = -1);
@@ -1,14 +1,500 @@
 #include "Profiler.h"
+#include <chrono>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FLAGRTS_PROFILER_TSC
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
 
 namespace FlagRTS
 {
+	// Detects invariant TSC (cpuid 0x80000007, edx bit 8) : without it rdtsc rate may change with cpu frequency
+	static bool CpuHasInvariantTsc()
+	{
+#if defined(FLAGRTS_PROFILER_TSC) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0x80000000);
+		if((unsigned int)info[0] < 0x80000007)
+			return false;
+		__cpuid(info, 0x80000007);
+		return (info[3] & (1 << 8)) != 0;
+#elif defined(FLAGRTS_PROFILER_TSC)
+		unsigned int eax, ebx, ecx, edx;
+		if(__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+			return false;
+		__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+		return (edx & (1 << 8)) != 0;
+#else
+		return false;
+#endif
+	}
+
+	static const bool _useTsc = CpuHasInvariantTsc();
+
+	static ProfilerTicks SteadyTicks()
+	{
+		return (ProfilerTicks)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	ProfilerTicks ReadProfilerTicks()
+	{
+#ifdef FLAGRTS_PROFILER_TSC
+		if(_useTsc)
+			return __rdtsc();
+#endif
+		return SteadyTicks();
+	}
+
+	bool Profiler::UsesTsc()
+	{
+		return _useTsc;
+	}
+
+	double Profiler::TicksPerSecond()
+	{
+		// TSC rate is measured against steady_clock by spinning for 20ms
+		static const double ticksPerSecond = []()
+		{
+			if(_useTsc == false)
+				return 1e9;
+			ProfilerTicks steadyStart = SteadyTicks();
+			ProfilerTicks ticksStart = ReadProfilerTicks();
+			ProfilerTicks steadyEnd;
+			do
+			{
+				steadyEnd = SteadyTicks();
+			}
+			while(steadyEnd - steadyStart < 20000000);
+			ProfilerTicks ticksEnd = ReadProfilerTicks();
+			return (double)(ticksEnd - ticksStart) * 1e9 / (double)(steadyEnd - steadyStart);
+		}();
+		return ticksPerSecond;
+	}
+
+	// Slots of one thread are kept in blocks, so pointers to them stay valid when new clocks are registered
+	static const int SlotsPerBlock = 64;
+	static const int MaxSlotBlocks = 64; // Up to 4096 clocks
+	static const size_t MaxTraceEventsPerThread = 1 << 20;
+
+	// Histogram of scope times : values below 8 ticks have own buckets, others are split
+	// in 8 buckets per power of 2 (bucket width is at most 1/8 of its lower bound)
+	static const int HistogramBuckets = 62 * 8;
+
+	static int HistogramBucket(ProfilerTicks ticks)
+	{
+		if(ticks < 8)
+			return (int)ticks;
+		int msb = 63;
+		while((ticks >> msb) == 0)
+			--msb;
+		return (msb - 2) * 8 + (int)((ticks >> (msb - 3)) & 7);
+	}
+
+	// Middle of bucket range
+	static ProfilerTicks HistogramValue(int bucket)
+	{
+		if(bucket < 8)
+			return (ProfilerTicks)bucket;
+		int shift = bucket / 8 - 1;
+		ProfilerTicks low = (ProfilerTicks)(8 + bucket % 8) << shift;
+		return low + ((ProfilerTicks)1 << shift) / 2;
+	}
+
+	// Recently used children of node, by clock id modulo ChildCacheSize (so repeated calls skip siblings scan)
+	static const int ChildCacheSize = 4;
+
+	// Node of scopes tree : node 0 is root (no clock), children are linked in order of first call
+	struct ProfilerNode
+	{
+		int ClockId;
+		int Parent;
+		int FirstChild;
+		int LastChild;
+		int NextSibling;
+		int ChildCache[ChildCacheSize]; // -1 if empty
+		uint64_t Calls;
+		ProfilerTicks TotalTicks;
+		ProfilerTicks ChildTicks;
+		ProfilerTicks MinTicks;
+		ProfilerTicks MaxTicks;
+		uint64_t Histogram[HistogramBuckets];
+	};
+
+	static void ResetNodes(std::vector<ProfilerNode>* nodes)
+	{
+		nodes->clear();
+		nodes->resize(1);
+		ProfilerNode& root = nodes->front();
+		memset(&root, 0, sizeof(ProfilerNode));
+		root.ClockId = -1;
+		root.Parent = -1;
+		root.FirstChild = -1;
+		root.LastChild = -1;
+		root.NextSibling = -1;
+		for(int i = 0; i < ChildCacheSize; ++i)
+			root.ChildCache[i] = -1;
+	}
+
+	// Returns child of 'parent' for clock 'clockId', adds it if there is none
+	static int ChildNode(std::vector<ProfilerNode>* nodes, int parent, int clockId)
+	{
+		int& cached = (*nodes)[parent].ChildCache[clockId % ChildCacheSize];
+		if(cached >= 0 && (*nodes)[cached].ClockId == clockId)
+			return cached;
+		for(int child = (*nodes)[parent].FirstChild; child >= 0; child = (*nodes)[child].NextSibling)
+		{
+			if((*nodes)[child].ClockId == clockId)
+			{
+				cached = child;
+				return child;
+			}
+		}
+
+		int index = (int)nodes->size();
+		nodes->resize(index + 1);
+		ProfilerNode& node = nodes->back();
+		memset(&node, 0, sizeof(ProfilerNode));
+		node.ClockId = clockId;
+		node.Parent = parent;
+		node.FirstChild = -1;
+		node.LastChild = -1;
+		node.NextSibling = -1;
+		for(int i = 0; i < ChildCacheSize; ++i)
+			node.ChildCache[i] = -1;
+		node.MinTicks = ~(ProfilerTicks)0;
+
+		ProfilerNode& parentNode = (*nodes)[parent];
+		if(parentNode.LastChild >= 0)
+			(*nodes)[parentNode.LastChild].NextSibling = index;
+		else
+			parentNode.FirstChild = index;
+		parentNode.LastChild = index;
+		parentNode.ChildCache[clockId % ChildCacheSize] = index;
+		return index;
+	}
+
+	// Adds statistics of subtree 'srcNode' to children of 'dstNode'
+	static void MergeNodes(std::vector<ProfilerNode>* dst, int dstNode, const std::vector<ProfilerNode>& src, int srcNode)
+	{
+		for(int child = src[srcNode].FirstChild; child >= 0; child = src[child].NextSibling)
+		{
+			const ProfilerNode& from = src[child];
+			int to = ChildNode(dst, dstNode, from.ClockId);
+			ProfilerNode& node = (*dst)[to];
+			node.Calls += from.Calls;
+			node.TotalTicks += from.TotalTicks;
+			node.ChildTicks += from.ChildTicks;
+			node.MinTicks = from.MinTicks < node.MinTicks ? from.MinTicks : node.MinTicks;
+			node.MaxTicks = from.MaxTicks > node.MaxTicks ? from.MaxTicks : node.MaxTicks;
+			for(int i = 0; i < HistogramBuckets; ++i)
+				node.Histogram[i] += from.Histogram[i];
+			MergeNodes(dst, to, src, child);
+		}
+	}
+
+	struct ProfilerStackEntry
+	{
+		int Node;
+		int ClockId;
+		ProfilerTicks StartTicks;
+	};
+
+	struct ProfilerTraceEvent
+	{
+		int ClockId;
+		uint32_t Thread;
+		ProfilerTicks StartTicks;
+		ProfilerTicks EndTicks;
+	};
+
+	static std::atomic<bool> _tracing(false);
+	static std::atomic<bool> _scopeTree(false);
+	static std::atomic<uint64_t> _droppedTraceEvents(0);
+
+	// Scopes stack is kept (and TreeMutex locked by Start() / End()) only if scopes tree or tracing is enabled
+	static bool CollectsScopes()
+	{
+		return _scopeTree.load(std::memory_order_relaxed) || _tracing.load(std::memory_order_relaxed);
+	}
+
+	// Counters of one thread : flat slots are lock-free, scopes tree and trace events
+	// are guarded by TreeMutex (locked by other threads only during reports)
+	struct ProfilerThreadData
+	{
+		std::atomic<ProfilerSlot*> Blocks[MaxSlotBlocks];
+
+		std::mutex TreeMutex;
+		uint32_t Index; // Thread id in trace
+		std::vector<ProfilerNode> Nodes;
+		std::vector<ProfilerStackEntry> Stack; // Running scopes
+		std::atomic<size_t> StackSize; // Size of Stack, read by End() without lock
+		std::vector<ProfilerTraceEvent> Events;
+
+		ProfilerThreadData();
+		~ProfilerThreadData();
+
+		ProfilerSlot* Slot(int id)
+		{
+			std::atomic<ProfilerSlot*>& blockPtr = Blocks[id / SlotsPerBlock];
+			ProfilerSlot* block = blockPtr.load(std::memory_order_acquire);
+			if(block == 0)
+			{
+				block = new ProfilerSlot[SlotsPerBlock];
+				for(int i = 0; i < SlotsPerBlock; ++i)
+				{
+					block[i].Ticks = 0;
+					block[i].Calls = 0;
+					block[i].StartTicks = 0;
+					block[i].Depth = 0;
+				}
+				blockPtr.store(block, std::memory_order_release);
+			}
+			return block + id % SlotsPerBlock;
+		}
+
+		// Ends scope from top of stack (TreeMutex must be locked)
+		void PopScope(ProfilerTicks endTicks)
+		{
+			ProfilerStackEntry entry = Stack.back();
+			Stack.pop_back();
+			StackSize.store(Stack.size(), std::memory_order_relaxed);
+
+			ProfilerTicks ticks = endTicks - entry.StartTicks;
+			ProfilerNode& node = Nodes[entry.Node];
+			++node.Calls;
+			node.TotalTicks += ticks;
+			node.MinTicks = ticks < node.MinTicks ? ticks : node.MinTicks;
+			node.MaxTicks = ticks > node.MaxTicks ? ticks : node.MaxTicks;
+			++node.Histogram[HistogramBucket(ticks)];
+			Nodes[node.Parent].ChildTicks += ticks;
+
+			if(_tracing.load(std::memory_order_relaxed))
+			{
+				if(Events.size() < MaxTraceEventsPerThread)
+				{
+					ProfilerTraceEvent traceEvent = { entry.ClockId, Index, entry.StartTicks, endTicks };
+					Events.push_back(traceEvent);
+				}
+				else
+					++_droppedTraceEvents;
+			}
+		}
+	};
+
+	// Data of live threads and totals of finished ones
+	// (allocated once and never released, so threads may exit after static objects are destroyed)
+	struct ProfilerThreads
+	{
+		std::mutex Mutex; // Locked before TreeMutex of any thread
+		std::vector<ProfilerThreadData*> Live;
+		std::vector<uint64_t> FinishedTicks; // By clock id
+		std::vector<uint64_t> FinishedCalls;
+		std::vector<ProfilerNode> FinishedNodes;
+		std::vector<ProfilerTraceEvent> FinishedEvents;
+		uint32_t NextThreadIndex;
+		ProfilerTicks BaseTicks; // Zero time in trace
+
+		ProfilerThreads() : NextThreadIndex(1), BaseTicks(ReadProfilerTicks())
+		{
+			ResetNodes(&FinishedNodes);
+		}
+	};
+
+	static ProfilerThreads& Threads()
+	{
+		static ProfilerThreads* threads = new ProfilerThreads();
+		return *threads;
+	}
+
+	ProfilerThreadData::ProfilerThreadData()
+	{
+		for(int i = 0; i < MaxSlotBlocks; ++i)
+			Blocks[i] = 0;
+		StackSize = 0;
+		ResetNodes(&Nodes);
+		ProfilerThreads& threads = Threads();
+		std::lock_guard<std::mutex> lock(threads.Mutex);
+		Index = threads.NextThreadIndex++;
+		threads.Live.push_back(this);
+	}
+
+	ProfilerThreadData::~ProfilerThreadData()
+	{
+		ProfilerThreads& threads = Threads();
+		std::lock_guard<std::mutex> lock(threads.Mutex);
+		for(int b = 0; b < MaxSlotBlocks; ++b)
+		{
+			ProfilerSlot* block = Blocks[b].load();
+			if(block == 0)
+				continue;
+			size_t size = (size_t)(b + 1) * SlotsPerBlock;
+			if(threads.FinishedTicks.size() < size)
+			{
+				threads.FinishedTicks.resize(size, 0);
+				threads.FinishedCalls.resize(size, 0);
+			}
+			for(int i = 0; i < SlotsPerBlock; ++i)
+			{
+				threads.FinishedTicks[b * SlotsPerBlock + i] += block[i].Ticks;
+				threads.FinishedCalls[b * SlotsPerBlock + i] += block[i].Calls;
+			}
+			delete[] block;
+		}
+
+		{
+			std::lock_guard<std::mutex> treeLock(TreeMutex);
+			MergeNodes(&threads.FinishedNodes, 0, Nodes, 0);
+			threads.FinishedEvents.insert(threads.FinishedEvents.end(), Events.begin(), Events.end());
+		}
+
+		for(size_t i = 0; i < threads.Live.size(); ++i)
+		{
+			if(threads.Live[i] == this)
+			{
+				threads.Live.erase(threads.Live.begin() + i);
+				break;
+			}
+		}
+	}
+
+	static ProfilerThreadData& ThreadData()
+	{
+		thread_local ProfilerThreadData data;
+		return data;
+	}
+
+	static double TicksToSeconds(ProfilerTicks ticks)
+	{
+		return (double)ticks / Profiler::TicksPerSecond();
+	}
+
+	ProfilerClock::ProfilerClock(const int id, const char* name) :
+		_id(id),
+		_name(name)
+	{
+		_resetTicks = 0;
+		_resetCalls = 0;
+	}
+
+	void ProfilerClock::Start()
+	{
+		ProfilerThreadData& data = ThreadData();
+		ProfilerSlot* slot = data.Slot(_id);
+		if(CollectsScopes() == false)
+		{
+			ProfilerTicks now = ReadProfilerTicks();
+			if(slot->Depth++ == 0)
+				slot->StartTicks = now;
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(data.TreeMutex);
+		int parent = data.Stack.empty() ? 0 : data.Stack.back().Node;
+		ProfilerStackEntry entry = { ChildNode(&data.Nodes, parent, _id), _id, 0 };
+		data.Stack.push_back(entry);
+		data.StackSize.store(data.Stack.size(), std::memory_order_relaxed);
+
+		// Time is read last, so bookkeeping is not counted
+		ProfilerTicks now = ReadProfilerTicks();
+		data.Stack.back().StartTicks = now;
+		if(slot->Depth++ == 0)
+			slot->StartTicks = now;
+	}
+
+	void ProfilerClock::End()
+	{
+		// Time is read first, so lookup of slot is not counted
+		ProfilerTicks now = ReadProfilerTicks();
+		ProfilerThreadData& data = ThreadData();
+		ProfilerSlot* slot = data.Slot(_id);
+		if(slot->Depth == 0)
+			return; // End() without Start()
+		if(--slot->Depth == 0)
+		{
+			// Only outermost pair is counted, as only its time is added (so Ticks / Calls is mean of outermost pairs)
+			slot->Ticks.store(slot->Ticks.load(std::memory_order_relaxed) + (now - slot->StartTicks), std::memory_order_relaxed);
+			slot->Calls.store(slot->Calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		// Stack may be left from time when scopes were collected, so it is checked even if they are not collected now
+		if(data.StackSize.load(std::memory_order_relaxed) == 0)
+			return;
+
+		// Scopes started after this one and not ended yet are ended too
+		std::lock_guard<std::mutex> lock(data.TreeMutex);
+		size_t top = data.Stack.size();
+		while(top > 0 && data.Stack[top - 1].ClockId != _id)
+			--top;
+		while(top > 0 && data.Stack.size() >= top)
+			data.PopScope(now);
+	}
+
+	void ProfilerClock::MergedTotals(uint64_t* ticks, uint64_t* calls) const
+	{
+		ProfilerThreads& threads = Threads();
+		std::lock_guard<std::mutex> lock(threads.Mutex);
+		*ticks = 0;
+		*calls = 0;
+		if((size_t)_id < threads.FinishedTicks.size())
+		{
+			*ticks = threads.FinishedTicks[_id];
+			*calls = threads.FinishedCalls[_id];
+		}
+		for(size_t i = 0; i < threads.Live.size(); ++i)
+		{
+			ProfilerSlot* block = threads.Live[i]->Blocks[_id / SlotsPerBlock].load(std::memory_order_acquire);
+			if(block == 0)
+				continue;
+			*ticks += block[_id % SlotsPerBlock].Ticks.load(std::memory_order_relaxed);
+			*calls += block[_id % SlotsPerBlock].Calls.load(std::memory_order_relaxed);
+		}
+	}
+
+	void ProfilerClock::Reset()
+	{
+		uint64_t ticks, calls;
+		MergedTotals(&ticks, &calls);
+		_resetTicks = ticks;
+		_resetCalls = calls;
+	}
+
+	uint64_t ProfilerClock::Calls() const
+	{
+		uint64_t ticks, calls;
+		MergedTotals(&ticks, &calls);
+		return calls - _resetCalls;
+	}
+
+	ProfilerTicks ProfilerClock::TotalTicks() const
+	{
+		uint64_t ticks, calls;
+		MergedTotals(&ticks, &calls);
+		return ticks - _resetTicks;
+	}
+
+	double ProfilerClock::TotalTime() const
+	{
+		return TicksToSeconds(TotalTicks());
+	}
+
 	Profiler* Profiler::_instance = 0;
+	std::mutex Profiler::_instanceMutex;
 
 	Profiler::Profiler()
 	{
-
+		// Calibration takes a while, so it is done here and not in first report
+		TicksPerSecond();
 	}
 
 	Profiler::~Profiler()
@@ -17,18 +503,177 @@ namespace FlagRTS
 			delete _clocks[i];
 	}
 
+	void Profiler::Release()
+	{
+		std::lock_guard<std::mutex> lock(_instanceMutex);
+		if(_instance != 0)
+		{
+			delete _instance;
+			_instance = 0;
+
+			// Ids of new clocks start from zero, so counters of old ones are cleared
+			ProfilerThreads& threads = Threads();
+			std::lock_guard<std::mutex> threadsLock(threads.Mutex);
+			threads.FinishedTicks.clear();
+			threads.FinishedCalls.clear();
+			ResetNodes(&threads.FinishedNodes);
+			threads.FinishedEvents.clear();
+			_droppedTraceEvents = 0;
+			for(size_t t = 0; t < threads.Live.size(); ++t)
+			{
+				ProfilerThreadData* data = threads.Live[t];
+				for(int b = 0; b < MaxSlotBlocks; ++b)
+				{
+					ProfilerSlot* block = data->Blocks[b].load();
+					for(int i = 0; block != 0 && i < SlotsPerBlock; ++i)
+					{
+						block[i].Ticks = 0;
+						block[i].Calls = 0;
+					}
+				}
+
+				// Running scopes are dropped, as their nodes are removed
+				std::lock_guard<std::mutex> treeLock(data->TreeMutex);
+				ResetNodes(&data->Nodes);
+				data->Stack.clear();
+				data->StackSize = 0;
+				data->Events.clear();
+			}
+		}
+	}
+
+	// Scopes trees of all threads merged into one
+	static void MergedNodes(std::vector<ProfilerNode>* nodes)
+	{
+		ProfilerThreads& threads = Threads();
+		std::lock_guard<std::mutex> lock(threads.Mutex);
+		*nodes = threads.FinishedNodes;
+		for(size_t i = 0; i < threads.Live.size(); ++i)
+		{
+			std::lock_guard<std::mutex> treeLock(threads.Live[i]->TreeMutex);
+			MergeNodes(nodes, 0, threads.Live[i]->Nodes, 0);
+		}
+	}
+
+	// Smallest time such that at least 'fraction' of calls are not longer
+	static double NodePercentile(const ProfilerNode& node, double fraction)
+	{
+		uint64_t target = (uint64_t)(fraction * (double)node.Calls + 0.999999);
+		uint64_t count = 0;
+		for(int i = 0; i < HistogramBuckets; ++i)
+		{
+			count += node.Histogram[i];
+			if(count >= target && count > 0)
+			{
+				ProfilerTicks ticks = HistogramValue(i);
+				ticks = ticks < node.MinTicks ? node.MinTicks : ticks;
+				ticks = ticks > node.MaxTicks ? node.MaxTicks : ticks;
+				return TicksToSeconds(ticks);
+			}
+		}
+		return 0.0;
+	}
+
+	void Profiler::ClockNames(std::vector<std::string>* names)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		names->resize(_clocks.size());
+		for(unsigned int i = 0; i < _clocks.size(); ++i)
+			(*names)[i] = _clocks[i]->ClockName();
+	}
+
+	std::vector<ProfilerScopeStats> Profiler::ScopeStats()
+	{
+		std::vector<std::string> names;
+		ClockNames(&names);
+		std::vector<ProfilerNode> nodes;
+		MergedNodes(&nodes);
+
+		std::vector<ProfilerScopeStats> scopes;
+		std::vector<std::pair<int, int>> stack; // Node and index of its parent in 'scopes'
+		// Children are pushed in reverse order, so they are visited in order of first call
+		std::vector<int> children;
+		for(int child = nodes[0].FirstChild; child >= 0; child = nodes[child].NextSibling)
+			children.push_back(child);
+		for(size_t i = children.size(); i > 0; --i)
+			stack.push_back(std::make_pair(children[i - 1], -1));
+
+		while(stack.empty() == false)
+		{
+			int nodeIndex = stack.back().first;
+			int parentScope = stack.back().second;
+			stack.pop_back();
+			const ProfilerNode& node = nodes[nodeIndex];
+
+			ProfilerScopeStats scope;
+			scope.Name = node.ClockId < (int)names.size() ? names[node.ClockId] : "?";
+			std::string pathName = scope.Name;
+			std::replace(pathName.begin(), pathName.end(), ';', ':');
+			scope.Path = parentScope >= 0 ? scopes[parentScope].Path + ";" + pathName : pathName;
+			scope.Depth = parentScope >= 0 ? scopes[parentScope].Depth + 1 : 0;
+			scope.Calls = node.Calls;
+			scope.TotalTime = TicksToSeconds(node.TotalTicks);
+			scope.SelfTime = node.TotalTicks > node.ChildTicks ? TicksToSeconds(node.TotalTicks - node.ChildTicks) : 0.0;
+			scope.MinTime = node.Calls > 0 ? TicksToSeconds(node.MinTicks) : 0.0;
+			scope.MaxTime = TicksToSeconds(node.MaxTicks);
+			scope.Percentile50 = NodePercentile(node, 0.5);
+			scope.Percentile90 = NodePercentile(node, 0.9);
+			scope.Percentile99 = NodePercentile(node, 0.99);
+			scopes.push_back(scope);
+
+			children.clear();
+			for(int child = node.FirstChild; child >= 0; child = nodes[child].NextSibling)
+				children.push_back(child);
+			for(size_t i = children.size(); i > 0; --i)
+				stack.push_back(std::make_pair(children[i - 1], (int)scopes.size() - 1));
+		}
+		return scopes;
+	}
+
 	const std::string& Profiler::PrepareLog()
 	{
+		std::vector<ProfilerScopeStats> scopes = ScopeStats();
+
+		std::lock_guard<std::mutex> lock(_mutex);
 		std::stringstream logBuild;
 		logBuild.precision(9);
 		logBuild<<"Profiler log:"<<std::endl;
+		logBuild<<"Timer: "<<(UsesTsc() ? "rdtsc" : "steady_clock")<<" ("<<TicksPerSecond() / 1e6<<" MHz)"<<std::endl;
 		for(unsigned int i = 0; i < _clocks.size(); ++i)
 		{
+			uint64_t calls = _clocks[i]->Calls();
+			double totalTime = _clocks[i]->TotalTime();
+			logBuild<<std::endl;
+			logBuild<<"Name: "<<_clocks[i]->ClockName()<<std::endl;
+			logBuild<<"Calls: "<<calls<<std::endl;
+			logBuild<<"Total time: "<<totalTime * 1000.0<<std::endl;
+			logBuild<<"Mean time: "<<(calls > 0 ? totalTime * 1000.0 / calls : 0.0)<<std::endl;
+		}
+
+		if(scopes.empty() == false)
+		{
+			logBuild<<std::endl<<"Scopes (times in ms):"<<std::endl;
+			logBuild<<std::left<<std::setw(40)<<"Name"<<std::right<<std::setw(10)<<"Calls";
+			const char* columns[] = { "Total", "Self", "Mean", "Min", "Max", "p50", "p90", "p99" };
+			for(int c = 0; c < 8; ++c)
+				logBuild<<std::setw(12)<<columns[c];
 			logBuild<<std::endl;
-			logBuild<<"Name: "<<_clocks[i]->ClockName<<std::endl;
-			logBuild<<"Calls: "<<_clocks[i]->Calls<<std::endl;
-			logBuild<<"Total time: "<<_clocks[i]->TotalTime * 1000.f<<std::endl;
+			logBuild<<std::fixed<<std::setprecision(4);
+			for(size_t i = 0; i < scopes.size(); ++i)
+			{
+				const ProfilerScopeStats& scope = scopes[i];
+				double mean = scope.Calls > 0 ? scope.TotalTime / scope.Calls : 0.0;
+				double times[] = { scope.TotalTime, scope.SelfTime, mean, scope.MinTime, scope.MaxTime,
+					scope.Percentile50, scope.Percentile90, scope.Percentile99 };
+				logBuild<<std::left<<std::setw(40)<<(std::string(2 * scope.Depth, ' ') + scope.Name)
+					<<std::right<<std::setw(10)<<scope.Calls;
+				for(int c = 0; c < 8; ++c)
+					logBuild<<std::setw(12)<<times[c] * 1000.0;
+				logBuild<<std::endl;
+			}
 		}
+		if(_droppedTraceEvents > 0)
+			logBuild<<std::endl<<"Dropped trace events: "<<_droppedTraceEvents.load()<<std::endl;
 		_log = logBuild.str();
 
 		return _log;
@@ -37,21 +682,161 @@ namespace FlagRTS
 	void Profiler::LogToFile(const char* fileName)
 	{
 		std::fstream file(fileName, std::ios::out | std::ios::trunc);
-		PrepareLog();
-		file<<_log;
+		file<<PrepareLog();
+		file.close();
+	}
+
+	void Profiler::SetTracing(bool enabled)
+	{
+		_tracing = enabled;
+	}
+
+	bool Profiler::IsTracing()
+	{
+		return _tracing;
+	}
+
+	void Profiler::SetScopeTree(bool enabled)
+	{
+		_scopeTree = enabled;
+	}
+
+	bool Profiler::IsScopeTreeEnabled()
+	{
+		return _scopeTree;
+	}
+
+	void Profiler::ClearTrace()
+	{
+		ProfilerThreads& threads = Threads();
+		std::lock_guard<std::mutex> lock(threads.Mutex);
+		threads.FinishedEvents.clear();
+		for(size_t i = 0; i < threads.Live.size(); ++i)
+		{
+			std::lock_guard<std::mutex> treeLock(threads.Live[i]->TreeMutex);
+			threads.Live[i]->Events.clear();
+		}
+		_droppedTraceEvents = 0;
+	}
+
+	static void WriteJsonString(std::ostream& out, const std::string& text)
+	{
+		out<<'"';
+		for(size_t i = 0; i < text.size(); ++i)
+		{
+			unsigned char c = (unsigned char)text[i];
+			if(c == '"' || c == '\\')
+				out<<'\\'<<c;
+			else if(c < 0x20)
+				out<<"\\u00"<<"0123456789abcdef"[c >> 4]<<"0123456789abcdef"[c & 15];
+			else
+				out<<c;
+		}
+		out<<'"';
+	}
+
+	std::string Profiler::PrepareChromeTrace()
+	{
+		std::vector<std::string> names;
+		ClockNames(&names);
+
+		std::vector<ProfilerTraceEvent> events;
+		std::vector<uint32_t> threadIndices;
+		ProfilerTicks baseTicks;
+		{
+			ProfilerThreads& threads = Threads();
+			std::lock_guard<std::mutex> lock(threads.Mutex);
+			baseTicks = threads.BaseTicks;
+			events = threads.FinishedEvents;
+			for(size_t i = 0; i < threads.Live.size(); ++i)
+			{
+				std::lock_guard<std::mutex> treeLock(threads.Live[i]->TreeMutex);
+				events.insert(events.end(), threads.Live[i]->Events.begin(), threads.Live[i]->Events.end());
+			}
+		}
+
+		// Complete ("X") events with times in microseconds, plus names of threads
+		double microsecondsPerTick = 1e6 / TicksPerSecond();
+		std::stringstream trace;
+		trace<<std::fixed<<std::setprecision(3);
+		trace<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["<<std::endl;
+		bool first = true;
+		for(size_t i = 0; i < events.size(); ++i)
+		{
+			const ProfilerTraceEvent& traceEvent = events[i];
+			if(std::find(threadIndices.begin(), threadIndices.end(), traceEvent.Thread) == threadIndices.end())
+			{
+				threadIndices.push_back(traceEvent.Thread);
+				trace<<(first ? "" : ",\n")<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<traceEvent.Thread
+					<<",\"args\":{\"name\":\"Thread "<<traceEvent.Thread<<"\"}}";
+				first = false;
+			}
+
+			trace<<(first ? "" : ",\n")<<"{\"name\":";
+			WriteJsonString(trace, traceEvent.ClockId < (int)names.size() ? names[traceEvent.ClockId] : "?");
+			trace<<",\"ph\":\"X\",\"pid\":1,\"tid\":"<<traceEvent.Thread
+				<<",\"ts\":"<<(double)(traceEvent.StartTicks - baseTicks) * microsecondsPerTick
+				<<",\"dur\":"<<(double)(traceEvent.EndTicks - traceEvent.StartTicks) * microsecondsPerTick<<"}";
+			first = false;
+		}
+		trace<<std::endl<<"]}"<<std::endl;
+		return trace.str();
+	}
+
+	void Profiler::WriteChromeTrace(const char* fileName)
+	{
+		std::fstream file(fileName, std::ios::out | std::ios::trunc);
+		file<<PrepareChromeTrace();
+		file.close();
+	}
+
+	std::string Profiler::PrepareCollapsedStacks()
+	{
+		std::vector<ProfilerScopeStats> scopes = ScopeStats();
+		std::stringstream stacks;
+		for(size_t i = 0; i < scopes.size(); ++i)
+		{
+			uint64_t selfMicroseconds = (uint64_t)(scopes[i].SelfTime * 1e6 + 0.5);
+			if(selfMicroseconds > 0)
+				stacks<<scopes[i].Path<<" "<<selfMicroseconds<<std::endl;
+		}
+		return stacks.str();
+	}
+
+	void Profiler::WriteCollapsedStacks(const char* fileName)
+	{
+		std::fstream file(fileName, std::ios::out | std::ios::trunc);
+		file<<PrepareCollapsedStacks();
 		file.close();
 	}
 
 	ProfilerClock* Profiler::RegisterClock(const char* name)
 	{
+		std::lock_guard<std::mutex> lock(_mutex);
 		auto clockIt = _clockNamesMap.find(std::string(name));
 		if( clockIt != _clockNamesMap.end() )
 			return clockIt->second;
 
-		ProfilerClock* clock = new ProfilerClock(_clocks.size(), name);
+		if(_clocks.size() >= (size_t)(SlotsPerBlock * MaxSlotBlocks))
+			return 0;
+
+		ProfilerClock* clock = new ProfilerClock((int)_clocks.size(), name);
 		_clocks.push_back(clock);
 		_clockNamesMap.insert(std::make_pair(
 			std::string(name), clock));
 		return clock;
 	}
-}
\ No newline at end of file
+
+	ProfilerClock* Profiler::GetClock(int id)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return id >= 0 && (size_t)id < _clocks.size() ? _clocks[id] : 0;
+	}
+
+	ProfilerClock* Profiler::GetClock(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto clockIt = _clockNamesMap.find(name);
+		return clockIt != _clockNamesMap.end() ? clockIt->second : 0;
+	}
+}
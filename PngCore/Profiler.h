@@ -1,9 +1,11 @@
 #pragma once
 
-#include <Windows.h>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <stdint.h>
 
 // #define PROFILE_OFF
 
@@ -13,59 +15,106 @@
 
 namespace FlagRTS
 {
-	struct ProfilerClock
+	typedef uint64_t ProfilerTicks;
+
+	// Current time in ticks of profiler timer : rdtsc if cpu has invariant TSC (constant rate,
+	// synchronized between cores), otherwise steady_clock nanoseconds (see Profiler::TicksPerSecond())
+	ProfilerTicks ReadProfilerTicks();
+
+	// Times of one clock measured by one thread : only owner thread writes it,
+	// reports read counters from other threads (so they are atomic, but never locked)
+	struct ProfilerSlot
+	{
+		std::atomic<uint64_t> Ticks;
+		std::atomic<uint64_t> Calls; // Outermost Start() / End() pairs
+		ProfilerTicks StartTicks; // Start of outermost running Start()
+		int Depth; // Number of running Start() (recursion)
+	};
+
+	// Statistics of one node of scopes tree (same clock under different parents gives different nodes)
+	// Times in seconds, percentiles are estimated from histogram (error up to ~6%)
+	struct ProfilerScopeStats
 	{
+		std::string Name;
+		std::string Path; // Names of clocks from outermost one, separated with ';' (';' in names is replaced with ':')
+		int Depth; // 0 for outermost scopes
+		uint64_t Calls;
+		double TotalTime;
+		double SelfTime; // TotalTime without time of child scopes
+		double MinTime;
+		double MaxTime;
+		double Percentile50;
+		double Percentile90;
+		double Percentile99;
+	};
+
+	// Named clock : Start() / End() pairs (may be nested or recursive, then only outermost pair is timed)
+	// may be called from any thread, each thread counts in its own slot and slots are merged on read
+	// (no locks). If scopes tree or tracing is enabled pairs also build tree of scopes of thread
+	// (see Profiler::ScopeStats()), then they must be nested properly and each pair locks mutex of its thread
+	class ProfilerClock
+	{
+	protected:
+		int _id;
+		std::string _name;
+		std::atomic<uint64_t> _resetTicks; // Totals at last Reset(), subtracted from merged totals
+		std::atomic<uint64_t> _resetCalls;
+
 	public:
-		LARGE_INTEGER ClockFreq;
-		LARGE_INTEGER TicksOnStart;
-		LARGE_INTEGER TicksOnEnd;
-		int Id;
-		int Calls;
-		float TotalTime; // In seconds
-		const char* ClockName;
-
-		ProfilerClock(const int id, const char* name) : 
-			Id(id),
-			Calls(0),
-			TotalTime(0.0f), 
-			ClockName(name)
-		{ }
-
-		void Start()
-		{
-			++Calls;
-			QueryPerformanceFrequency(&ClockFreq);
-			QueryPerformanceCounter(&TicksOnStart);
-		}
+		ProfilerClock(const int id, const char* name);
 
-		void End()
-		{
-			QueryPerformanceCounter(&TicksOnEnd);
-			TotalTime += static_cast<float>(TicksOnEnd.QuadPart - TicksOnStart.QuadPart)
-				/ static_cast<float>(ClockFreq.QuadPart);
-		}
+		int Id() const { return _id; }
+		const char* ClockName() const { return _name.c_str(); }
 
-		void Reset()
-		{
-			Calls = 0;
-			TotalTime = 0.0f;
-		}
+		void Start();
+		void End();
+		// Clock counts from zero again (for all threads)
+		void Reset();
+
+		// Totals merged over all threads (running Start() are not counted untill End())
+		// Calls counts only outermost pairs (nested / recursive ones are part of outer call), like TotalTicks()
+		uint64_t Calls() const;
+		ProfilerTicks TotalTicks() const;
+		double TotalTime() const; // In seconds
+
+	protected:
+		void MergedTotals(uint64_t* ticks, uint64_t* calls) const;
+	};
+
+	// Starts clock in constructor and ends it in destructor
+	class ProfilerScope
+	{
+	protected:
+		ProfilerClock* _clock;
+
+	public:
+		ProfilerScope(ProfilerClock* clock) : _clock(clock) { _clock->Start(); }
+		~ProfilerScope() { _clock->End(); }
+
+	private:
+		ProfilerScope(const ProfilerScope&);
+		ProfilerScope& operator=(const ProfilerScope&);
 	};
 
 	class Profiler
 	{
 	private:
 		static Profiler* _instance;
+		static std::mutex _instanceMutex;
+		std::mutex _mutex; // Guards clocks registration and log
 		std::vector<ProfilerClock*> _clocks;
 		std::string _log;
 		std::map<std::string, ProfilerClock*> _clockNamesMap;
 
 		Profiler();
 
+		void ClockNames(std::vector<std::string>* names);
+
 	public:
 		~Profiler();
 		static Profiler* GetProfiler()
 		{
+			std::lock_guard<std::mutex> lock(_instanceMutex);
 			if(_instance == 0)
 			{
 				_instance = new Profiler();
@@ -75,26 +124,52 @@ namespace FlagRTS
 
 		// Releases profiler instance ( one is created if GetProfiler() is called at least once )
 		// All registered clocks are invalid after this call
-		static void Release()
-		{
-			if(_instance != 0)
-			{
-				delete _instance;
-				_instance = 0;
-			}
-		}
+		static void Release();
+
+		// Rate of ReadProfilerTicks() (measured once, on first call)
+		static double TicksPerSecond();
+		// True if timer is rdtsc
+		static bool UsesTsc();
 
+		// Flat totals of clocks and tree of scopes with self time and min/max/percentiles
 		const std::string& PrepareLog();
 		void LogToFile(const char* fileName);
 
+		// Scopes tree merged over all threads, in depth-first order
+		// (only scopes started while scopes tree or tracing was enabled)
+		std::vector<ProfilerScopeStats> ScopeStats();
+
+		// Scopes tree collection (disabled by default, so clocks count only flat totals)
+		// Should be switched when no clocks are running, scopes running while it is switched may be lost
+		static void SetScopeTree(bool enabled);
+		static bool IsScopeTreeEnabled();
+
+		// If enabled each ended scope is recorded as trace event (up to 1M events per thread)
+		// Scopes tree is collected too while tracing is enabled
+		static void SetTracing(bool enabled);
+		static bool IsTracing();
+		// Removes recorded trace events
+		void ClearTrace();
+
+		// Recorded events in Chrome trace-event JSON format (chrome://tracing, Perfetto)
+		std::string PrepareChromeTrace();
+		void WriteChromeTrace(const char* fileName);
+		// Self times of scopes tree in collapsed stacks format ("a;b;c microseconds" lines, for flamegraph.pl)
+		std::string PrepareCollapsedStacks();
+		void WriteCollapsedStacks(const char* fileName);
+
 		ProfilerClock* RegisterClock(const char* name);
-		ProfilerClock* GetClock(int id) { return _clocks[id]; }
-		ProfilerClock* GetClock(const std::string& name) { return _clockNamesMap.find(name)->second; }
+		ProfilerClock* GetClock(int id);
+		// Returns NULL if there is no clock with such name
+		ProfilerClock* GetClock(const std::string& name);
 	};
 }
 
 #ifdef PROFILE_ON
 
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
 #define PROFILE_REGISTER_CLOCK(clockname, blockname) \
 	static FlagRTS::ProfilerClock* clockname = FlagRTS::Profiler::GetProfiler()->RegisterClock(blockname);
 
@@ -108,6 +183,12 @@ namespace FlagRTS
 #define PROFILE_END(clockname) \
 	clockname->End();
 
+// Times rest of enclosing block with clock named 'blockname' (ends on any exit from block)
+#define PROFILE_SCOPE(blockname) \
+	static FlagRTS::ProfilerClock* PROFILE_CONCAT(_profileClock, __LINE__) = \
+		FlagRTS::Profiler::GetProfiler()->RegisterClock(blockname); \
+	FlagRTS::ProfilerScope PROFILE_CONCAT(_profileScope, __LINE__)(PROFILE_CONCAT(_profileClock, __LINE__));
+
 #define PROFILE_RESET_CLOCK(clockname) \
 	clockname->Reset();
 
@@ -123,13 +204,31 @@ namespace FlagRTS
 #define PROFILE_GET_LOG() \
 	FlagRTS::Profiler::GetProfiler()->PrepareLog();
 
+#define PROFILE_SET_TRACING(enabled) \
+	FlagRTS::Profiler::SetTracing(enabled);
+
+#define PROFILE_SET_SCOPE_TREE(enabled) \
+	FlagRTS::Profiler::SetScopeTree(enabled);
+
+#define PROFILE_WRITE_CHROME_TRACE(filename) \
+	FlagRTS::Profiler::GetProfiler()->WriteChromeTrace(filename);
+
+#define PROFILE_WRITE_COLLAPSED_STACKS(filename) \
+	FlagRTS::Profiler::GetProfiler()->WriteCollapsedStacks(filename);
+
 #else
 #define PROFILE_REGISTER_CLOCK(clockname, blockname)
 #define PROFILE_START(clockname)
+#define PROFILE_START_NEW(clockname)
 #define PROFILE_END(clockname)
+#define PROFILE_SCOPE(blockname)
 #define PROFILE_FIND_CLOCK(cn, blockname)
 #define PROFILE_RESET_CLOCK(clockname)
-#define PROFILE_LOG_TO_FILE(filename) 
+#define PROFILE_LOG_TO_FILE(filename)
 #define PROFILE_RELEASE()
 #define PROFILE_GET_LOG()
+#define PROFILE_SET_TRACING(enabled)
+#define PROFILE_SET_SCOPE_TREE(enabled)
+#define PROFILE_WRITE_CHROME_TRACE(filename)
+#define PROFILE_WRITE_COLLAPSED_STACKS(filename)
 #endif
@@ -1,29 +1,50 @@
-﻿#pragma once
-
-#include "RSA.h"
+﻿#include "RSA.h"
+#include "RsaEngine.h"
+#include "DataStream.h"
+#include "ChaCha20.h"
+#include "Drbg.h"
+#include "ThreadPool.h"
 #include <cmath>
-#include <time.h>
-#include <boost/multiprecision/random.hpp>
-#include "Profiler.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace ImgOps
 {
 	namespace RSA
 	{
 		using namespace boost::multiprecision;
-		using namespace boost::random;
 
-		mt19937 _randEngine = mt19937(clock());
+		// Liczby losowe z generatora watku (Drbg::ThreadLocal), wiec wiele watkow moze losowac jednoczesnie
 		Word Rand()
 		{
-			boost::random::uniform_int_distribution<Word> randGen;
-			return randGen(_randEngine);
+			FixedUInt<WordBitCount / 64> value;
+			Drbg::ThreadLocal().Generate((byte*)value.Limb, WordByteCount);
+			return FixedToWord(value);
 		}
 
 		Word Rand(Word rangeMin, Word rangeMax)
 		{
-			boost::random::uniform_int_distribution<Word> randGen(rangeMin, rangeMax);
-			return randGen(_randEngine);
+			// Losuje liczby o dlugosci zakresu do skutku (srednio mniej niz 2 proby), wiec rozklad jest rowny
+			Word range = rangeMax - rangeMin;
+			if(range <= 0)
+				return rangeMin;
+			int bits = (int)msb(range) + 1;
+			Word mask = (Word(1) << bits) - 1;
+			Word value;
+			do
+			{
+				value = Rand() & mask;
+			}
+			while(value > range);
+			return rangeMin + value;
+		}
+
+		void RandomBytes(byte* bytes, uint32 length)
+		{
+			Drbg::ThreadLocal().Generate(bytes, length);
 		}
 
 		// Mnozenie modulo : a*b mod k
@@ -34,20 +55,26 @@ namespace ImgOps
 			Word2 ab = a2 * b2;
 			Word2 k2 = k;
 			Word2 res2 = ab % k2;
-			Word res1 = (Word)res2;
 			return (Word)res2;
 		}
 
 		// Potegowanie modulo : a^e mod k
-		// Poteguje uzywajac 'Right-to-left binary method'
 		Word ModuloPower(Word base, Word e, Word k)
 		{
+			if(k == 1)
+				return Word(0);
+			if(base >= k)
+				base %= k;
+			if(bit_test(k, 0))
+				return MontgomeryContext::Get(k)->Power(base, e);
+
+			// Parzysty modul : 'Right-to-left binary method'
 			Word p = base;
 			Word res = Word(1);
-			Word bit = Word(1);
-			for(int i = 0; i < WordBitCount; ++i, bit <<= 1) // 'bit' to przesuwajacy sie bit (od 1 do liczby bitow w 'Word')
+			int bits = e == 0 ? 0 : (int)msb(e) + 1;
+			for(int i = 0; i < bits; ++i)
 			{
-				if(e & bit) 
+				if(bit_test(e, i))
 					res = ModuloMultiplcation(res, p, k);
 
 				p = ModuloMultiplcation(p, p, k);
@@ -55,6 +82,80 @@ namespace ImgOps
 			return res;
 		}
 
+		// Nieuzywany kontekst dostaje modul 1 (jego konstrukcja nic nie kosztuje)
+		MontgomeryContext::MontgomeryContext(const Word& modulus) :
+			_n(modulus),
+			_short(msb(modulus) < ShortLimbs * 64),
+			_shortFixed(_short ? WordToFixed<ShortLimbs>(modulus) : FixedUInt<ShortLimbs>(1)),
+			_fixed(_short ? FixedUInt<WordLimbs>(1) : WordToFixed<WordLimbs>(modulus))
+		{
+		}
+
+		Word MontgomeryContext::ToMontgomery(const Word& a) const
+		{
+			if(_short)
+				return FixedToWord(_shortFixed.ToMontgomery(WordToFixed<ShortLimbs>(a)));
+			return FixedToWord(_fixed.ToMontgomery(WordToFixed<WordLimbs>(a)));
+		}
+
+		Word MontgomeryContext::FromMontgomery(const Word& a) const
+		{
+			if(_short)
+				return FixedToWord(_shortFixed.FromMontgomery(WordToFixed<ShortLimbs>(a)));
+			return FixedToWord(_fixed.FromMontgomery(WordToFixed<WordLimbs>(a)));
+		}
+
+		Word MontgomeryContext::Multiply(const Word& a, const Word& b) const
+		{
+			if(_short)
+				return FixedToWord(_shortFixed.Multiply(WordToFixed<ShortLimbs>(a), WordToFixed<ShortLimbs>(b)));
+			return FixedToWord(_fixed.Multiply(WordToFixed<WordLimbs>(a), WordToFixed<WordLimbs>(b)));
+		}
+
+		template<int Limbs>
+		static Word FixedPower(const FixedMontgomery<Limbs>& context, const Word& base, const Word& e)
+		{
+			// Wykladnik dluzszy od slow kontekstu jest liczony w kontekscie pelnej dlugosci Word
+			FixedUInt<WordLimbs> fullE = WordToFixed<WordLimbs>(e);
+			if(fullE.BitLength() > Limbs * 64)
+				return FixedPower(FixedMontgomery<WordLimbs>(FixedUInt<WordLimbs>::Resize(context.Modulus())), base, e);
+
+			FixedUInt<Limbs> fixedE = FixedUInt<Limbs>::Resize(fullE);
+			if(fixedE.BitLength() <= 64)
+				return FixedToWord(context.PowerPublic(WordToFixed<Limbs>(base), fixedE));
+			return FixedToWord(context.Power(WordToFixed<Limbs>(base), fixedE));
+		}
+
+		Word MontgomeryContext::Power(const Word& base, const Word& e) const
+		{
+			if(_short)
+				return FixedPower(_shortFixed, base, e);
+			return FixedPower(_fixed, base, e);
+		}
+
+		std::shared_ptr<const MontgomeryContext> MontgomeryContext::Get(const Word& modulus)
+		{
+			// Klucz zwykle sie nie zmienia, wiec najpierw sprawdzany jest ostatnio uzyty kontekst watku
+			thread_local std::shared_ptr<const MontgomeryContext> lastContext;
+			if(lastContext != NULL && lastContext->_n == modulus)
+				return lastContext;
+
+			// Pamiec podreczna jest ograniczona, konteksty usuniete z niej zyja dopoki sa uzywane
+			static const size_t MaxCachedContexts = 16;
+			static std::mutex cacheMutex;
+			static std::map<Word, std::shared_ptr<const MontgomeryContext> > cache;
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			auto it = cache.find(modulus);
+			if(it == cache.end())
+			{
+				if(cache.size() >= MaxCachedContexts)
+					cache.clear();
+				it = cache.insert(std::make_pair(modulus, std::make_shared<const MontgomeryContext>(modulus))).first;
+			}
+			lastContext = it->second;
+			return lastContext;
+		}
+
 		// Sprawdza czy liczba 'num' jest pierwsza z prawdopodobienstwem 1 - (1/4)^'passes'
 		// Niech p będzie nieparzystą liczbą pierwszą zapisaną jako p = 1 + 2^s * d, gdzie d jest nieparzyste. 
 		// Wtedy dla dowolnej liczby naturalnej a ∈ <2, p - 2> ciąg Millera-Rabina:
@@ -90,27 +191,33 @@ namespace ImgOps
 
 			Word base, d, x;
 			int s = 0;
+			// Testowane liczby sa uzywane jako modul tylko raz, wiec kontekst nie trafia do pamieci podrecznej
+			MontgomeryContext context(num);
 
 			for(d = num - 1; (d & 1) == 0; ++s) 
 				d >>= 1;
 
+			// Kolejne wyrazy ciagu sa liczone w dziedzinie Montgomery'ego, wiec porownujemy z 1 i num - 1 w tej dziedzinie
+			Word one = context.ToMontgomery(Word(1));
+			Word minusOne = context.ToMontgomery(num - 1);
+
 			for(int i = 0; i < passes; ++i)
 			{
 				base = Rand(Word(2), num - Word(2)); // Losujemy baze ciagu
-				x = ModuloPower(base, d, num); // Pierwszy wyraz ciagu
+				x = context.ToMontgomery(context.Power(base, d)); // Pierwszy wyraz ciagu
 
-				if((x == 1) || (x == num - 1)) // Zla baza
+				if((x == one) || (x == minusOne)) // Zla baza
 					continue;
 
-				for(int j = 1; (j < s) && (x != num - 1); j++)
+				for(int j = 1; (j < s) && (x != minusOne); j++)
 				{
-					x = ModuloMultiplcation(x, x, num); // Wyliczamy a^(2^j * d) mod num
-					if(x == 1) // Tylko ostatni wyraz ciągu Millera-Rabina może mieć wartość 1!
+					x = context.Multiply(x, x); // Wyliczamy a^(2^j * d) mod num
+					if(x == one) // Tylko ostatni wyraz ciągu Millera-Rabina może mieć wartość 1!
 					{
 						return false;
 					}
 				}
-				if(x != num - 1) // przedostatni wyraz ciągu Millera-Rabina musi być równy p - 1
+				if(x != minusOne) // przedostatni wyraz ciągu Millera-Rabina musi być równy p - 1
 				{
 					return false;
 				}
@@ -118,48 +225,111 @@ namespace ImgOps
 			return true;
 		}
 
+		// Liczby pierwsze mniejsze od SmallPrimeLimit (bez 2), wyznaczone sitem Eratostenesa przy pierwszym uzyciu
+		static const uint32 SmallPrimeLimit = 4096;
+		const std::vector<uint32>& SmallPrimes()
+		{
+			static std::vector<uint32> primes;
+			static std::once_flag primesFlag;
+			std::call_once(primesFlag, []()
+			{
+				std::vector<bool> composite(SmallPrimeLimit, false);
+				for(uint32 i = 3; i < SmallPrimeLimit; i += 2)
+				{
+					if(composite[i])
+						continue;
+					primes.push_back(i);
+					for(uint32 j = i * i; j < SmallPrimeLimit; j += 2 * i)
+						composite[j] = true;
+				}
+			});
+			return primes;
+		}
+
+		// Szuka liczby pierwszej z przedzialu [rangeMin, rangeMax] :
+		// 1) losuje nieparzysty poczatek okna 'start' i liczy jego reszty z dzielenia przez male liczby pierwsze
+		// 2) sito na oknie kandydatow start + 2j : kandydat jest podzielny przez p gdy (r + 2j) mod p = 0
+		// 3) kandydaci ktorzy przeszli sito sa testowani (Fermat, Miller-Rabin) rownolegle na 'pool',
+		//    watki biora kolejnych kandydatow i koncza po znalezieniu pierwszej liczby (zwracany jest najmniejszy
+		//    pierwszy kandydat w oknie, wiec wynik nie zalezy od liczby watkow)
+		static Word FindPrime(const Word& rangeMin, const Word& rangeMax, int testPasses, ThreadPool* pool)
+		{
+			static const int SieveWindow = 2048; // Liczba nieparzystych kandydatow w oknie
+			const std::vector<uint32>& primes = SmallPrimes();
+			if(pool == NULL)
+				pool = ThreadPool::Default();
+
+			std::vector<bool> composite(SieveWindow);
+			std::vector<int> candidates;
+			candidates.reserve(SieveWindow);
+			while(true)
+			{
+				Word start = Rand(rangeMin, rangeMax - 2 * SieveWindow) | 1;
+
+				composite.assign(SieveWindow, false);
+				for(size_t i = 0; i < primes.size(); ++i)
+				{
+					uint32 prime = primes[i];
+					uint32 r = (uint32)(start % prime);
+					// 2j = -r (mod p) -> j = (p - r) * 2^-1 (mod p), 2^-1 = (p + 1) / 2
+					uint32 first = (uint32)((uint64)((prime - r) % prime) * ((prime + 1) / 2) % prime);
+					for(uint32 j = first; j < (uint32)SieveWindow; j += prime)
+						composite[j] = true;
+				}
+
+				candidates.clear();
+				for(int j = 0; j < SieveWindow; ++j)
+				{
+					if(!composite[j])
+						candidates.push_back(j);
+				}
+
+				std::atomic<int> next(0);
+				std::atomic<int> found((int)candidates.size());
+				pool->ParallelFor(pool->ThreadCount(), [&](int, int)
+				{
+					for(int index = next++; index < found; index = next++)
+					{
+						Word candidate = start + 2 * candidates[index];
+						// Test fermata : Jesli p jest liczba pierwsza, to 2^p mod p = 2
+						if(MontgomeryContext(candidate).Power(Word(2), candidate) != 2)
+							continue;
+						// Sprawdz czy jest pierwsza z duzym prawdopodobienstwem
+						if(CheckMillerRabin(candidate, testPasses) == false)
+							continue;
+
+						int current = found;
+						while(index < current && !found.compare_exchange_weak(current, index));
+						return;
+					}
+				});
+
+				if(found < (int)candidates.size())
+					return start + 2 * candidates[found];
+			}
+		}
+
 		// Zwraca pare licz pierwszych (p,q) takich ze n = p*q ma zadana liczbe bitow (N = WordBitCount) -> n > 2^(N-1)
 		// Czyli dla danego p, q > 2^(N-1) / p i q < 2^N / p (czyli q = (2^(N-1) / p, 2^N / p))
 		// Prawdopodobienstwo ze p i q sa rzeczywiscie pierwsze to 1 - (1/4)^'passes'
-		void GeneratePrimaryPair(Word* p, Word* q, int testPasses)
+		void GeneratePrimaryPair(Word* p, Word* q, int testPasses, ThreadPool* pool)
 		{
 			int n2 = WordBitCount / 2;
 
+			// Liczba pierwsza z przedzialu (2^(N2-1), 2^(N2))
 			Word rangeMin = Word(1) << (n2 - 1);
 			Word rangeMax = rangeMin << 1;
-			bool primaryTestPassed = false;
-			while(!primaryTestPassed)
-			{
-				// Wygeneruj losowa liczbe z przedzialu (2^(N2-1), 2^(N))
-				*p = Rand(rangeMin, rangeMax);
-				if((*p & 1) == 0) // Do parzytych dodaj 1
-					*p |= 1;
-				// Zrob test fermata : Jeśli p jest liczbą pierwszą, to 2^p mod p = 2.
-				Word ferm = ModuloPower(Word(2), *p, *p);
-				if(ferm != 2)
-					continue;
-				// Sprawdz czy jest pierwsza z duzym prawdopodobienstwem
-				primaryTestPassed = CheckMillerRabin(*p, testPasses);
-			}
+			*p = FindPrime(rangeMin, rangeMax, testPasses, pool);
 
 			// Mamy p pierwsze z duzym prawdopodobienstwem
 			// Teraz trezba znalezc q tak aby n = (2^(N-1), 2^N)
 			rangeMin = (Word(1) << (WordBitCount - 1)) / *p;
 			rangeMax = rangeMin << 1;
-			primaryTestPassed = false;
-			while(!primaryTestPassed)
+			do
 			{
-				// Wygeneruj losowa liczbe
-				*q = Rand(rangeMin, rangeMax);
-				if((*q & 1) == 0) // Do parzytych dodaj 1
-					*q |= 1;
-				// Zrob test fermata : Jeśli q jest liczbą pierwszą, to 2^q mod q = 2.
-				Word ferm = ModuloPower(Word(2), *q, *q);
-				if(ferm != 2)
-					continue;
-				// Sprawdz czy jest pierwsza z duzym prawdopodobienstwem
-				primaryTestPassed = CheckMillerRabin(*q, testPasses);
+				*q = FindPrime(rangeMin, rangeMax, testPasses, pool);
 			}
+			while(*q == *p);
 		}
 
 		Word Nwd(Word a, Word b)
@@ -215,11 +385,11 @@ namespace ImgOps
 			return p1;
 		}
 
-		void GenerateRSAKeys(RSAKey* pubKey, RSAKey* privKey, double maxPrimeError)
+		void GenerateRSAKeys(RSAKey* pubKey, RSAKey* privKey, double maxPrimeError, ThreadPool* pool)
 		{
 			int testPasses = -((log(maxPrimeError) / log(2)) / 2 - 1); // t = log2(maxError) -> 2^t = maxError, each pass -> emax = 2^2, so passes = t/2 + 1
 			Word p, q;
-			GeneratePrimaryPair(&p, &q, testPasses);
+			GeneratePrimaryPair(&p, &q, testPasses, pool);
 			Word n = p * q;
 			// Mamy wygenerowane 2 liczby pierwsze, teraz znajdz wartosc funkcji eulera (p-1)(q-1)
 			Word euler = (p - 1) * (q - 1);
@@ -232,68 +402,309 @@ namespace ImgOps
 
 			pubKey->n = n;
 			pubKey->e = e;
+			pubKey->HasCrt = false;
 			privKey->n = n;
 			privKey->e = d;
+			SetCrtParameters(privKey, p, q);
 		}
 
-		Word EncryptDataChunk(Word data, RSAKey* key)
+		void SetCrtParameters(RSAKey* privKey, const Word& p, const Word& q)
 		{
-			// Zaszyfrowane dane : c = t^e mod n
-			return ModuloPower(data, key->e, key->n);
+			privKey->p = p;
+			privKey->q = q;
+			privKey->dP = privKey->e % (p - 1);
+			privKey->dQ = privKey->e % (q - 1);
+			privKey->qInv = FindModuloInverse(q % p, p);
+			privKey->HasCrt = true;
+			PrepareCrtContexts(privKey);
 		}
 
-		Word DecryptDataChunk(Word data, RSAKey* key)
+		void PrepareCrtContexts(RSAKey* privKey)
 		{
-			// Rozszyfrowane dane : t = c^d mod n
-			return ModuloPower(data, key->e, key->n);
+			privKey->ContextP = std::make_shared<const MontgomeryContext>(privKey->p);
+			privKey->ContextQ = std::make_shared<const MontgomeryContext>(privKey->q);
 		}
 
-		void ByteArrayToWord(byte* bytes, uint32 len, Word* word)
+		static const byte KeyFileMagic[4] = { 'R', 'S', 'A', 'K' };
+		static const uint32 KeyFileHasCrt = 1;
+		// Wersja zapisywana dla RSAKey : bez dlugosci klucza, wszystkie liczby na WordByteCount bajtach
+		// (q z GeneratePrimaryPair moze miec wiecej niz WordBitCount / 2 bitow, wiec nie miesci sie w formacie 3)
+		static const uint32 WordKeyFileVersion = 2;
+
+		static bool WriteUInt32(IDataStream* stream, uint32 value)
 		{
-			*word = 0;
-			Word byteWord;
-			int actLen = min(len, WordByteCount);
-			for(int i = 0; i < actLen; ++i)
+			byte buf[4] = { (byte)value, (byte)(value >> 8), (byte)(value >> 16), (byte)(value >> 24) };
+			return stream->WriteSome(4, buf) == 4;
+		}
+
+		static bool ReadUInt32(IDataStream* stream, uint32* value)
+		{
+			byte buf[4];
+			if(stream->ReadSome(4, buf) != 4)
+				return false;
+			*value = (uint32)buf[0] | ((uint32)buf[1] << 8) | ((uint32)buf[2] << 16) | ((uint32)buf[3] << 24);
+			return true;
+		}
+
+		static bool WriteWord(IDataStream* stream, Word* word)
+		{
+			byte buf[WordByteCount];
+			WordToByteArray_FullWord(buf, word);
+			return stream->WriteSome(WordByteCount, buf) == WordByteCount;
+		}
+
+		static bool ReadWord(IDataStream* stream, Word* word)
+		{
+			byte buf[WordByteCount];
+			if(stream->ReadSome(WordByteCount, buf) != WordByteCount)
+				return false;
+			ByteArrayToWord(buf, WordByteCount, word);
+			return true;
+		}
+
+		bool WriteKey(IDataStream* stream, RSAKey* key)
+		{
+			if(stream->WriteSome(4, (byte*)KeyFileMagic) != 4 ||
+				WriteUInt32(stream, WordKeyFileVersion) == false ||
+				WriteUInt32(stream, key->HasCrt ? KeyFileHasCrt : 0) == false ||
+				WriteWord(stream, &key->n) == false ||
+				WriteWord(stream, &key->e) == false)
+				return false;
+
+			if(key->HasCrt)
 			{
-				byteWord = bytes[i];
-				*word = *word + (byteWord << (i*8));
+				if(WriteWord(stream, &key->p) == false ||
+					WriteWord(stream, &key->q) == false ||
+					WriteWord(stream, &key->dP) == false ||
+					WriteWord(stream, &key->dQ) == false ||
+					WriteWord(stream, &key->qInv) == false)
+					return false;
 			}
+			return true;
 		}
 
-		void WordToByteArray_FullWord(byte* bytes, Word* word)
+		template<int Limbs>
+		static bool WriteFixed(IDataStream* stream, const FixedUInt<Limbs>& value)
+		{
+			byte buf[FixedUInt<Limbs>::ByteCount];
+			value.ToBytes(buf, FixedUInt<Limbs>::ByteCount);
+			return stream->WriteSome(FixedUInt<Limbs>::ByteCount, buf) == FixedUInt<Limbs>::ByteCount;
+		}
+
+		template<int Limbs>
+		static bool ReadFixed(IDataStream* stream, FixedUInt<Limbs>* value)
 		{
-			auto limbsCount = (*word).backend().size();
-			boost::multiprecision::limb_type* limbs = (boost::multiprecision::limb_type*)(*word).backend().limbs();
+			byte buf[FixedUInt<Limbs>::ByteCount];
+			if(stream->ReadSome(FixedUInt<Limbs>::ByteCount, buf) != FixedUInt<Limbs>::ByteCount)
+				return false;
+			value->FromBytes(buf, FixedUInt<Limbs>::ByteCount);
+			return true;
+		}
 
-			int actLen = min(limbsCount * 4, WordByteCount);
-			for(int i = 0; i < actLen; ++i)
+		template<int Bits>
+		static bool WriteEngineKey(IDataStream* stream, const typename RsaEngine<Bits>::Key& key)
+		{
+			if(stream->WriteSome(4, (byte*)KeyFileMagic) != 4 ||
+				WriteUInt32(stream, KeyFileVersion) == false ||
+				WriteUInt32(stream, key.HasCrt ? KeyFileHasCrt : 0) == false ||
+				WriteUInt32(stream, Bits) == false ||
+				WriteFixed(stream, key.n) == false ||
+				WriteFixed(stream, key.e) == false)
+				return false;
+
+			if(key.HasCrt)
 			{
-				byte b = *(limbs + (i >> 2)) >> 8 * (i & 3);
-				bytes[i] = *(limbs + (i >> 2)) >> 8 * (i & 3);
+				if(WriteFixed(stream, key.p) == false ||
+					WriteFixed(stream, key.q) == false ||
+					WriteFixed(stream, key.dP) == false ||
+					WriteFixed(stream, key.dQ) == false ||
+					WriteFixed(stream, key.qInv) == false)
+					return false;
 			}
+			return true;
+		}
 
-			for(int i = actLen; i < WordByteCount; ++i)
+		template<int Bits>
+		static bool ReadEngineKey(IDataStream* stream, uint32 flags, typename RsaEngine<Bits>::Key* key)
+		{
+			key->HasCrt = false;
+			if(ReadFixed(stream, &key->n) == false ||
+				ReadFixed(stream, &key->e) == false)
+				return false;
+			// Klucze sa generowane z n o dokladnie Bits bitach, Montgomery wymaga nieparzystego n
+			if(key->n.BitLength() != Bits || (key->n.Limb[0] & 1) == 0)
+				return false;
+
+			if((flags & KeyFileHasCrt) != 0)
 			{
-				bytes[i] = 0;
+				if(ReadFixed(stream, &key->p) == false ||
+					ReadFixed(stream, &key->q) == false ||
+					ReadFixed(stream, &key->dP) == false ||
+					ReadFixed(stream, &key->dQ) == false ||
+					ReadFixed(stream, &key->qInv) == false)
+					return false;
+				// RsaEngine wymaga ustawionych najstarszych bitow p i q
+				key->HasCrt = key->p.BitLength() == Bits / 2 && key->q.BitLength() == Bits / 2;
 			}
+			return true;
 		}
 
-		void WordToByteArray(byte* bytes, uint32 len, Word* word)
+		// Odczytuje klucz w dowolnej wersji : wersje 1 i 2 do 'wordKey' ('sizedKey->Bits' = 0),
+		// wersje od 3 do 'sizedKey'
+		static bool ReadKeyFile(IDataStream* stream, RSAKey* wordKey, SizedKey* sizedKey)
 		{
-			auto limbsCount = (*word).backend().size();
-			boost::multiprecision::limb_type* limbs = (boost::multiprecision::limb_type*)(*word).backend().limbs();
+			// Stary format zaczyna sie od najmlodszego bajtu n, ktory jest nieparzysty, wiec nie moze byc 'R'
+			byte buf[WordByteCount];
+			if(stream->ReadSome(4, buf) != 4)
+				return false;
+
+			sizedKey->Bits = 0;
+			wordKey->HasCrt = false;
+			if(memcmp(buf, KeyFileMagic, 4) != 0)
+			{
+				if(stream->ReadSome(WordByteCount - 4, buf + 4) != WordByteCount - 4)
+					return false;
+				ByteArrayToWord(buf, WordByteCount, &wordKey->n);
+				return ReadWord(stream, &wordKey->e);
+			}
+
+			uint32 version, flags;
+			if(ReadUInt32(stream, &version) == false || version > KeyFileVersion ||
+				ReadUInt32(stream, &flags) == false)
+				return false;
 
-			int actLen = min(limbsCount * 4, len);
-			for(int i = 0; i < actLen; ++i)
+			if(version >= 3)
 			{
-				byte b = *(limbs + (i >> 2)) >> 8 * (i & 3);
-				bytes[i] = *(limbs + (i >> 2)) >> 8 * (i & 3);
+				uint32 bits;
+				if(ReadUInt32(stream, &bits) == false || IsSupportedKeySize(bits) == false)
+					return false;
+				sizedKey->Bits = bits;
+				switch(bits)
+				{
+				case 1024:
+					return ReadEngineKey<1024>(stream, flags, &sizedKey->Key1024);
+				case 2048:
+					return ReadEngineKey<2048>(stream, flags, &sizedKey->Key2048);
+				default:
+					return ReadEngineKey<4096>(stream, flags, &sizedKey->Key4096);
+				}
 			}
 
-			for(int i = actLen; i < len; ++i)
+			if(ReadWord(stream, &wordKey->n) == false ||
+				ReadWord(stream, &wordKey->e) == false)
+				return false;
+
+			if((flags & KeyFileHasCrt) != 0)
 			{
-				bytes[i] = 0;
+				if(ReadWord(stream, &wordKey->p) == false ||
+					ReadWord(stream, &wordKey->q) == false ||
+					ReadWord(stream, &wordKey->dP) == false ||
+					ReadWord(stream, &wordKey->dQ) == false ||
+					ReadWord(stream, &wordKey->qInv) == false)
+					return false;
+				wordKey->HasCrt = true;
 			}
+			return true;
+		}
+
+		bool ReadKey(IDataStream* stream, RSAKey* key)
+		{
+			SizedKey sizedKey;
+			if(ReadKeyFile(stream, key, &sizedKey) == false)
+				return false;
+
+			if(sizedKey.Bits != 0)
+				return ToRSAKey(sizedKey, key);
+			if(key->HasCrt)
+				PrepareCrtContexts(key);
+			return true;
+		}
+
+		bool WriteKey(IDataStream* stream, const SizedKey* key)
+		{
+			switch(key->Bits)
+			{
+			case 1024:
+				return WriteEngineKey<1024>(stream, key->Key1024);
+			case 2048:
+				return WriteEngineKey<2048>(stream, key->Key2048);
+			case 4096:
+				return WriteEngineKey<4096>(stream, key->Key4096);
+			}
+			return false;
+		}
+
+		bool ReadKey(IDataStream* stream, SizedKey* key)
+		{
+			RSAKey wordKey;
+			if(ReadKeyFile(stream, &wordKey, key) == false)
+				return false;
+			return key->Bits != 0 || FromRSAKey(wordKey, key);
+		}
+
+		Word EncryptDataChunk(Word data, RSAKey* key)
+		{
+			// Zaszyfrowane dane : c = t^e mod n
+			return ModuloPower(data, key->e, key->n);
+		}
+
+		Word DecryptDataChunk(Word data, RSAKey* key)
+		{
+			// Rozszyfrowane dane : t = c^d mod n
+			if(key->HasCrt == false)
+				return ModuloPower(data, key->e, key->n);
+
+			// Konteksty dla p i q sa brane z klucza, nigdy z MontgomeryContext::Get (tajne liczby nie moga trafic do
+			// wspolnej pamieci podrecznej), jesli klucz ich nie ma (lub p, q zmieniono recznie) sa tworzone tymczasowo
+			std::shared_ptr<const MontgomeryContext> contextP = key->ContextP;
+			std::shared_ptr<const MontgomeryContext> contextQ = key->ContextQ;
+			if(contextP == NULL || contextP->Modulus() != key->p)
+				contextP = std::make_shared<const MontgomeryContext>(key->p);
+			if(contextQ == NULL || contextQ->Modulus() != key->q)
+				contextQ = std::make_shared<const MontgomeryContext>(key->q);
+
+			// CRT : m1 = c^dP mod p, m2 = c^dQ mod q, h = qInv(m1 - m2) mod p, t = m2 + hq
+			Word m1 = contextP->Power(data % key->p, key->dP);
+			Word m2 = contextQ->Power(data % key->q, key->dQ);
+			Word diff = m1 - m2 % key->p;
+			if(diff < 0)
+				diff += key->p;
+			// qInv*R * diff * R^-1 = qInv * diff mod p
+			Word h = contextP->Multiply(contextP->ToMontgomery(key->qInv), diff);
+			return m2 + h * key->q;
+		}
+
+		void ByteArrayToWord(byte* bytes, uint32 len, Word* word)
+		{
+			uint32 actLen = len < (uint32)WordByteCount ? len : (uint32)WordByteCount;
+			*word = 0;
+			if(actLen > 0)
+				import_bits(*word, bytes, bytes + actLen, 8, false);
+		}
+
+		// Bajty liczby sa czytane z jej slow (limb_type ma 4 lub 8 bajtow zaleznie od platformy)
+		static void LimbsToBytes(byte* bytes, uint32 len, const Word& word)
+		{
+			const uint32 limbBytes = sizeof(boost::multiprecision::limb_type);
+			uint32 limbsCount = (uint32)word.backend().size();
+			const boost::multiprecision::limb_type* limbs = word.backend().limbs();
+
+			uint32 actLen = limbsCount * limbBytes < len ? limbsCount * limbBytes : len;
+			for(uint32 i = 0; i < actLen; ++i)
+				bytes[i] = (byte)(limbs[i / limbBytes] >> (8 * (i % limbBytes)));
+
+			for(uint32 i = actLen; i < len; ++i)
+				bytes[i] = 0;
+		}
+
+		void WordToByteArray_FullWord(byte* bytes, Word* word)
+		{
+			LimbsToBytes(bytes, WordByteCount, *word);
+		}
+
+		void WordToByteArray(byte* bytes, uint32 len, Word* word)
+		{
+			LimbsToBytes(bytes, len, *word);
 		}
 
 		void EncryptMessage(byte* data, uint64 dataLen, byte** encryptedData, uint64* encryptedLen, RSAKey* pubKey)
@@ -335,6 +746,23 @@ namespace ImgOps
 			WordToByteArray_FullWord(encChunk, &encryptedWord);
 		}
 
+		// Szyfruje kawalki [begin, end) wiadomosci podzielonej na kawalki 'chunkLength' bajtow
+		// (kawalek 'chunkCount' to niepelny ostatni kawalek o dlugosci 'lastChunkSize')
+		static void EncryptChunkRange(byte* data, uint64 chunkCount, uint32 chunkLength, uint32 lastChunkSize,
+			byte* encryptedData, RSAKey* pubKey, uint64 begin, uint64 end)
+		{
+			Word chunkData;
+			Word encryptedWord;
+			for(uint64 i = begin; i < end; ++i)
+			{
+				byte* chunk = data + i * chunkLength;
+				byte* encChunk = encryptedData + i * WordByteCount;
+				ByteArrayToWord(chunk, i < chunkCount ? chunkLength : lastChunkSize, &chunkData);
+				encryptedWord = EncryptDataChunk(chunkData, pubKey);
+				WordToByteArray_FullWord(encChunk, &encryptedWord);
+			}
+		}
+
 		void EncryptMessage_FixedChunks(byte* data, uint64 dataLen, 
 			uint32 chunkLength, uint32* lastChunkSize, 
 			byte** encryptedData, uint64* encryptedLen, RSAKey* pubKey)
@@ -342,31 +770,12 @@ namespace ImgOps
 			// 2) Znajdujemy liczbe kawalkow w wiadomosci (zakodowana wiadomosc ma taka sama dlugosc)
 			*lastChunkSize = dataLen % chunkLength;
 			uint64 chunkCount = dataLen / chunkLength;
-			*encryptedLen =  chunkCount * WordByteCount; // Zakodowany kawalek zawiera 1 Word
 			*encryptedLen = *lastChunkSize != 0 ? (chunkCount + 1) * WordByteCount : chunkCount * WordByteCount;
 			*encryptedData = (byte*)malloc(*encryptedLen);
 
-			// 3) Kodujemy kazdy kawalek
-			Word chunkData;
-			Word encryptedWord;
-			for(int i = 0; i < chunkCount; ++i)
-			{
-				byte* chunk = data + i * chunkLength;
-				byte* encChunk = *encryptedData + i * WordByteCount;
-				ByteArrayToWord(chunk, chunkLength, &chunkData);
-				encryptedWord = EncryptDataChunk(chunkData, pubKey);
-				WordToByteArray_FullWord(encChunk, &encryptedWord);
-			}
-
-			// 4) Ostatni kawalek moze byc niepelny
-			if(*lastChunkSize != 0)
-			{
-				byte* chunk = data + chunkCount * chunkLength;
-				byte* encChunk = *encryptedData + chunkCount * WordByteCount;
-				ByteArrayToWord(chunk, *lastChunkSize, &chunkData);
-				encryptedWord = EncryptDataChunk(chunkData, pubKey);
-				WordToByteArray_FullWord(encChunk, &encryptedWord);
-			}
+			// 3) Kodujemy kazdy kawalek, ostatni moze byc niepelny
+			EncryptChunkRange(data, chunkCount, chunkLength, *lastChunkSize, *encryptedData, pubKey,
+				0, *encryptedLen / WordByteCount);
 		}
 
 		void DecryptMessage(byte* data, uint64 dataLen, byte** decryptedData, uint64* decryptedLen, RSAKey* privKey)
@@ -400,6 +809,23 @@ namespace ImgOps
 			}
 		}
 
+		// Deszyfruje kawalki [begin, end) zapisujac je w kawalkach 'chunkLength' bajtow
+		// (kawalek 'chunkCount' to ostatni kawalek o dlugosci 'lastChunkSize')
+		static void DecryptChunkRange(byte* data, uint64 chunkCount, uint32 chunkLength, uint32 lastChunkSize,
+			byte* decryptedData, RSAKey* privKey, uint64 begin, uint64 end)
+		{
+			Word chunkData;
+			Word decryptedWord;
+			for(uint64 i = begin; i < end; ++i)
+			{
+				byte* chunk = data + i * WordByteCount;
+				byte* decChunk = decryptedData + i * chunkLength;
+				ByteArrayToWord(chunk, WordByteCount, &chunkData);
+				decryptedWord = DecryptDataChunk(chunkData, privKey);
+				WordToByteArray(decChunk, i < chunkCount ? chunkLength : lastChunkSize, &decryptedWord);
+			}
+		}
+
 		void DecryptMessage_FixedChunks(byte* data, uint64 dataLen, 
 			uint32 chunkLength, uint32 lastChunkSize, byte** decryptedData, uint64* decryptedLen, RSAKey* privKey)
 		{
@@ -410,24 +836,173 @@ namespace ImgOps
 			*decryptedLen = chunkCount * chunkLength + lastChunkSize; 
 			*decryptedData = (byte*)malloc(*decryptedLen);
 
-			// 3) Dekodujemy kazdy kawalek
-			Word chunkData;
-			Word decryptedWord;
-			for(int i = 0; i < chunkCount; ++i)
+			// 3) Dekodujemy kazdy kawalek, ostatni moze byc niepelny
+			DecryptChunkRange(data, chunkCount, chunkLength, lastChunkSize, *decryptedData, privKey, 0, chunkCount + 1);
+		}
+
+		// Wykonuje 'processRange' dla kawalkow [0, totalChunks) rownolegle na 'pool'
+		// Kawalki sa przetwarzane blokami, po kazdym bloku zglaszany jest postep i sprawdzane jest przerwanie
+		static bool ProcessChunksParallel(uint64 totalChunks, const std::function<void(uint64 begin, uint64 end)>& processRange,
+			const ChunkProgress& progress, ThreadPool* pool)
+		{
+			static const uint64 ChunksPerBlock = 64;
+			if(pool == NULL)
+				pool = ThreadPool::Default();
+
+			std::atomic<uint64> processed(0);
+			std::atomic<bool> cancelled(false);
+			std::mutex progressMutex;
+			int blockCount = (int)((totalChunks + ChunksPerBlock - 1) / ChunksPerBlock);
+			pool->ParallelFor(blockCount, [&](int beginBlock, int endBlock)
 			{
-				byte* chunk = data + i * WordByteCount;
-				byte* encChunk = *decryptedData + i * chunkLength;
-				ByteArrayToWord(chunk, WordByteCount, &chunkData);
-				decryptedWord = DecryptDataChunk(chunkData, privKey);
-				WordToByteArray(encChunk, chunkLength, &decryptedWord);
+				for(int block = beginBlock; block < endBlock && !cancelled; ++block)
+				{
+					uint64 begin = block * ChunksPerBlock;
+					uint64 end = begin + ChunksPerBlock < totalChunks ? begin + ChunksPerBlock : totalChunks;
+					processRange(begin, end);
+
+					uint64 done = processed += end - begin;
+					if(progress)
+					{
+						std::lock_guard<std::mutex> lock(progressMutex);
+						if(!cancelled && progress(done, totalChunks) == false)
+							cancelled = true;
+					}
+				}
+			});
+			return !cancelled;
+		}
+
+		bool EncryptMessage_FixedChunksParallel(byte* data, uint64 dataLen,
+			uint32 chunkLength, uint32* lastChunkSize,
+			byte** encryptedData, uint64* encryptedLen, RSAKey* pubKey,
+			const ChunkProgress& progress, ThreadPool* pool)
+		{
+			*lastChunkSize = dataLen % chunkLength;
+			uint64 chunkCount = dataLen / chunkLength;
+			*encryptedLen = *lastChunkSize != 0 ? (chunkCount + 1) * WordByteCount : chunkCount * WordByteCount;
+			*encryptedData = (byte*)malloc(*encryptedLen);
+
+			uint32 lastSize = *lastChunkSize;
+			byte* output = *encryptedData;
+			bool finished = ProcessChunksParallel(*encryptedLen / WordByteCount, [&](uint64 begin, uint64 end)
+			{
+				EncryptChunkRange(data, chunkCount, chunkLength, lastSize, output, pubKey, begin, end);
+			}, progress, pool);
+
+			if(finished == false)
+			{
+				free(*encryptedData);
+				*encryptedData = NULL;
+				*encryptedLen = 0;
 			}
+			return finished;
+		}
 
-			// 4) Ostatni kawalek moze byc niepelny
-			byte* chunk = data + chunkCount * WordByteCount;
-			byte* encChunk = *decryptedData + chunkCount * chunkLength;
-			ByteArrayToWord(chunk, WordByteCount, &chunkData);
-			decryptedWord = DecryptDataChunk(chunkData, privKey);
-			WordToByteArray(encChunk, lastChunkSize, &decryptedWord);
+		bool DecryptMessage_FixedChunksParallel(byte* data, uint64 dataLen,
+			uint32 chunkLength, uint32 lastChunkSize,
+			byte** decryptedData, uint64* decryptedLen, RSAKey* privKey,
+			const ChunkProgress& progress, ThreadPool* pool)
+		{
+			uint64 chunkCount = dataLen / WordByteCount - 1;
+			if(lastChunkSize == 0)
+				lastChunkSize = chunkLength;
+			*decryptedLen = chunkCount * chunkLength + lastChunkSize;
+			*decryptedData = (byte*)malloc(*decryptedLen);
+
+			byte* output = *decryptedData;
+			bool finished = ProcessChunksParallel(chunkCount + 1, [&](uint64 begin, uint64 end)
+			{
+				DecryptChunkRange(data, chunkCount, chunkLength, lastChunkSize, output, privKey, begin, end);
+			}, progress, pool);
+
+			if(finished == false)
+			{
+				free(*decryptedData);
+				*decryptedData = NULL;
+				*decryptedLen = 0;
+			}
+			return finished;
+		}
+
+		// Zawartosc kawalka z kluczem hybrydowym : klucz, nonce, znacznik (do sprawdzenia klucza prywatnego),
+		// reszta do dlugosci n to losowe bajty (male liczby nie moga byc szyfrowane RSA bez dopelnienia)
+		static const byte HybridKeyMarker[4] = { 'C', 'h', 'C', 'h' };
+		static const int HybridKeyPayload = ChaCha20::KeySize + ChaCha20::NonceSize + 4;
+
+		template<int Bits>
+		static void EncryptHybridWith(const typename RsaEngine<Bits>::Key& pubKey, byte* data, uint64 dataLen,
+			byte* wrappedKey, ThreadPool* pool)
+		{
+			// Liczba ma o bajt mniej niz n, wiec jest od niego mniejsza
+			uint32 keyChunkLength = (pubKey.n.BitLength() - 1) / 8;
+			byte keyChunk[Bits / 8];
+			RandomBytes(keyChunk, keyChunkLength);
+			memcpy(keyChunk + ChaCha20::KeySize + ChaCha20::NonceSize, HybridKeyMarker, 4);
+			RsaEngine<Bits>(pubKey).EncryptBlock(keyChunk, keyChunkLength, wrappedKey);
+
+			ChaCha20 cipher(keyChunk, keyChunk + ChaCha20::KeySize);
+			cipher.ProcessParallel(data, dataLen, pool);
+			memset(keyChunk, 0, sizeof(keyChunk));
+		}
+
+		template<int Bits>
+		static bool DecryptHybridWith(const typename RsaEngine<Bits>::Key& privKey, byte* data, uint64 dataLen,
+			const byte* wrappedKey, ThreadPool* pool)
+		{
+			byte keyChunk[HybridKeyPayload];
+			RsaEngine<Bits>(privKey).DecryptBlock(wrappedKey, keyChunk, HybridKeyPayload);
+			if(memcmp(keyChunk + ChaCha20::KeySize + ChaCha20::NonceSize, HybridKeyMarker, 4) != 0)
+				return false;
+
+			ChaCha20 cipher(keyChunk, keyChunk + ChaCha20::KeySize);
+			cipher.ProcessParallel(data, dataLen, pool);
+			memset(keyChunk, 0, sizeof(keyChunk));
+			return true;
+		}
+
+		bool EncryptHybrid(byte* data, uint64 dataLen, byte* wrappedKey, const SizedKey* pubKey, ThreadPool* pool)
+		{
+			switch(pubKey->Bits)
+			{
+			case 1024:
+				EncryptHybridWith<1024>(pubKey->Key1024, data, dataLen, wrappedKey, pool);
+				return true;
+			case 2048:
+				EncryptHybridWith<2048>(pubKey->Key2048, data, dataLen, wrappedKey, pool);
+				return true;
+			case 4096:
+				EncryptHybridWith<4096>(pubKey->Key4096, data, dataLen, wrappedKey, pool);
+				return true;
+			}
+			return false;
+		}
+
+		bool DecryptHybrid(byte* data, uint64 dataLen, const byte* wrappedKey, const SizedKey* privKey, ThreadPool* pool)
+		{
+			switch(privKey->Bits)
+			{
+			case 1024:
+				return DecryptHybridWith<1024>(privKey->Key1024, data, dataLen, wrappedKey, pool);
+			case 2048:
+				return DecryptHybridWith<2048>(privKey->Key2048, data, dataLen, wrappedKey, pool);
+			case 4096:
+				return DecryptHybridWith<4096>(privKey->Key4096, data, dataLen, wrappedKey, pool);
+			}
+			return false;
+		}
+
+		void EncryptHybrid(byte* data, uint64 dataLen, byte* wrappedKey, RSAKey* pubKey, ThreadPool* pool)
+		{
+			SizedKey sizedKey;
+			FromRSAKey(*pubKey, &sizedKey);
+			EncryptHybrid(data, dataLen, wrappedKey, &sizedKey, pool);
+		}
+
+		bool DecryptHybrid(byte* data, uint64 dataLen, const byte* wrappedKey, RSAKey* privKey, ThreadPool* pool)
+		{
+			SizedKey sizedKey;
+			return FromRSAKey(*privKey, &sizedKey) && DecryptHybrid(data, dataLen, wrappedKey, &sizedKey, pool);
 		}
 	}
 }
\ No newline at end of file
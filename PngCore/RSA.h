@@ -1,10 +1,17 @@
 ﻿#pragma once
 
 #include "TypeDefs.h"
-#include <boost\multiprecision\cpp_int.hpp>
+#include "FixedUInt.h"
+#include <boost/multiprecision/cpp_int.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace ImgOps
 {
+	__interface IDataStream;
+	class ThreadPool;
+
 	namespace RSA
 	{
 		static const int WordByteCount = 128;
@@ -19,12 +26,58 @@ namespace ImgOps
 			(WordBitCount + 2)*2, (WordBitCount + 2)*2, boost::multiprecision::signed_magnitude, boost::multiprecision::unchecked, void>> 
 			Word2; // Word that contains at least 2 * WordBitCount
 
+		// Liczba 64-bitowych slow FixedUInt mieszczaca Word
+		static const int WordLimbs = (WordBitCount + 2 + 63) / 64;
+
+		// Zamiana nieujemnego Word na FixedUInt (nadmiarowe bity sa obcinane) i odwrotnie
+		template<int Limbs>
+		FixedUInt<Limbs> WordToFixed(const Word& word)
+		{
+			uint64 limbs[WordLimbs] = { 0 };
+			boost::multiprecision::export_bits(word, limbs, 64, false);
+			FixedUInt<Limbs> result;
+			for(int i = 0; i < Limbs && i < WordLimbs; ++i)
+				result.Limb[i] = limbs[i];
+			return result;
+		}
+
+		template<int Limbs>
+		Word FixedToWord(const FixedUInt<Limbs>& value)
+		{
+			Word word;
+			boost::multiprecision::import_bits(word, value.Limb, value.Limb + Limbs, 64, false);
+			return word;
+		}
+
+		class MontgomeryContext;
+
+		// Klucz funkcji operujacych na Word (*DataChunk / *Message*), ma co najwyzej WordBitCount (1024) bitow
+		// Klucze 2048 i 4096 bitow sa przechowywane w SizedKey (patrz RsaEngine.h)
 		struct RSAKey
 		{
 			Word n;
 			Word e;
+
+			// Skladowe klucza prywatnego dla deszyfrowania z Chinskiego Twierdzenia o Resztach (jesli HasCrt)
+			// dP = d mod (p-1), dQ = d mod (q-1), qInv = q^-1 mod p
+			bool HasCrt;
+			Word p;
+			Word q;
+			Word dP;
+			Word dQ;
+			Word qInv;
+
+			// Konteksty Montgomery'ego dla p i q (ustawiane przez SetCrtParameters / ReadKey / PrepareCrtContexts)
+			// Tajne liczby nie trafiaja do wspolnej pamieci podrecznej MontgomeryContext::Get, konteksty zyja z kluczem
+			std::shared_ptr<const MontgomeryContext> ContextP;
+			std::shared_ptr<const MontgomeryContext> ContextQ;
+
+			RSAKey() : HasCrt(false) { }
 		};
 
+		// Wersja formatu zapisu kluczy (WriteKey / ReadKey), od wersji 3 zawiera dlugosc klucza
+		static const uint32 KeyFileVersion = 3;
+
 		// Converts array of bytes of length 'len' to Word and stores in 'word'
 		void ByteArrayToWord(byte* bytes, uint32 len, Word* word);
 
@@ -34,16 +87,66 @@ namespace ImgOps
 		// Converts Word to array of bytes of length WordByteCount
 		void WordToByteArray_FullWord(byte* bytes, Word* word);
 
+		// Losowanie z generatora kryptograficznego watku (Drbg::ThreadLocal), bezpieczne dla wielu watkow
+		// Dla powtarzalnych wynikow (testy) patrz Drbg::SetDeterministicSeed
+		// Losowa liczba WordBitCount-bitowa
 		Word Rand();
+		// Losowa liczba z przedzialu [rangeMin, rangeMax] (rozklad rownomierny)
 		Word Rand(Word rangeMin, Word rangeMax);
+		// Wypelnia 'bytes' losowymi bajtami
+		void RandomBytes(byte* bytes, uint32 length);
+
+		// Liczby pierwsze mniejsze od 4096 (bez 2), do odsiewania kandydatow na liczby pierwsze
+		const std::vector<uint32>& SmallPrimes();
 
 		// Mnozenie modulo : a*b mod k
 		Word ModuloMultiplcation(Word a, Word b, Word k);
 
 		// Potegowanie modulo : a^e mod k
-		// Poteguje uzywajac 'Right-to-left binary method'
+		// Dla nieparzystego k poteguje w dziedzinie Montgomery'ego na liczbach stalej dlugosci (MontgomeryContext::Power),
+		// stale dla modulu sa liczone raz i trzymane w pamieci podrecznej (tylko dla jawnych modulow, np. n klucza)
+		// Dla parzystego k uzywa 'Right-to-left binary method' (tylko do najstarszego bitu 'e')
 		Word ModuloPower(Word base, Word e, Word k);
 
+		// Arytmetyka Montgomery'ego dla nieparzystego modulu n : liczba a jest reprezentowana jako aR mod n,
+		// wtedy mnozenie to REDC(aR * bR) = abR mod n (bez dzielenia)
+		// Obliczenia sa wykonywane na FixedUInt (patrz FixedMontgomery) : moduly do WordBitCount / 2 bitow
+		// (np. p i q w CRT) na liczbach o polowie dlugosci, R = 2^(64 * liczba slow), Word jest zamieniany
+		// tylko na wejsciu i wyjsciu
+		// Obiekt nie zmienia sie po utworzeniu, wiec moze byc uzywany przez wiele watkow
+		class MontgomeryContext
+		{
+		protected:
+			static const int ShortLimbs = WordBitCount / 128;
+
+			Word _n;
+			bool _short; // Modul miesci sie w ShortLimbs slowach
+			FixedMontgomery<ShortLimbs> _shortFixed;
+			FixedMontgomery<WordLimbs> _fixed;
+
+		public:
+			// 'modulus' musi byc nieparzysty i wiekszy od 1
+			MontgomeryContext(const Word& modulus);
+
+			const Word& Modulus() const { return _n; }
+
+			// a -> aR mod n (a < n)
+			Word ToMontgomery(const Word& a) const;
+			// aR -> a mod n
+			Word FromMontgomery(const Word& a) const;
+			// aR, bR -> abR mod n
+			Word Multiply(const Word& a, const Word& b) const;
+
+			// base^e mod n (zwykle liczby, nie w dziedzinie Montgomery'ego, base < n)
+			// Wykladniki do 64 bitow (publiczne) metoda 'left-to-right', dluzsze w stalym czasie
+			// (stale okna, patrz FixedMontgomery::Power)
+			Word Power(const Word& base, const Word& e) const;
+
+			// Zwraca kontekst dla modulu z pamieci podrecznej (tworzy go przy pierwszym uzyciu)
+			// Tylko dla jawnych modulow : konteksty dla tajnych p i q sa trzymane w RSAKey
+			static std::shared_ptr<const MontgomeryContext> Get(const Word& modulus);
+		};
+
 		// Funkcja obliczająca NWD dla dwóch liczb (algorytm Euklidesa)
 		Word Nwd(Word a, Word b);
 
@@ -63,15 +166,32 @@ namespace ImgOps
 		// Zwraca pare licz pierwszych (p,q) takich ze n = p*q ma zadana liczbe bitow (N = WordBitCount) -> n > 2^(N-1)
 		// Czyli dla danego p, q > 2^(N-1) / p i q < 2^N / p (czyli q = (2^(N-1) / p, 2^N / p))
 		// Prawdopodobienstwo ze p i q sa rzeczywiscie pierwsze to 1 - (1/4)^'passes'
-		void GeneratePrimaryPair(Word* p, Word* q, int testPasses = 10);
+		// Kandydaci sa odsiewani przez male liczby pierwsze, a reszta jest testowana rownolegle na 'pool'
+		// (NULL - ThreadPool::Default())
+		void GeneratePrimaryPair(Word* p, Word* q, int testPasses = 10, ThreadPool* pool = NULL);
 
 		// Generuje pare kluczy RSA, (n,e) stanowia klucz publiczny, (n,d) klucz prywatny
 		// Liczby (p,q) sluzace do wyznaczenia kluczy sa pierwsze z prawdopodobienstwem (1 - 'maxPrimeError')
-		void GenerateRSAKeys(RSAKey* pubKey, RSAKey* privKey, double maxPrimeError = 1e-10);
+		void GenerateRSAKeys(RSAKey* pubKey, RSAKey* privKey, double maxPrimeError = 1e-10, ThreadPool* pool = NULL);
+
+		// Ustawia skladowe CRT klucza prywatnego (n,d) dla jego liczb pierwszych (p,q)
+		void SetCrtParameters(RSAKey* privKey, const Word& p, const Word& q);
+		// Tworzy konteksty Montgomery'ego dla p i q klucza z CRT (po recznym ustawieniu p i q)
+		// DecryptDataChunk bez nich tworzy konteksty tymczasowe przy kazdym wywolaniu
+		void PrepareCrtContexts(RSAKey* privKey);
+
+		// Zapisuje klucz do strumienia w formacie wersji 2 : naglowek 'RSAK', wersja, flagi (1 - zawiera CRT),
+		// nastepnie n, e oraz jesli sa p, q, dP, dQ, qInv (kazda liczba zajmuje WordByteCount bajtow)
+		// Klucze dowolnej dlugosci zapisuje WriteKey dla SizedKey (wersja KeyFileVersion)
+		bool WriteKey(IDataStream* stream, RSAKey* key);
+		// Odczytuje klucz zapisany przez WriteKey, w starym formacie (tylko n i e, bez naglowka)
+		// lub w formacie KeyFileVersion jesli klucz ma WordBitCount bitow
+		bool ReadKey(IDataStream* stream, RSAKey* key);
 
 		// Zaszyfrowuje pojedynczy kawalek danych
 		Word EncryptDataChunk(Word data, RSAKey* pubKey);
 		// Rozszyfrowuje pojedynczy kawalek danych
+		// Dla klucza z CRT liczy dwie potegi modulo p i q (o polowe krotsze) i laczy je wzorem Garnera
 		Word DecryptDataChunk(Word data, RSAKey* privKey);
 
 		// Koduje wiadomosc : tablice bajtow o podanej dlugosci uzywajac klucza publicznego
@@ -100,5 +220,43 @@ namespace ImgOps
 			byte* encryptedData, uint64 encryptedLen,
 			uint32 chunkLength, uint32 lastChunkSize,
 			byte** decryptedData, uint64* decryptedLen, RSAKey* privKey);
+
+		// Wywolywana w trakcie operacji na kawalkach z liczba przetworzonych i wszystkich kawalkow
+		// Zwraca false aby przerwac operacje, moze byc wolana z roznych watkow (ale nigdy jednoczesnie)
+		typedef std::function<bool(uint64 processedChunks, uint64 totalChunks)> ChunkProgress;
+
+		// To samo co EncryptMessage_FixedChunks, ale kawalki sa szyfrowane rownolegle na 'pool'
+		// (NULL - ThreadPool::Default()), kazdy watek zapisuje rozlaczny fragment wyniku
+		// Zwraca false jesli 'progress' przerwal operacje (wtedy 'encryptedData' jest NULL)
+		bool EncryptMessage_FixedChunksParallel(byte* data, uint64 dataLen,
+			uint32 chunkLength, uint32* lastChunkSize,
+			byte** encryptedData, uint64* encryptedLen, RSAKey* pubKey,
+			const ChunkProgress& progress = ChunkProgress(), ThreadPool* pool = NULL);
+
+		// To samo co DecryptMessage_FixedChunks, ale kawalki sa deszyfrowane rownolegle na 'pool'
+		// Zwraca false jesli 'progress' przerwal operacje (wtedy 'decryptedData' jest NULL)
+		bool DecryptMessage_FixedChunksParallel(
+			byte* encryptedData, uint64 encryptedLen,
+			uint32 chunkLength, uint32 lastChunkSize,
+			byte** decryptedData, uint64* decryptedLen, RSAKey* privKey,
+			const ChunkProgress& progress = ChunkProgress(), ThreadPool* pool = NULL);
+
+		// Sposob zaszyfrowania danych obrazu (zapisywany w chunku deCf)
+		enum EncryptionMode : uint32
+		{
+			RsaChunks = 0, // Kazdy kawalek danych zaszyfrowany RSA (szyfrogram jest wiekszy od danych)
+			Hybrid = 1 // Dane zaszyfrowane ChaCha20, klucz ChaCha20 zaszyfrowany RSA
+		};
+
+		// Szyfrowanie hybrydowe : losowy klucz i nonce ChaCha20 sa szyfrowane RSA jako jeden kawalek
+		// (dopelniony losowymi bajtami do dlugosci n), a dane sa szyfrowane w miejscu strumieniem ChaCha20
+		// Szyfrogram ma dlugosc danych, bloki danych sa przetwarzane rownolegle na 'pool' (NULL - ThreadPool::Default())
+		// Zaszyfrowany klucz jest zapisywany w 'wrappedKey' (WordByteCount bajtow)
+		// Szyfrowanie wykonuje RsaEngine<WordBitCount>, klucze innych dlugosci - patrz EncryptHybrid dla SizedKey
+		void EncryptHybrid(byte* data, uint64 dataLen, byte* wrappedKey, RSAKey* pubKey, ThreadPool* pool = NULL);
+
+		// Odszyfrowuje klucz ChaCha20 z 'wrappedKey' kluczem prywatnym i deszyfruje dane w miejscu
+		// Zwraca false (dane nie sa zmieniane) jesli klucz prywatny nie pasuje do 'wrappedKey'
+		bool DecryptHybrid(byte* data, uint64 dataLen, const byte* wrappedKey, RSAKey* privKey, ThreadPool* pool = NULL);
 	}
 }
\ No newline at end of file
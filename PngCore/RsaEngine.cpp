@@ -0,0 +1,358 @@
+#include "RsaEngine.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <atomic>
+#include <vector>
+
+namespace ImgOps
+{
+	namespace RSA
+	{
+		using namespace boost::multiprecision;
+
+		// Liczba ze znakiem do rzadkich obliczen przy generowaniu kluczy (odwrotnosci modulo)
+		template<int Bits>
+		struct BigIntOf
+		{
+			typedef number<cpp_int_backend<Bits + 64, Bits + 64, signed_magnitude, unchecked, void>> Type;
+		};
+
+		template<class BigInt, int Limbs>
+		static BigInt FixedToBig(const FixedUInt<Limbs>& value)
+		{
+			BigInt big;
+			import_bits(big, value.Limb, value.Limb + Limbs, 64, false);
+			return big;
+		}
+
+		template<int Limbs, class BigInt>
+		static FixedUInt<Limbs> BigToFixed(const BigInt& big)
+		{
+			std::vector<uint64> limbs;
+			export_bits(big, std::back_inserter(limbs), 64, false);
+			FixedUInt<Limbs> result;
+			for(int i = 0; i < Limbs && i < (int)limbs.size(); ++i)
+				result.Limb[i] = limbs[i];
+			return result;
+		}
+
+		// a^-1 mod m (rozszerzony algorytm Euklidesa, NWD(a, m) = 1)
+		template<class BigInt>
+		static BigInt InverseModulo(BigInt a, BigInt m)
+		{
+			BigInt m0 = m;
+			BigInt x0 = 0;
+			BigInt x1 = 1;
+			a %= m;
+			while(a > 1)
+			{
+				BigInt q = a / m;
+				BigInt t = m;
+				m = a % m;
+				a = t;
+				t = x0;
+				x0 = x1 - q * x0;
+				x1 = t;
+			}
+			return x1 < 0 ? x1 + m0 : x1;
+		}
+
+		// x mod p dla x < R^2 (R = 2^(Bits/2)) : x = xH * R + xL, a xH * R mod p to ToMontgomery(xH)
+		template<int Limbs>
+		static FixedUInt<Limbs> ReduceDouble(const FixedMontgomery<Limbs>& mont, const FixedUInt<2 * Limbs>& x)
+		{
+			FixedUInt<Limbs> low = FixedUInt<Limbs>::Resize(x);
+			FixedUInt<2 * Limbs> shifted = x;
+			shifted.ShiftRight(Limbs * 64);
+			FixedUInt<Limbs> high = FixedUInt<Limbs>::Resize(shifted);
+			return mont.Add(mont.ToMontgomery(high), mont.Reduce(low));
+		}
+
+		template<int Bits>
+		RsaEngine<Bits>::RsaEngine(const Key& key) :
+			_key(key),
+			_n(key.n),
+			_p(key.HasCrt ? key.p : HalfUInt(1)),
+			_q(key.HasCrt ? key.q : HalfUInt(1))
+		{
+			if(key.HasCrt)
+				_qInv = _p.ToMontgomery(key.qInv);
+		}
+
+		template<int Bits>
+		typename RsaEngine<Bits>::UInt RsaEngine<Bits>::EncryptChunk(const UInt& data) const
+		{
+			return _n.PowerPublic(data, _key.e);
+		}
+
+		template<int Bits>
+		typename RsaEngine<Bits>::UInt RsaEngine<Bits>::DecryptChunk(const UInt& data) const
+		{
+			if(_key.HasCrt == false)
+				return _n.Power(data, _key.e);
+
+			// m1 = c^dP mod p, m2 = c^dQ mod q, h = qInv * (m1 - m2) mod p, m = m2 + h * q
+			HalfUInt m1 = _p.Power(ReduceDouble(_p, data), _key.dP);
+			HalfUInt m2 = _q.Power(ReduceDouble(_q, data), _key.dQ);
+			// m2 < q < 2p (oba maja Bits/2 bitow)
+			HalfUInt h = _p.Multiply(_qInv, _p.Sub(m1, _p.Reduce(m2)));
+			UInt m = MultiplyFull(h, _key.q);
+			m.Add(UInt::Resize(m2));
+			return m;
+		}
+
+		template<int Bits>
+		void RsaEngine<Bits>::EncryptBlock(const byte* data, uint32 length, byte* encrypted) const
+		{
+			UInt chunk;
+			chunk.FromBytes(data, length);
+			EncryptChunk(chunk).ToBytes(encrypted, KeyBytes);
+		}
+
+		template<int Bits>
+		void RsaEngine<Bits>::DecryptBlock(const byte* encrypted, byte* data, uint32 length) const
+		{
+			UInt chunk;
+			chunk.FromBytes(encrypted, KeyBytes);
+			DecryptChunk(chunk).ToBytes(data, length);
+		}
+
+		template<int Bits>
+		bool RsaEngine<Bits>::CheckMillerRabin(const HalfUInt& num, int passes)
+		{
+			FixedMontgomery<Bits / 128> mont(num);
+			HalfUInt numMinusOne = num;
+			numMinusOne.SubSmall(1);
+			HalfUInt minusOne = mont.ToMontgomery(numMinusOne);
+
+			// num - 1 = 2^s * d
+			HalfUInt d = numMinusOne;
+			int s = 0;
+			for(; d.IsOdd() == false; ++s)
+				d.ShiftRight(1);
+
+			int topBit = num.BitLength() - 1;
+			for(int i = 0; i < passes; ++i)
+			{
+				// Baza z przedzialu <2, 2^topBit) jest mniejsza od num - 2
+				HalfUInt base;
+				do
+				{
+					RandomBytes((byte*)base.Limb, HalfUInt::ByteCount);
+					base.ShiftRight(HalfUInt::BitCount - topBit);
+				}
+				while(base.BitLength() < 2);
+
+				HalfUInt x = mont.ToMontgomery(mont.Power(base, d)); // Pierwszy wyraz ciagu
+				if(x == mont.One() || x == minusOne) // Zla baza
+					continue;
+
+				for(int j = 1; j < s && x != minusOne; ++j)
+				{
+					mont.Multiply(x, x, &x);
+					if(x == mont.One()) // Tylko ostatni wyraz ciagu moze byc rowny 1
+						return false;
+				}
+				if(x != minusOne)
+					return false;
+			}
+			return true;
+		}
+
+		// Jak FindPrime w RSA.cpp : losowy nieparzysty poczatek okna z dwoma najstarszymi bitami ustawionymi
+		// (iloczyn dwoch takich liczb ma dokladnie 2 * HalfBits bitow), sito malymi liczbami pierwszymi
+		// i rownolegly test kandydatow (zwracany jest najmniejszy pierwszy kandydat w oknie)
+		// Odrzucane sa liczby p = 1 mod PublicExponent, aby e bylo wzglednie pierwsze z (p-1)
+		template<int Bits>
+		static typename RsaEngine<Bits>::HalfUInt FindEnginePrime(int testPasses, ThreadPool* pool)
+		{
+			typedef typename RsaEngine<Bits>::HalfUInt HalfUInt;
+			static const int SieveWindow = 2048;
+			static const int HalfBits = HalfUInt::BitCount;
+			const std::vector<uint32>& primes = SmallPrimes();
+			if(pool == NULL)
+				pool = ThreadPool::Default();
+
+			std::vector<bool> composite(SieveWindow);
+			std::vector<int> candidates;
+			candidates.reserve(SieveWindow);
+			while(true)
+			{
+				HalfUInt start;
+				RandomBytes((byte*)start.Limb, HalfUInt::ByteCount);
+				start.SetBit(HalfBits - 1);
+				start.SetBit(HalfBits - 2);
+				start.Limb[0] |= 1;
+				HalfUInt last = start;
+				if(last.AddSmall(2 * SieveWindow) != 0)
+					continue;
+
+				composite.assign(SieveWindow, false);
+				for(size_t i = 0; i < primes.size(); ++i)
+				{
+					uint32 prime = primes[i];
+					uint32 r = start.ModSmall(prime);
+					uint32 first = (uint32)((uint64)((prime - r) % prime) * ((prime + 1) / 2) % prime);
+					for(uint32 j = first; j < (uint32)SieveWindow; j += prime)
+						composite[j] = true;
+				}
+
+				candidates.clear();
+				for(int j = 0; j < SieveWindow; ++j)
+				{
+					if(!composite[j])
+						candidates.push_back(j);
+				}
+
+				std::atomic<int> next(0);
+				std::atomic<int> found((int)candidates.size());
+				pool->ParallelFor(pool->ThreadCount(), [&](int, int)
+				{
+					for(int index = next++; index < found; index = next++)
+					{
+						HalfUInt candidate = start;
+						candidate.AddSmall(2 * (uint64)candidates[index]);
+						if(candidate.ModSmall(RsaEngine<Bits>::PublicExponent) == 1)
+							continue;
+						// Test Fermata przy podstawie 2
+						FixedMontgomery<Bits / 128> mont(candidate);
+						if(mont.PowerPublic(HalfUInt(2), candidate) != HalfUInt(2))
+							continue;
+						if(RsaEngine<Bits>::CheckMillerRabin(candidate, testPasses) == false)
+							continue;
+
+						int current = found;
+						while(index < current && !found.compare_exchange_weak(current, index));
+						return;
+					}
+				});
+
+				if(found < (int)candidates.size())
+				{
+					HalfUInt prime = start;
+					prime.AddSmall(2 * (uint64)candidates[found]);
+					return prime;
+				}
+			}
+		}
+
+		template<int Bits>
+		void RsaEngine<Bits>::GenerateKeys(Key* pubKey, Key* privKey, double maxPrimeError, ThreadPool* pool)
+		{
+			typedef typename BigIntOf<Bits>::Type BigInt;
+			int testPasses = -((log(maxPrimeError) / log(2)) / 2 - 1);
+
+			HalfUInt p = FindEnginePrime<Bits>(testPasses, pool);
+			HalfUInt q;
+			do
+			{
+				q = FindEnginePrime<Bits>(testPasses, pool);
+			}
+			while(q == p);
+
+			BigInt bigP = FixedToBig<BigInt>(p);
+			BigInt bigQ = FixedToBig<BigInt>(q);
+			BigInt e = PublicExponent;
+			BigInt d = InverseModulo(e, BigInt((bigP - 1) * (bigQ - 1)));
+
+			pubKey->n = MultiplyFull(p, q);
+			pubKey->e = UInt(PublicExponent);
+			pubKey->HasCrt = false;
+
+			privKey->n = pubKey->n;
+			privKey->e = BigToFixed<Bits / 64>(d);
+			privKey->HasCrt = true;
+			privKey->p = p;
+			privKey->q = q;
+			privKey->dP = BigToFixed<Bits / 128>(BigInt(d % (bigP - 1)));
+			privKey->dQ = BigToFixed<Bits / 128>(BigInt(d % (bigQ - 1)));
+			privKey->qInv = BigToFixed<Bits / 128>(InverseModulo(bigQ, bigP));
+		}
+
+		template<int Bits>
+		bool RsaEngine<Bits>::FromRSAKey(const RSAKey& key, Key* result)
+		{
+			if(msb(key.n) >= Bits)
+				return false;
+
+			result->n = WordToFixed<Bits / 64>(key.n);
+			result->e = WordToFixed<Bits / 64>(key.e);
+			result->HasCrt = key.HasCrt && msb(key.p) < Bits / 2 && msb(key.q) < Bits / 2;
+			if(result->HasCrt)
+			{
+				result->p = WordToFixed<Bits / 128>(key.p);
+				result->q = WordToFixed<Bits / 128>(key.q);
+				result->dP = WordToFixed<Bits / 128>(key.dP);
+				result->dQ = WordToFixed<Bits / 128>(key.dQ);
+				result->qInv = WordToFixed<Bits / 128>(key.qInv);
+				// ReduceDouble wymaga ustawionych najstarszych bitow p i q
+				result->HasCrt = result->p.BitLength() == Bits / 2 && result->q.BitLength() == Bits / 2;
+			}
+			return true;
+		}
+
+		template<int Bits>
+		void RsaEngine<Bits>::ToRSAKey(const Key& key, RSAKey* result)
+		{
+			result->n = FixedToWord(key.n);
+			result->e = FixedToWord(key.e);
+			result->HasCrt = key.HasCrt;
+			if(key.HasCrt)
+			{
+				result->p = FixedToWord(key.p);
+				result->q = FixedToWord(key.q);
+				result->dP = FixedToWord(key.dP);
+				result->dQ = FixedToWord(key.dQ);
+				result->qInv = FixedToWord(key.qInv);
+				PrepareCrtContexts(result);
+			}
+		}
+
+		template class RsaEngine<1024>;
+		template class RsaEngine<2048>;
+		template class RsaEngine<4096>;
+
+		bool IsSupportedKeySize(int bits)
+		{
+			return bits == 1024 || bits == 2048 || bits == 4096;
+		}
+
+		bool GenerateRSAKeys(int bits, SizedKey* pubKey, SizedKey* privKey, double maxPrimeError, ThreadPool* pool)
+		{
+			switch(bits)
+			{
+			case 1024:
+				Rsa1024::GenerateKeys(&pubKey->Key1024, &privKey->Key1024, maxPrimeError, pool);
+				break;
+			case 2048:
+				Rsa2048::GenerateKeys(&pubKey->Key2048, &privKey->Key2048, maxPrimeError, pool);
+				break;
+			case 4096:
+				Rsa4096::GenerateKeys(&pubKey->Key4096, &privKey->Key4096, maxPrimeError, pool);
+				break;
+			default:
+				return false;
+			}
+			pubKey->Bits = bits;
+			privKey->Bits = bits;
+			return true;
+		}
+
+		bool FromRSAKey(const RSAKey& key, SizedKey* result)
+		{
+			result->Bits = 0;
+			if(RsaEngine<WordBitCount>::FromRSAKey(key, &result->Key1024) == false)
+				return false;
+			result->Bits = WordBitCount;
+			return true;
+		}
+
+		bool ToRSAKey(const SizedKey& key, RSAKey* result)
+		{
+			if(key.Bits != WordBitCount)
+				return false;
+			RsaEngine<WordBitCount>::ToRSAKey(key.Key1024, result);
+			return true;
+		}
+	}
+}
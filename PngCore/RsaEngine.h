@@ -0,0 +1,130 @@
+#pragma once
+
+#include "RSA.h"
+#include "FixedUInt.h"
+
+namespace ImgOps
+{
+	class ThreadPool;
+
+	namespace RSA
+	{
+		// RSA dla kluczy o stalej dlugosci 'Bits' (1024, 2048 lub 4096) na liczbach FixedUInt (bez alokacji)
+		// Potegowanie w dziedzinie Montgomery'ego w stalym czasie, deszyfrowanie z CRT na liczbach o polowie dlugosci
+		// Obiekt przechowuje klucz i konteksty Montgomery'ego (liczone raz w konstruktorze), nie zmienia sie
+		// po utworzeniu, wiec moze byc uzywany przez wiele watkow
+		// Dla Bits = WordBitCount wyniki sa zgodne z funkcjami operujacymi na Word (EncryptDataChunk itd.)
+		// Klucze wszystkich dlugosci sa przechowywane w SizedKey (zapis, szyfrowanie hybrydowe - patrz nizej)
+		template<int Bits>
+		class RsaEngine
+		{
+		public:
+			static const int KeyBits = Bits;
+			static const int KeyBytes = Bits / 8;
+
+			typedef FixedUInt<Bits / 64> UInt;
+			typedef FixedUInt<Bits / 128> HalfUInt;
+
+			struct Key
+			{
+				UInt n;
+				UInt e; // Wykladnik publiczny lub prywatny (d)
+
+				// Skladowe CRT klucza prywatnego (jesli HasCrt) : dP = d mod (p-1), dQ = d mod (q-1), qInv = q^-1 mod p
+				bool HasCrt;
+				HalfUInt p;
+				HalfUInt q;
+				HalfUInt dP;
+				HalfUInt dQ;
+				HalfUInt qInv;
+
+				Key() : HasCrt(false) { }
+			};
+
+			// Wykladnik publiczny generowanych kluczy
+			static const uint32 PublicExponent = 65537;
+
+		protected:
+			Key _key;
+			FixedMontgomery<Bits / 64> _n;
+			FixedMontgomery<Bits / 128> _p; // Uzywane tylko jesli klucz ma CRT
+			FixedMontgomery<Bits / 128> _q;
+			HalfUInt _qInv; // qInv w dziedzinie Montgomery'ego modulo p
+
+		public:
+			RsaEngine(const Key& key);
+
+			const Key& GetKey() const { return _key; }
+
+			// data^e mod n (data < n)
+			UInt EncryptChunk(const UInt& data) const;
+			// data^d mod n, dla klucza z CRT dwie potegi modulo p i q polaczone wzorem Garnera
+			UInt DecryptChunk(const UInt& data) const;
+
+			// Szyfruje 'length' (< KeyBytes) bajtow 'data' do KeyBytes bajtow 'encrypted'
+			void EncryptBlock(const byte* data, uint32 length, byte* encrypted) const;
+			// Deszyfruje KeyBytes bajtow 'encrypted' do 'length' bajtow 'data'
+			void DecryptBlock(const byte* encrypted, byte* data, uint32 length) const;
+
+			// Generuje pare kluczy (n ma dokladnie Bits bitow, e = PublicExponent), liczby p i q sa pierwsze
+			// z prawdopodobienstwem (1 - 'maxPrimeError'), kandydaci sa testowani rownolegle na 'pool'
+			// (NULL - ThreadPool::Default())
+			static void GenerateKeys(Key* pubKey, Key* privKey, double maxPrimeError = 1e-10, ThreadPool* pool = NULL);
+
+			// Test Millera-Rabina (patrz CheckMillerRabin) dla nieparzystej liczby z ustawionym najstarszym bitem
+			static bool CheckMillerRabin(const HalfUInt& num, int passes);
+
+			// Zamiana klucza na RSAKey i odwrotnie (tylko dla Bits <= WordBitCount)
+			// FromRSAKey zwraca false jesli liczby klucza nie mieszcza sie w Bits bitach
+			static bool FromRSAKey(const RSAKey& key, Key* result);
+			static void ToRSAKey(const Key& key, RSAKey* result);
+		};
+
+		typedef RsaEngine<1024> Rsa1024;
+		typedef RsaEngine<2048> Rsa2048;
+		typedef RsaEngine<4096> Rsa4096;
+
+		// Dlugosc kluczy generowanych domyslnie (np. w oknie programu)
+		static const int DefaultKeyBits = 2048;
+
+		// Klucz jednej z obslugiwanych dlugosci : uzywany jest tylko klucz dla 'Bits' (0 - brak klucza)
+		struct SizedKey
+		{
+			int Bits;
+			Rsa1024::Key Key1024;
+			Rsa2048::Key Key2048;
+			Rsa4096::Key Key4096;
+
+			SizedKey() : Bits(0) { }
+
+			// Dlugosc n (i zaszyfrowanego kawalka) w bajtach
+			int ByteCount() const { return Bits / 8; }
+		};
+
+		// Zwraca true dla dlugosci obslugiwanych przez SizedKey (1024, 2048, 4096)
+		bool IsSupportedKeySize(int bits);
+
+		// Generuje pare kluczy 'bits'-bitowych (patrz RsaEngine::GenerateKeys)
+		// Zwraca false dla nieobslugiwanej dlugosci
+		bool GenerateRSAKeys(int bits, SizedKey* pubKey, SizedKey* privKey, double maxPrimeError = 1e-10, ThreadPool* pool = NULL);
+
+		// Zamiana klucza WordBitCount-bitowego na SizedKey i odwrotnie (np. dla szyfrowania kawalkami)
+		// Zwracaja false jesli klucz nie ma WordBitCount bitow
+		bool FromRSAKey(const RSAKey& key, SizedKey* result);
+		bool ToRSAKey(const SizedKey& key, RSAKey* result);
+
+		// Zapisuje klucz w formacie KeyFileVersion : naglowek 'RSAK', wersja, flagi (1 - zawiera CRT),
+		// dlugosc klucza w bitach, n i e (po Bits/8 bajtow) oraz jesli sa p, q, dP, dQ, qInv (po Bits/16 bajtow)
+		bool WriteKey(IDataStream* stream, const SizedKey* key);
+		// Odczytuje klucz w dowolnej wersji formatu, klucze z wersji 1 i 2 maja WordBitCount bitow
+		bool ReadKey(IDataStream* stream, SizedKey* key);
+
+		// Szyfrowanie hybrydowe (patrz EncryptHybrid dla RSAKey) kluczem dowolnej dlugosci
+		// Zaszyfrowany klucz ChaCha20 jest zapisywany w 'wrappedKey' (pubKey->ByteCount() bajtow)
+		// Zwraca false (dane nie sa zmieniane) dla klucza nieobslugiwanej dlugosci
+		bool EncryptHybrid(byte* data, uint64 dataLen, byte* wrappedKey, const SizedKey* pubKey, ThreadPool* pool = NULL);
+		// Odszyfrowuje dane zaszyfrowane przez EncryptHybrid ('wrappedKey' ma privKey->ByteCount() bajtow)
+		// Zwraca false jesli klucz prywatny nie pasuje (dane nie sa zmieniane)
+		bool DecryptHybrid(byte* data, uint64 dataLen, const byte* wrappedKey, const SizedKey* privKey, ThreadPool* pool = NULL);
+	}
+}
@@ -0,0 +1,138 @@
+#include "ThreadPool.h"
+
+namespace ImgOps
+{
+	ThreadPool::ThreadPool(int threadCount)
+	{
+		_activeTasks = 0;
+		_stopping = false;
+
+		if(threadCount <= 0)
+			threadCount = (int)std::thread::hardware_concurrency();
+		if(threadCount <= 0)
+			threadCount = 1;
+
+		for(int i = 0; i < threadCount; ++i)
+			_threads.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_taskAdded.notify_all();
+		for(size_t i = 0; i < _threads.size(); ++i)
+			_threads[i].join();
+	}
+
+	ThreadPool* ThreadPool::Default()
+	{
+		static ThreadPool pool;
+		return &pool;
+	}
+
+	void ThreadPool::Submit(const Task& task)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_tasks.push_back(task);
+		}
+		_taskAdded.notify_one();
+	}
+
+	void ThreadPool::RunOneTask(std::unique_lock<std::mutex>& lock)
+	{
+		Task task = _tasks.front();
+		_tasks.pop_front();
+		++_activeTasks;
+		lock.unlock();
+
+		task();
+
+		lock.lock();
+		--_activeTasks;
+		_taskFinished.notify_all();
+	}
+
+	void ThreadPool::WorkerLoop()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true)
+		{
+			while(_tasks.empty() && !_stopping)
+				_taskAdded.wait(lock);
+
+			if(_tasks.empty()) // Stopping and nothing left to do
+				return;
+
+			RunOneTask(lock);
+		}
+	}
+
+	void ThreadPool::WaitAll()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(_tasks.empty() == false || _activeTasks > 0)
+		{
+			if(_tasks.empty() == false)
+				RunOneTask(lock);
+			else
+				_taskFinished.wait(lock);
+		}
+	}
+
+	void ThreadPool::ParallelFor(int count, const RangeTask& task, int minRange)
+	{
+		if(count <= 0)
+			return;
+		if(minRange < 1)
+			minRange = 1;
+
+		int ranges = ThreadCount();
+		if(ranges > count / minRange)
+			ranges = count / minRange;
+		if(ranges <= 1)
+		{
+			task(0, count);
+			return;
+		}
+
+		// Counter of unfinished ranges is guarded by pool mutex
+		int remaining = ranges - 1;
+		int rangeSize = count / ranges;
+		int extra = count % ranges;
+		int begin = 0;
+		int firstEnd = 0;
+		for(int r = 0; r < ranges; ++r)
+		{
+			int end = begin + rangeSize + (r < extra ? 1 : 0);
+			if(r == 0)
+			{
+				firstEnd = end; // Executed by calling thread
+			}
+			else
+			{
+				Submit([this, &task, &remaining, begin, end]()
+				{
+					task(begin, end);
+					std::unique_lock<std::mutex> lock(_mutex);
+					--remaining;
+				});
+			}
+			begin = end;
+		}
+
+		task(0, firstEnd);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(remaining > 0)
+		{
+			if(_tasks.empty() == false)
+				RunOneTask(lock);
+			else
+				_taskFinished.wait(lock);
+		}
+	}
+}
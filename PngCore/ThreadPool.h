@@ -0,0 +1,58 @@
+#pragma once
+
+#include "TypeDefs.h"
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+namespace ImgOps
+{
+	// Fixed set of worker threads executing queued tasks in FIFO order
+	class ThreadPool
+	{
+	public:
+		typedef std::function<void()> Task;
+		typedef std::function<void(int begin, int end)> RangeTask;
+
+	protected:
+		std::vector<std::thread> _threads;
+		std::deque<Task> _tasks;
+		std::mutex _mutex;
+		std::condition_variable _taskAdded;
+		std::condition_variable _taskFinished;
+		int _activeTasks;
+		bool _stopping;
+
+	public:
+		// If 'threadCount' <= 0 number of hardware threads is used
+		ThreadPool(int threadCount = 0);
+		// Finishes all queued tasks and joins threads
+		~ThreadPool();
+
+		int ThreadCount() const { return (int)_threads.size(); }
+
+		void Submit(const Task& task);
+		// Waits untill all queued tasks are finished
+		void WaitAll();
+
+		// Splits [0, count) into at most ThreadCount() ranges of at least 'minRange' elements,
+		// runs 'task' on them and waits for completion
+		// Calling thread executes queued tasks while waiting, so it may be used from inside of pool tasks
+		void ParallelFor(int count, const RangeTask& task, int minRange = 1);
+
+		// Shared pool with hardware threads count, created on first use
+		static ThreadPool* Default();
+
+	protected:
+		void WorkerLoop();
+		// Runs one queued task, 'lock' must be held and queue must not be empty
+		void RunOneTask(std::unique_lock<std::mutex>& lock);
+
+	private:
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+	};
+}
@@ -0,0 +1,260 @@
+#include "TiledImage.h"
+#include "FileStream.h"
+#include "Exceptions.h"
+#include <stdio.h>
+
+namespace ImgOps
+{
+	TiledImage::TiledImage(const char* scratchPath, int maxResidentTiles)
+	{
+		_width = 0;
+		_height = 0;
+		_format = PixelFormats::Unknown;
+		_pixelSize = 0;
+		_channelSize = 0;
+		_stride = 0;
+		_tilesX = 0;
+		_tilesY = 0;
+		_tileStride = 0;
+		_tileBytes = 0;
+		_tiles = NULL;
+		_residentTiles = 0;
+		_maxResidentTiles = maxResidentTiles > 0 ? maxResidentTiles : 1;
+		_newestUse = NULL;
+		_oldestUse = NULL;
+		_scratchPath = scratchPath != NULL ? scratchPath : "";
+		_scratch = NULL;
+		_scratchEnd = 0;
+	}
+
+	TiledImage::TiledImage(int width, int height, PixelFormat format,
+		const char* scratchPath, int maxResidentTiles)
+	{
+		_tiles = NULL;
+		_scratch = NULL;
+		_residentTiles = 0;
+		_maxResidentTiles = maxResidentTiles > 0 ? maxResidentTiles : 1;
+		_newestUse = NULL;
+		_oldestUse = NULL;
+		_scratchPath = scratchPath != NULL ? scratchPath : "";
+		_scratchEnd = 0;
+		Create(width, height, format);
+	}
+
+	TiledImage::~TiledImage()
+	{
+		Release();
+	}
+
+	void TiledImage::Release()
+	{
+		if(_tiles != NULL)
+		{
+			for(int i = 0; i < _tilesX * _tilesY; ++i)
+			{
+				if(_tiles[i].Data != NULL)
+					free(_tiles[i].Data);
+			}
+			free(_tiles);
+			_tiles = NULL;
+		}
+		if(_scratch != NULL)
+		{
+			delete _scratch;
+			_scratch = NULL;
+			remove(_scratchPath.c_str());
+		}
+		_residentTiles = 0;
+		_newestUse = NULL;
+		_oldestUse = NULL;
+		_scratchEnd = 0;
+	}
+
+	void TiledImage::Create(int width, int height, PixelFormat format)
+	{
+		Release();
+
+		_width = width;
+		_height = height;
+		_format = format;
+		_pixelSize = PixelFormats::GetPixelSize(format);
+		_channelSize = _pixelSize / PixelFormats::GetChannels(format);
+		_stride = _width * _pixelSize;
+
+		_tilesX = (width + TileSize - 1) / TileSize;
+		_tilesY = (height + TileSize - 1) / TileSize;
+		_tileStride = TileSize * _pixelSize;
+		_tileBytes = TileSize * _tileStride;
+
+		int tilesCount = _tilesX * _tilesY;
+		_tiles = (TileInfo*)malloc(tilesCount * sizeof(TileInfo));
+		for(int i = 0; i < tilesCount; ++i)
+		{
+			_tiles[i].Data = NULL;
+			_tiles[i].ScratchOffset = -1;
+			_tiles[i].NewerUse = NULL;
+			_tiles[i].OlderUse = NULL;
+			_tiles[i].Dirty = false;
+		}
+
+		if(_scratchPath.empty() == false)
+		{
+			_scratch = new FileStream(_scratchPath.c_str(), OpenModes::ReadWriteTrunc);
+			if(_scratch->IsOpen() == false)
+			{
+				delete _scratch;
+				_scratch = NULL;
+				throw Exception("Failed to open tiles scratch file");
+			}
+		}
+	}
+
+	bool TiledImage::LoadTile(TileInfo* tile, bool allocate)
+	{
+		if(tile->Data != NULL)
+		{
+			if(tile != _newestUse)
+			{
+				UnlinkUse(tile);
+				LinkNewestUse(tile);
+			}
+			return true;
+		}
+
+		if(tile->ScratchOffset < 0 && !allocate)
+			return false; // Never written -> all zeros
+
+		if(_scratch != NULL && _residentTiles >= _maxResidentTiles)
+			PageOutLeastUsed();
+
+		tile->Data = (byte*)malloc(_tileBytes);
+		++_residentTiles;
+		LinkNewestUse(tile);
+		if(tile->ScratchOffset >= 0)
+		{
+			// Tile was paged out -> read it back
+			if(_scratch->SetPosition(tile->ScratchOffset) == false ||
+				_scratch->ReadSome(_tileBytes, tile->Data) != _tileBytes)
+			{
+				throw Exception("Failed to read tile from scratch file");
+			}
+			tile->Dirty = false;
+		}
+		else
+		{
+			// First write : materialize tile
+			memset(tile->Data, 0, _tileBytes);
+			tile->Dirty = true;
+		}
+		return true;
+	}
+
+	void TiledImage::PageOut(TileInfo* tile)
+	{
+		if(tile->Data == NULL)
+			return;
+
+		if(tile->Dirty)
+		{
+			if(tile->ScratchOffset < 0)
+			{
+				// Tiles are never removed from scratch file, so next slot is always at the end
+				tile->ScratchOffset = _scratchEnd;
+				_scratchEnd += _tileBytes;
+			}
+			if(_scratch->SetPosition(tile->ScratchOffset) == false ||
+				_scratch->WriteSome(_tileBytes, tile->Data) != _tileBytes)
+			{
+				throw Exception("Failed to write tile to scratch file");
+			}
+			tile->Dirty = false;
+		}
+
+		free(tile->Data);
+		tile->Data = NULL;
+		--_residentTiles;
+		UnlinkUse(tile);
+	}
+
+	void TiledImage::PageOutLeastUsed()
+	{
+		if(_oldestUse != NULL)
+			PageOut(_oldestUse);
+	}
+
+	void TiledImage::UnlinkUse(TileInfo* tile)
+	{
+		if(tile->NewerUse != NULL)
+			tile->NewerUse->OlderUse = tile->OlderUse;
+		else
+			_newestUse = tile->OlderUse;
+		if(tile->OlderUse != NULL)
+			tile->OlderUse->NewerUse = tile->NewerUse;
+		else
+			_oldestUse = tile->NewerUse;
+		tile->NewerUse = NULL;
+		tile->OlderUse = NULL;
+	}
+
+	void TiledImage::LinkNewestUse(TileInfo* tile)
+	{
+		tile->NewerUse = NULL;
+		tile->OlderUse = _newestUse;
+		if(_newestUse != NULL)
+			_newestUse->NewerUse = tile;
+		else
+			_oldestUse = tile;
+		_newestUse = tile;
+	}
+
+	void TiledImage::PageOutAll()
+	{
+		if(_scratch == NULL)
+			return;
+
+		for(int i = 0; i < _tilesX * _tilesY; ++i)
+			PageOut(&_tiles[i]);
+	}
+
+	byte* TiledImage::Tile(int tileX, int tileY)
+	{
+		TileInfo* tile = GetTile(tileX, tileY);
+		LoadTile(tile, true);
+		tile->Dirty = true;
+		return tile->Data;
+	}
+
+	const byte* TiledImage::TileForRead(int tileX, int tileY)
+	{
+		TileInfo* tile = GetTile(tileX, tileY);
+		return LoadTile(tile, false) ? tile->Data : NULL;
+	}
+
+	void TiledImage::ReadRow(int row, byte* data)
+	{
+		int tileY = row / TileSize;
+		int tileRowOffset = (row % TileSize) * _tileStride;
+		for(int tileX = 0; tileX < _tilesX; ++tileX)
+		{
+			int bytes = TileWidth(tileX) * _pixelSize;
+			const byte* tile = TileForRead(tileX, tileY);
+			if(tile != NULL)
+				memcpy(data, tile + tileRowOffset, bytes);
+			else
+				memset(data, 0, bytes);
+			data += bytes;
+		}
+	}
+
+	void TiledImage::WriteRow(int row, const byte* data)
+	{
+		int tileY = row / TileSize;
+		int tileRowOffset = (row % TileSize) * _tileStride;
+		for(int tileX = 0; tileX < _tilesX; ++tileX)
+		{
+			int bytes = TileWidth(tileX) * _pixelSize;
+			memcpy(Tile(tileX, tileY) + tileRowOffset, data, bytes);
+			data += bytes;
+		}
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Image.h"
+
+namespace ImgOps
+{
+	class FileStream;
+
+	// Image stored in square tiles of TileSize x TileSize pixels, so it may be larger than available memory:
+	// - tile memory is allocated on first write, never written tiles reads as zeros
+	// - if scratch file is given, at most 'maxResidentTiles' are kept in memory and least recently
+	//   used ones are paged out to scratch file (and read back on next access)
+	// - scratch file is removed when image is recreated or destroyed
+	// Pointers returned by Pixel() / Tile() are valid only until next access to other tile
+	// Palettes are not stored - indexed images keep them in header Image returned by decoder
+	class TiledImage : public ImageRowSink
+	{
+	public:
+		static const int TileSize = 256;
+		static const int DefaultResidentTiles = 256; // 16MB for Rgba32 tiles
+
+	protected:
+		struct TileInfo
+		{
+			byte* Data; // NULL if tile is not in memory
+			int64 ScratchOffset; // Position of tile in scratch file or -1 if it was never paged out
+			TileInfo* NewerUse; // Neighbours on list of resident tiles (ordered by last use)
+			TileInfo* OlderUse;
+			bool Dirty; // Tile was modified since it was last paged out
+		};
+
+		int _width;
+		int _height;
+		PixelFormat _format;
+		int _pixelSize;
+		int _channelSize;
+		int _stride; // Size of single image row (pixel size * width)
+
+		int _tilesX;
+		int _tilesY;
+		int _tileStride; // Size of single tile row (pixel size * TileSize)
+		uint32 _tileBytes;
+		TileInfo* _tiles;
+
+		int _residentTiles;
+		int _maxResidentTiles;
+		TileInfo* _newestUse; // Ends of list of resident tiles
+		TileInfo* _oldestUse;
+
+		string _scratchPath;
+		FileStream* _scratch;
+		int64 _scratchEnd;
+
+	public:
+		// Creates empty image, its size must be set with Create() (or by decoder through BeginImage())
+		// If 'scratchPath' is NULL tiles are never paged out
+		TiledImage(const char* scratchPath = NULL, int maxResidentTiles = DefaultResidentTiles);
+		TiledImage(int width, int height, PixelFormat format,
+			const char* scratchPath = NULL, int maxResidentTiles = DefaultResidentTiles);
+		~TiledImage();
+
+		// (Re)creates image with given size, all tiles are released
+		void Create(int width, int height, PixelFormat format);
+
+		int Width() const { return _width; }
+		int Height() const { return _height; }
+		int PixelSize() const { return _pixelSize; }
+		int ChannelSize() const { return _channelSize; }
+		int Stride() const { return _stride; }
+		PixelFormat PixFormat() const { return _format; }
+		bool IsFloatingPoint() const { return PixelFormats::IsFloatingPoint(_format); }
+
+		int TilesX() const { return _tilesX; }
+		int TilesY() const { return _tilesY; }
+		int TileStride() const { return _tileStride; }
+		int ResidentTiles() const { return _residentTiles; }
+		// Returns number of valid columns / rows in tile (edge tiles may be smaller than TileSize)
+		int TileWidth(int tileX) const { return tileX < _tilesX - 1 ? TileSize : _width - tileX * TileSize; }
+		int TileHeight(int tileY) const { return tileY < _tilesY - 1 ? TileSize : _height - tileY * TileSize; }
+
+		// Returns tile data for writing (tile is allocated if needed)
+		// Tile is row-major matrix of TileSize x TileSize pixels with row size of TileStride()
+		byte* Tile(int tileX, int tileY);
+		// Returns tile data for reading or NULL if tile was never written (so contains zeros)
+		const byte* TileForRead(int tileX, int tileY);
+
+		// Returns pointer to pixel on position (y,x) for storage
+		byte* Pixel(int y, int x)
+		{
+			return Tile(x / TileSize, y / TileSize) +
+				(y % TileSize) * _tileStride + (x % TileSize) * _pixelSize;
+		}
+
+		// Returns pointer to byte in pixel (y,x) corresponding to given channel
+		byte* Pixel(int y, int x, int channel)
+		{
+			return Pixel(y, x) + channel * _channelSize;
+		}
+
+		// Sets value for a pixel, assumes 'value' is pointer to array containing 'pixelSize' bytes
+		void SetPixel(int y, int x, const byte* value)
+		{
+			memcpy(Pixel(y, x), value, _pixelSize);
+		}
+
+		// Copies row of image to 'data' (Stride() bytes)
+		void ReadRow(int row, byte* data);
+		// Copies row of image from 'data' (Stride() bytes)
+		void WriteRow(int row, const byte* data);
+
+		// Releases tiles memory, but keeps tiles in scratch file
+		// (all resident tiles are paged out, so works only if scratch file is used)
+		void PageOutAll();
+
+		// ImageRowSink
+		void BeginImage(int width, int height, PixelFormat format) { Create(width, height, format); }
+		void StoreRow(int row, const byte* data) { WriteRow(row, data); }
+
+	protected:
+		void Release();
+		TileInfo* GetTile(int tileX, int tileY) { return &_tiles[tileY * _tilesX + tileX]; }
+		// Makes sure tile is in memory, returns false if tile was never written (and 'allocate' is false)
+		bool LoadTile(TileInfo* tile, bool allocate);
+		void PageOut(TileInfo* tile);
+		void PageOutLeastUsed();
+		void UnlinkUse(TileInfo* tile);
+		void LinkNewestUse(TileInfo* tile);
+
+	private:
+		TiledImage(const TiledImage&);
+		TiledImage& operator=(const TiledImage&);
+	};
+}
@@ -1,16 +1,37 @@
 #pragma once
 
 #include <string>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _MSC_VER
+#include <stdint.h>
+// Interfaces are plain abstract structs outside of MSVC
+#define __interface struct
+#endif
 
 namespace ImgOps
 {
 	typedef std::string string;
+#ifdef _MSC_VER
 	typedef unsigned __int8 byte;
 	typedef __int8 sbyte;
+	typedef __int16 int16;
+	typedef unsigned __int16 uint16;
 	typedef __int32 int32;
 	typedef unsigned __int32 uint32;
 	typedef __int64 int64;
 	typedef unsigned __int64 uint64;
+#else
+	typedef uint8_t byte;
+	typedef int8_t sbyte;
+	typedef int16_t int16;
+	typedef uint16_t uint16;
+	typedef int32_t int32;
+	typedef uint32_t uint32;
+	typedef int64_t int64;
+	typedef uint64_t uint64;
+#endif
 	
 	namespace ColorChannels
 	{
@@ -38,7 +59,7 @@ namespace ImgOps
 			PixelSize_32 = 0x4,
 			PixelSize_48 = 0x6,
 			PixelSize_64 = 0x8,
-			PixelSize_128 = 0xF,
+			PixelSize_128 = 0x10,
 			PixelSize_Mask = 0xFF,
 			
 			Channels_1 = 0x10000,
@@ -50,6 +71,7 @@ namespace ImgOps
 			HaveAlphaChannel = 0x100000,
 			GrayScale = 0x200000,
 			TrueColor = 0x400000,
+			FloatingPoint = 0x800000, // Each channel is 32bit float (in range [0,1] for colors)
 			Misc_Mask = 0xFF00000,
 
 			Gray8 = 0x100 | PixelSize_8 | Channels_1 | GrayScale,
@@ -62,7 +84,8 @@ namespace ImgOps
 			GrayAlpha32 = 0x800 | PixelSize_32 | Channels_2 | HaveAlphaChannel | GrayScale,
 			Indexed = 0x900 | PixelSize_8 | Channels_1,
 
-			// GrayFloat32 = 0xA00 | Channels_1 | PixelSize_32,
+			GrayFloat32 = 0xA00 | PixelSize_32 | Channels_1 | GrayScale | FloatingPoint,
+			RgbaFloat32 = 0xB00 | PixelSize_128 | Channels_4 | HaveAlphaChannel | TrueColor | FloatingPoint,
 
 			Format_Mask = 0xFF00
 		};
@@ -81,6 +104,11 @@ namespace ImgOps
 		{
 			return (format & PixelSize_Mask);
 		}
+
+		static bool IsFloatingPoint(PixelFormatType format)
+		{
+			return (format & FloatingPoint) != 0;
+		}
 	}
 	typedef PixelFormats::PixelFormatType PixelFormat;
 
@@ -0,0 +1,617 @@
+// Standalone benchmark and correctness suite of RSA code from PngCore (see Makefile)
+// Usage : RsaBench [--seed N] [--threads 1,2,4] [--quick] [--check-only]
+//   --seed N      fixed-seed mode : keys and data are the same in every run (Drbg::SetDeterministicSeed)
+//   --threads     thread counts used by chunked encryption benchmark (default : 1, 2, 4 ... cpu count)
+//   --quick       fewer iterations (for use as regression check)
+//   --check-only  only correctness checks
+// Exit code is number of failed checks
+
+#include "RSA.h"
+#include "RsaEngine.h"
+#include "ChaCha20.h"
+#include "Drbg.h"
+#include "MemoryStream.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace ImgOps;
+
+namespace
+{
+	struct Options
+	{
+		bool FixedSeed;
+		uint64 Seed;
+		bool Quick;
+		bool CheckOnly;
+		std::vector<int> Threads;
+	};
+
+	Options _options;
+	int _failures = 0;
+
+	double NowMs()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Restarts random generators, so in fixed-seed mode each section works on the same keys and data
+	void ResetRandom(uint64 section)
+	{
+		if(_options.FixedSeed)
+			Drbg::SetDeterministicSeed(_options.Seed * 1000 + section);
+	}
+
+	void Check(bool condition, const char* name)
+	{
+		printf("  %-52s %s\n", name, condition ? "ok" : "FAILED");
+		if(condition == false)
+			++_failures;
+	}
+
+	// Runs 'op' until at least 'minMs' passed, returns operations per second
+	double OpsPerSecond(const std::function<void()>& op, double minMs)
+	{
+		int count = 0;
+		double start = NowMs();
+		double elapsed = 0.0;
+		do
+		{
+			op();
+			++count;
+			elapsed = NowMs() - start;
+		}
+		while(elapsed < minMs);
+		return count * 1000.0 / elapsed;
+	}
+
+	double Percentile(std::vector<double> values, double p)
+	{
+		std::sort(values.begin(), values.end());
+		size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+		return values[index];
+	}
+
+	void PrintLatencies(const char* name, std::vector<double>& times)
+	{
+		double sum = 0.0;
+		for(size_t i = 0; i < times.size(); ++i)
+			sum += times[i];
+		printf("  %-20s runs %3d  mean %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f ms\n", name, (int)times.size(),
+			sum / times.size(), Percentile(times, 0.5), Percentile(times, 0.9), Percentile(times, 0.99), Percentile(times, 1.0));
+	}
+
+	RSA::Word Mersenne(int exponent)
+	{
+		return (RSA::Word(1) << exponent) - 1;
+	}
+
+	// Known vectors --------------------------------------------------------------------------------
+
+	void CheckChaCha20Vector()
+	{
+		// RFC 8439, 2.3.2 : block function with counter 1
+		byte key[ChaCha20::KeySize];
+		for(int i = 0; i < ChaCha20::KeySize; ++i)
+			key[i] = (byte)i;
+		const byte nonce[ChaCha20::NonceSize] = { 0, 0, 0, 0x09, 0, 0, 0, 0x4a, 0, 0, 0, 0 };
+		const byte expected[ChaCha20::BlockSize] = {
+			0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+			0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+			0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+			0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e };
+		byte block[ChaCha20::BlockSize];
+		ChaCha20(key, nonce).Block(1, block);
+		Check(memcmp(block, expected, ChaCha20::BlockSize) == 0, "ChaCha20 RFC 8439 block vector");
+	}
+
+	void CheckKnownVectors()
+	{
+		printf("Known vectors\n");
+		CheckChaCha20Vector();
+
+		// Textbook RSA : p = 61, q = 53, e = 17, d = 2753
+		RSA::Word n = 3233;
+		Check(RSA::ModuloPower(65, 17, n) == 2790, "ModuloPower textbook encrypt (65^17 mod 3233)");
+		Check(RSA::ModuloPower(2790, 2753, n) == 65, "ModuloPower textbook decrypt (2790^2753 mod 3233)");
+		Check(RSA::ModuloPower(4, 13, 497) == 445, "ModuloPower even exponent base (4^13 mod 497)");
+		Check(RSA::ModuloPower(3, 10, 1000) == 49, "ModuloPower even modulus (3^10 mod 1000)");
+
+		// Fermat for known primes, Miller-Rabin for known primes and composites
+		RSA::Word m521 = Mersenne(521);
+		Check(RSA::ModuloPower(3, m521 - 1, m521) == 1, "ModuloPower Fermat 3^(M521-1) mod M521");
+		Check(RSA::CheckMillerRabin(Mersenne(127), 20), "CheckMillerRabin M127 is prime");
+		Check(RSA::CheckMillerRabin(m521, 20), "CheckMillerRabin M521 is prime");
+		Check(RSA::CheckMillerRabin(Mersenne(523), 20) == false, "CheckMillerRabin M523 is composite");
+		// Carmichael number 561 passes Fermat test, but not Miller-Rabin
+		Check(RSA::CheckMillerRabin(561, 20) == false, "CheckMillerRabin 561 (Carmichael) is composite");
+
+		RSA::RSAKey textbookPub;
+		textbookPub.n = n;
+		textbookPub.e = 17;
+		RSA::RSAKey textbookPriv;
+		textbookPriv.n = n;
+		textbookPriv.e = 2753;
+		RSA::SetCrtParameters(&textbookPriv, 61, 53);
+		Check(RSA::EncryptDataChunk(65, &textbookPub) == 2790, "EncryptDataChunk textbook vector");
+		Check(RSA::DecryptDataChunk(2790, &textbookPriv) == 65, "DecryptDataChunk textbook vector (CRT)");
+	}
+
+	// Montgomery kernels ---------------------------------------------------------------------------
+
+	// Value below 'n' (n has nonzero top limb) : random limbs, top limb reduced below top limb of n
+	void RandomBelow(const uint64* n, int limbs, uint64* value)
+	{
+		for(int i = 0; i < limbs; ++i)
+			value[i] = Drbg::ThreadLocal().Next64();
+		value[limbs - 1] %= n[limbs - 1];
+	}
+
+	boost::multiprecision::cpp_int LimbsToInt(const uint64* limbs, int count)
+	{
+		boost::multiprecision::cpp_int value;
+		boost::multiprecision::import_bits(value, limbs, limbs + count, 64, false);
+		return value;
+	}
+
+	// Compares dispatched MontgomeryMultiply (mulx / adx if supported) with portable kernel for every
+	// limb count, on random odd moduli with top bit set, all-ones moduli and moduli with short top limb
+	// Portable results are also checked against definition : result * R = a * b (mod n), result < n
+	void CheckMontgomeryKernels()
+	{
+		printf("Montgomery kernels\n");
+		ResetRandom(2);
+		const int trials = _options.Quick ? 8 : 64;
+		bool same = true;
+		bool correct = true;
+		for(int limbs = 1; limbs <= MaxMontgomeryLimbs; ++limbs)
+		{
+			uint64 n[MaxMontgomeryLimbs];
+			uint64 a[MaxMontgomeryLimbs];
+			uint64 b[MaxMontgomeryLimbs];
+			uint64 portable[MaxMontgomeryLimbs];
+			uint64 dispatched[MaxMontgomeryLimbs];
+			for(int trial = 0; trial < trials; ++trial)
+			{
+				int kind = trial % 3;
+				for(int i = 0; i < limbs; ++i)
+					n[i] = kind == 1 ? ~(uint64)0 : Drbg::ThreadLocal().Next64();
+				if(kind == 0)
+					n[limbs - 1] |= (uint64)1 << 63;
+				else if(kind == 2)
+					n[limbs - 1] = 1 + (n[limbs - 1] & 0xffff);
+				n[0] |= 1;
+
+				uint64 inv = n[0];
+				for(int i = 0; i < 5; ++i)
+					inv *= 2 - n[0] * inv;
+				uint64 n0Inv = (uint64)0 - inv;
+
+				RandomBelow(n, limbs, a);
+				RandomBelow(n, limbs, b);
+				if(trial < 3)
+				{
+					// Largest inputs : n - 1 (n is odd)
+					memcpy(a, n, limbs * sizeof(uint64));
+					a[0] &= ~(uint64)1;
+					memcpy(b, a, limbs * sizeof(uint64));
+				}
+
+				MontgomeryMultiplyPortable(a, b, n, n0Inv, limbs, portable);
+				MontgomeryMultiply(a, b, n, n0Inv, limbs, dispatched);
+				same = same && memcmp(portable, dispatched, limbs * sizeof(uint64)) == 0;
+
+				boost::multiprecision::cpp_int modulus = LimbsToInt(n, limbs);
+				boost::multiprecision::cpp_int result = LimbsToInt(portable, limbs);
+				correct = correct && result < modulus &&
+					((result << (64 * limbs)) % modulus) == (LimbsToInt(a, limbs) * LimbsToInt(b, limbs)) % modulus;
+			}
+		}
+		Check(correct, "Portable kernel matches definition (1..64 limbs)");
+		Check(same, HasMulxAdx() ? "mulx/adx kernel == portable (1..64 limbs)" :
+			"MontgomeryMultiply == portable (no mulx/adx)");
+	}
+
+	// Round trips ----------------------------------------------------------------------------------
+
+	bool KeysEqual(const RSA::RSAKey& a, const RSA::RSAKey& b)
+	{
+		return a.n == b.n && a.e == b.e && a.HasCrt == b.HasCrt &&
+			(a.HasCrt == false || (a.p == b.p && a.q == b.q && a.dP == b.dP && a.dQ == b.dQ && a.qInv == b.qInv));
+	}
+
+	template<int Bits>
+	void CheckEngineRoundTrip(const char* name)
+	{
+		typedef RSA::RsaEngine<Bits> Engine;
+		typename Engine::Key pubKey;
+		typename Engine::Key privKey;
+		Engine::GenerateKeys(&pubKey, &privKey);
+		typename Engine::Key plainKey = privKey;
+		plainKey.HasCrt = false;
+
+		Engine encryptor(pubKey);
+		Engine decryptor(privKey);
+		Engine plainDecryptor(plainKey);
+		bool ok = pubKey.n.BitLength() == Bits;
+		for(int i = 0; i < 4 && ok; ++i)
+		{
+			byte data[Engine::KeyBytes];
+			byte encrypted[Engine::KeyBytes];
+			byte decrypted[Engine::KeyBytes];
+			RSA::RandomBytes(data, Engine::KeyBytes - 1);
+			encryptor.EncryptBlock(data, Engine::KeyBytes - 1, encrypted);
+			decryptor.DecryptBlock(encrypted, decrypted, Engine::KeyBytes - 1);
+			ok = memcmp(data, decrypted, Engine::KeyBytes - 1) == 0;
+			typename Engine::UInt chunk;
+			chunk.FromBytes(encrypted, Engine::KeyBytes);
+			ok = ok && decryptor.DecryptChunk(chunk) == plainDecryptor.DecryptChunk(chunk);
+		}
+		Check(ok, name);
+	}
+
+	// Key of given size through key file (format 3) and hybrid encryption, as used by ImageShow
+	void CheckSizedKeyRoundTrip(int bits, const char* name)
+	{
+		RSA::SizedKey pubKey;
+		RSA::SizedKey privKey;
+		bool ok = RSA::GenerateRSAKeys(bits, &pubKey, &privKey);
+
+		MemoryStream pubStream;
+		MemoryStream privStream;
+		RSA::SizedKey readPub;
+		RSA::SizedKey readPriv;
+		ok = ok && RSA::WriteKey(&pubStream, &pubKey) && RSA::WriteKey(&privStream, &privKey);
+		pubStream.SetPosition(0);
+		privStream.SetPosition(0);
+		ok = ok && RSA::ReadKey(&pubStream, &readPub) && RSA::ReadKey(&privStream, &readPriv) &&
+			readPub.Bits == bits && readPriv.Bits == bits;
+
+		const uint64 dataLen = 4096 + 13;
+		std::vector<byte> data(dataLen);
+		RSA::RandomBytes(data.data(), (uint32)dataLen);
+		std::vector<byte> hybrid(data);
+		std::vector<byte> wrappedKey(pubKey.ByteCount());
+		ok = ok && RSA::EncryptHybrid(hybrid.data(), dataLen, wrappedKey.data(), &readPub);
+		ok = ok && hybrid != data;
+		// Public key can't unwrap the key (and must leave data unchanged)
+		ok = ok && RSA::DecryptHybrid(hybrid.data(), dataLen, wrappedKey.data(), &readPub) == false && hybrid != data;
+		ok = ok && RSA::DecryptHybrid(hybrid.data(), dataLen, wrappedKey.data(), &readPriv) && hybrid == data;
+		Check(ok, name);
+	}
+
+	void CheckRoundTrips()
+	{
+		printf("Round trips\n");
+		ResetRandom(1);
+		RSA::RSAKey pubKey;
+		RSA::RSAKey privKey;
+		RSA::GenerateRSAKeys(&pubKey, &privKey);
+		Check(boost::multiprecision::msb(pubKey.n) == RSA::WordBitCount - 1, "GenerateRSAKeys modulus has WordBitCount bits");
+
+		RSA::Word message = RSA::Rand() % pubKey.n;
+		RSA::Word encrypted = RSA::EncryptDataChunk(message, &pubKey);
+		Check(RSA::DecryptDataChunk(encrypted, &privKey) == message, "EncryptDataChunk / DecryptDataChunk (CRT)");
+		RSA::RSAKey plainKey = privKey;
+		plainKey.HasCrt = false;
+		Check(RSA::DecryptDataChunk(encrypted, &plainKey) == message, "DecryptDataChunk without CRT");
+
+		// Engine of the same size must give the same results as Word functions
+		RSA::Rsa1024::Key enginePub;
+		RSA::Rsa1024::Key enginePriv;
+		bool converted = RSA::Rsa1024::FromRSAKey(pubKey, &enginePub) && RSA::Rsa1024::FromRSAKey(privKey, &enginePriv);
+		RSA::Rsa1024::UInt fixedMessage = RSA::WordToFixed<16>(message);
+		Check(converted && RSA::FixedToWord(RSA::Rsa1024(enginePub).EncryptChunk(fixedMessage)) == encrypted,
+			"Rsa1024 encrypt matches EncryptDataChunk");
+		Check(converted && RSA::Rsa1024(enginePriv).DecryptChunk(RSA::WordToFixed<16>(encrypted)) == fixedMessage,
+			"Rsa1024 decrypts EncryptDataChunk result");
+
+		MemoryStream keyStream;
+		RSA::RSAKey readKey;
+		bool written = RSA::WriteKey(&keyStream, &privKey);
+		keyStream.SetPosition(0);
+		Check(written && RSA::ReadKey(&keyStream, &readKey) && KeysEqual(privKey, readKey), "WriteKey / ReadKey");
+
+		// Chunked message as used for images (RGBA : chunk of half of word)
+		const uint32 chunkLength = RSA::WordByteCount / 2;
+		const uint64 dataLen = 64 * chunkLength + 17;
+		std::vector<byte> data(dataLen);
+		RSA::RandomBytes(data.data(), (uint32)dataLen);
+
+		byte* serialEncrypted;
+		uint64 serialLen;
+		uint32 lastChunkSize;
+		RSA::EncryptMessage_FixedChunks(data.data(), dataLen, chunkLength, &lastChunkSize, &serialEncrypted, &serialLen, &pubKey);
+		byte* parallelEncrypted;
+		uint64 parallelLen;
+		uint32 parallelLastChunkSize;
+		ThreadPool pool(2);
+		RSA::EncryptMessage_FixedChunksParallel(data.data(), dataLen, chunkLength, &parallelLastChunkSize,
+			&parallelEncrypted, &parallelLen, &pubKey, RSA::ChunkProgress(), &pool);
+		Check(serialLen == parallelLen && lastChunkSize == parallelLastChunkSize &&
+			memcmp(serialEncrypted, parallelEncrypted, (size_t)serialLen) == 0, "EncryptMessage_FixedChunks serial == parallel");
+
+		byte* decrypted;
+		uint64 decryptedLen;
+		RSA::DecryptMessage_FixedChunksParallel(parallelEncrypted, parallelLen, chunkLength, parallelLastChunkSize,
+			&decrypted, &decryptedLen, &privKey, RSA::ChunkProgress(), &pool);
+		Check(decryptedLen == dataLen && memcmp(decrypted, data.data(), (size_t)dataLen) == 0, "DecryptMessage_FixedChunksParallel round trip");
+		free(serialEncrypted);
+		free(parallelEncrypted);
+		free(decrypted);
+
+		std::vector<byte> hybrid(data);
+		byte wrappedKey[RSA::WordByteCount];
+		RSA::EncryptHybrid(hybrid.data(), dataLen, wrappedKey, &pubKey, &pool);
+		bool changed = memcmp(hybrid.data(), data.data(), (size_t)dataLen) != 0;
+		bool decryptedHybrid = RSA::DecryptHybrid(hybrid.data(), dataLen, wrappedKey, &privKey, &pool);
+		Check(changed && decryptedHybrid && hybrid == data, "EncryptHybrid / DecryptHybrid round trip");
+
+		CheckEngineRoundTrip<1024>("Rsa1024 keys, block round trip, CRT == plain");
+		CheckEngineRoundTrip<2048>("Rsa2048 keys, block round trip, CRT == plain");
+		if(_options.Quick == false)
+			CheckEngineRoundTrip<4096>("Rsa4096 keys, block round trip, CRT == plain");
+
+		// Key file of version 2 and Word hybrid encryption must work with SizedKey
+		MemoryStream oldKeyStream;
+		RSA::SizedKey oldKey;
+		RSA::WriteKey(&oldKeyStream, &privKey);
+		oldKeyStream.SetPosition(0);
+		bool oldRead = RSA::ReadKey(&oldKeyStream, &oldKey) && oldKey.Bits == RSA::WordBitCount;
+		RSA::EncryptHybrid(hybrid.data(), dataLen, wrappedKey, &pubKey, &pool);
+		Check(oldRead && RSA::DecryptHybrid(hybrid.data(), dataLen, wrappedKey, &oldKey, &pool) && hybrid == data,
+			"SizedKey reads key file version 2");
+
+		CheckSizedKeyRoundTrip(1024, "SizedKey 1024 key file 3, hybrid round trip");
+		CheckSizedKeyRoundTrip(2048, "SizedKey 2048 key file 3, hybrid round trip");
+		if(_options.Quick == false)
+			CheckSizedKeyRoundTrip(4096, "SizedKey 4096 key file 3, hybrid round trip");
+
+		if(_options.FixedSeed)
+		{
+			// Fixed seed must give the same keys in every run, fingerprint allows comparing runs of different builds
+			ResetRandom(1);
+			RSA::RSAKey againPub;
+			RSA::RSAKey againPriv;
+			RSA::GenerateRSAKeys(&againPub, &againPriv);
+			Check(againPub.n == pubKey.n, "Fixed seed gives the same keys");
+			printf("  key fingerprint (low 64 bits of n) : %016llx\n", (unsigned long long)RSA::WordToFixed<1>(pubKey.n).Limb[0]);
+		}
+	}
+
+	// Benchmarks -----------------------------------------------------------------------------------
+
+	template<int Bits>
+	void BenchEngine(double minMs)
+	{
+		typedef RSA::RsaEngine<Bits> Engine;
+		typename Engine::Key pubKey;
+		typename Engine::Key privKey;
+		Engine::GenerateKeys(&pubKey, &privKey);
+		Engine encryptor(pubKey);
+		Engine decryptor(privKey);
+		typename Engine::Key plainKey = privKey;
+		plainKey.HasCrt = false;
+		Engine plainDecryptor(plainKey);
+
+		typename Engine::UInt message;
+		RSA::RandomBytes((byte*)message.Limb, Engine::KeyBytes - 1);
+		typename Engine::UInt encrypted = encryptor.EncryptChunk(message);
+
+		double publicOps = OpsPerSecond([&]() { encryptor.EncryptChunk(message); }, minMs);
+		double crtOps = OpsPerSecond([&]() { decryptor.DecryptChunk(encrypted); }, minMs);
+		double plainOps = OpsPerSecond([&]() { plainDecryptor.DecryptChunk(encrypted); }, minMs);
+		printf("  RsaEngine<%d>        public %9.0f ops/s  private CRT %8.1f ops/s  private %8.1f ops/s\n",
+			Bits, publicOps, crtOps, plainOps);
+	}
+
+	void BenchModExp()
+	{
+		printf("Modular exponentiation\n");
+		double minMs = _options.Quick ? 100.0 : 500.0;
+		ResetRandom(2);
+		RSA::RSAKey pubKey;
+		RSA::RSAKey privKey;
+		RSA::GenerateRSAKeys(&pubKey, &privKey);
+		RSA::Word message = RSA::Rand() % pubKey.n;
+		RSA::Word encrypted = RSA::EncryptDataChunk(message, &pubKey);
+		RSA::Word exponent = RSA::Rand() % pubKey.n;
+		RSA::RSAKey plainKey = privKey;
+		plainKey.HasCrt = false;
+
+		double powerOps = OpsPerSecond([&]() { RSA::ModuloPower(message, exponent, pubKey.n); }, minMs);
+		double halfOps = OpsPerSecond([&]() { RSA::ModuloPower(message % privKey.p, privKey.dP, privKey.p); }, minMs);
+		printf("  ModuloPower          %d-bit %9.1f ops/s  %d-bit %9.1f ops/s\n",
+			RSA::WordBitCount, powerOps, RSA::WordBitCount / 2, halfOps);
+		double publicOps = OpsPerSecond([&]() { RSA::EncryptDataChunk(message, &pubKey); }, minMs);
+		double crtOps = OpsPerSecond([&]() { RSA::DecryptDataChunk(encrypted, &privKey); }, minMs);
+		double plainOps = OpsPerSecond([&]() { RSA::DecryptDataChunk(encrypted, &plainKey); }, minMs);
+		printf("  Word (%d)          public %9.0f ops/s  private CRT %8.1f ops/s  private %8.1f ops/s\n",
+			RSA::WordBitCount, publicOps, crtOps, plainOps);
+
+		double mrOps = OpsPerSecond([&]() { RSA::CheckMillerRabin(privKey.p, 1); }, minMs);
+		printf("  CheckMillerRabin     %d-bit prime, 1 pass %9.1f ops/s\n", (int)boost::multiprecision::msb(privKey.p) + 1, mrOps);
+
+		BenchEngine<1024>(minMs);
+		BenchEngine<2048>(minMs);
+		if(_options.Quick == false)
+			BenchEngine<4096>(minMs);
+	}
+
+	template<int Bits>
+	void BenchEngineKeygen(int runs)
+	{
+		typedef RSA::RsaEngine<Bits> Engine;
+		std::vector<double> times;
+		for(int i = 0; i < runs; ++i)
+		{
+			typename Engine::Key pubKey;
+			typename Engine::Key privKey;
+			double start = NowMs();
+			Engine::GenerateKeys(&pubKey, &privKey);
+			times.push_back(NowMs() - start);
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "RsaEngine<%d>", Bits);
+		PrintLatencies(name, times);
+	}
+
+	void BenchKeygen()
+	{
+		printf("Key generation latency\n");
+		ResetRandom(3);
+		int runs = _options.Quick ? 10 : 50;
+		std::vector<double> times;
+		for(int i = 0; i < runs; ++i)
+		{
+			RSA::RSAKey pubKey;
+			RSA::RSAKey privKey;
+			double start = NowMs();
+			RSA::GenerateRSAKeys(&pubKey, &privKey);
+			times.push_back(NowMs() - start);
+		}
+		PrintLatencies("GenerateRSAKeys", times);
+
+		BenchEngineKeygen<2048>(_options.Quick ? 3 : 10);
+		if(_options.Quick == false)
+			BenchEngineKeygen<4096>(3);
+	}
+
+	void BenchChunks()
+	{
+		printf("Chunked image encryption (RGBA chunks of %d bytes)\n", RSA::WordByteCount / 2);
+		ResetRandom(4);
+		RSA::RSAKey pubKey;
+		RSA::RSAKey privKey;
+		RSA::GenerateRSAKeys(&pubKey, &privKey);
+
+		const uint32 chunkLength = RSA::WordByteCount / 2;
+		const uint64 dataLen = (_options.Quick ? 256 : 1024) * (uint64)chunkLength;
+		const uint64 hybridLen = (_options.Quick ? 8 : 32) * 1024 * 1024;
+		std::vector<byte> data(hybridLen);
+		RSA::RandomBytes(data.data(), (uint32)hybridLen);
+
+		for(size_t t = 0; t < _options.Threads.size(); ++t)
+		{
+			ThreadPool pool(_options.Threads[t]);
+			byte* encrypted;
+			uint64 encryptedLen;
+			uint32 lastChunkSize;
+			double start = NowMs();
+			RSA::EncryptMessage_FixedChunksParallel(data.data(), dataLen, chunkLength, &lastChunkSize,
+				&encrypted, &encryptedLen, &pubKey, RSA::ChunkProgress(), &pool);
+			double encryptMs = NowMs() - start;
+
+			byte* decrypted;
+			uint64 decryptedLen;
+			start = NowMs();
+			RSA::DecryptMessage_FixedChunksParallel(encrypted, encryptedLen, chunkLength, lastChunkSize,
+				&decrypted, &decryptedLen, &privKey, RSA::ChunkProgress(), &pool);
+			double decryptMs = NowMs() - start;
+			bool ok = decryptedLen == dataLen && memcmp(decrypted, data.data(), (size_t)dataLen) == 0;
+			free(encrypted);
+			free(decrypted);
+
+			std::vector<byte> hybrid(data);
+			byte wrappedKey[RSA::WordByteCount];
+			start = NowMs();
+			RSA::EncryptHybrid(hybrid.data(), hybridLen, wrappedKey, &pubKey, &pool);
+			double hybridEncryptMs = NowMs() - start;
+			start = NowMs();
+			ok = RSA::DecryptHybrid(hybrid.data(), hybridLen, wrappedKey, &privKey, &pool) && ok;
+			double hybridDecryptMs = NowMs() - start;
+			ok = ok && hybrid == data;
+
+			double mb = dataLen / (1024.0 * 1024.0);
+			double hybridMb = hybridLen / (1024.0 * 1024.0);
+			printf("  threads %2d  RSA chunks encrypt %7.3f MB/s  decrypt %7.3f MB/s  hybrid encrypt %8.1f MB/s  decrypt %8.1f MB/s  %s\n",
+				_options.Threads[t], mb * 1000.0 / encryptMs, mb * 1000.0 / decryptMs,
+				hybridMb * 1000.0 / hybridEncryptMs, hybridMb * 1000.0 / hybridDecryptMs, ok ? "" : "ROUND TRIP FAILED");
+			if(ok == false)
+				++_failures;
+		}
+	}
+
+	bool ParseOptions(int argc, char** argv)
+	{
+		_options.FixedSeed = false;
+		_options.Seed = 0;
+		_options.Quick = false;
+		_options.CheckOnly = false;
+		for(int i = 1; i < argc; ++i)
+		{
+			if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			{
+				_options.FixedSeed = true;
+				_options.Seed = strtoull(argv[++i], NULL, 10);
+			}
+			else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			{
+				for(char* token = strtok(argv[++i], ","); token != NULL; token = strtok(NULL, ","))
+				{
+					int threads = atoi(token);
+					if(threads > 0)
+						_options.Threads.push_back(threads);
+				}
+			}
+			else if(strcmp(argv[i], "--quick") == 0)
+				_options.Quick = true;
+			else if(strcmp(argv[i], "--check-only") == 0)
+				_options.CheckOnly = true;
+			else
+				return false;
+		}
+
+		if(_options.Threads.empty())
+		{
+			int cpus = (int)std::thread::hardware_concurrency();
+			for(int threads = 1; threads < cpus; threads *= 2)
+				_options.Threads.push_back(threads);
+			_options.Threads.push_back(cpus > 0 ? cpus : 1);
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(ParseOptions(argc, argv) == false)
+	{
+		printf("Usage : RsaBench [--seed N] [--threads 1,2,4] [--quick] [--check-only]\n");
+		return -1;
+	}
+
+	printf("RsaBench : %s, mulx/adx %s, %d cpus\n", _options.FixedSeed ? "fixed seed" : "random seed",
+		HasMulxAdx() ? "on" : "off", (int)std::thread::hardware_concurrency());
+	CheckKnownVectors();
+	CheckRoundTrips();
+	CheckMontgomeryKernels();
+	if(HasMulxAdx())
+	{
+		// The same checks on portable kernel, so both paths are covered on cpus with mulx / adx
+		printf("Portable Montgomery kernel (mulx/adx disabled)\n");
+		SetMulxAdxEnabled(false);
+		CheckKnownVectors();
+		CheckRoundTrips();
+		SetMulxAdxEnabled(true);
+	}
+	if(_options.CheckOnly == false)
+	{
+		BenchModExp();
+		BenchKeygen();
+		BenchChunks();
+	}
+
+	if(_failures == 0)
+		printf("All checks passed\n");
+	else
+		printf("%d checks FAILED\n", _failures);
+	return _failures;
+}